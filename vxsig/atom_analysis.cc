@@ -0,0 +1,276 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/atom_analysis.h"
+
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_format.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/scan_cost.h"
+
+namespace security::vxsig {
+namespace {
+
+constexpr double kBytesPerMb = 1024.0 * 1024.0;
+
+// Counts the occurrences of each atom in the corpus, reusing the scanner
+// model with one single-piece rule per atom.
+void CountAtomHits(const Corpus& corpus, Executor* executor,
+                   std::vector<AtomUsage>* atoms) {
+  std::vector<ScanRule> atom_rules(atoms->size());
+  for (int i = 0; i < atoms->size(); ++i) {
+    const auto& usage = (*atoms)[i];
+    auto& rule = atom_rules[i];
+    rule.pieces.push_back(
+        {usage.bytes, std::string(usage.bytes.size(), '\xff')});
+    rule.atoms.push_back({usage.bytes, /*offset=*/0, usage.quality});
+  }
+  const RuleScanner scanner(atom_rules);
+
+  // Keep per-file hits sparse, most atoms do not occur in most files.
+  std::vector<std::vector<std::pair<int, int64_t>>> file_hits(corpus.size());
+  executor->ParallelFor(corpus.size(), [&](int64_t i) {
+    ScanResult result;
+    scanner.Scan(corpus.files()[i].data, &result);
+    for (int j = 0; j < result.atom_hits.size(); ++j) {
+      if (result.atom_hits[j] > 0) {
+        file_hits[i].emplace_back(j, result.atom_hits[j]);
+      }
+    }
+  });
+  for (const auto& hits : file_hits) {
+    for (const auto& [atom, count] : hits) {
+      (*atoms)[atom].corpus_hits += count;
+      ++(*atoms)[atom].files_with_hits;
+    }
+  }
+}
+
+}  // namespace
+
+int AtomAnalysis::num_over_budget() const {
+  return std::count_if(rules.begin(), rules.end(),
+                       [](const RuleAtomCost& r) { return r.over_budget; });
+}
+
+absl::StatusOr<AtomAnalysis> AnalyzeAtoms(const Signatures& signatures,
+                                          const Corpus& corpus,
+                                          const AtomAnalysisOptions& options) {
+  AtomAnalysis analysis;
+  analysis.corpus_files = corpus.size();
+  analysis.corpus_bytes = corpus.total_bytes();
+
+  // Collect the distinct atoms of all rules. Atoms never contain masked bits,
+  // so their bytes identify them.
+  std::vector<AtomUsage> atoms;
+  absl::flat_hash_map<std::string, int> atom_indices;
+  std::vector<std::vector<int>> rule_atoms(signatures.signature_size());
+  analysis.rules.resize(signatures.signature_size());
+  for (int i = 0; i < signatures.signature_size(); ++i) {
+    NA_ASSIGN_OR_RETURN(
+        const ScanRule rule,
+        MakeScanRule(signatures.signature(i), options.engine_min_piece_len));
+    auto& cost = analysis.rules[i];
+    cost.name = rule.name;
+    cost.signature_index = i;
+    cost.num_pieces = rule.pieces.size();
+    cost.min_atom_quality = rule.atoms.empty() ? 0 : kMaxAtomQuality;
+    for (const auto& atom : rule.atoms) {
+      cost.min_atom_quality = std::min(cost.min_atom_quality, atom.quality);
+      if (atom.bytes.empty()) {
+        ++cost.pieces_without_atom;
+        rule_atoms[i].push_back(-1);
+        continue;
+      }
+      auto inserted = atom_indices.emplace(atom.bytes, atoms.size());
+      if (inserted.second) {
+        atoms.push_back({atom.bytes, atom.quality});
+      }
+      const int index = inserted.first->second;
+      auto& usage = atoms[index];
+      ++usage.num_pieces;
+      if (usage.rules.empty() || usage.rules.back() != i) {
+        usage.rules.push_back(i);
+      }
+      rule_atoms[i].push_back(index);
+    }
+  }
+
+  CountAtomHits(
+      corpus,
+      GetOrMakeExecutor(options.executor, options.num_threads).get(),
+      &atoms);
+
+  // Every piece costs one verification per hit of its atom. Pieces without an
+  // atom need to be verified at every position.
+  const double corpus_mb = corpus.total_bytes() / kBytesPerMb;
+  int64_t total_hits = 0;
+  for (int i = 0; i < analysis.rules.size(); ++i) {
+    auto& cost = analysis.rules[i];
+    absl::flat_hash_set<int> shared;
+    for (int index : rule_atoms[i]) {
+      if (index < 0) {
+        cost.atom_hits += corpus.total_bytes();
+        continue;
+      }
+      const auto& usage = atoms[index];
+      cost.atom_hits += usage.corpus_hits;
+      if (cost.hottest_atom < 0 ||
+          usage.corpus_hits > atoms[cost.hottest_atom].corpus_hits) {
+        cost.hottest_atom = index;
+      }
+      if (usage.rules.size() > 1) {
+        shared.insert(index);
+      }
+    }
+    cost.shared_atoms = shared.size();
+    cost.verifications_per_mb = corpus_mb > 0 ? cost.atom_hits / corpus_mb : 0;
+    cost.over_budget =
+        cost.verifications_per_mb > options.max_verifications_per_mb;
+    total_hits += cost.atom_hits;
+  }
+  analysis.total_verifications_per_mb =
+      corpus_mb > 0 ? total_hits / corpus_mb : 0;
+
+  // Order atoms by frequency and remap the references from the rules.
+  std::vector<int> order(atoms.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&atoms](int a, int b) {
+    const auto& x = atoms[a];
+    const auto& y = atoms[b];
+    if (x.corpus_hits != y.corpus_hits) {
+      return x.corpus_hits > y.corpus_hits;
+    }
+    if (x.rules.size() != y.rules.size()) {
+      return x.rules.size() > y.rules.size();
+    }
+    return x.bytes < y.bytes;
+  });
+  std::vector<int> new_index(atoms.size());
+  analysis.atoms.reserve(atoms.size());
+  for (int i = 0; i < order.size(); ++i) {
+    new_index[order[i]] = i;
+    analysis.atoms.push_back(std::move(atoms[order[i]]));
+  }
+  for (auto& cost : analysis.rules) {
+    if (cost.hottest_atom >= 0) {
+      cost.hottest_atom = new_index[cost.hottest_atom];
+    }
+    cost.cost_share =
+        total_hits > 0 ? static_cast<double>(cost.atom_hits) / total_hits : 0;
+  }
+
+  std::stable_sort(analysis.rules.begin(), analysis.rules.end(),
+                   [](const RuleAtomCost& a, const RuleAtomCost& b) {
+                     return a.atom_hits > b.atom_hits;
+                   });
+  return analysis;
+}
+
+std::string FormatAtomAnalysis(const AtomAnalysis& analysis, int max_atoms,
+                               int max_rules) {
+  std::string result = absl::StrFormat(
+      "Corpus: %d files, %.2f MB, ruleset total %.2f verifications/MB\n",
+      analysis.corpus_files, analysis.corpus_bytes / kBytesPerMb,
+      analysis.total_verifications_per_mb);
+
+  absl::StrAppendFormat(&result, "\nTop %d of %d atoms:\n",
+                        std::min<int>(max_atoms, analysis.atoms.size()),
+                        analysis.atoms.size());
+  absl::StrAppendFormat(&result, "%-10s %7s %6s %6s %12s %10s\n", "atom",
+                        "quality", "rules", "pieces", "hits", "hit_files");
+  for (int i = 0; i < analysis.atoms.size() && i < max_atoms; ++i) {
+    const auto& atom = analysis.atoms[i];
+    absl::StrAppendFormat(&result, "%-10s %7d %6d %6d %12d %10d\n",
+                          absl::BytesToHexString(atom.bytes), atom.quality,
+                          atom.rules.size(), atom.num_pieces, atom.corpus_hits,
+                          atom.files_with_hits);
+  }
+
+  absl::StrAppendFormat(&result, "\nTop %d of %d rules by scan cost:\n",
+                        std::min<int>(max_rules, analysis.rules.size()),
+                        analysis.rules.size());
+  absl::StrAppendFormat(&result, "%-40s %6s %7s %7s %12s %6s %-10s %6s  %s\n",
+                        "rule", "pieces", "min_aq", "no_atom", "verif/MB",
+                        "share", "hottest", "shared", "budget");
+  for (int i = 0; i < analysis.rules.size() && i < max_rules; ++i) {
+    const auto& rule = analysis.rules[i];
+    absl::StrAppendFormat(
+        &result, "%-40s %6d %7d %7d %12.2f %5.1f%% %-10s %6d  %s\n",
+        rule.name.substr(0, 40), rule.num_pieces, rule.min_atom_quality,
+        rule.pieces_without_atom, rule.verifications_per_mb,
+        100 * rule.cost_share,
+        rule.hottest_atom >= 0
+            ? absl::BytesToHexString(analysis.atoms[rule.hottest_atom].bytes)
+            : "-",
+        rule.shared_atoms, rule.over_budget ? "OVER" : "ok");
+  }
+  absl::StrAppendFormat(&result, "%d of %d rules over budget\n",
+                        analysis.num_over_budget(), analysis.rules.size());
+  return result;
+}
+
+absl::StatusOr<Signatures> RegenerateExpensiveRules(
+    const Signatures& signatures, const AtomAnalysis& analysis,
+    const Corpus& corpus, const VariantSearchOptions& options,
+    int* num_changed) {
+  Signatures result = signatures;
+  *num_changed = 0;
+  // Search all rules on the same threads.
+  const std::shared_ptr<Executor> executor =
+      GetOrMakeExecutor(options.executor, options.num_threads);
+  for (const auto& cost : analysis.rules) {
+    if (!cost.over_budget) {
+      continue;
+    }
+    if (cost.signature_index >= signatures.signature_size()) {
+      return absl::InvalidArgumentError(
+          "Analysis does not belong to the signatures");
+    }
+    const auto& signature = signatures.signature(cost.signature_index);
+    const auto& definition = signature.definition();
+
+    VariantSearchOptions search_options = options;
+    search_options.scan_corpus = &corpus;
+    search_options.executor = executor.get();
+    if (search_options.min_piece_lengths.empty()) {
+      const int min_piece_length = std::max(1, definition.min_piece_length());
+      search_options.min_piece_lengths = {
+          min_piece_length, 2 * min_piece_length, 3 * min_piece_length};
+    }
+    auto search = SearchVariants(signature, search_options);
+    if (!search.ok()) {
+      continue;  // Keep the rule, nothing yields a signature
+    }
+    const auto& best = search->best.definition();
+    if (best.variant() == definition.variant() &&
+        best.trim_length() == definition.trim_length() &&
+        best.min_piece_length() == definition.min_piece_length()) {
+      continue;
+    }
+    *result.mutable_signature(cost.signature_index) = std::move(search->best);
+    ++*num_changed;
+  }
+  return result;
+}
+
+}  // namespace security::vxsig
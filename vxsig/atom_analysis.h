@@ -0,0 +1,123 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Ruleset-wide analysis of the atoms that an atom-based scan engine selects
+// for a database of signatures (see scan_cost.h for the scanner model).
+// Scanner slowdowns are usually caused by a few rules whose atoms occur in
+// almost every file. This module aggregates the atoms of all rules, counts
+// how often each of them occurs in a corpus of representative files and ranks
+// the rules by the number of piece verifications they add. Expensive rules
+// can then be regenerated with different trim settings.
+
+#ifndef VXSIG_ATOM_ANALYSIS_H_
+#define VXSIG_ATOM_ANALYSIS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "vxsig/corpus.h"
+#include "vxsig/executor.h"
+#include "vxsig/variant_search.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// A distinct atom together with its use in the ruleset.
+struct AtomUsage {
+  std::string bytes;
+  int quality = 0;
+  std::vector<int> rules;  // Sorted indices of the rules using this atom
+  int num_pieces = 0;      // Number of pieces across all rules
+  int64_t corpus_hits = 0;
+  int files_with_hits = 0;
+};
+
+struct RuleAtomCost {
+  std::string name;
+  int signature_index = 0;  // Index into the analyzed Signatures message
+  int num_pieces = 0;
+  int min_atom_quality = 0;
+
+  // Pieces without any atom (e.g. because they are fully masked) need to be
+  // verified at every file position and make the rule prohibitively expensive.
+  int pieces_without_atom = 0;
+
+  int64_t atom_hits = 0;  // Equals the number of verifications
+  double verifications_per_mb = 0;
+
+  // Fraction of the ruleset's total verifications caused by this rule.
+  double cost_share = 0;
+
+  int hottest_atom = -1;  // Index into AtomAnalysis::atoms
+  int shared_atoms = 0;   // Atoms that are also used by other rules
+  bool over_budget = false;
+};
+
+struct AtomAnalysis {
+  // Distinct atoms, most frequent in the corpus first.
+  std::vector<AtomUsage> atoms;
+
+  // Rules, most expensive first.
+  std::vector<RuleAtomCost> rules;
+
+  int corpus_files = 0;
+  int64_t corpus_bytes = 0;
+  double total_verifications_per_mb = 0;
+
+  int num_over_budget() const;
+};
+
+struct AtomAnalysisOptions {
+  // Minimum piece length of the target engine, see
+  // GetRelevantSignatureSubset().
+  int engine_min_piece_len = 2;
+
+  // Rules adding more verifications per scanned MB are over budget.
+  double max_verifications_per_mb = 100.0;
+
+  // Number of threads to use if no executor is set, zero selects a default.
+  int num_threads = 0;
+
+  // Optional executor for scanning the corpus. Not owned.
+  Executor* executor = nullptr;
+};
+
+// Extracts the best atom of each piece of the trimmed signatures and counts
+// their occurrences in the corpus.
+absl::StatusOr<AtomAnalysis> AnalyzeAtoms(const Signatures& signatures,
+                                          const Corpus& corpus,
+                                          const AtomAnalysisOptions& options);
+
+// Renders the most frequent atoms and the most expensive rules as human
+// readable tables.
+std::string FormatAtomAnalysis(const AtomAnalysis& analysis, int max_atoms,
+                               int max_rules);
+
+// Searches new signature definitions for all rules that are over budget,
+// using the corpus of the analysis to estimate scan cost. Empty search space
+// lists in the options default to the current definition for trim lengths and
+// to increasing multiples of the current minimum piece length. Returns a copy
+// of the signatures with updated definitions and sets num_changed to the
+// number of rules whose definition changed. Rules for which no better
+// definition exists are left as they are.
+absl::StatusOr<Signatures> RegenerateExpensiveRules(
+    const Signatures& signatures, const AtomAnalysis& analysis,
+    const Corpus& corpus, const VariantSearchOptions& options,
+    int* num_changed);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_ATOM_ANALYSIS_H_
@@ -0,0 +1,161 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A program that analyzes the atoms of a whole signature database against a
+// local corpus of files and lists the atoms and rules that slow down scanning
+// the most. Optionally, rules that are over budget are regenerated with
+// different trim settings and written to a new Signatures proto. This only
+// works well for Signatures protos produced by the generator, as these
+// contain the untrimmed raw signatures.
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "vxsig/atom_analysis.h"
+#include "vxsig/corpus.h"
+#include "vxsig/executor.h"
+#include "vxsig/signature_parser.h"
+#include "vxsig/variant_search.h"
+#include "vxsig/vxsig.pb.h"
+
+ABSL_FLAG(std::string, corpus, "",
+          "Directory with representative files to scan");
+ABSL_FLAG(int64_t, max_file_size, 64 << 20,
+          "Skip corpus files larger than this many bytes");
+ABSL_FLAG(double, max_verifications_per_mb, 100.0,
+          "Budget: maximum piece verifications per scanned MB for each rule");
+ABSL_FLAG(int32_t, engine_min_piece_length, 2,
+          "Minimum piece length of the target engine, applied to raw "
+          "signatures");
+ABSL_FLAG(int32_t, top_atoms, 20, "Number of atoms to list");
+ABSL_FLAG(int32_t, top_rules, 20, "Number of rules to list");
+ABSL_FLAG(int32_t, num_threads, 0,
+          "Number of threads to use, 0 to use all available cores");
+ABSL_FLAG(std::string, regenerate_output, "",
+          "If set, search new signature definitions for rules over budget and "
+          "write all signatures to this file as a Signatures proto");
+ABSL_FLAG(std::string, search_trim_lengths, "",
+          "Comma-separated trim lengths to search when regenerating");
+ABSL_FLAG(std::string, search_min_piece_lengths, "",
+          "Comma-separated minimum piece lengths to search when regenerating. "
+          "Defaults to multiples of the current minimum piece length");
+ABSL_FLAG(int32_t, search_variants, 1,
+          "Number of variants to search when regenerating rules that use "
+          "TRIM_RANDOM");
+
+namespace security::vxsig {
+namespace {
+
+std::vector<int> ParseIntList(const std::string& list) {
+  std::vector<int> values;
+  for (absl::string_view value : absl::StrSplit(list, ',', absl::SkipEmpty())) {
+    int parsed;
+    ABSL_RAW_CHECK(absl::SimpleAtoi(value, &parsed),
+                   absl::StrCat("Not an integer: ", value).c_str());
+    values.push_back(parsed);
+  }
+  return values;
+}
+
+void RegenerateSignatures(const Signatures& signatures,
+                          const AtomAnalysis& analysis, const Corpus& corpus,
+                          Executor* executor) {
+  VariantSearchOptions options;
+  for (int i = 0; i < absl::GetFlag(FLAGS_search_variants); ++i) {
+    options.variants.push_back(i);
+  }
+  options.trim_lengths = ParseIntList(absl::GetFlag(FLAGS_search_trim_lengths));
+  options.min_piece_lengths =
+      ParseIntList(absl::GetFlag(FLAGS_search_min_piece_lengths));
+  options.engine_min_piece_len = absl::GetFlag(FLAGS_engine_min_piece_length);
+  options.executor = executor;
+
+  int num_changed = 0;
+  auto regenerated = RegenerateExpensiveRules(signatures, analysis, corpus,
+                                              options, &num_changed);
+  ABSL_RAW_CHECK(regenerated.ok(), absl::StrCat("Failed to regenerate: ",
+                                                regenerated.status().message())
+                                       .c_str());
+  const std::string& filename = absl::GetFlag(FLAGS_regenerate_output);
+  std::ofstream output(filename, std::ios::binary);
+  ABSL_RAW_CHECK(regenerated->SerializeToOstream(&output),
+                 absl::StrCat("Failed to write ", filename).c_str());
+  absl::PrintF("Changed the definitions of %d of %d rules over budget\n",
+               num_changed, analysis.num_over_budget());
+}
+
+int AtomAnalysisMain(int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc >= 2, "Need at least one signature file");
+  ABSL_RAW_CHECK(!absl::GetFlag(FLAGS_corpus).empty(), "Need --corpus");
+
+  Signatures signatures;
+  for (int i = 1; i < argc; ++i) {
+    auto parsed = ReadSignaturesFromFile(argv[i]);
+    ABSL_RAW_CHECK(parsed.ok(), absl::StrCat("Failed to read signatures: ",
+                                             parsed.status().message())
+                                    .c_str());
+    signatures.MergeFrom(*parsed);
+  }
+
+  auto corpus = Corpus::LoadFromDirectory(absl::GetFlag(FLAGS_corpus),
+                                          absl::GetFlag(FLAGS_max_file_size));
+  ABSL_RAW_CHECK(corpus.ok(), absl::StrCat("Failed to load corpus: ",
+                                           corpus.status().message())
+                                  .c_str());
+
+  const std::shared_ptr<Executor> executor =
+      MakeExecutor(absl::GetFlag(FLAGS_num_threads));
+  AtomAnalysisOptions options;
+  options.engine_min_piece_len = absl::GetFlag(FLAGS_engine_min_piece_length);
+  options.max_verifications_per_mb =
+      absl::GetFlag(FLAGS_max_verifications_per_mb);
+  options.executor = executor.get();
+  auto analysis = AnalyzeAtoms(signatures, *corpus, options);
+  ABSL_RAW_CHECK(analysis.ok(), absl::StrCat("Failed to analyze atoms: ",
+                                             analysis.status().message())
+                                    .c_str());
+  absl::PrintF("%s", FormatAtomAnalysis(*analysis,
+                                        absl::GetFlag(FLAGS_top_atoms),
+                                        absl::GetFlag(FLAGS_top_rules)));
+
+  if (!absl::GetFlag(FLAGS_regenerate_output).empty()) {
+    RegenerateSignatures(signatures, *analysis, *corpus, executor.get());
+  }
+  return analysis->num_over_budget() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Find the atoms and rules of a signature database that slow down "
+      "scanning.\n"
+      "usage:\n",
+      argv[0], " --corpus=DIR [OPTION] SIGNATURES..."));
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  return security::vxsig::AtomAnalysisMain(args.size(), &args[0]);
+}
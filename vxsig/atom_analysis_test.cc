@@ -0,0 +1,155 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/atom_analysis.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Gt;
+using testing::HasSubstr;
+using testing::IsEmpty;
+using testing::IsFalse;
+using testing::IsTrue;
+using testing::Ne;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kPrologue[] = "\x55\x8b\xec\x83\xe4\xf8\x56\x57";
+
+class AtomAnalysisTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    AddSignature("cold", {kPrologue, "\xde\xad\xbe\xef\x01"});
+    AddSignature("hot", {std::string(6, '\0'), kPrologue});
+    corpus_.AddFile("zeroes", std::string(4096, '\0'));
+    corpus_.AddFile("prologue", kPrologue);
+    options_.max_verifications_per_mb = 1000;
+  }
+
+  void AddSignature(const std::string& name,
+                    absl::Span<const std::string> pieces) {
+    auto* signature = signatures_.add_signature();
+    signature->mutable_definition()->set_detection_name(name);
+    AddSignaturePieces(pieces, signature->mutable_raw_signature());
+  }
+
+  Signatures signatures_;
+  Corpus corpus_;
+  AtomAnalysisOptions options_;
+};
+
+TEST_F(AtomAnalysisTest, RanksRulesByScanCost) {
+  options_.num_threads = 2;
+  auto analysis = AnalyzeAtoms(signatures_, corpus_, options_);
+  ASSERT_THAT(analysis, IsOk());
+  ASSERT_THAT(analysis->atoms, SizeIs(3));
+  ASSERT_THAT(analysis->rules, SizeIs(2));
+
+  const auto& hottest = analysis->atoms[0];
+  EXPECT_THAT(hottest.bytes, Eq(std::string(4, '\0')));
+  EXPECT_THAT(hottest.corpus_hits, Eq(4096 - 3));
+  EXPECT_THAT(hottest.files_with_hits, Eq(1));
+  EXPECT_THAT(hottest.rules, ElementsAre(1));
+
+  // The prologue atom is shared by both rules.
+  const auto& shared = analysis->atoms[1];
+  EXPECT_THAT(shared.corpus_hits, Eq(1));
+  EXPECT_THAT(shared.rules, ElementsAre(0, 1));
+  EXPECT_THAT(shared.num_pieces, Eq(2));
+  EXPECT_THAT(analysis->atoms[2].corpus_hits, Eq(0));
+
+  const auto& hot = analysis->rules[0];
+  EXPECT_THAT(hot.name, Eq("hot"));
+  EXPECT_THAT(hot.signature_index, Eq(1));
+  EXPECT_THAT(hot.atom_hits, Eq(4096 - 3 + 1));
+  EXPECT_THAT(hot.hottest_atom, Eq(0));
+  EXPECT_THAT(hot.shared_atoms, Eq(1));
+  EXPECT_THAT(hot.cost_share, Gt(0.99));
+  EXPECT_THAT(hot.over_budget, IsTrue());
+
+  const auto& cold = analysis->rules[1];
+  EXPECT_THAT(cold.name, Eq("cold"));
+  EXPECT_THAT(cold.atom_hits, Eq(1));
+  EXPECT_THAT(cold.hottest_atom, Eq(1));
+  EXPECT_THAT(cold.over_budget, IsFalse());
+  EXPECT_THAT(analysis->num_over_budget(), Eq(1));
+}
+
+TEST_F(AtomAnalysisTest, RegeneratesExpensiveRules) {
+  // Like the generator, keep the formatted rules with the signatures.
+  const auto formatter = SignatureFormatter::Create(YARA);
+  for (auto& signature : *signatures_.mutable_signature()) {
+    ASSERT_THAT(formatter->Format(&signature), IsOk());
+  }
+  std::string database;
+  ASSERT_THAT(formatter->FormatDatabase(signatures_, &database), IsOk());
+
+  auto analysis = AnalyzeAtoms(signatures_, corpus_, options_);
+  ASSERT_THAT(analysis, IsOk());
+
+  int num_changed = 0;
+  auto regenerated = RegenerateExpensiveRules(
+      signatures_, *analysis, corpus_, VariantSearchOptions(), &num_changed);
+  ASSERT_THAT(regenerated, IsOk());
+  EXPECT_THAT(num_changed, Eq(1));
+  // Only the hot rule changes, dropping the zero bytes.
+  EXPECT_THAT(regenerated->signature(0).definition().min_piece_length(),
+              Eq(4));
+  EXPECT_THAT(regenerated->signature(1).definition().min_piece_length(),
+              Eq(8));
+
+  auto reanalyzed = AnalyzeAtoms(*regenerated, corpus_, options_);
+  ASSERT_THAT(reanalyzed, IsOk());
+  EXPECT_THAT(reanalyzed->num_over_budget(), Eq(0));
+
+  // The changed rule is formatted from its new definition.
+  EXPECT_THAT(regenerated->signature(1).yara_signature().data(), IsEmpty());
+  std::string regenerated_database;
+  ASSERT_THAT(formatter->FormatDatabase(*regenerated, &regenerated_database),
+              IsOk());
+  EXPECT_THAT(regenerated_database, Ne(database));
+  EXPECT_THAT(regenerated_database,
+              HasSubstr(regenerated->signature(0).yara_signature().data()));
+}
+
+TEST_F(AtomAnalysisTest, PiecesWithoutAtom) {
+  auto* piece = signatures_.mutable_signature(0)
+                    ->mutable_raw_signature()
+                    ->mutable_piece(1);
+  for (int i = 0; i < piece->bytes().size() * 2; ++i) {
+    piece->add_masked_nibble(i);
+  }
+  auto analysis = AnalyzeAtoms(signatures_, corpus_, options_);
+  ASSERT_THAT(analysis, IsOk());
+  const auto& cold = analysis->rules[0];
+  EXPECT_THAT(cold.name, Eq("cold"));
+  EXPECT_THAT(cold.pieces_without_atom, Eq(1));
+  EXPECT_THAT(cold.min_atom_quality, Eq(0));
+  EXPECT_THAT(cold.atom_hits, Eq(corpus_.total_bytes() + 1));
+}
+
+}  // namespace
+}  // namespace security::vxsig
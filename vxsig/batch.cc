@@ -0,0 +1,432 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "google/protobuf/text_format.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/bounded_queue.h"
+#include "vxsig/corpus.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/executor.h"
+#include "vxsig/siggen.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/trace.h"
+#include "vxsig/trim_plan.h"
+
+namespace security::vxsig {
+namespace {
+
+// Approximate size of a BinDiff file per instruction of its two inputs, used
+// to estimate the cost of diffs whose headers cannot be read.
+constexpr double kBinDiffBytesPerInstruction = 16;
+
+// The plan must have been built from the raw signature of the signature.
+absl::Status WriteJobOutput(const std::string& output_base,
+                            SignatureType format, Signature* signature,
+                            const TrimPlan& plan,
+                            std::vector<std::string>* output_files) {
+  std::string filename;
+  std::string data;
+  switch (format) {
+    case YARA:
+      NA_RETURN_IF_ERROR(
+          SignatureFormatter::Create(YARA)->Format(signature, &plan));
+      filename = absl::StrCat(output_base, ".yar");
+      data = signature->yara_signature().data();
+      break;
+    case CLAMAV:
+      NA_RETURN_IF_ERROR(
+          SignatureFormatter::Create(CLAMAV)->Format(signature, &plan));
+      filename = absl::StrCat(output_base, ".ndb");
+      data = signature->clam_av_signature().data();
+      break;
+    case RAW: {
+      filename = absl::StrCat(output_base, ".pb");
+      Signatures signatures;
+      *signatures.add_signature() = *signature;
+      data = signatures.SerializeAsString();
+      break;
+    }
+    default:
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid output format: ", format));
+  }
+  // Other processes may be reading the outputs of a previous run.
+  NA_RETURN_IF_ERROR(WriteFileContentsAtomically(filename, data));
+  output_files->push_back(std::move(filename));
+  return absl::OkStatus();
+}
+
+// A job on its way through the pipeline stages of RunBatch().
+struct PipelineJob {
+  int index;
+  std::unique_ptr<AvSignatureGenerator> siggen;
+  Signature signature;
+};
+
+// Returns a generator for the job and sets up the signature definition. The
+// job runs on the executor if set, otherwise on the calling thread.
+std::unique_ptr<AvSignatureGenerator> MakeJobGenerator(
+    const BatchManifest::Job& job, const BatchOptions& options,
+    std::shared_ptr<InputCache> input_cache,
+    std::shared_ptr<Executor> executor, Signature* signature) {
+  *signature->mutable_definition() = options.default_definition;
+  signature->mutable_definition()->MergeFrom(job.definition());
+
+  auto siggen = absl::make_unique<AvSignatureGenerator>();
+  siggen->set_input_cache(std::move(input_cache))
+      .set_verbose(false)
+      .set_minimize(options.minimize)
+      .set_minimize_min_pieces(options.minimize_min_pieces)
+      .set_order_diffs(options.order_diffs);
+  if (executor) {
+    siggen->set_executor(std::move(executor));
+  } else {
+    siggen->set_num_threads(1);
+  }
+  if (options.goodware) {
+    siggen->set_goodware(options.goodware)
+        .set_goodware_max_rounds(options.goodware_max_rounds);
+  }
+  if (options.signature_cache) {
+    siggen->set_signature_cache(options.signature_cache);
+  }
+  siggen->AddDiffResults(job.diff().begin(), job.diff().end());
+  return siggen;
+}
+
+void WriteAllJobOutput(const BatchManifest& manifest,
+                       const BatchManifest::Job& job,
+                       const std::string& output_directory,
+                       Signature* signature, BatchJobResult* result) {
+  std::string output_base = result->name;
+  if (!output_directory.empty()) {
+    output_base = JoinPath(output_directory, output_base);
+  }
+  // All formats trim the same raw signature.
+  const TrimPlan plan(signature->raw_signature());
+  for (SignatureType format : GetJobOutputFormats(manifest, job)) {
+    result->status = WriteJobOutput(output_base, format, signature, plan,
+                                    &result->output_files);
+    if (!result->status.ok()) {
+      return;
+    }
+  }
+}
+
+// Returns the jobs for the clusters of the samples of a job, or nothing if the
+// job should be kept as is.
+std::optional<std::vector<BatchManifest::Job>> SplitJob(
+    const BatchManifest::Job& job, absl::string_view name,
+    const ClusteringOptions& options, InputCache* cache, Executor* executor) {
+  // Samples are identified by their BinExport files.
+  std::vector<std::string> samples;
+  absl::flat_hash_map<std::string, int> sample_indices;
+  std::vector<std::pair<int, int>> diff_samples;
+  for (const auto& diff : job.diff()) {
+    std::pair<FileMetaData, FileMetaData> metadata;
+    if (!ReadBinDiffMetaData(diff, &metadata).ok()) {
+      return std::nullopt;
+    }
+    int indices[2];
+    for (int i = 0; i < 2; ++i) {
+      std::string binexport =
+          JoinPath(Dirname(diff), i == 0 ? metadata.first.filename
+                                         : metadata.second.filename)
+              .append(".BinExport");
+      auto [it, inserted] =
+          sample_indices.emplace(std::move(binexport), samples.size());
+      if (inserted) {
+        samples.push_back(it->first);
+      }
+      indices[i] = it->second;
+    }
+    diff_samples.emplace_back(indices[0], indices[1]);
+  }
+  if (samples.size() <= 2) {
+    return std::nullopt;
+  }
+
+  TraceSpan span("ClusterSamples");
+  span.Arg("samples", samples.size());
+  std::vector<MinHashSketch> sketches(samples.size());
+  std::atomic<bool> failed(false);
+  executor->ParallelFor(samples.size(), [&](int64_t i) {
+    auto fingerprints = ReadFunctionFingerprints(samples[i], options, cache);
+    if (!fingerprints.ok()) {
+      failed = true;
+      return;
+    }
+    sketches[i] = ComputeMinHash(*fingerprints, options.num_hashes);
+  });
+  if (failed) {
+    return std::nullopt;
+  }
+  const std::vector<std::vector<int>> clusters =
+      ClusterSketches(sketches, options);
+  span.Arg("clusters", clusters.size());
+  if (clusters.size() == 1) {
+    return std::nullopt;
+  }
+  std::vector<int> cluster_of(samples.size());
+  for (int i = 0; i < clusters.size(); ++i) {
+    for (int sample : clusters[i]) {
+      cluster_of[sample] = i;
+    }
+  }
+
+  // Group the diffs within clusters by the samples they connect.
+  std::vector<int> component(samples.size());
+  std::iota(component.begin(), component.end(), 0);
+  auto find = [&component](int i) {
+    while (component[i] != i) {
+      i = component[i] = component[component[i]];
+    }
+    return i;
+  };
+  for (const auto& [first, second] : diff_samples) {
+    if (cluster_of[first] == cluster_of[second]) {
+      component[find(first)] = find(second);
+    }
+  }
+  std::vector<BatchManifest::Job> jobs;
+  absl::flat_hash_map<int, int> job_indices;
+  for (int i = 0; i < diff_samples.size(); ++i) {
+    const auto& [first, second] = diff_samples[i];
+    if (cluster_of[first] != cluster_of[second]) {
+      continue;
+    }
+    auto [it, inserted] = job_indices.emplace(find(first), jobs.size());
+    if (inserted) {
+      auto& cluster_job = jobs.emplace_back(job);
+      cluster_job.clear_diff();
+      cluster_job.set_name(absl::StrCat(name, "_cluster", it->second));
+    }
+    jobs[it->second].add_diff(job.diff(i));
+  }
+  if (jobs.empty() ||
+      (jobs.size() == 1 && jobs[0].diff_size() == job.diff_size())) {
+    return std::nullopt;
+  }
+  return jobs;
+}
+
+}  // namespace
+
+double EstimateJobCost(const BatchManifest::Job& job) {
+  double cost = 0;
+  for (const auto& diff : job.diff()) {
+    std::pair<FileMetaData, FileMetaData> metadata;
+    if (ReadBinDiffMetaData(diff, &metadata).ok()) {
+      cost += static_cast<double>(metadata.first.num_instructions) +
+              metadata.second.num_instructions;
+    } else if (auto size = GetFileSize(diff); size.ok()) {
+      cost += *size / kBinDiffBytesPerInstruction;
+    }
+  }
+  return cost;
+}
+
+BatchManifest SplitJobsByCluster(const BatchManifest& manifest,
+                                 const ClusteringOptions& options,
+                                 InputCache* cache, int num_threads) {
+  BatchManifest result = manifest;
+  result.clear_job();
+  const std::shared_ptr<Executor> executor = MakeExecutor(num_threads);
+  for (int i = 0; i < manifest.job_size(); ++i) {
+    const auto& job = manifest.job(i);
+    const std::string name =
+        job.has_name() ? job.name() : absl::StrCat("job", i);
+    auto cluster_jobs = SplitJob(job, name, options, cache, executor.get());
+    if (!cluster_jobs) {
+      auto* kept = result.add_job();
+      *kept = job;
+      kept->set_name(name);
+      continue;
+    }
+    for (auto& cluster_job : *cluster_jobs) {
+      *result.add_job() = std::move(cluster_job);
+    }
+  }
+  return result;
+}
+
+absl::Status GenerateJobSignature(const BatchManifest::Job& job,
+                                  const BatchOptions& options,
+                                  std::shared_ptr<InputCache> input_cache,
+                                  Signature* signature, absl::Time deadline,
+                                  const CancellationToken* cancellation) {
+  if (job.diff().empty()) {
+    return absl::InvalidArgumentError("Job has no diff results");
+  }
+  return MakeJobGenerator(job, options, std::move(input_cache),
+                          options.executor, signature)
+      ->Generate(signature, deadline, cancellation);
+}
+
+std::vector<SignatureType> GetJobOutputFormats(const BatchManifest& manifest,
+                                               const BatchManifest::Job& job) {
+  std::vector<SignatureType> formats;
+  for (int format : !job.output_format().empty() ? job.output_format()
+                                                 : manifest.output_format()) {
+    formats.push_back(static_cast<SignatureType>(format));
+  }
+  if (formats.empty()) {
+    formats.push_back(YARA);
+  }
+  return formats;
+}
+
+absl::StatusOr<BatchManifest> ReadBatchManifest(absl::string_view filename) {
+  NA_ASSIGN_OR_RETURN(std::string data, ReadFileContents(filename));
+  BatchManifest manifest;
+  if (!google::protobuf::TextFormat::ParseFromString(data, &manifest)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Failed to parse batch manifest: ", filename));
+  }
+  return manifest;
+}
+
+absl::StatusOr<std::vector<BatchJobResult>> RunBatch(
+    const BatchManifest& manifest, const BatchOptions& options) {
+  if (options.cluster_samples) {
+    BatchOptions cluster_options = options;
+    cluster_options.cluster_samples = false;
+    if (!cluster_options.input_cache) {
+      cluster_options.input_cache = std::make_shared<InputCache>();
+    }
+    return RunBatch(
+        SplitJobsByCluster(manifest, options.clustering,
+                           cluster_options.input_cache.get(),
+                           options.num_threads),
+        cluster_options);
+  }
+
+  std::vector<BatchJobResult> results(manifest.job_size());
+  absl::flat_hash_set<std::string> names;
+  for (int i = 0; i < manifest.job_size(); ++i) {
+    const auto& job = manifest.job(i);
+    auto& name = results[i].name;
+    name = job.has_name() ? job.name() : absl::StrCat("job", i);
+    if (name.empty() || !names.insert(name).second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Empty or duplicate job name: \"", name, "\""));
+    }
+  }
+
+  const std::string& output_directory = !options.output_directory.empty()
+                                            ? options.output_directory
+                                            : manifest.output_directory();
+  const std::shared_ptr<InputCache> input_cache =
+      options.input_cache ? options.input_cache
+                          : std::make_shared<InputCache>();
+  // The load stage runs on an executor of its own, as its tasks block on the
+  // queue to the generate stage. The jobs run on the executor of the generate
+  // stage, so that a large job is helped by the threads that have no job
+  // left to run.
+  const std::shared_ptr<Executor> load_executor =
+      MakeExecutor(options.num_load_threads);
+  const std::shared_ptr<Executor> generate_executor =
+      options.executor ? options.executor : MakeExecutor(options.num_threads);
+  const int num_threads = generate_executor->num_threads();
+
+  // Start the most expensive jobs first, so that the batch does not end with
+  // a single large job running while the other threads are idle.
+  std::vector<int> order(manifest.job_size());
+  std::iota(order.begin(), order.end(), 0);
+  std::vector<double> costs(manifest.job_size());
+  if (options.longest_job_first) {
+    TraceSpan span("BatchEstimateCosts");
+    load_executor->ParallelFor(manifest.job_size(), [&](int64_t i) {
+      costs[i] = EstimateJobCost(manifest.job(i));
+    });
+    std::stable_sort(order.begin(), order.end(),
+                     [&costs](int a, int b) { return costs[a] > costs[b]; });
+  }
+
+  BoundedQueue<PipelineJob> loaded(options.queue_capacity);
+  BoundedQueue<PipelineJob> generated(options.queue_capacity);
+
+  // Stage 1: parse BinDiff and BinExport files (mostly I/O).
+  std::thread load_stage([&]() {
+    load_executor->ParallelFor(manifest.job_size(), [&](int64_t k) {
+      const int i = order[k];
+      const auto& job = manifest.job(i);
+      if (job.diff().empty()) {
+        results[i].status =
+            absl::InvalidArgumentError("Job has no diff results");
+        return;
+      }
+      TraceSpan span("BatchLoadJob");
+      span.Arg("job", i);
+      PipelineJob pipeline_job{i};
+      pipeline_job.siggen =
+          MakeJobGenerator(job, options, input_cache, generate_executor,
+                           &pipeline_job.signature);
+      results[i].status =
+          pipeline_job.siggen->LoadInputs(pipeline_job.signature.definition());
+      if (results[i].status.ok()) {
+        loaded.Push(std::move(pipeline_job));
+      }
+    });
+    loaded.Close();
+  });
+
+  // Stage 2: compute the signatures (CPU-bound).
+  std::thread generate_stage([&]() {
+    generate_executor->ParallelFor(num_threads, [&](int64_t /* thread */) {
+      while (auto pipeline_job = loaded.Pop()) {
+        TraceSpan span("BatchGenerateJob");
+        span.Arg("job", pipeline_job->index);
+        auto& status = results[pipeline_job->index].status;
+        status = pipeline_job->siggen->GenerateFromInputs(
+            &pipeline_job->signature);
+        // Release the match chain table before waiting for the next stage.
+        pipeline_job->siggen.reset();
+        if (status.ok()) {
+          generated.Push(*std::move(pipeline_job));
+        }
+      }
+    });
+    generated.Close();
+  });
+
+  // Stage 3: format and write the output files.
+  while (auto pipeline_job = generated.Pop()) {
+    const int i = pipeline_job->index;
+    TraceSpan span("BatchWriteJob");
+    span.Arg("job", i);
+    WriteAllJobOutput(manifest, manifest.job(i), output_directory,
+                      &pipeline_job->signature, &results[i]);
+  }
+  load_stage.join();
+  generate_stage.join();
+  return results;
+}
+
+}  // namespace security::vxsig
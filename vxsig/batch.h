@@ -0,0 +1,151 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs the signature generation jobs of a BatchManifest in a single process.
+// Jobs run concurrently and share decoded BinDiff and BinExport files, which
+// avoids paying process startup and input parsing for every job.
+// Jobs flow through a pipeline of three stages: loading the inputs, computing
+// the signature and formatting/writing the output. The stages are connected by
+// bounded queues, so that loading the next jobs overlaps the computation of
+// the current ones without loading far more inputs than can be processed.
+// Optionally, each job is first split into one job per cluster of similar
+// samples (see clustering.h), so that heterogeneous families still yield
+// signatures.
+// Jobs are started longest first by a cost estimate from the BinDiff headers,
+// so that a large job does not start last and determine the batch's runtime.
+// Jobs that make up a large part of the batch also get several threads.
+
+#ifndef VXSIG_BATCH_H_
+#define VXSIG_BATCH_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/clustering.h"
+#include "vxsig/executor.h"
+#include "vxsig/goodware.h"
+#include "vxsig/input_cache.h"
+#include "vxsig/minimize.h"
+#include "vxsig/signature_cache.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+struct BatchOptions {
+  // The signature definition of each job is merged into this one.
+  SignatureDefinition default_definition;
+
+  // Overrides the output directory of the manifest if non-empty.
+  std::string output_directory;
+
+  // Generator settings shared by all jobs, see AvSignatureGenerator.
+  std::shared_ptr<const GoodwareCorpus> goodware;
+  int goodware_max_rounds = 10;
+  bool minimize = false;
+  int minimize_min_pieces = MinimizeOptions().min_pieces;
+  bool order_diffs = false;
+
+  // Whether to split each job into clusters of similar samples before
+  // running it, see SplitJobsByCluster().
+  bool cluster_samples = false;
+  ClusteringOptions clustering;
+
+  // Cache for decoded input files. A new cache is used if this is null.
+  std::shared_ptr<InputCache> input_cache;
+
+  // Optional cache for raw signatures, shared by all jobs.
+  std::shared_ptr<RawSignatureCache> signature_cache;
+
+  // Number of jobs to compute concurrently, zero selects a default.
+  int num_threads = 0;
+
+  // Executor that all jobs run on. Jobs run concurrently on its threads and
+  // large jobs use the threads that others leave idle. If null, RunBatch()
+  // creates one with num_threads threads and GenerateJobSignature() runs the
+  // job on the calling thread.
+  std::shared_ptr<Executor> executor;
+
+  // Whether to start jobs in order of decreasing estimated cost instead of
+  // manifest order, see EstimateJobCost().
+  bool longest_job_first = true;
+
+  // Number of jobs to load inputs for concurrently.
+  int num_load_threads = 2;
+
+  // Maximum number of jobs waiting between two pipeline stages.
+  int queue_capacity = 2;
+};
+
+struct BatchJobResult {
+  std::string name;
+  absl::Status status;
+  std::vector<std::string> output_files;
+};
+
+// Generates the signature for a single job, without formatting it. The job's
+// signature definition is merged into the default one from the options. The
+// deadline and cancellation token are passed on to
+// AvSignatureGenerator::Generate().
+absl::Status GenerateJobSignature(
+    const BatchManifest::Job& job, const BatchOptions& options,
+    std::shared_ptr<InputCache> input_cache, Signature* signature,
+    absl::Time deadline = absl::InfiniteFuture(),
+    const CancellationToken* cancellation = nullptr);
+
+// Returns the output formats of a job, falling back to the manifest-wide
+// setting and then to YARA.
+std::vector<SignatureType> GetJobOutputFormats(const BatchManifest& manifest,
+                                               const BatchManifest::Job& job);
+
+// Returns an estimate of the cost of generating the signature for a job, in
+// arbitrary units. Only the headers of the diffs are read: each diff
+// contributes the instruction counts of both of its files, so that longer
+// chains and larger samples cost more. Diffs whose headers cannot be read
+// contribute their file size instead.
+double EstimateJobCost(const BatchManifest::Job& job);
+
+// Clusters the samples of each job by their function fingerprints and
+// replaces the job by one job per cluster, named "<name>_cluster<index>". The
+// job of a cluster consists of the job's diffs between samples of the
+// cluster; clusters whose samples are not connected by diffs are split
+// further. Samples without a diff to another sample of their cluster are left
+// out. Jobs that form a single cluster, or whose inputs cannot be read, are
+// kept as is. The inputs are read through the cache, if non-null, so that the
+// jobs can reuse them.
+BatchManifest SplitJobsByCluster(const BatchManifest& manifest,
+                                 const ClusteringOptions& options,
+                                 InputCache* cache = nullptr,
+                                 int num_threads = 0);
+
+// Reads a manifest in text format.
+absl::StatusOr<BatchManifest> ReadBatchManifest(absl::string_view filename);
+
+// Runs all jobs of the manifest and writes one output file per job and
+// requested format: "<name>.yar" for YARA, "<name>.ndb" for CLAMAV and
+// "<name>.pb" (a binary Signatures message) for RAW. Returns one result per
+// job, in manifest order. Errors of individual jobs do not stop the batch,
+// only an invalid manifest is reported as an error. If the samples are
+// clustered, there is one result per cluster job instead.
+absl::StatusOr<std::vector<BatchJobResult>> RunBatch(
+    const BatchManifest& manifest, const BatchOptions& options);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_BATCH_H_
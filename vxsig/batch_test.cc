@@ -0,0 +1,236 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/batch.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/corpus.h"
+#include "vxsig/executor.h"
+#include "vxsig/siggen.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/test_util.h"
+
+using not_absl::IsOk;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Gt;
+using testing::IsFalse;
+using testing::IsTrue;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kFirstDiff[] =
+    "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa_vs_"
+    "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82.BinDiff";
+constexpr char kSecondDiff[] =
+    "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82_vs_"
+    "1d3949acb5eb175af3cbc5f448ece50669a44743faec91e3d574dad9596a9d83.BinDiff";
+
+constexpr char kOtherFamilyDiff[] =
+    "592fb377afa9f93670a23159aa585e0eca908b97571ab3218e026fea3598cc16_vs_"
+    "65d25a86feb6d15527e398d7b5d043e7712b00e674bc6e8cf2a709a0c6f9b97b.BinDiff";
+
+class BatchTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    options_.output_directory = getenv("TEST_TMPDIR");
+    options_.default_definition.set_detection_name("batch_test");
+    options_.input_cache = std::make_shared<InputCache>();
+    options_.num_threads = 2;
+  }
+
+  BatchManifest::Job* AddJob(absl::string_view name,
+                             std::initializer_list<const char*> diffs) {
+    auto* job = manifest_.add_job();
+    job->set_name(std::string(name));
+    for (const char* diff : diffs) {
+      job->add_diff(TestDataPath(diff));
+    }
+    return job;
+  }
+
+  BatchManifest manifest_;
+  BatchOptions options_;
+};
+
+TEST_F(BatchTest, SharesInputsBetweenJobs) {
+  auto* chain = AddJob("chain", {kFirstDiff, kSecondDiff});
+  chain->add_output_format(RAW);
+  chain->add_output_format(CLAMAV);
+  AddJob("first", {kFirstDiff})->add_output_format(RAW);
+  auto results = RunBatch(manifest_, options_);
+  ASSERT_THAT(results, IsOk());
+  ASSERT_THAT(*results, SizeIs(2));
+  for (const auto& result : *results) {
+    EXPECT_THAT(result.status, IsOk());
+  }
+  const std::string output_base = JoinPath(getenv("TEST_TMPDIR"), "chain");
+  EXPECT_THAT((*results)[0].output_files,
+              ElementsAre(output_base + ".pb", output_base + ".ndb"));
+
+  // One BinDiff and two BinExport files are shared between the jobs.
+  EXPECT_THAT(options_.input_cache->misses(), Eq(5));
+  EXPECT_THAT(options_.input_cache->hits(), Eq(3));
+
+  // Cached inputs yield the same signature as uncached ones.
+  AvSignatureGenerator siggen;
+  siggen.set_verbose(false).AddDiffResults(
+      {TestDataPath(kFirstDiff), TestDataPath(kSecondDiff)});
+  Signature expected;
+  ASSERT_THAT(siggen.Generate(&expected), IsOk());
+  auto data = ReadFileContents(output_base + ".pb");
+  ASSERT_THAT(data, IsOk());
+  Signatures written;
+  ASSERT_THAT(written.ParseFromString(*data), IsTrue());
+  ASSERT_THAT(written.signature_size(), Eq(1));
+  EXPECT_THAT(written.signature(0).definition().detection_name(),
+              Eq("batch_test"));
+  EXPECT_THAT(EquivRawSignature(written.signature(0).raw_signature(),
+                                expected.raw_signature()),
+              IsTrue());
+}
+
+TEST_F(BatchTest, FailingJobDoesNotStopBatch) {
+  AddJob("missing", {"does_not_exist.BinDiff"});
+  AddJob("first", {kFirstDiff});
+  auto results = RunBatch(manifest_, options_);
+  ASSERT_THAT(results, IsOk());
+  ASSERT_THAT(*results, SizeIs(2));
+  EXPECT_THAT((*results)[0].status.ok(), IsFalse());
+  EXPECT_THAT((*results)[1].status, IsOk());
+  EXPECT_THAT((*results)[1].output_files,
+              ElementsAre(JoinPath(getenv("TEST_TMPDIR"), "first.yar")));
+}
+
+TEST_F(BatchTest, PipelineWithSmallQueues) {
+  options_.num_load_threads = 3;
+  options_.queue_capacity = 1;
+  for (int i = 0; i < 6; ++i) {
+    AddJob(absl::StrCat("job", i), {i % 2 == 0 ? kFirstDiff : kSecondDiff});
+  }
+  AddJob("empty", {});
+  auto results = RunBatch(manifest_, options_);
+  ASSERT_THAT(results, IsOk());
+  ASSERT_THAT(*results, SizeIs(7));
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_THAT((*results)[i].name, Eq(absl::StrCat("job", i)));
+    EXPECT_THAT((*results)[i].status, IsOk());
+    EXPECT_THAT((*results)[i].output_files, SizeIs(1));
+  }
+  EXPECT_THAT((*results)[6].status.ok(), IsFalse());
+}
+
+TEST_F(BatchTest, EstimatesCostFromDiffHeaders) {
+  const double first = EstimateJobCost(*AddJob("first", {kFirstDiff}));
+  const double second = EstimateJobCost(*AddJob("second", {kSecondDiff}));
+  const double chain =
+      EstimateJobCost(*AddJob("chain", {kFirstDiff, kSecondDiff}));
+  EXPECT_THAT(first, Gt(0));
+  EXPECT_THAT(second, Gt(0));
+  EXPECT_THAT(chain, Eq(first + second));
+  EXPECT_THAT(EstimateJobCost(*AddJob("missing", {"does_not_exist.BinDiff"})),
+              Eq(0));
+}
+
+TEST_F(BatchTest, RunsJobsOnSharedExecutor) {
+  // Counts the tasks that are scheduled on a pool.
+  class CountingExecutor : public Executor {
+   public:
+    int num_threads() const override { return pool_.num_threads(); }
+    void Schedule(std::function<void()> fn) override {
+      ++num_scheduled_;
+      pool_.Schedule(std::move(fn));
+    }
+    int64_t num_scheduled() const { return num_scheduled_; }
+
+   private:
+    WorkStealingExecutor pool_{/*num_threads=*/2};
+    std::atomic<int64_t> num_scheduled_{0};
+  };
+  auto executor = std::make_shared<CountingExecutor>();
+  options_.executor = executor;
+  AddJob("chain", {kFirstDiff, kSecondDiff});
+  AddJob("first", {kFirstDiff});
+  auto results = RunBatch(manifest_, options_);
+  ASSERT_THAT(results, IsOk());
+  for (const auto& result : *results) {
+    EXPECT_THAT(result.status, IsOk());
+  }
+  // One task starts the second job runner, the others come from the jobs.
+  EXPECT_THAT(executor->num_scheduled(), Gt(1));
+}
+
+TEST_F(BatchTest, LongestJobFirstKeepsManifestOrder) {
+  AddJob("small", {kSecondDiff});
+  AddJob("large", {kFirstDiff, kSecondDiff});
+  for (bool longest_job_first : {false, true}) {
+    options_.longest_job_first = longest_job_first;
+    auto results = RunBatch(manifest_, options_);
+    ASSERT_THAT(results, IsOk());
+    ASSERT_THAT(*results, SizeIs(2));
+    EXPECT_THAT((*results)[0].name, Eq("small"));
+    EXPECT_THAT((*results)[0].status, IsOk());
+    EXPECT_THAT((*results)[1].name, Eq("large"));
+    EXPECT_THAT((*results)[1].status, IsOk());
+  }
+}
+
+TEST_F(BatchTest, RejectsDuplicateJobNames) {
+  AddJob("job", {kFirstDiff});
+  AddJob("job", {kSecondDiff});
+  EXPECT_THAT(RunBatch(manifest_, options_).ok(), IsFalse());
+}
+
+TEST_F(BatchTest, SplitsJobsByCluster) {
+  AddJob("family", {kFirstDiff, kSecondDiff, kOtherFamilyDiff});
+  AddJob("single", {kFirstDiff});
+  const BatchManifest split = SplitJobsByCluster(
+      manifest_, options_.clustering, options_.input_cache.get());
+  ASSERT_THAT(split.job(), SizeIs(3));
+  EXPECT_THAT(split.job(0).name(), Eq("family_cluster0"));
+  EXPECT_THAT(split.job(0).diff(), ElementsAre(TestDataPath(kFirstDiff),
+                                               TestDataPath(kSecondDiff)));
+  EXPECT_THAT(split.job(1).name(), Eq("family_cluster1"));
+  EXPECT_THAT(split.job(1).diff(),
+              ElementsAre(TestDataPath(kOtherFamilyDiff)));
+  EXPECT_THAT(split.job(2).name(), Eq("single"));
+
+  options_.cluster_samples = true;
+  auto results = RunBatch(manifest_, options_);
+  ASSERT_THAT(results, IsOk());
+  ASSERT_THAT(*results, SizeIs(3));
+  for (const auto& result : *results) {
+    EXPECT_THAT(result.status, IsOk()) << result.name;
+  }
+  EXPECT_THAT((*results)[1].output_files,
+              ElementsAre(JoinPath(getenv("TEST_TMPDIR"),
+                                   "family_cluster1.yar")));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,138 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/benchmark_util.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/candidates.h"
+
+namespace {
+
+std::atomic<int64_t> g_allocations(0);
+std::atomic<int64_t> g_allocated_bytes(0);
+
+void* CountedAllocate(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  // malloc(0) may return null, which operator new must not.
+  void* ptr = std::malloc(size > 0 ? size : 1);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+}  // namespace
+
+// The array and sized variants forward to these by default.
+void* operator new(size_t size) { return CountedAllocate(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+namespace security::vxsig {
+
+std::string BenchmarkDataPath(absl::string_view filename) {
+  const char* srcdir = getenv("TEST_SRCDIR");
+  return srcdir ? JoinPath(srcdir, "com_google_vxsig/vxsig/testdata", filename)
+                : JoinPath("vxsig/testdata", filename);
+}
+
+std::vector<std::string> BenchmarkDiffs() {
+  std::vector<std::string> diffs;
+  for (int i = 0; i + 1 < std::size(kBenchmarkBinaries); ++i) {
+    diffs.push_back(BenchmarkDataPath(absl::StrCat(
+        kBenchmarkBinaries[i], "_vs_", kBenchmarkBinaries[i + 1],
+        ".BinDiff")));
+  }
+  return diffs;
+}
+
+std::vector<std::string> BenchmarkBinExports() {
+  std::vector<std::string> binexports;
+  for (absl::string_view binary : kBenchmarkBinaries) {
+    binexports.push_back(
+        BenchmarkDataPath(absl::StrCat(binary, ".BinExport")));
+  }
+  return binexports;
+}
+
+absl::Status LoadMatchChainTable(absl::Span<const std::string> diffs,
+                                 MatchChainTable* table) {
+  table->clear();
+  for (int i = 0; i < diffs.size() + 1; ++i) {
+    table->emplace_back(absl::make_unique<MatchChainColumn>());
+  }
+  std::vector<std::pair<std::string, std::string>> diff_file_pairs;
+  for (int i = 0; i < diffs.size(); ++i) {
+    NA_RETURN_IF_ERROR(AddDiffResult(diffs[i], i == diffs.size() - 1,
+                                     (*table)[i].get(), (*table)[i + 1].get(),
+                                     &diff_file_pairs));
+  }
+  for (auto& column : *table) {
+    NA_RETURN_IF_ERROR(AddFunctionData(
+        JoinPath(column->diff_directory(), column->filename())
+            .append(".BinExport"),
+        column.get()));
+  }
+  return absl::OkStatus();
+}
+
+void ComputeBenchmarkCandidates(MatchChainTable* table,
+                                IdentSequence* bb_candidate_ids) {
+  PropagateIds(table);
+  BuildIdIndices(table);
+  IdentSequence func_candidate_ids;
+  ComputeFunctionCandidates(*table, &func_candidate_ids);
+  ComputeBasicBlockCandidates(*table, func_candidate_ids, bb_candidate_ids);
+  FilterBasicBlockOverlaps(*table, bb_candidate_ids);
+}
+
+AllocationCounter::AllocationCounter()
+    : start_allocations_(g_allocations.load(std::memory_order_relaxed)),
+      start_bytes_(g_allocated_bytes.load(std::memory_order_relaxed)) {}
+
+int64_t AllocationCounter::allocations() const {
+  return g_allocations.load(std::memory_order_relaxed) - start_allocations_;
+}
+
+int64_t AllocationCounter::bytes() const {
+  return g_allocated_bytes.load(std::memory_order_relaxed) - start_bytes_;
+}
+
+void ReportAllocations(const AllocationCounter& counter,
+                       benchmark::State& state) {
+  state.counters["allocs"] = benchmark::Counter(
+      counter.allocations(), benchmark::Counter::kAvgIterations);
+  state.counters["alloc_bytes"] = benchmark::Counter(
+      counter.bytes(), benchmark::Counter::kAvgIterations,
+      benchmark::Counter::OneK::kIs1024);
+}
+
+bool CheckBenchmarkStatus(const absl::Status& status,
+                          benchmark::State& state) {
+  if (!status.ok()) {
+    state.SkipWithError(std::string(status.message()).c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,91 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Helpers shared by the *_benchmark targets. Run them with
+//   bazel run -c opt //vxsig:siggen_benchmark -- --benchmark_out=siggen.json
+// and compare two JSON outputs with tools/compare.py from Google Benchmark.
+// Files written with --benchmark_out are in JSON format by default.
+// Linking this library replaces the global operator new, so that benchmarks
+// can report their allocations.
+
+#ifndef VXSIG_BENCHMARK_UTIL_H_
+#define VXSIG_BENCHMARK_UTIL_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "benchmark/benchmark.h"
+#include "vxsig/match_chain_table.h"
+#include "vxsig/types.h"
+
+namespace security::vxsig {
+
+// The large chain of diffs from the test data:
+//   1794a0... -> 1b0a84... -> 1d3949...
+inline constexpr absl::string_view kBenchmarkBinaries[] = {
+    "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa",
+    "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82",
+    "1d3949acb5eb175af3cbc5f448ece50669a44743faec91e3d574dad9596a9d83",
+};
+
+// Returns the path of a test data file. Uses $TEST_SRCDIR if set, otherwise
+// the runfiles directory that "bazel run" starts in.
+std::string BenchmarkDataPath(absl::string_view filename);
+
+// Returns the paths of the BinDiff and BinExport files of the chain.
+std::vector<std::string> BenchmarkDiffs();
+std::vector<std::string> BenchmarkBinExports();
+
+// Loads the chain of diffs into a new table, like
+// AvSignatureGenerator::LoadInputs() does.
+absl::Status LoadMatchChainTable(absl::Span<const std::string> diffs,
+                                 MatchChainTable* table);
+
+// Runs the stages of signature generation that precede
+// GenericSignatureFromMatches() on a loaded table.
+void ComputeBenchmarkCandidates(MatchChainTable* table,
+                                IdentSequence* bb_candidate_ids);
+
+// Counts the allocations made with operator new by all threads while it is
+// alive. Allocations made with malloc(), e.g. by SQLite, are not covered.
+class AllocationCounter {
+ public:
+  AllocationCounter();
+
+  AllocationCounter(const AllocationCounter&) = delete;
+  AllocationCounter& operator=(const AllocationCounter&) = delete;
+
+  int64_t allocations() const;
+  int64_t bytes() const;
+
+ private:
+  const int64_t start_allocations_;
+  const int64_t start_bytes_;
+};
+
+// Adds the "allocs" and "alloc_bytes" counters, averaged per iteration.
+void ReportAllocations(const AllocationCounter& counter,
+                       benchmark::State& state);
+
+// Aborts the benchmark with an error if the status is not OK. Returns whether
+// it is OK.
+bool CheckBenchmarkStatus(const absl::Status& status, benchmark::State& state);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_BENCHMARK_UTIL_H_
@@ -0,0 +1,243 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/bindiff_writer.h"
+
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/sqlite/sqlite3.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+
+namespace security::vxsig {
+namespace {
+
+// The subset of the BinDiff schema that BinDiff writes and vxsig reads.
+constexpr char kBinDiffSchema[] =
+    "CREATE TABLE basicblockalgorithm (id SMALLINT PRIMARY KEY, name TEXT);"
+    "CREATE TABLE functionalgorithm (id SMALLINT PRIMARY KEY, name TEXT);"
+    "CREATE TABLE \"file\" (id INT,filename TEXT,exefilename TEXT,"
+    "hash CHARACTER(40),functions INT,libfunctions INT,calls INT,"
+    "basicblocks INT,libbasicblocks INT,edges INT,libedges INT,"
+    "instructions INT,libinstructions INT);"
+    "CREATE TABLE \"metadata\" (version TEXT,file1 INT,file2 INT,"
+    "description TEXT,created DATE,modified DATE,"
+    "similarity DOUBLE PRECISION,confidence DOUBLE PRECISION,"
+    "FOREIGN KEY(file1) REFERENCES file(id),"
+    "FOREIGN KEY(file2) REFERENCES file(id));"
+    "CREATE TABLE \"function\" (id INT,address1 BIGINT,address2 BIGINT,"
+    "similarity DOUBLE PRECISION,confidence DOUBLE PRECISION,flags INTEGER,"
+    "algorithm SMALLINT,evaluate BOOLEAN,commentsported BOOLEAN,"
+    "basicblocks INTEGER,edges INTEGER,instructions INTEGER,"
+    "UNIQUE(address1, address2),PRIMARY KEY(id),"
+    "FOREIGN KEY(algorithm) REFERENCES functionalgorithm(id));"
+    "CREATE TABLE basicblock (id INT,functionid INT,address1 BIGINT,"
+    "address2 BIGINT,algorithm SMALLINT,evaluate BOOLEAN,PRIMARY KEY(id),"
+    "FOREIGN KEY(functionid) REFERENCES \"function\"(id),"
+    "FOREIGN KEY(algorithm) REFERENCES basicblockalgorithm(id));"
+    "CREATE TABLE instruction (basicblockid INT,address1 BIGINT,"
+    "address2 BIGINT,FOREIGN KEY(basicblockid) REFERENCES basicblock(id));";
+
+}  // namespace
+
+class BinDiffWriter::Database {
+ public:
+  Database() = default;
+  Database(const Database&) = delete;
+  Database& operator=(const Database&) = delete;
+
+  ~Database() {
+    for (sqlite3_stmt* statement : statements_) {
+      sqlite3_finalize(statement);
+    }
+    if (db_) {
+      sqlite3_close(db_);
+    }
+  }
+
+  absl::Status Create(const std::string& filename) {
+    remove(filename.c_str());
+    if (sqlite3_open_v2(filename.c_str(), &db_,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                        nullptr) != SQLITE_OK) {
+      return Error("open");
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status Execute(const char* sql) {
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+      return Error(sql);
+    }
+    return absl::OkStatus();
+  }
+
+  // Returns a statement that is finalized with the database.
+  absl::StatusOr<sqlite3_stmt*> Prepare(const char* sql) {
+    sqlite3_stmt* statement;
+    if (sqlite3_prepare_v2(db_, sql, -1, &statement, nullptr) != SQLITE_OK) {
+      return Error(sql);
+    }
+    statements_.push_back(statement);
+    return statement;
+  }
+
+  // Binds the values to the parameters of the statement, in order, and runs
+  // it.
+  template <typename... Args>
+  absl::Status Insert(sqlite3_stmt* statement, const Args&... args) {
+    sqlite3_reset(statement);
+    int index = 0;
+    (Bind(statement, ++index, args), ...);
+    if (sqlite3_step(statement) != SQLITE_DONE) {
+      return Error(sqlite3_sql(statement));
+    }
+    return absl::OkStatus();
+  }
+
+  sqlite3_stmt* insert_function = nullptr;
+  sqlite3_stmt* insert_basic_block = nullptr;
+  sqlite3_stmt* insert_instruction = nullptr;
+
+ private:
+  static void Bind(sqlite3_stmt* statement, int index, int64_t value) {
+    sqlite3_bind_int64(statement, index, value);
+  }
+  static void Bind(sqlite3_stmt* statement, int index, double value) {
+    sqlite3_bind_double(statement, index, value);
+  }
+  static void Bind(sqlite3_stmt* statement, int index,
+                   absl::string_view value) {
+    sqlite3_bind_text(statement, index, value.data(), value.size(),
+                      SQLITE_TRANSIENT);
+  }
+
+  absl::Status Error(absl::string_view what) const {
+    return absl::InternalError(absl::StrCat(
+        "SQLite error: ", db_ ? sqlite3_errmsg(db_) : "", ", in: ", what));
+  }
+
+  sqlite3* db_ = nullptr;
+  std::vector<sqlite3_stmt*> statements_;
+};
+
+BinDiffWriter::BinDiffWriter(std::unique_ptr<Database> db)
+    : db_(std::move(db)) {}
+
+BinDiffWriter::~BinDiffWriter() = default;
+
+absl::StatusOr<std::unique_ptr<BinDiffWriter>> BinDiffWriter::Create(
+    const std::string& filename, absl::string_view algorithm_name) {
+  auto db = std::make_unique<Database>();
+  NA_RETURN_IF_ERROR(db->Create(filename));
+  NA_RETURN_IF_ERROR(db->Execute(kBinDiffSchema));
+  for (const char* table : {"functionalgorithm", "basicblockalgorithm"}) {
+    NA_ASSIGN_OR_RETURN(
+        auto* insert_algorithm,
+        db->Prepare(absl::StrCat("INSERT INTO ", table, " VALUES (1, ?);")
+                        .c_str()));
+    NA_RETURN_IF_ERROR(db->Insert(insert_algorithm, algorithm_name));
+  }
+  NA_RETURN_IF_ERROR(db->Execute("BEGIN TRANSACTION;"));
+  NA_ASSIGN_OR_RETURN(db->insert_function,
+                      db->Prepare("INSERT INTO \"function\" VALUES "
+                                  "(?, ?, ?, ?, 1.0, 0, 1, 0, 0, ?, 0, ?);"));
+  NA_ASSIGN_OR_RETURN(
+      db->insert_basic_block,
+      db->Prepare("INSERT INTO basicblock VALUES (?, ?, ?, ?, 1, 0);"));
+  NA_ASSIGN_OR_RETURN(
+      db->insert_instruction,
+      db->Prepare("INSERT INTO instruction VALUES (?, ?, ?);"));
+  return absl::WrapUnique(new BinDiffWriter(std::move(db)));
+}
+
+absl::Status BinDiffWriter::FlushFunction() {
+  if (function_.id == 0) {
+    return absl::OkStatus();
+  }
+  return db_->Insert(db_->insert_function, function_.id,
+                     static_cast<int64_t>(function_.match.first),
+                     static_cast<int64_t>(function_.match.second),
+                     function_.similarity, function_.num_basic_blocks,
+                     function_.num_instructions);
+}
+
+absl::Status BinDiffWriter::AddFunctionMatch(const MemoryAddressPair& match,
+                                             double similarity) {
+  NA_RETURN_IF_ERROR(FlushFunction());
+  const int64_t id = function_.id + 1;
+  function_ = PendingFunction{};
+  function_.id = id;
+  function_.match = match;
+  function_.similarity = similarity;
+  return absl::OkStatus();
+}
+
+absl::Status BinDiffWriter::AddBasicBlockMatch(const MemoryAddressPair& match) {
+  if (function_.id == 0) {
+    return absl::FailedPreconditionError(
+        "Basic block match without function match");
+  }
+  ++function_.num_basic_blocks;
+  return db_->Insert(db_->insert_basic_block, ++basic_block_id_, function_.id,
+                     static_cast<int64_t>(match.first),
+                     static_cast<int64_t>(match.second));
+}
+
+absl::Status BinDiffWriter::AddInstructionMatch(
+    const MemoryAddressPair& match) {
+  if (basic_block_id_ == 0) {
+    return absl::FailedPreconditionError(
+        "Instruction match without basic block match");
+  }
+  ++function_.num_instructions;
+  return db_->Insert(db_->insert_instruction, basic_block_id_,
+                     static_cast<int64_t>(match.first),
+                     static_cast<int64_t>(match.second));
+}
+
+absl::Status BinDiffWriter::Finish(const BinDiffFile& primary,
+                                   const BinDiffFile& secondary,
+                                   const DiffSimilarity& similarity) {
+  if (finished_) {
+    return absl::FailedPreconditionError("Result already finished");
+  }
+  finished_ = true;
+  NA_RETURN_IF_ERROR(FlushFunction());
+  NA_ASSIGN_OR_RETURN(auto* insert_file,
+                      db_->Prepare("INSERT INTO \"file\" VALUES "
+                                   "(?, ?, ?, ?, ?, 0, 0, ?, 0, ?, 0, ?, 0);"));
+  int64_t file_id = 0;
+  for (const BinDiffFile* file : {&primary, &secondary}) {
+    NA_RETURN_IF_ERROR(db_->Insert(
+        insert_file, ++file_id, file->metadata.filename,
+        file->metadata.original_filename, file->metadata.original_hash,
+        file->num_functions, file->num_basic_blocks, file->num_edges,
+        file->num_instructions));
+  }
+  // Fixed timestamps keep the output reproducible.
+  NA_ASSIGN_OR_RETURN(
+      auto* insert_metadata,
+      db_->Prepare("INSERT INTO \"metadata\" VALUES "
+                   "('vxsig', 1, 2, '', '2021-01-01 00:00:00', "
+                   "'2021-01-01 00:00:00', ?, ?);"));
+  NA_RETURN_IF_ERROR(db_->Insert(insert_metadata, similarity.similarity,
+                                 similarity.confidence));
+  return db_->Execute("COMMIT;");
+}
+
+}  // namespace security::vxsig
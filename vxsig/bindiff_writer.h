@@ -0,0 +1,92 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A writer for the SQLite based .BinDiff result file format. Only the tables
+// and columns that BinDiff's UI and the vxsig readers use are written.
+
+#ifndef VXSIG_BINDIFF_WRITER_H_
+#define VXSIG_BINDIFF_WRITER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/types.h"
+
+namespace security::vxsig {
+
+// One of the two binaries of a BinDiff result, as stored in its file table.
+struct BinDiffFile {
+  FileMetaData metadata;
+  int64_t num_functions = 0;
+  int64_t num_basic_blocks = 0;
+  int64_t num_edges = 0;
+  int64_t num_instructions = 0;
+};
+
+// Writes matches in the same hierarchical order in which ParseBinDiff()
+// reports them: basic block matches belong to the last function match and
+// instruction matches to the last basic block match. Nothing is readable
+// before Finish() returns.
+class BinDiffWriter {
+ public:
+  BinDiffWriter(const BinDiffWriter&) = delete;
+  BinDiffWriter& operator=(const BinDiffWriter&) = delete;
+
+  ~BinDiffWriter();
+
+  // Creates the result file, replacing an existing one. The algorithm name is
+  // recorded as the match algorithm of all matches.
+  static absl::StatusOr<std::unique_ptr<BinDiffWriter>> Create(
+      const std::string& filename, absl::string_view algorithm_name);
+
+  absl::Status AddFunctionMatch(const MemoryAddressPair& match,
+                                double similarity = 1.0);
+  absl::Status AddBasicBlockMatch(const MemoryAddressPair& match);
+  absl::Status AddInstructionMatch(const MemoryAddressPair& match);
+
+  // Writes the file table and the metadata and commits the result.
+  absl::Status Finish(const BinDiffFile& primary, const BinDiffFile& secondary,
+                      const DiffSimilarity& similarity);
+
+ private:
+  class Database;
+
+  // The function table also stores the number of matched basic blocks and
+  // instructions, so function rows are written after their children.
+  struct PendingFunction {
+    int64_t id = 0;
+    MemoryAddressPair match;
+    double similarity = 0;
+    int64_t num_basic_blocks = 0;
+    int64_t num_instructions = 0;
+  };
+
+  explicit BinDiffWriter(std::unique_ptr<Database> db);
+
+  absl::Status FlushFunction();
+
+  std::unique_ptr<Database> db_;
+  PendingFunction function_;
+  int64_t basic_block_id_ = 0;
+  bool finished_ = false;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_BINDIFF_WRITER_H_
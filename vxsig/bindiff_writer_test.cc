@@ -0,0 +1,111 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/bindiff_writer.h"
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/diff_result_reader.h"
+
+using not_absl::IsOk;
+using testing::DoubleEq;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Pair;
+
+namespace security::vxsig {
+namespace {
+
+std::string TestFile() {
+  return JoinPath(
+      getenv("TEST_TMPDIR"),
+      testing::UnitTest::GetInstance()->current_test_info()->name());
+}
+
+BinDiffFile TestBinary(const std::string& name) {
+  BinDiffFile file;
+  file.metadata = {name, name + ".exe", "hash_of_" + name};
+  file.num_functions = 2;
+  return file;
+}
+
+TEST(BinDiffWriterTest, WritesMatchesInReaderOrder) {
+  const std::string filename = TestFile();
+  auto writer = BinDiffWriter::Create(filename, "test");
+  ASSERT_THAT(writer, IsOk());
+  ASSERT_THAT((*writer)->AddFunctionMatch({0x1000, 0x2000}), IsOk());
+  ASSERT_THAT((*writer)->AddBasicBlockMatch({0x1000, 0x2000}), IsOk());
+  ASSERT_THAT((*writer)->AddInstructionMatch({0x1000, 0x2000}), IsOk());
+  ASSERT_THAT((*writer)->AddInstructionMatch({0x1002, 0x2002}), IsOk());
+  ASSERT_THAT((*writer)->AddFunctionMatch({0x1100, 0x2100}, 0.5), IsOk());
+  ASSERT_THAT((*writer)->AddBasicBlockMatch({0x1110, 0x2110}), IsOk());
+  ASSERT_THAT((*writer)->AddInstructionMatch({0x1110, 0x2110}), IsOk());
+  DiffSimilarity similarity;
+  similarity.similarity = 0.75;
+  similarity.confidence = 0.5;
+  ASSERT_THAT((*writer)->Finish(TestBinary("primary"), TestBinary("secondary"),
+                                similarity),
+              IsOk());
+
+  std::vector<MemoryAddressPair> functions;
+  std::vector<MemoryAddressPair> basic_blocks;
+  std::vector<MemoryAddressPair> instructions;
+  std::pair<FileMetaData, FileMetaData> metadata;
+  ASSERT_THAT(
+      ParseBinDiff(
+          filename,
+          [&](const MemoryAddressPair& match) { functions.push_back(match); },
+          [&](const MemoryAddressPair& match) {
+            basic_blocks.push_back(match);
+          },
+          [&](const MemoryAddressPair& match) {
+            instructions.push_back(match);
+          },
+          &metadata),
+      IsOk());
+  EXPECT_THAT(functions, ElementsAre(Pair(0x1000, 0x2000),
+                                     Pair(0x1100, 0x2100)));
+  EXPECT_THAT(basic_blocks, ElementsAre(Pair(0x1000, 0x2000),
+                                        Pair(0x1110, 0x2110)));
+  EXPECT_THAT(instructions,
+              ElementsAre(Pair(0x1000, 0x2000), Pair(0x1002, 0x2002),
+                          Pair(0x1110, 0x2110)));
+  EXPECT_THAT(metadata.first.filename, Eq("primary"));
+  EXPECT_THAT(metadata.second.original_filename, Eq("secondary.exe"));
+  EXPECT_THAT(metadata.second.original_hash, Eq("hash_of_secondary"));
+
+  DiffSimilarity read_similarity;
+  ASSERT_THAT(ReadBinDiffMetaData(filename, &metadata, &read_similarity),
+              IsOk());
+  EXPECT_THAT(read_similarity.similarity, DoubleEq(0.75));
+  EXPECT_THAT(read_similarity.confidence, DoubleEq(0.5));
+}
+
+TEST(BinDiffWriterTest, RejectsMatchesOutsideOfHierarchy) {
+  auto writer = BinDiffWriter::Create(TestFile(), "test");
+  ASSERT_THAT(writer, IsOk());
+  EXPECT_THAT((*writer)->AddBasicBlockMatch({0x1000, 0x2000}).ok(), Eq(false));
+  EXPECT_THAT((*writer)->AddInstructionMatch({0x1000, 0x2000}).ok(),
+              Eq(false));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -130,12 +130,17 @@ void RenderExpression(const BinExport2& proto,
 absl::Status ParseBinExport(
     absl::string_view filename,
     const FunctionReceiverCallback& function_receiver,
-    const InstructionReceiverCallback& instruction_receiver) {
+    const InstructionReceiverCallback& instruction_receiver,
+    const StopCondition* stop,
+    const FlowGraphReceiverCallback& flow_graph_receiver) {
   std::ifstream file(std::string(filename), std::ios_base::binary);
   BinExport2 proto;
   if (!proto.ParseFromIstream(&file)) {
     return absl::InternalError(absl::StrCat("failed parsing ", filename));
   }
+  if (ShouldStop(stop)) {
+    return stop->status();
+  }
 
   // TODO(cblichmann): Read MD indices if we have them.
   std::map<MemoryAddress, double> md_index_map;
@@ -151,6 +156,24 @@ absl::Status ParseBinExport(
   }
 
   for (const auto& flow_graph : proto.flow_graph()) {
+    if (ShouldStop(stop)) {
+      return stop->status();
+    }
+    // Flow graphs without basic blocks have no instructions to report.
+    if (flow_graph_receiver && flow_graph.basic_block_index_size() > 0) {
+      const int entry_index = flow_graph.has_entry_basic_block_index()
+                                  ? flow_graph.entry_basic_block_index()
+                                  : flow_graph.basic_block_index(0);
+      if (entry_index < 0 || entry_index >= proto.basic_block_size() ||
+          proto.basic_block(entry_index).instruction_index_size() == 0) {
+        return absl::DataLossError(
+            absl::StrCat("Invalid entry basic block in ", filename));
+      }
+      flow_graph_receiver(GetInstructionAddress(
+          proto, proto.basic_block(entry_index)
+                     .instruction_index(0)
+                     .begin_index()));
+    }
     MemoryAddress computed_instruction_address = 0;
     int last_instruction_index = 0;
     for (const auto& basic_block_index : flow_graph.basic_block_index()) {
@@ -23,6 +23,7 @@
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
 #include "third_party/zynamics/binexport/binexport2.pb.h"
+#include "vxsig/cancellation.h"
 #include "vxsig/types.h"
 
 namespace security::vxsig {
@@ -50,12 +51,22 @@ using InstructionReceiverCallback = std::function<void(
     const std::string& raw_bytes, const std::string& disassembly,
     const Immediates& immediates)>;
 
+// Each time a flow graph starts, this callback gets called with the address of
+// its entry basic block. The instructions of the flow graph follow. Basic
+// blocks shared by several functions are reported once per flow graph.
+using FlowGraphReceiverCallback =
+    std::function<void(MemoryAddress entry_address)>;
+
 // Parses the specified .BinExport file and calls the specified callback
-// function for all encountered functions.
+// function for all encountered functions. If a stop condition is specified, it
+// is checked after decoding and between flow graphs. Returns its status if it
+// is met. The flow graph receiver is optional.
 absl::Status ParseBinExport(
     absl::string_view filename,
     const FunctionReceiverCallback& function_receiver,
-    const InstructionReceiverCallback& instruction_receiver);
+    const InstructionReceiverCallback& instruction_receiver,
+    const StopCondition* stop = nullptr,
+    const FlowGraphReceiverCallback& flow_graph_receiver = nullptr);
 
 }  // namespace security::vxsig
 
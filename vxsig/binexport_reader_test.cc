@@ -15,9 +15,11 @@
 #include "vxsig/binexport_reader.h"
 
 #include <cstddef>
+#include <cstdlib>
 #include <string>
 #include <utility>
 #include <map>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
@@ -25,8 +27,11 @@
 #include "gtest/gtest.h"
 #include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/corpus.h"
 
+using testing::ElementsAre;
 using testing::Eq;
+using testing::IsFalse;
 using testing::Ne;
 using not_absl::IsOk;
 
@@ -92,4 +97,45 @@ TEST_F(BinExportReaderTest, ParseBinExport2Complex) {
   EXPECT_THAT("\x83\x7D\xFC\x10", Eq(found->second));  // cmp ss:[ebp-4], 10h
 }
 
+TEST_F(BinExportReaderTest, ChecksFlowGraphEntries) {
+  BinExport2 proto;
+  proto.add_mnemonic()->set_name("nop");
+  auto* instruction = proto.add_instruction();
+  instruction->set_address(0x1000);
+  instruction->set_raw_bytes("\x90");
+  proto.mutable_call_graph()->add_vertex()->set_address(0x1000);
+  proto.add_basic_block()->add_instruction_index()->set_begin_index(0);
+  proto.add_flow_graph();  // No basic blocks
+  auto* flow_graph = proto.add_flow_graph();
+  flow_graph->add_basic_block_index(0);
+  flow_graph->set_entry_basic_block_index(0);
+
+  const std::string file_name =
+      JoinPath(getenv("TEST_TMPDIR"), "flow_graphs.BinExport");
+  ASSERT_THAT(
+      WriteFileContentsAtomically(file_name, proto.SerializeAsString()),
+      IsOk());
+  std::vector<MemoryAddress> entries;
+  auto parse = [&]() {
+    entries.clear();
+    return ParseBinExport(
+        file_name,
+        [](const std::string&, MemoryAddress,
+           BinExport2::CallGraph::Vertex::Type, double) {},
+        [](MemoryAddress, MemoryAddress, const std::string&,
+           const std::string&, const Immediates&) {},
+        /*stop=*/nullptr,
+        [&entries](MemoryAddress entry) { entries.push_back(entry); });
+  };
+  ASSERT_THAT(parse(), IsOk());
+  EXPECT_THAT(entries, ElementsAre(0x1000));
+
+  // An entry basic block outside of the file is an error.
+  flow_graph->set_entry_basic_block_index(1);
+  ASSERT_THAT(
+      WriteFileContentsAtomically(file_name, proto.SerializeAsString()),
+      IsOk());
+  EXPECT_THAT(parse().ok(), IsFalse());
+}
+
 }  // namespace security::vxsig
@@ -0,0 +1,98 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A blocking queue with a fixed capacity, used to connect the stages of a
+// pipeline. Producers block while the queue is full, which limits the amount
+// of work in flight between stages.
+
+#ifndef VXSIG_BOUNDED_QUEUE_H_
+#define VXSIG_BOUNDED_QUEUE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace security::vxsig {
+
+// This class is thread-safe.
+template <typename T>
+class BoundedQueue {
+ public:
+  // A capacity of less than one is treated as one.
+  explicit BoundedQueue(int capacity)
+      : capacity_(static_cast<size_t>(std::max(capacity, 1))) {}
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Blocks until there is room for the item. Returns false and drops the item
+  // if the queue has been closed.
+  bool Push(T item) {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &BoundedQueue::CanPush));
+    if (closed_) {
+      return false;
+    }
+    items_.push_back(std::move(item));
+    return true;
+  }
+
+  // Blocks until an item is available. Returns std::nullopt once the queue
+  // has been closed and all items have been taken.
+  std::optional<T> Pop() {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(this, &BoundedQueue::CanPop));
+    if (items_.empty()) {
+      return std::nullopt;
+    }
+    T item = std::move(items_.front());
+    items_.pop_front();
+    return item;
+  }
+
+  // Wakes up all waiting consumers once the remaining items are taken. Items
+  // pushed after this are dropped.
+  void Close() {
+    absl::MutexLock lock(&mutex_);
+    closed_ = true;
+  }
+
+  size_t size() const {
+    absl::MutexLock lock(&mutex_);
+    return items_.size();
+  }
+
+ private:
+  bool CanPush() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return closed_ || items_.size() < capacity_;
+  }
+
+  bool CanPop() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return closed_ || !items_.empty();
+  }
+
+  const size_t capacity_;
+  mutable absl::Mutex mutex_;
+  std::deque<T> items_ ABSL_GUARDED_BY(mutex_);
+  bool closed_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_BOUNDED_QUEUE_H_
@@ -0,0 +1,83 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/bounded_queue.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsFalse;
+using testing::IsTrue;
+using testing::Optional;
+
+namespace security::vxsig {
+namespace {
+
+TEST(BoundedQueueTest, KeepsOrderAndDrainsAfterClose) {
+  BoundedQueue<std::unique_ptr<int>> queue(3);
+  EXPECT_THAT(queue.Push(absl::make_unique<int>(1)), IsTrue());
+  EXPECT_THAT(queue.Push(absl::make_unique<int>(2)), IsTrue());
+  queue.Close();
+  EXPECT_THAT(queue.Push(absl::make_unique<int>(3)), IsFalse());
+
+  std::vector<int> popped;
+  while (auto item = queue.Pop()) {
+    popped.push_back(**item);
+  }
+  EXPECT_THAT(popped, ElementsAre(1, 2));
+}
+
+TEST(BoundedQueueTest, BlocksProducerWhenFull) {
+  // Capacities of less than one are treated as one.
+  for (int capacity : {1, 0, -1}) {
+    BoundedQueue<int> queue(capacity);
+    std::atomic<int> pushed(0);
+    std::thread producer([&]() {
+      for (int i = 0; i < 3; ++i) {
+        queue.Push(i);
+        ++pushed;
+      }
+    });
+    absl::SleepFor(absl::Milliseconds(50));
+    EXPECT_THAT(pushed.load(), Eq(1));
+    EXPECT_THAT(queue.size(), Eq(1));
+
+    EXPECT_THAT(queue.Pop(), Optional(0));
+    EXPECT_THAT(queue.Pop(), Optional(1));
+    EXPECT_THAT(queue.Pop(), Optional(2));
+    producer.join();
+    EXPECT_THAT(pushed.load(), Eq(3));
+  }
+}
+
+TEST(BoundedQueueTest, CloseWakesConsumers) {
+  BoundedQueue<int> queue(1);
+  std::thread consumer([&]() { EXPECT_THAT(queue.Pop(), Eq(std::nullopt)); });
+  absl::SleepFor(absl::Milliseconds(10));
+  queue.Close();
+  consumer.join();
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,354 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/c_api.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/executor.h"
+#include "vxsig/input_cache.h"
+#include "vxsig/siggen.h"
+#include "vxsig/signature_cache.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/spool.h"
+#include "vxsig/trim_plan.h"
+#include "vxsig/vxsig.pb.h"
+
+using security::vxsig::AvSignatureGenerator;
+using security::vxsig::BatchManifest;
+using security::vxsig::DaemonRequest;
+using security::vxsig::Executor;
+using security::vxsig::InputCache;
+using security::vxsig::MakeExecutor;
+using security::vxsig::RawSignatureCache;
+using security::vxsig::RawSignatureCacheOptions;
+using security::vxsig::Signature;
+using security::vxsig::SignatureDefinition;
+using security::vxsig::SignatureFormatter;
+using security::vxsig::SignatureType;
+using security::vxsig::Spool;
+using security::vxsig::SpoolOptions;
+using security::vxsig::TrimPlan;
+
+namespace {
+
+// A spool in a new directory below $TMPDIR that only this process can access.
+// File buffers are removed as soon as their job ends, the directory is
+// removed on destruction.
+class PrivateSpool {
+ public:
+  static absl::StatusOr<std::unique_ptr<PrivateSpool>> Create() {
+    const char* temp_directory = getenv("TMPDIR");
+    std::string directory =
+        JoinPath(temp_directory && *temp_directory ? temp_directory : "/tmp",
+                 "vxsig_c_api.XXXXXX");
+    if (mkdtemp(&directory[0]) == nullptr) {
+      return absl::UnavailableError(
+          absl::StrCat("mkdtemp() failed: ", strerror(errno)));
+    }
+    auto result = absl::WrapUnique(new PrivateSpool(directory));
+    SpoolOptions options;
+    options.directory = std::move(directory);
+    options.max_unused_bytes = 0;
+    NA_ASSIGN_OR_RETURN(result->spool_, Spool::Open(options));
+    return result;
+  }
+
+  ~PrivateSpool() {
+    spool_.reset();
+    RemoveAll(directory_).IgnoreError();
+  }
+
+  Spool* spool() { return spool_.get(); }
+
+ private:
+  explicit PrivateSpool(std::string directory)
+      : directory_(std::move(directory)) {}
+
+  const std::string directory_;
+  std::unique_ptr<Spool> spool_;
+};
+
+// Message of the last vxsig_context_create() call on this thread.
+thread_local std::string context_error;
+
+// Stores the message of the status and returns its code.
+int SetContextStatus(const absl::Status& status) {
+  context_error = std::string(status.message());
+  return static_cast<int>(status.code());
+}
+
+}  // namespace
+
+static_assert(VXSIG_UNAUTHENTICATED ==
+                  static_cast<int>(absl::StatusCode::kUnauthenticated),
+              "Status codes must match absl::StatusCode");
+
+struct vxsig_context {
+  std::shared_ptr<InputCache> input_cache = std::make_shared<InputCache>();
+  // All jobs of the context run on the same threads.
+  std::shared_ptr<Executor> executor = MakeExecutor(/*num_threads=*/0);
+  std::shared_ptr<RawSignatureCache> signature_cache;
+
+  // Spool for file buffers, created on first use.
+  absl::StatusOr<Spool*> GetSpool() {
+    absl::MutexLock lock(&spool_mutex);
+    if (!spool) {
+      NA_ASSIGN_OR_RETURN(spool, PrivateSpool::Create());
+    }
+    return spool->spool();
+  }
+
+  absl::Mutex spool_mutex;
+  std::unique_ptr<PrivateSpool> spool ABSL_GUARDED_BY(spool_mutex);
+};
+
+struct vxsig_generator {
+  vxsig_context* context = nullptr;
+  SignatureDefinition definition;
+  int num_threads = 0;
+  bool order_diffs = false;
+
+  // Inputs of the next job. Either diff files or file buffers, which are
+  // spooled to disk when the job starts.
+  std::vector<std::string> diffs;
+  DaemonRequest buffers;
+
+  Signature signature;
+  bool has_signature = false;
+  std::string formatted;
+
+  // Built from the raw signature on first format, shared by all formats.
+  std::unique_ptr<TrimPlan> trim_plan;
+  std::string error;
+
+  // Stores the message of the status and returns its code.
+  int SetStatus(const absl::Status& status) {
+    error = std::string(status.message());
+    return static_cast<int>(status.code());
+  }
+
+  absl::Status Generate(int64_t deadline_ms) {
+    std::vector<std::string> files = std::move(diffs);
+    DaemonRequest request = std::move(buffers);
+    diffs.clear();
+    buffers.Clear();
+    trim_plan.reset();
+    signature.Clear();
+    has_signature = false;
+
+    // The spooled files are removed when the job ends.
+    std::unique_ptr<PrivateSpool> own_spool;
+    std::unique_ptr<Spool::Files> spooled;
+    if (!request.inline_file().empty()) {
+      Spool* spool;
+      if (context) {
+        NA_ASSIGN_OR_RETURN(spool, context->GetSpool());
+      } else {
+        NA_ASSIGN_OR_RETURN(own_spool, PrivateSpool::Create());
+        spool = own_spool->spool();
+      }
+      NA_ASSIGN_OR_RETURN(spooled, spool->Add(request));
+      files.assign(spooled->job().diff().begin(),
+                   spooled->job().diff().end());
+    }
+    if (files.empty()) {
+      return absl::FailedPreconditionError("No diffs added");
+    }
+
+    AvSignatureGenerator siggen;
+    siggen.set_verbose(false)
+        .set_num_threads(num_threads)
+        .set_order_diffs(order_diffs);
+    if (context) {
+      siggen.set_executor(context->executor)
+          .set_input_cache(context->input_cache);
+      if (context->signature_cache) {
+        siggen.set_signature_cache(context->signature_cache);
+      }
+    }
+    siggen.AddDiffResults(files);
+    *signature.mutable_definition() = definition;
+    NA_RETURN_IF_ERROR(
+        siggen.Generate(&signature, deadline_ms > 0
+                                        ? absl::Now() +
+                                              absl::Milliseconds(deadline_ms)
+                                        : absl::InfiniteFuture()));
+    has_signature = true;
+    return absl::OkStatus();
+  }
+};
+
+extern "C" {
+
+int vxsig_api_version(void) { return VXSIG_API_VERSION; }
+
+int vxsig_context_create(const char* signature_cache_directory,
+                         vxsig_context** context) {
+  if (!context) {
+    return SetContextStatus(absl::InvalidArgumentError("No context given"));
+  }
+  auto new_context = absl::make_unique<vxsig_context>();
+  if (signature_cache_directory) {
+    RawSignatureCacheOptions options;
+    options.directory = signature_cache_directory;
+    auto cache = RawSignatureCache::Open(options);
+    if (!cache.ok()) {
+      return SetContextStatus(cache.status());
+    }
+    new_context->signature_cache = std::move(*cache);
+  }
+  *context = new_context.release();
+  return SetContextStatus(absl::OkStatus());
+}
+
+const char* vxsig_context_error(void) { return context_error.c_str(); }
+
+void vxsig_context_destroy(vxsig_context* context) { delete context; }
+
+vxsig_generator* vxsig_generator_create(vxsig_context* context) {
+  auto* generator = new vxsig_generator();
+  generator->context = context;
+  return generator;
+}
+
+void vxsig_generator_destroy(vxsig_generator* generator) { delete generator; }
+
+int vxsig_generator_set_definition(vxsig_generator* generator,
+                                   const void* data, size_t size) {
+  SignatureDefinition definition;
+  if (!definition.ParseFromArray(data, size)) {
+    return generator->SetStatus(
+        absl::InvalidArgumentError("Failed to parse signature definition"));
+  }
+  generator->definition = std::move(definition);
+  return generator->SetStatus(absl::OkStatus());
+}
+
+void vxsig_generator_set_num_threads(vxsig_generator* generator,
+                                     int num_threads) {
+  generator->num_threads = num_threads;
+}
+
+void vxsig_generator_set_order_diffs(vxsig_generator* generator, int value) {
+  generator->order_diffs = value != 0;
+}
+
+int vxsig_generator_add_diff_file(vxsig_generator* generator,
+                                  const char* path) {
+  if (!path || !*path) {
+    return generator->SetStatus(absl::InvalidArgumentError("Empty path"));
+  }
+  if (!generator->buffers.inline_file().empty()) {
+    return generator->SetStatus(absl::FailedPreconditionError(
+        "Cannot mix diff files and file buffers"));
+  }
+  generator->diffs.emplace_back(path);
+  return generator->SetStatus(absl::OkStatus());
+}
+
+int vxsig_generator_add_file_buffer(vxsig_generator* generator,
+                                    const char* name, const void* data,
+                                    size_t size) {
+  if (!name || !*name || (!data && size > 0)) {
+    return generator->SetStatus(
+        absl::InvalidArgumentError("Missing name or data"));
+  }
+  if (!generator->diffs.empty()) {
+    return generator->SetStatus(absl::FailedPreconditionError(
+        "Cannot mix diff files and file buffers"));
+  }
+  auto* file = generator->buffers.add_inline_file();
+  file->set_name(name);
+  file->set_data(static_cast<const char*>(data), size);
+  if (absl::EndsWith(name, ".BinDiff")) {
+    generator->buffers.mutable_job()->add_diff(name);
+  }
+  return generator->SetStatus(absl::OkStatus());
+}
+
+void vxsig_generator_clear_inputs(vxsig_generator* generator) {
+  generator->diffs.clear();
+  generator->buffers.Clear();
+}
+
+int vxsig_generator_generate(vxsig_generator* generator, int64_t deadline_ms) {
+  return generator->SetStatus(generator->Generate(deadline_ms));
+}
+
+int vxsig_generator_get_signature(vxsig_generator* generator,
+                                  const void** data, size_t* size) {
+  if (!generator->has_signature) {
+    return generator->SetStatus(
+        absl::FailedPreconditionError("No signature generated"));
+  }
+  generator->signature.SerializeToString(&generator->formatted);
+  *data = generator->formatted.data();
+  *size = generator->formatted.size();
+  return generator->SetStatus(absl::OkStatus());
+}
+
+int vxsig_generator_format(vxsig_generator* generator, int format,
+                           const char** text, size_t* size) {
+  if (!generator->has_signature) {
+    return generator->SetStatus(
+        absl::FailedPreconditionError("No signature generated"));
+  }
+  std::unique_ptr<SignatureFormatter> formatter;
+  if (format == VXSIG_FORMAT_CLAMAV || format == VXSIG_FORMAT_YARA) {
+    formatter = SignatureFormatter::Create(static_cast<SignatureType>(format));
+  }
+  if (!formatter) {
+    return generator->SetStatus(absl::InvalidArgumentError(
+        absl::StrCat("Unsupported signature format: ", format)));
+  }
+  Signature& signature = generator->signature;
+  if (!generator->trim_plan) {
+    generator->trim_plan =
+        absl::make_unique<TrimPlan>(signature.raw_signature());
+  }
+  if (absl::Status status =
+          formatter->Format(&signature, generator->trim_plan.get());
+      !status.ok()) {
+    return generator->SetStatus(status);
+  }
+  generator->formatted = format == VXSIG_FORMAT_CLAMAV
+                             ? signature.clam_av_signature().data()
+                             : signature.yara_signature().data();
+  *text = generator->formatted.c_str();
+  *size = generator->formatted.size();
+  return generator->SetStatus(absl::OkStatus());
+}
+
+const char* vxsig_generator_error(const vxsig_generator* generator) {
+  return generator->error.c_str();
+}
+
+}  // extern "C"
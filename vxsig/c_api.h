@@ -0,0 +1,168 @@
+/*
+ * Copyright 2011-2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A C API for embedding signature generation, e.g. from Python or Go, without
+ * running the vxsig binary for every job. Signatures are exchanged as
+ * serialized Signature and SignatureDefinition messages (see vxsig.proto) or
+ * as formatted text.
+ *
+ * A context holds the caches shared between generators. It is thread-safe
+ * and should live as long as the embedding process. A generator runs one job
+ * at a time and can be reused for any number of jobs, but must not be used
+ * from several threads at once.
+ *
+ * Functions that can fail return VXSIG_OK or an absl::StatusCode. The message
+ * of the last error of a generator is available from vxsig_generator_error().
+ * Use like this:
+ *   vxsig_context* context;
+ *   vxsig_context_create(NULL, &context);
+ *   vxsig_generator* generator = vxsig_generator_create(context);
+ *   vxsig_generator_add_diff_file(generator, "a_vs_b.BinDiff");
+ *   if (vxsig_generator_generate(generator, 0) == VXSIG_OK) {
+ *     const char* yara;
+ *     size_t yara_size;
+ *     vxsig_generator_format(generator, VXSIG_FORMAT_YARA, &yara, &yara_size);
+ *   }
+ *   vxsig_generator_destroy(generator);
+ *   vxsig_context_destroy(context);
+ */
+
+#ifndef VXSIG_C_API_H_
+#define VXSIG_C_API_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremented whenever functions are added. Existing functions keep their
+ * signature and behavior. */
+#define VXSIG_API_VERSION 1
+
+/* Status codes, same values as absl::StatusCode. */
+#define VXSIG_OK 0
+#define VXSIG_CANCELLED 1
+#define VXSIG_UNKNOWN 2
+#define VXSIG_INVALID_ARGUMENT 3
+#define VXSIG_DEADLINE_EXCEEDED 4
+#define VXSIG_NOT_FOUND 5
+#define VXSIG_ALREADY_EXISTS 6
+#define VXSIG_PERMISSION_DENIED 7
+#define VXSIG_RESOURCE_EXHAUSTED 8
+#define VXSIG_FAILED_PRECONDITION 9
+#define VXSIG_ABORTED 10
+#define VXSIG_OUT_OF_RANGE 11
+#define VXSIG_UNIMPLEMENTED 12
+#define VXSIG_INTERNAL 13
+#define VXSIG_UNAVAILABLE 14
+#define VXSIG_DATA_LOSS 15
+#define VXSIG_UNAUTHENTICATED 16
+
+/* Output formats, same values as SignatureType. */
+#define VXSIG_FORMAT_CLAMAV 1
+#define VXSIG_FORMAT_YARA 2
+
+typedef struct vxsig_context vxsig_context;
+typedef struct vxsig_generator vxsig_generator;
+
+/* Returns VXSIG_API_VERSION of the library. */
+int vxsig_api_version(void);
+
+/* Creates a context with an input cache and a pool of threads. If
+ * signature_cache_directory is non-NULL, raw signatures are also cached in
+ * that directory across processes. On success, stores the new context in
+ * *context. On failure, the message is available from vxsig_context_error().
+ */
+int vxsig_context_create(const char* signature_cache_directory,
+                         vxsig_context** context);
+
+/* Returns the message of the last failed call to vxsig_context_create() on
+ * the calling thread, or an empty string if the last call succeeded. Valid
+ * until the next call to vxsig_context_create() on the same thread. */
+const char* vxsig_context_error(void);
+
+/* Destroys a context. All generators created with it must have been destroyed
+ * before. */
+void vxsig_context_destroy(vxsig_context* context);
+
+/* Creates a generator that uses the caches of the context, which may be NULL
+ * for a generator without caches. */
+vxsig_generator* vxsig_generator_create(vxsig_context* context);
+
+void vxsig_generator_destroy(vxsig_generator* generator);
+
+/* Sets the signature definition (a serialized SignatureDefinition) for the
+ * following jobs. Defaults to an empty definition. */
+int vxsig_generator_set_definition(vxsig_generator* generator,
+                                   const void* data, size_t size);
+
+/* Number of threads per job, 0 to use all available cores (the default).
+ * Only used by generators without a context. The jobs of a context share
+ * one pool of threads, one for each available core. */
+void vxsig_generator_set_num_threads(vxsig_generator* generator,
+                                     int num_threads);
+
+/* Whether to accept diffs in any order and direction, see --order_diffs. */
+void vxsig_generator_set_order_diffs(vxsig_generator* generator, int value);
+
+/* Adds a BinDiff file to the chain of diffs of the next job. The BinExport
+ * files are expected next to it. */
+int vxsig_generator_add_diff_file(vxsig_generator* generator,
+                                  const char* path);
+
+/* Adds a file from memory to the next job. The name is the base name of the
+ * file, like "a_vs_b.BinDiff" or "a.BinExport". Files whose name ends in
+ * ".BinDiff" are added to the chain of diffs, in the order they were added.
+ * The data is copied. While the job runs, it is stored in a private directory
+ * below $TMPDIR (or /tmp), which is removed with the context. Cannot be mixed
+ * with vxsig_generator_add_diff_file() in the same job. */
+int vxsig_generator_add_file_buffer(vxsig_generator* generator,
+                                    const char* name, const void* data,
+                                    size_t size);
+
+/* Removes the inputs added so far. Inputs are also removed by each call to
+ * vxsig_generator_generate(). */
+void vxsig_generator_clear_inputs(vxsig_generator* generator);
+
+/* Generates the signature for the inputs added since the last job. Stops with
+ * VXSIG_DEADLINE_EXCEEDED after deadline_ms milliseconds, if non-zero. */
+int vxsig_generator_generate(vxsig_generator* generator, int64_t deadline_ms);
+
+/* Returns the last generated signature as a serialized Signature. The data is
+ * owned by the generator and valid until the next call to
+ * vxsig_generator_generate(), vxsig_generator_format() or
+ * vxsig_generator_destroy(). */
+int vxsig_generator_get_signature(vxsig_generator* generator,
+                                  const void** data, size_t* size);
+
+/* Formats the last generated signature in one of the VXSIG_FORMAT_* formats.
+ * The text is owned by the generator, like for
+ * vxsig_generator_get_signature(). It is NUL-terminated for convenience. */
+int vxsig_generator_format(vxsig_generator* generator, int format,
+                           const char** text, size_t* size);
+
+/* Returns the message of the last error, or an empty string. Owned by the
+ * generator and valid until the next call to any of its functions. */
+const char* vxsig_generator_error(const vxsig_generator* generator);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* VXSIG_C_API_H_ */
@@ -0,0 +1,198 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/c_api.h"
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/corpus.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::HasSubstr;
+using testing::IsEmpty;
+using testing::IsNull;
+using testing::IsTrue;
+using testing::Ne;
+using testing::Not;
+using testing::StartsWith;
+using testing::StrEq;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kPrimary[] =
+    "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa";
+constexpr char kSecondary[] =
+    "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82";
+
+std::string DiffName() {
+  return absl::StrCat(kPrimary, "_vs_", kSecondary, ".BinDiff");
+}
+
+class CApiTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // File buffers are spooled below $TMPDIR.
+    auto temp_directory = CreateTestTempDirectory();
+    ASSERT_THAT(temp_directory, IsOk());
+    temp_directory_ = *std::move(temp_directory);
+    setenv("TMPDIR", temp_directory_.c_str(), /*overwrite=*/1);
+
+    ASSERT_THAT(vxsig_context_create(nullptr, &context_), Eq(VXSIG_OK));
+    generator_ = vxsig_generator_create(context_);
+
+    SignatureDefinition definition;
+    definition.set_detection_name("c_api_test");
+    const std::string data = definition.SerializeAsString();
+    ASSERT_THAT(
+        vxsig_generator_set_definition(generator_, data.data(), data.size()),
+        Eq(VXSIG_OK));
+    vxsig_generator_set_num_threads(generator_, 1);
+  }
+
+  void TearDown() override {
+    vxsig_generator_destroy(generator_);
+    vxsig_context_destroy(context_);
+  }
+
+  Signature GetSignature() {
+    const void* data;
+    size_t size;
+    Signature signature;
+    EXPECT_THAT(vxsig_generator_get_signature(generator_, &data, &size),
+                Eq(VXSIG_OK));
+    EXPECT_THAT(signature.ParseFromArray(data, size), IsTrue());
+    return signature;
+  }
+
+  // Returns the files and directories in the temporary directory.
+  std::vector<std::string> GetTempFiles(absl::string_view directory = "") {
+    std::vector<std::string> files;
+    EXPECT_THAT(GetDirectoryEntries(JoinPath(temp_directory_, directory),
+                                    &files),
+                IsOk());
+    return files;
+  }
+
+  std::string temp_directory_;
+  vxsig_context* context_ = nullptr;
+  vxsig_generator* generator_ = nullptr;
+};
+
+TEST_F(CApiTest, ReportsVersion) {
+  EXPECT_THAT(vxsig_api_version(), Eq(VXSIG_API_VERSION));
+}
+
+TEST_F(CApiTest, GeneratesFromFilesAndBuffers) {
+  ASSERT_THAT(vxsig_generator_add_diff_file(generator_,
+                                            TestDataPath(DiffName()).c_str()),
+              Eq(VXSIG_OK));
+  ASSERT_THAT(vxsig_generator_generate(generator_, 0), Eq(VXSIG_OK))
+      << vxsig_generator_error(generator_);
+  const Signature from_files = GetSignature();
+  EXPECT_THAT(from_files.raw_signature().piece(), Not(IsEmpty()));
+
+  // Reuse the generator with the same inputs from memory.
+  for (const std::string& name :
+       {DiffName(), absl::StrCat(kPrimary, ".BinExport"),
+        absl::StrCat(kSecondary, ".BinExport")}) {
+    auto data = ReadFileContents(TestDataPath(name));
+    ASSERT_THAT(data, IsOk());
+    ASSERT_THAT(vxsig_generator_add_file_buffer(generator_, name.c_str(),
+                                                data->data(), data->size()),
+                Eq(VXSIG_OK));
+  }
+  ASSERT_THAT(vxsig_generator_generate(generator_, 0), Eq(VXSIG_OK))
+      << vxsig_generator_error(generator_);
+  const Signature from_buffers = GetSignature();
+  EXPECT_THAT(EquivRawSignature(from_buffers.raw_signature(),
+                                from_files.raw_signature()),
+              IsTrue());
+
+  // The buffers are removed after the job, their directory with the context.
+  const std::vector<std::string> spool = GetTempFiles();
+  ASSERT_THAT(spool.size(), Eq(1));
+  EXPECT_THAT(spool[0], StartsWith("vxsig_c_api."));
+  EXPECT_THAT(GetTempFiles(spool[0]), IsEmpty());
+
+  const char* text;
+  size_t size;
+  ASSERT_THAT(
+      vxsig_generator_format(generator_, VXSIG_FORMAT_YARA, &text, &size),
+      Eq(VXSIG_OK));
+  EXPECT_THAT(std::string(text, size), HasSubstr("rule c_api_test"));
+
+  vxsig_generator_destroy(generator_);
+  generator_ = nullptr;
+  vxsig_context_destroy(context_);
+  context_ = nullptr;
+  EXPECT_THAT(GetTempFiles(), IsEmpty());
+}
+
+TEST_F(CApiTest, ReportsContextErrors) {
+  // The signature cache directory cannot be created below a file.
+  const std::string file = JoinPath(temp_directory_, "file");
+  ASSERT_THAT(WriteFileContentsAtomically(file, "data"), IsOk());
+  vxsig_context* context = nullptr;
+  const int status =
+      vxsig_context_create(JoinPath(file, "cache").c_str(), &context);
+  EXPECT_THAT(status, Ne(VXSIG_OK));
+  EXPECT_THAT(context, IsNull());
+  EXPECT_THAT(vxsig_context_error(), Not(StrEq("")));
+
+  EXPECT_THAT(vxsig_context_create(nullptr, nullptr),
+              Eq(VXSIG_INVALID_ARGUMENT));
+  ASSERT_THAT(vxsig_context_create(nullptr, &context), Eq(VXSIG_OK));
+  EXPECT_THAT(vxsig_context_error(), StrEq(""));
+  vxsig_context_destroy(context);
+}
+
+TEST_F(CApiTest, ReportsErrors) {
+  EXPECT_THAT(vxsig_generator_generate(generator_, 0),
+              Eq(VXSIG_FAILED_PRECONDITION));
+  EXPECT_THAT(vxsig_generator_error(generator_), HasSubstr("No diffs"));
+
+  const void* data;
+  size_t size;
+  EXPECT_THAT(vxsig_generator_get_signature(generator_, &data, &size),
+              Eq(VXSIG_FAILED_PRECONDITION));
+
+  ASSERT_THAT(vxsig_generator_add_diff_file(generator_, "a_vs_b.BinDiff"),
+              Eq(VXSIG_OK));
+  EXPECT_THAT(vxsig_generator_add_file_buffer(generator_, "b.BinExport", "",
+                                              0),
+              Eq(VXSIG_FAILED_PRECONDITION));
+  vxsig_generator_clear_inputs(generator_);
+  EXPECT_THAT(vxsig_generator_add_file_buffer(generator_, "../b.BinDiff", "",
+                                              0),
+              Eq(VXSIG_OK));
+  EXPECT_THAT(vxsig_generator_generate(generator_, 0),
+              Eq(VXSIG_INVALID_ARGUMENT));
+}
+
+}  // namespace
+}  // namespace security::vxsig
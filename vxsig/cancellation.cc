@@ -0,0 +1,30 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/cancellation.h"
+
+namespace security::vxsig {
+
+absl::Status StopCondition::status() const {
+  if (token_ != nullptr && token_->cancelled()) {
+    return absl::CancelledError("Signature generation was cancelled");
+  }
+  if (deadline_ != absl::InfiniteFuture() && absl::Now() >= deadline_) {
+    return absl::DeadlineExceededError(
+        "Signature generation exceeded its deadline");
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace security::vxsig
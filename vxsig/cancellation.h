@@ -0,0 +1,92 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Cooperative cancellation for long-running computations. Loops that may run
+// for a long time poll a StopCondition and return early once it is met. The
+// caller then reports the reason with StopCondition::status(), which is
+// either a deadline being exceeded or an explicit cancellation.
+// Use like this:
+//   CancellationToken token;  // Call token.Cancel() from another thread
+//   StopCondition stop(absl::Now() + absl::Seconds(10), &token);
+//   for (...) {
+//     if (ShouldStop(&stop)) {
+//       return stop.status();
+//     }
+//     ...
+//   }
+
+#ifndef VXSIG_CANCELLATION_H_
+#define VXSIG_CANCELLATION_H_
+
+#include <atomic>
+
+#include "absl/status/status.h"
+#include "absl/time/time.h"
+
+namespace security::vxsig {
+
+// Number of loop iterations between checks in loops with cheap iterations,
+// so that polling the clock does not show up in profiles.
+inline constexpr int kStopCheckInterval = 4096;
+
+// This class is thread-safe.
+class CancellationToken {
+ public:
+  CancellationToken() = default;
+
+  CancellationToken(const CancellationToken&) = delete;
+  CancellationToken& operator=(const CancellationToken&) = delete;
+
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<bool> cancelled_ = false;
+};
+
+// A deadline combined with an optional cancellation token. The default
+// instance never stops. Does not take ownership of the token, which needs to
+// outlive this object. This class is thread-safe.
+class StopCondition {
+ public:
+  StopCondition() = default;
+  explicit StopCondition(absl::Time deadline,
+                         const CancellationToken* token = nullptr)
+      : deadline_(deadline), token_(token) {}
+
+  // Returns true if the token was cancelled or the deadline has passed.
+  bool ShouldStop() const {
+    return (token_ != nullptr && token_->cancelled()) ||
+           (deadline_ != absl::InfiniteFuture() && absl::Now() >= deadline_);
+  }
+
+  // Returns CANCELLED or DEADLINE_EXCEEDED if the computation should stop and
+  // OK otherwise.
+  absl::Status status() const;
+
+  absl::Time deadline() const { return deadline_; }
+
+ private:
+  absl::Time deadline_ = absl::InfiniteFuture();
+  const CancellationToken* token_ = nullptr;
+};
+
+// Convenience function for code that takes an optional stop condition.
+inline bool ShouldStop(const StopCondition* stop) {
+  return stop != nullptr && stop->ShouldStop();
+}
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_CANCELLATION_H_
@@ -0,0 +1,61 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/cancellation.h"
+
+#include "absl/status/status.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::IsFalse;
+using testing::IsTrue;
+
+namespace security::vxsig {
+namespace {
+
+TEST(CancellationTest, DefaultNeverStops) {
+  const StopCondition stop;
+  EXPECT_THAT(stop.ShouldStop(), IsFalse());
+  EXPECT_THAT(stop.status().ok(), IsTrue());
+  EXPECT_THAT(ShouldStop(nullptr), IsFalse());
+}
+
+TEST(CancellationTest, Deadline) {
+  const StopCondition future(absl::Now() + absl::Hours(1));
+  EXPECT_THAT(ShouldStop(&future), IsFalse());
+  EXPECT_THAT(future.status().ok(), IsTrue());
+
+  const StopCondition past(absl::Now() - absl::Seconds(1));
+  EXPECT_THAT(ShouldStop(&past), IsTrue());
+  EXPECT_THAT(absl::IsDeadlineExceeded(past.status()), IsTrue());
+}
+
+TEST(CancellationTest, Token) {
+  CancellationToken token;
+  const StopCondition stop(absl::InfiniteFuture(), &token);
+  EXPECT_THAT(stop.ShouldStop(), IsFalse());
+  token.Cancel();
+  EXPECT_THAT(token.cancelled(), IsTrue());
+  EXPECT_THAT(stop.ShouldStop(), IsTrue());
+  EXPECT_THAT(absl::IsCancelled(stop.status()), IsTrue());
+
+  // Cancellation takes precedence over the deadline.
+  const StopCondition both(absl::InfinitePast(), &token);
+  EXPECT_THAT(absl::IsCancelled(both.status()), IsTrue());
+}
+
+}  // namespace
+}  // namespace security::vxsig
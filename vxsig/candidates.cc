@@ -50,7 +50,9 @@ bool IsCandidateBasicBlock(const MatchedBasicBlock& bb) {
 }  // namespace
 
 void ComputeFunctionCandidates(const MatchChainTable& match_chain_table,
-                               IdentSequence* func_candidate_ids) {
+                               IdentSequence* func_candidate_ids,
+                               Executor* executor,
+                               const LcsOptions& lcs_options) {
   std::vector<IdentSequence> func_ids;
   func_ids.reserve(match_chain_table.size());
 
@@ -67,12 +69,15 @@ void ComputeFunctionCandidates(const MatchChainTable& match_chain_table,
   }
 
   // Solve k-LCS on resulting permutations to obtain a stable function order.
-  CommonSubsequence(func_ids, back_inserter(*func_candidate_ids));
+  CommonSubsequence(func_ids, back_inserter(*func_candidate_ids), executor,
+                    lcs_options);
 }
 
 void ComputeBasicBlockCandidates(const MatchChainTable& match_chain_table,
                                  const IdentSequence& func_candidate_ids,
-                                 IdentSequence* bb_candidate_ids) {
+                                 IdentSequence* bb_candidate_ids,
+                                 Executor* executor,
+                                 const LcsOptions& lcs_options) {
   using MatchedBasicBlockWord = std::vector<MatchedBasicBlock*>;
   std::vector<IdentSequence> bb_ids;
   bb_ids.reserve(match_chain_table.size());
@@ -105,7 +110,8 @@ void ComputeBasicBlockCandidates(const MatchChainTable& match_chain_table,
   }
 
   // Solve k-LCS on resulting permutations to obtain a stable basic block order.
-  CommonSubsequence(bb_ids, back_inserter(*bb_candidate_ids));
+  CommonSubsequence(bb_ids, back_inserter(*bb_candidate_ids), executor,
+                    lcs_options);
 }
 
 void FilterBasicBlockOverlaps(const MatchChainTable& match_chain_table,
@@ -18,20 +18,27 @@
 #ifndef VXSIG_CANDIDATES_H_
 #define VXSIG_CANDIDATES_H_
 
+#include "vxsig/executor.h"
+#include "vxsig/longest_common_subsequence.h"
 #include "vxsig/match_chain_table.h"
 #include "vxsig/types.h"
 
 namespace security::vxsig {
 
 // Computes function candidates filtered by the specified predicate callback.
+// The optional executor and LCS options are passed on to CommonSubsequence().
 void ComputeFunctionCandidates(const MatchChainTable& match_chain_table,
-                               IdentSequence* func_candidate_ids);
+                               IdentSequence* func_candidate_ids,
+                               Executor* executor = nullptr,
+                               const LcsOptions& lcs_options = LcsOptions());
 
 // Computes basic block candidates for the basic blocks of the given candidate
 // functions.
 void ComputeBasicBlockCandidates(const MatchChainTable& match_chain_table,
                                  const IdentSequence& func_candidate_ids,
-                                 IdentSequence* bb_candidate_ids);
+                                 IdentSequence* bb_candidate_ids,
+                                 Executor* executor = nullptr,
+                                 const LcsOptions& lcs_options = LcsOptions());
 
 // Filters overlapping basic blocks from a list of basicblock candidates.
 // Overlapping basic blocks mean basicblocks that share common instructions.
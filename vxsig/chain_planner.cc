@@ -0,0 +1,251 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/chain_planner.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/diff_result_reader.h"
+
+namespace security::vxsig {
+namespace {
+
+constexpr double kNoEdge = -std::numeric_limits<double>::infinity();
+
+absl::Status NotAChainError() {
+  return absl::FailedPreconditionError(
+      "Diffs do not connect all binaries into a chain");
+}
+
+// Held-Karp dynamic programming over subsets of binaries.
+absl::StatusOr<std::vector<int>> ExactMaxSimilarityPath(
+    int num_binaries, const std::vector<std::vector<double>>& weights) {
+  const uint32_t num_subsets = uint32_t{1} << num_binaries;
+  // Best weight of a path visiting the binaries in the subset and ending in
+  // the specified binary, and the binary before that.
+  std::vector<double> best(num_subsets * num_binaries, kNoEdge);
+  std::vector<int> previous(num_subsets * num_binaries, -1);
+  for (int i = 0; i < num_binaries; ++i) {
+    best[(uint32_t{1} << i) * num_binaries + i] = 0;
+  }
+  for (uint32_t subset = 1; subset < num_subsets; ++subset) {
+    for (int last = 0; last < num_binaries; ++last) {
+      const double weight = best[subset * num_binaries + last];
+      if (weight == kNoEdge) {
+        continue;
+      }
+      for (int next = 0; next < num_binaries; ++next) {
+        const uint32_t next_bit = uint32_t{1} << next;
+        if ((subset & next_bit) || weights[last][next] == kNoEdge) {
+          continue;
+        }
+        const uint32_t index = (subset | next_bit) * num_binaries + next;
+        if (weight + weights[last][next] > best[index]) {
+          best[index] = weight + weights[last][next];
+          previous[index] = last;
+        }
+      }
+    }
+  }
+
+  const uint32_t all = num_subsets - 1;
+  int last = -1;
+  for (int i = 0; i < num_binaries; ++i) {
+    if (best[all * num_binaries + i] != kNoEdge &&
+        (last == -1 ||
+         best[all * num_binaries + i] > best[all * num_binaries + last])) {
+      last = i;
+    }
+  }
+  if (last == -1) {
+    return NotAChainError();
+  }
+  std::vector<int> path;
+  for (uint32_t subset = all; last != -1;) {
+    path.push_back(last);
+    const int before = previous[subset * num_binaries + last];
+    subset &= ~(uint32_t{1} << last);
+    last = before;
+  }
+  return path;
+}
+
+// Greedy heuristic: adds edges by decreasing similarity unless they would
+// create a branch or a cycle.
+absl::StatusOr<std::vector<int>> GreedyMaxSimilarityPath(
+    int num_binaries, absl::Span<const SimilarityEdge> edges) {
+  std::vector<int> order(edges.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&edges](int a, int b) {
+    return edges[a].similarity > edges[b].similarity;
+  });
+
+  std::vector<int> component(num_binaries);
+  std::iota(component.begin(), component.end(), 0);
+  auto find = [&component](int i) {
+    while (component[i] != i) {
+      i = component[i] = component[component[i]];
+    }
+    return i;
+  };
+  std::vector<std::vector<int>> neighbors(num_binaries);
+  int num_path_edges = 0;
+  for (int index : order) {
+    const auto& edge = edges[index];
+    const int first = find(edge.first);
+    const int second = find(edge.second);
+    if (first == second || neighbors[edge.first].size() == 2 ||
+        neighbors[edge.second].size() == 2) {
+      continue;
+    }
+    component[first] = second;
+    neighbors[edge.first].push_back(edge.second);
+    neighbors[edge.second].push_back(edge.first);
+    ++num_path_edges;
+  }
+  if (num_path_edges != num_binaries - 1) {
+    return NotAChainError();
+  }
+
+  int current = 0;
+  while (neighbors[current].size() != 1) {
+    ++current;
+  }
+  std::vector<int> path = {current};
+  for (int previous = -1; path.size() < num_binaries;) {
+    const int next = neighbors[current][0] != previous ? neighbors[current][0]
+                                                       : neighbors[current][1];
+    previous = current;
+    current = next;
+    path.push_back(current);
+  }
+  return path;
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<int>> FindMaxSimilarityPath(
+    int num_binaries, absl::Span<const SimilarityEdge> edges) {
+  if (num_binaries <= 0) {
+    return absl::InvalidArgumentError("Need at least one binary");
+  }
+  if (num_binaries == 1) {
+    return std::vector<int>{0};
+  }
+
+  std::vector<int> path;
+  if (num_binaries <= kMaxExactChainBinaries) {
+    std::vector<std::vector<double>> weights(
+        num_binaries, std::vector<double>(num_binaries, kNoEdge));
+    for (const auto& edge : edges) {
+      if (edge.first == edge.second) {
+        continue;
+      }
+      double& weight = weights[edge.first][edge.second];
+      weight = std::max(weight, edge.similarity);
+      weights[edge.second][edge.first] = weight;
+    }
+    NA_ASSIGN_OR_RETURN(path, ExactMaxSimilarityPath(num_binaries, weights));
+  } else {
+    NA_ASSIGN_OR_RETURN(path, GreedyMaxSimilarityPath(num_binaries, edges));
+  }
+  if (path.front() > path.back()) {
+    std::reverse(path.begin(), path.end());
+  }
+  return path;
+}
+
+absl::StatusOr<DiffChain> PlanDiffChain(
+    absl::Span<const std::string> diff_files) {
+  if (diff_files.empty()) {
+    return absl::InvalidArgumentError("Need at least one diff");
+  }
+
+  // Binaries are numbered in order of their first appearance, so that input
+  // that already forms the best chain keeps its order.
+  DiffChain chain;
+  absl::flat_hash_map<std::string, int> binary_indices;
+  auto binary_index = [&chain, &binary_indices](const std::string& name) {
+    auto [it, inserted] = binary_indices.emplace(name, chain.binaries.size());
+    if (inserted) {
+      chain.binaries.push_back(name);
+    }
+    return it->second;
+  };
+  std::vector<SimilarityEdge> edges;
+  for (const auto& diff : diff_files) {
+    std::pair<FileMetaData, FileMetaData> metadata;
+    DiffSimilarity similarity;
+    NA_RETURN_IF_ERROR(ReadBinDiffMetaData(diff, &metadata, &similarity));
+    const int first = binary_index(metadata.first.filename);
+    const int second = binary_index(metadata.second.filename);
+    if (first == second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Diff of a binary with itself: ", diff));
+    }
+    edges.push_back({first, second, similarity.similarity});
+  }
+
+  NA_ASSIGN_OR_RETURN(std::vector<int> path,
+                      FindMaxSimilarityPath(chain.binaries.size(), edges));
+
+  // Uses the most similar diff between each pair of neighbors.
+  std::vector<int> path_edges;
+  int num_reversed = 0;
+  for (int i = 1; i < path.size(); ++i) {
+    int best = -1;
+    for (int j = 0; j < edges.size(); ++j) {
+      const auto& edge = edges[j];
+      if (((edge.first == path[i - 1] && edge.second == path[i]) ||
+           (edge.first == path[i] && edge.second == path[i - 1])) &&
+          (best == -1 || edge.similarity > edges[best].similarity)) {
+        best = j;
+      }
+    }
+    path_edges.push_back(best);
+    num_reversed += edges[best].first != path[i - 1];
+  }
+  // Both directions of the path are equally good. Prefer the one that uses
+  // most diffs in their original direction.
+  if (2 * num_reversed > path_edges.size()) {
+    std::reverse(path.begin(), path.end());
+    std::reverse(path_edges.begin(), path_edges.end());
+  }
+
+  std::vector<std::string> binaries;
+  binaries.reserve(path.size());
+  for (int i = 0; i < path.size(); ++i) {
+    binaries.push_back(chain.binaries[path[i]]);
+    if (i == 0) {
+      continue;
+    }
+    const int index = path_edges[i - 1];
+    const auto& edge = edges[index];
+    chain.diffs.push_back(
+        {diff_files[index], edge.first != path[i - 1], edge.similarity});
+    chain.similarity += edge.similarity;
+  }
+  chain.binaries = std::move(binaries);
+  return chain;
+}
+
+}  // namespace security::vxsig
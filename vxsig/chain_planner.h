@@ -0,0 +1,85 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Orders a set of BinDiff results into a chain of diffs. Signature generation
+// follows matches along the chain, so every pair of neighbors that BinDiff
+// found dissimilar breaks id chains and removes candidates. The planner reads
+// only the metadata and overall similarity of each diff and picks the chain
+// that visits every binary once with the highest total similarity, i.e. a
+// maximum-weight Hamiltonian path in the similarity graph. Diffs may be used
+// in either direction, so that one BinDiff per pair of binaries suffices.
+
+#ifndef VXSIG_CHAIN_PLANNER_H_
+#define VXSIG_CHAIN_PLANNER_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+namespace security::vxsig {
+
+// Up to this many binaries, the best chain is computed exactly. Larger sets
+// use a greedy heuristic.
+inline constexpr int kMaxExactChainBinaries = 16;
+
+// An edge of the similarity graph between two binaries, identified by their
+// index.
+struct SimilarityEdge {
+  int first;
+  int second;
+  double similarity;
+};
+
+// Returns the binaries in the order of a path that visits each of them once
+// and maximizes the sum of the similarities of its edges. Of the two
+// directions of the path, the one starting with the lower index is returned.
+// Returns an error if the edges do not connect all binaries into a path.
+absl::StatusOr<std::vector<int>> FindMaxSimilarityPath(
+    int num_binaries, absl::Span<const SimilarityEdge> edges);
+
+struct ChainDiff {
+  std::string filename;
+
+  // Whether the diff is used from its secondary to its primary binary.
+  bool reversed = false;
+
+  double similarity = 0;
+};
+
+struct DiffChain {
+  // The diffs in chain order, one less than there are binaries.
+  std::vector<ChainDiff> diffs;
+
+  // The names of the binaries in chain order, as stored in the BinDiff
+  // metadata.
+  std::vector<std::string> binaries;
+
+  // Sum of the similarities of the diffs.
+  double similarity = 0;
+};
+
+// Reads the metadata of the specified BinDiff files and returns the chain with
+// the highest total similarity. Diffs that are not needed for the chain, like
+// all but n - 1 of the diffs of an all-pairs comparison, are left out. If
+// there are several diffs for the same pair of binaries, the most similar one
+// is used. Of the two directions of the chain, the one that reverses fewer
+// diffs is returned, so that diffs that already form a chain keep their order.
+absl::StatusOr<DiffChain> PlanDiffChain(
+    absl::Span<const std::string> diff_files);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_CHAIN_PLANNER_H_
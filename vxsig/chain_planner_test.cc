@@ -0,0 +1,109 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/chain_planner.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+
+using not_absl::IsOk;
+using testing::DoubleNear;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsFalse;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kTestData[] = "com_google_vxsig/vxsig/testdata/";
+
+TEST(ChainPlannerTest, FindsExactMaxSimilarityPath) {
+  // Picking the most similar edges first would leave binary 3 disconnected.
+  const std::vector<SimilarityEdge> edges = {
+      {0, 1, 0.9}, {0, 2, 0.4}, {1, 2, 0.5}, {1, 3, 0.1}};
+  auto path = FindMaxSimilarityPath(4, edges);
+  ASSERT_THAT(path, IsOk());
+  EXPECT_THAT(*path, ElementsAre(2, 0, 1, 3));
+
+  auto single = FindMaxSimilarityPath(1, {});
+  ASSERT_THAT(single, IsOk());
+  EXPECT_THAT(*single, ElementsAre(0));
+}
+
+TEST(ChainPlannerTest, FindsGreedyPathForManyBinaries) {
+  constexpr int kNumBinaries = kMaxExactChainBinaries + 4;
+  // A line of similar binaries with weak shortcuts.
+  std::vector<SimilarityEdge> edges;
+  for (int i = 1; i < kNumBinaries; ++i) {
+    edges.push_back({i - 1, i, 0.9});
+  }
+  for (int i = 2; i < kNumBinaries; ++i) {
+    edges.push_back({i - 2, i, 0.1});
+  }
+  auto path = FindMaxSimilarityPath(kNumBinaries, edges);
+  ASSERT_THAT(path, IsOk());
+  ASSERT_THAT(*path, SizeIs(kNumBinaries));
+  for (int i = 0; i < kNumBinaries; ++i) {
+    EXPECT_THAT((*path)[i], Eq(i));
+  }
+}
+
+TEST(ChainPlannerTest, FailsIfNotConnected) {
+  const std::vector<SimilarityEdge> edges = {{0, 1, 0.5}, {2, 3, 0.5}};
+  EXPECT_THAT(FindMaxSimilarityPath(4, edges).ok(), IsFalse());
+
+  // A star cannot be visited in a single path.
+  const std::vector<SimilarityEdge> star = {
+      {0, 1, 0.5}, {0, 2, 0.5}, {0, 3, 0.5}};
+  EXPECT_THAT(FindMaxSimilarityPath(4, star).status().code(),
+              Eq(absl::StatusCode::kFailedPrecondition));
+}
+
+TEST(ChainPlannerTest, OrdersDiffs) {
+  const std::string first = JoinPath(
+      getenv("TEST_SRCDIR"), kTestData,
+      "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa_vs_"
+      "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82."
+      "BinDiff");
+  const std::string second = JoinPath(
+      getenv("TEST_SRCDIR"), kTestData,
+      "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82_vs_"
+      "1d3949acb5eb175af3cbc5f448ece50669a44743faec91e3d574dad9596a9d83."
+      "BinDiff");
+
+  auto chain = PlanDiffChain({second, first});
+  ASSERT_THAT(chain, IsOk());
+  ASSERT_THAT(chain->diffs, SizeIs(2));
+  EXPECT_THAT(chain->diffs[0].filename, Eq(first));
+  EXPECT_THAT(chain->diffs[0].reversed, IsFalse());
+  EXPECT_THAT(chain->diffs[1].filename, Eq(second));
+  EXPECT_THAT(chain->diffs[1].reversed, IsFalse());
+  EXPECT_THAT(
+      chain->binaries,
+      ElementsAre(
+          "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa",
+          "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82",
+          "1d3949acb5eb175af3cbc5f448ece50669a44743faec91e3d574dad9596a9d83"));
+  EXPECT_THAT(chain->similarity, DoubleNear(0.9289 + 0.1114, 1e-3));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -17,10 +17,13 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <string>
+#include <vector>
 
-#include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/trim_plan.h"
 
 namespace security::vxsig {
 namespace {
@@ -34,28 +37,25 @@ enum {
 
 static constexpr char kClamAvWildcard[] = "*";
 
-}  // namespace
-
-absl::Status ClamAvSignatureFormatter::DoFormat(Signature* signature) const {
-  std::string* signature_data =
-      signature->mutable_clam_av_signature()->mutable_data();
-
-  // Avoid too many reallocations.
-  signature_data->clear();
-  signature_data->reserve(static_cast<int>(kClamAvMaxLineLen));
-
-  absl::StrAppend(signature_data, signature->definition().detection_name(),
-                  ":0:*:");
-
-  RawSignature subset_regex;
+// Appends the signature line for a signature to the output, without the
+// trailing newline. The pieces are written directly from the raw signature of
+// the plan, without copying them. Leaves the output unchanged on error.
+absl::Status AppendClamAvSignature(const SignatureDefinition& definition,
+                                   const TrimPlan& plan, std::string* output) {
+  const RawSignature& raw_signature = plan.raw_signature();
+  std::vector<int> piece_indices;
   NA_RETURN_IF_ERROR(
-      GetRelevantSignatureSubset(*signature, kClamAvMinBytes, &subset_regex));
+      plan.GetSubsetIndices(definition, kClamAvMinBytes, &piece_indices));
+
+  const size_t line_start = output->size();
+  absl::StrAppend(output, definition.detection_name(), ":0:*:");
 
   int max_copy_bytes = 0;
   bool needs_wildcard = false;
-  for (const auto& piece : subset_regex.piece()) {
+  for (const int i : piece_indices) {
     // Append wildcard and hexadecimal signature piece.
-    max_copy_bytes = (kClamAvMaxLineLen - signature_data->size() -
+    const int line_length = output->size() - line_start;
+    max_copy_bytes = (kClamAvMaxLineLen - line_length -
                       (needs_wildcard ? ABSL_ARRAYSIZE(kClamAvWildcard) : 0)) /
                      2 /* Two hex bytes per byte */;
     if (max_copy_bytes < kClamAvMinBytes) {
@@ -64,42 +64,53 @@ absl::Status ClamAvSignatureFormatter::DoFormat(Signature* signature) const {
       break;
     }
     if (needs_wildcard) {
-      absl::StrAppend(signature_data, kClamAvWildcard);
-    }
-    const auto piece_bytes(piece.bytes().substr(0, max_copy_bytes));
-    int start_mask = signature_data->size();
-    absl::StrAppend(signature_data, absl::BytesToHexString(piece_bytes));
-    for (const auto& masked_nibble : piece.masked_nibble()) {
-      if (masked_nibble / 2 < max_copy_bytes) {
-        (*signature_data)[start_mask + masked_nibble] = '?';
-      }
+      absl::StrAppend(output, kClamAvWildcard);
     }
+    AppendPieceHex(raw_signature.piece(i), max_copy_bytes, output);
     needs_wildcard = true;
   }
   // A return value of false can only happen if the detection name is overly
   // long.
-  if (signature_data->size() > kClamAvMaxLineLen) {
+  const size_t line_length = output->size() - line_start;
+  if (line_length > kClamAvMaxLineLen) {
+    output->resize(line_start);
     return absl::OutOfRangeError(
-        absl::StrCat("Signature data size too long: ", signature_data->size(),
-                     " > ", kClamAvMaxLineLen));
+        absl::StrCat("Signature data size too long: ", line_length, " > ",
+                     kClamAvMaxLineLen));
   }
   return absl::OkStatus();
 }
 
+}  // namespace
+
+absl::Status ClamAvSignatureFormatter::DoFormat(Signature* signature,
+                                                const TrimPlan& plan) const {
+  std::string* signature_data =
+      signature->mutable_clam_av_signature()->mutable_data();
+
+  // Avoid too many reallocations.
+  signature_data->clear();
+  signature_data->reserve(static_cast<int>(kClamAvMaxLineLen));
+  return AppendClamAvSignature(signature->definition(), plan, signature_data);
+}
+
 absl::Status ClamAvSignatureFormatter::DoFormatDatabase(
     const Signatures& signatures, std::string* database) const {
   if (!database) {
     return absl::InvalidArgumentError("Database must not be nullptr");
   }
-  Signature format_signature;
   for (const auto& signature : signatures.signature()) {
-    const auto* signature_data = &signature.clam_av_signature().data();
-    if (signature_data->empty()) {
-      format_signature = signature;
-      NA_RETURN_IF_ERROR(Format(&format_signature));
-      signature_data = &format_signature.clam_av_signature().data();
+    const std::string& signature_data = signature.clam_av_signature().data();
+    if (!signature_data.empty()) {
+      absl::StrAppend(database, signature_data, "\n");
+      continue;
     }
-    absl::StrAppend(database, *signature_data, "\n");
+    // Format directly into the database instead of formatting a copy of the
+    // signature.
+    const TrimPlan plan(signature.raw_signature());
+    NA_RETURN_IF_ERROR(
+        AppendClamAvSignature(signature.definition(), plan, database));
+    database->push_back('\n');
   }
   return absl::OkStatus();
 }
@@ -24,11 +24,20 @@ namespace security::vxsig {
 // signature format. See http://www.clamav.net/doc/latest/signatures.pdf for
 // details.
 class ClamAvSignatureFormatter : public SignatureFormatter {
+ public:
+  explicit ClamAvSignatureFormatter(const FormatterOptions& options)
+      : SignatureFormatter(options) {}
+
  private:
-  absl::Status DoFormat(Signature* signature) const override;
+  absl::Status DoFormat(Signature* signature,
+                        const TrimPlan& plan) const override;
 
   absl::Status DoFormatDatabase(const Signatures& signatures,
                                 std::string* database) const override;
+
+  const std::string& GetOutput(const Signature& signature) const override {
+    return signature.clam_av_signature().data();
+  }
 };
 
 }  // namespace security::vxsig
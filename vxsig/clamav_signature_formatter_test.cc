@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <memory>
+#include <string>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -88,4 +89,29 @@ TEST_F(ClamAvSignatureFormatterTest, TestDatabaseMultipleSignatures) {
   EXPECT_THAT(database, Eq("one:0:*:3132*3334\ntwo:0:*:3536*3738\n"));
 }
 
+TEST_F(ClamAvSignatureFormatterTest, TestDatabaseKeepsCompleteSignatures) {
+  Signatures signatures;
+  {
+    auto* signature = signatures.add_signature();
+    signature->mutable_definition()->set_detection_name("one");
+    signature->mutable_definition()->set_min_piece_length(2);
+    AddSignaturePieces({"12", "34"}, signature->mutable_raw_signature());
+  }
+  // Fails after the signature was written, as it exceeds the line length.
+  auto* signature = signatures.add_signature();
+  signature->mutable_definition()->set_detection_name(std::string(8192, 'x'));
+  signature->mutable_definition()->set_min_piece_length(2);
+  AddSignaturePieces({"56", "78"}, signature->mutable_raw_signature());
+  std::string database;
+  EXPECT_FALSE(formatter_->FormatDatabase(signatures, &database).ok());
+  EXPECT_THAT(database, Eq("one:0:*:3132*3334\n"));
+
+  // Fails before anything is written, as there are no pieces.
+  signature->mutable_definition()->set_detection_name("two");
+  signature->clear_raw_signature();
+  database.clear();
+  EXPECT_FALSE(formatter_->FormatDatabase(signatures, &database).ok());
+  EXPECT_THAT(database, Eq("one:0:*:3132*3334\n"));
+}
+
 }  // namespace security::vxsig
@@ -0,0 +1,243 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/clustering.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/internal/city.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/binexport_reader.h"
+
+namespace security::vxsig {
+namespace {
+
+// Seeds the hash of basic blocks and functions.
+constexpr uint64_t kBasicBlockSeed = 0x9ae16a3b2f90404f;
+constexpr uint64_t kFunctionSeed = 0xc949d7c7509e6557;
+
+// A fast, well-mixing bijection on 64-bit values (SplitMix64 finalizer).
+uint64_t Mix(uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xbf58476d1ce4e5b9;
+  value ^= value >> 27;
+  value *= 0x94d049bb133111eb;
+  value ^= value >> 31;
+  return value;
+}
+
+// Collects the basic blocks of the instruction stream of a .BinExport file
+// into functions. Flow graphs are reported one after the other, each starting
+// with a call to StartFlowGraph(). Their entry blocks need not come first.
+class FingerprintBuilder {
+ public:
+  explicit FingerprintBuilder(int min_function_instructions)
+      : min_function_instructions_(min_function_instructions) {}
+
+  // Only the flow graphs of functions added here are fingerprinted.
+  void AddFunction(MemoryAddress address) { entries_.insert(address); }
+
+  void StartFlowGraph(MemoryAddress entry_address) {
+    FinishBasicBlock();
+    FinishFunction();
+    in_function_ = entries_.contains(entry_address);
+    basic_block_address_ = 0;
+  }
+
+  void AddInstruction(MemoryAddress basic_block_address,
+                      absl::string_view disassembly) {
+    if (!in_function_) {
+      return;
+    }
+    if (basic_block_address != basic_block_address_) {
+      FinishBasicBlock();
+      basic_block_address_ = basic_block_address;
+    }
+    const absl::string_view mnemonic =
+        disassembly.substr(0, disassembly.find(' '));
+    basic_block_hash_ = absl::hash_internal::CityHash64WithSeed(
+        mnemonic.data(), mnemonic.size(), basic_block_hash_);
+    ++num_instructions_;
+  }
+
+  std::vector<uint64_t> Finish() {
+    FinishBasicBlock();
+    FinishFunction();
+    return std::move(fingerprints_);
+  }
+
+ private:
+  void FinishBasicBlock() {
+    if (basic_block_hash_ != kBasicBlockSeed) {
+      basic_block_hashes_.push_back(basic_block_hash_);
+    }
+    basic_block_hash_ = kBasicBlockSeed;
+  }
+
+  void FinishFunction() {
+    if (num_instructions_ >= min_function_instructions_) {
+      // Independent of the layout of the basic blocks.
+      std::sort(basic_block_hashes_.begin(), basic_block_hashes_.end());
+      const uint64_t hash = absl::hash_internal::CityHash64WithSeed(
+          reinterpret_cast<const char*>(basic_block_hashes_.data()),
+          basic_block_hashes_.size() * sizeof(uint64_t), kFunctionSeed);
+      // Make repeated functions distinct, so that the sets of fingerprints
+      // reflect how often a function occurs.
+      const int occurrence = occurrences_[hash]++;
+      fingerprints_.push_back(Mix(hash + occurrence));
+    }
+    basic_block_hashes_.clear();
+    num_instructions_ = 0;
+  }
+
+  const int min_function_instructions_;
+  absl::flat_hash_set<MemoryAddress> entries_;
+  absl::flat_hash_map<uint64_t, int> occurrences_;
+
+  bool in_function_ = false;
+  MemoryAddress basic_block_address_ = 0;
+  uint64_t basic_block_hash_ = kBasicBlockSeed;
+  std::vector<uint64_t> basic_block_hashes_;
+  int num_instructions_ = 0;
+
+  std::vector<uint64_t> fingerprints_;
+};
+
+}  // namespace
+
+absl::StatusOr<std::vector<uint64_t>> ReadFunctionFingerprints(
+    absl::string_view filename, const ClusteringOptions& options,
+    InputCache* cache) {
+  FingerprintBuilder builder(options.min_function_instructions);
+  const FunctionReceiverCallback function_receiver =
+      [&builder](const std::string& /*sha256*/, MemoryAddress address,
+                 BinExport2::CallGraph::Vertex::Type type,
+                 double /*md_index*/) {
+        if (type == BinExport2::CallGraph::Vertex::NORMAL) {
+          builder.AddFunction(address);
+        }
+      };
+  const InstructionReceiverCallback instruction_receiver =
+      [&builder](MemoryAddress basic_block_address,
+                 MemoryAddress /*instruction_address*/,
+                 const std::string& /*raw_bytes*/,
+                 const std::string& disassembly,
+                 const Immediates& /*immediates*/) {
+        builder.AddInstruction(basic_block_address, disassembly);
+      };
+  const FlowGraphReceiverCallback flow_graph_receiver =
+      [&builder](MemoryAddress entry_address) {
+        builder.StartFlowGraph(entry_address);
+      };
+  NA_RETURN_IF_ERROR(
+      cache ? cache->ParseBinExport(filename, function_receiver,
+                                    instruction_receiver, /*stop=*/nullptr,
+                                    flow_graph_receiver)
+            : ParseBinExport(filename, function_receiver,
+                             instruction_receiver, /*stop=*/nullptr,
+                             flow_graph_receiver));
+  return builder.Finish();
+}
+
+MinHashSketch ComputeMinHash(absl::Span<const uint64_t> features,
+                             int num_hashes) {
+  MinHashSketch sketch(num_hashes, std::numeric_limits<uint64_t>::max());
+  for (uint64_t feature : features) {
+    const uint64_t hash = Mix(feature);
+    for (int i = 0; i < num_hashes; ++i) {
+      // Each index uses a different bijection of the feature hash.
+      sketch[i] = std::min(sketch[i], Mix(hash + i * 0x9e3779b97f4a7c15));
+    }
+  }
+  return sketch;
+}
+
+double EstimateSimilarity(const MinHashSketch& first,
+                          const MinHashSketch& second) {
+  if (first.empty() || first.size() != second.size()) {
+    return 0;
+  }
+  int num_equal = 0;
+  for (int i = 0; i < first.size(); ++i) {
+    // Sketches of empty sets are not similar to anything.
+    num_equal += first[i] == second[i] &&
+                 first[i] != std::numeric_limits<uint64_t>::max();
+  }
+  return static_cast<double>(num_equal) / first.size();
+}
+
+std::vector<std::vector<int>> ClusterSketches(
+    absl::Span<const MinHashSketch> sketches,
+    const ClusteringOptions& options) {
+  const int num_samples = sketches.size();
+  std::vector<int> parent(num_samples);
+  std::iota(parent.begin(), parent.end(), 0);
+  auto find = [&parent](int i) {
+    while (parent[i] != i) {
+      i = parent[i] = parent[parent[i]];
+    }
+    return i;
+  };
+
+  const int rows = options.num_hashes / std::max(options.num_bands, 1);
+  absl::flat_hash_set<std::pair<int, int>> compared;
+  for (int band = 0; band < options.num_bands && rows > 0; ++band) {
+    // Samples whose hashes agree in this band.
+    absl::flat_hash_map<uint64_t, std::vector<int>> buckets;
+    for (int i = 0; i < num_samples; ++i) {
+      if (sketches[i].size() < (band + 1) * rows) {
+        continue;
+      }
+      const uint64_t bucket = absl::hash_internal::CityHash64(
+          reinterpret_cast<const char*>(&sketches[i][band * rows]),
+          rows * sizeof(uint64_t));
+      buckets[bucket].push_back(i);
+    }
+    for (const auto& [bucket, samples] : buckets) {
+      for (int i = 1; i < samples.size(); ++i) {
+        for (int j = 0; j < i; ++j) {
+          const int first = samples[j];
+          const int second = samples[i];
+          if (find(first) == find(second) ||
+              !compared.emplace(first, second).second) {
+            continue;
+          }
+          if (EstimateSimilarity(sketches[first], sketches[second]) >=
+              options.min_similarity) {
+            parent[find(first)] = find(second);
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<std::vector<int>> clusters;
+  absl::flat_hash_map<int, int> cluster_indices;
+  for (int i = 0; i < num_samples; ++i) {
+    auto [it, inserted] = cluster_indices.emplace(find(i), clusters.size());
+    if (inserted) {
+      clusters.emplace_back();
+    }
+    clusters[it->second].push_back(i);
+  }
+  return clusters;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,84 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Groups samples of a malware family by the functions they share. Signature
+// generation needs functions that are present in all samples, so large,
+// heterogeneous families often end up without any function candidates. Each
+// sample is described by a set of function fingerprints, which is summarized
+// by a MinHash sketch. Locality-sensitive hashing on the sketches finds the
+// pairs of similar samples without comparing all of them, and clusters are
+// the connected components of those pairs.
+
+#ifndef VXSIG_CLUSTERING_H_
+#define VXSIG_CLUSTERING_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "vxsig/input_cache.h"
+
+namespace security::vxsig {
+
+struct ClusteringOptions {
+  // Number of hash functions in each MinHash sketch.
+  int num_hashes = 128;
+
+  // The sketches are split into this many bands for LSH. Two samples become
+  // candidates if all hashes of at least one band agree. Must divide
+  // num_hashes.
+  int num_bands = 32;
+
+  // Minimum estimated Jaccard similarity of two candidate samples to put them
+  // into the same cluster.
+  double min_similarity = 0.4;
+
+  // Functions with fewer instructions, like thunks, are too common to tell
+  // samples apart and are not fingerprinted.
+  int min_function_instructions = 4;
+};
+
+using MinHashSketch = std::vector<uint64_t>;
+
+// Returns the fingerprints of the functions in the specified .BinExport file.
+// A function's fingerprint is derived from the mnemonics of its basic blocks,
+// so that it does not change with relocation. Functions that occur more than
+// once yield distinct fingerprints. If cache is non-null, the decoded file is
+// shared with signature generation.
+absl::StatusOr<std::vector<uint64_t>> ReadFunctionFingerprints(
+    absl::string_view filename, const ClusteringOptions& options,
+    InputCache* cache = nullptr);
+
+// Computes the MinHash sketch of a set of features. The sketch of an empty set
+// consists of the maximum value only.
+MinHashSketch ComputeMinHash(absl::Span<const uint64_t> features,
+                             int num_hashes);
+
+// Estimates the Jaccard similarity of the sets that two sketches of the same
+// size were computed from.
+double EstimateSimilarity(const MinHashSketch& first,
+                          const MinHashSketch& second);
+
+// Clusters samples by their sketches. Returns the clusters as lists of sample
+// indices, each sorted in ascending order, ordered by their first sample.
+// Every sample is part of exactly one cluster, so samples that are not similar
+// to any other form a cluster of their own.
+std::vector<std::vector<int>> ClusterSketches(
+    absl::Span<const MinHashSketch> sketches, const ClusteringOptions& options);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_CLUSTERING_H_
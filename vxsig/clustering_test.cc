@@ -0,0 +1,141 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/clustering.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/binexport_reader.h"
+#include "vxsig/test_util.h"
+
+using not_absl::IsOk;
+using testing::DoubleNear;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Gt;
+using testing::IsEmpty;
+using testing::Not;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+// Returns the features [begin, end).
+std::vector<uint64_t> Range(uint64_t begin, uint64_t end) {
+  std::vector<uint64_t> features;
+  for (uint64_t i = begin; i < end; ++i) {
+    features.push_back(i);
+  }
+  return features;
+}
+
+TEST(ClusteringTest, EstimatesSimilarity) {
+  // Jaccard similarity of 500 / 1500.
+  const MinHashSketch first = ComputeMinHash(Range(0, 1000), 256);
+  const MinHashSketch second = ComputeMinHash(Range(500, 1500), 256);
+  EXPECT_THAT(EstimateSimilarity(first, second), DoubleNear(1.0 / 3, 0.1));
+  EXPECT_THAT(EstimateSimilarity(first, first), Eq(1));
+  EXPECT_THAT(EstimateSimilarity(first, ComputeMinHash(Range(2000, 3000), 256)),
+              DoubleNear(0, 0.02));
+
+  // Empty sets are not similar, not even to each other.
+  const MinHashSketch empty = ComputeMinHash({}, 256);
+  EXPECT_THAT(EstimateSimilarity(empty, empty), Eq(0));
+}
+
+TEST(ClusteringTest, ClustersSimilarSamples) {
+  const ClusteringOptions options;
+  // Two families with variants that share most functions, plus an outlier.
+  const std::vector<MinHashSketch> sketches = {
+      ComputeMinHash(Range(0, 1000), options.num_hashes),
+      ComputeMinHash(Range(10000, 11000), options.num_hashes),
+      ComputeMinHash(Range(100, 1100), options.num_hashes),
+      ComputeMinHash(Range(50000, 50500), options.num_hashes),
+      ComputeMinHash(Range(10200, 11200), options.num_hashes),
+      ComputeMinHash(Range(200, 1200), options.num_hashes),
+      ComputeMinHash({}, options.num_hashes),
+  };
+  EXPECT_THAT(ClusterSketches(sketches, options),
+              ElementsAre(ElementsAre(0, 2, 5), ElementsAre(1, 4),
+                          ElementsAre(3), ElementsAre(6)));
+}
+
+TEST(ClusteringTest, ReadsFunctionFingerprints) {
+  const ClusteringOptions options;
+  InputCache cache;
+  std::vector<MinHashSketch> sketches;
+  for (const char* sample : {
+           "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa."
+           "BinExport",
+           "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82."
+           "BinExport",
+           "1d3949acb5eb175af3cbc5f448ece50669a44743faec91e3d574dad9596a9d83."
+           "BinExport",
+       }) {
+    auto fingerprints =
+        ReadFunctionFingerprints(TestDataPath(sample), options, &cache);
+    ASSERT_THAT(fingerprints, IsOk());
+    EXPECT_THAT(*fingerprints, Not(IsEmpty()));
+    sketches.push_back(ComputeMinHash(*fingerprints, options.num_hashes));
+  }
+  EXPECT_THAT(cache.misses(), Eq(3));
+
+  // The samples are variants of the same family.
+  EXPECT_THAT(EstimateSimilarity(sketches[0], sketches[1]),
+              Gt(options.min_similarity));
+  EXPECT_THAT(ClusterSketches(sketches, options),
+              ElementsAre(ElementsAre(0, 1, 2)));
+}
+
+TEST(ClusteringTest, FingerprintsEachFlowGraph) {
+  const std::string filename = TestDataPath(
+      "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa."
+      "BinExport");
+  ClusteringOptions options;
+  options.min_function_instructions = 1;
+
+  // Count the flow graphs of normal functions, including those whose entry
+  // block is not reported first.
+  absl::flat_hash_set<MemoryAddress> functions;
+  int num_flow_graphs = 0;
+  ASSERT_THAT(
+      ParseBinExport(
+          filename,
+          [&functions](const std::string&, MemoryAddress address,
+                       BinExport2::CallGraph::Vertex::Type type, double) {
+            if (type == BinExport2::CallGraph::Vertex::NORMAL) {
+              functions.insert(address);
+            }
+          },
+          [](MemoryAddress, MemoryAddress, const std::string&,
+             const std::string&, const Immediates&) {},
+          /*stop=*/nullptr,
+          [&](MemoryAddress entry_address) {
+            num_flow_graphs += functions.contains(entry_address);
+          }),
+      IsOk());
+  auto fingerprints = ReadFunctionFingerprints(filename, options);
+  ASSERT_THAT(fingerprints, IsOk());
+  EXPECT_THAT(*fingerprints, SizeIs(num_flow_graphs));
+}
+
+}  // namespace
+}  // namespace security::vxsig
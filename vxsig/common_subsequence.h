@@ -20,6 +20,7 @@
 #define VXSIG_COMMON_SUBSEQUENCE_H_
 
 #include <algorithm>
+#include <cstdint>
 #include <iterator>
 #include <set>
 #include <string>
@@ -27,8 +28,10 @@
 #include <vector>
 
 #include "absl/base/internal/raw_logging.h"
+#include "vxsig/executor.h"
 #include "vxsig/hamming.h"
 #include "vxsig/longest_common_subsequence.h"
+#include "vxsig/trace.h"
 
 namespace security::vxsig {
 
@@ -75,32 +78,63 @@ IteratorT PruneSequence(IteratorT first, IteratorT last,
 // The worst case performance of this algorithm does not exceed O(n^2 + k * n)
 // time and O(n^2) space, where k is the number of input sequences and n the
 // maximum length of a sequence.
+//
+// If an executor is specified, the pairwise distances and the LCS of large
+// sequences are computed in parallel. The result does not depend on the
+// executor. The lcs_options select the strategy for each LCS computation, with
+// approximate strategies the result may be shorter. If their stop condition is
+// met, the result is incomplete.
 template <typename NestedContT, typename OutputIteratorT>
-void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
+void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result,
+                       Executor* executor = nullptr,
+                       const LcsOptions& lcs_options = LcsOptions()) {
   using ValueType = typename NestedContT::value_type::value_type;
 
   if (sequences.size() < 2) {
     ABSL_RAW_LOG(FATAL, "Invalid number of sequences");
   }
 
+  TraceSpan span("CommonSubsequence");
+
   // Create a modifiable copy of sequences.
   std::vector<std::vector<ValueType>> sub_seqs;
   sub_seqs.reserve(sequences.size());
+  int64_t total_size = 0;
   for (const auto& sequence : sequences) {
     sub_seqs.emplace_back(sequence.begin(), sequence.end());
+    total_size += sub_seqs.back().size();
   }
+  span.Arg("sequences", sub_seqs.size()).Arg("total_size", total_size);
 
   while (sub_seqs.size() > 2) {
+    if (ShouldStop(lcs_options.stop)) {
+      return;
+    }
     // Find the two sequences with the greatest Hamming distance and
     // populate the removal set.
     size_t max_dist = 0;  // Greatest distance so far.
     // Indices of sequences with smallest distance.
     std::pair<int, int> shd(0, 0);
     std::set<int> removals;  // Indices of sequences to remove.
+    // Distances of each sequence to all sequences before it.
+    std::vector<std::vector<size_t>> distances(sub_seqs.size());
+    auto compute_distances = [&sub_seqs, &distances](int64_t i) {
+      distances[i].reserve(i);
+      for (int j = 0; j < i; ++j) {
+        distances[i].push_back(HammingDistance(sub_seqs[i], sub_seqs[j]));
+      }
+    };
+    if (executor != nullptr) {
+      executor->ParallelFor(sub_seqs.size(), compute_distances);
+    } else {
+      for (int i = 0; i < sub_seqs.size(); ++i) {
+        compute_distances(i);
+      }
+    }
     for (int i = 0; i < sub_seqs.size(); ++i) {
       for (int j = 0; j < i; ++j) {
         // Current Hamming distance.
-        const size_t cur_dist = HammingDistance(sub_seqs[i], sub_seqs[j]);
+        const size_t cur_dist = distances[i][j];
         if (cur_dist == 0) {
           removals.insert(removals.end(), i);
         } else if (cur_dist > max_dist) {
@@ -123,7 +157,8 @@ void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
                              sub_seqs[shd.second].end(),
                              sub_seqs[shd.first].begin(),
                              sub_seqs[shd.first].end(),
-                             back_inserter(max_dist_lcs));
+                             back_inserter(max_dist_lcs), executor,
+                             lcs_options);
 
     // Replace the two most similar sequences with their LCS. From all other
     // sequences, remove any element not found in the LCS. Those elements
@@ -157,7 +192,8 @@ void CommonSubsequence(const NestedContT& sequences, OutputIteratorT result) {
   } else if (sub_seqs.size() == 2) {
     // Problem size 2 is the well-known longest common subsequence problem.
     LongestCommonSubsequence(sub_seqs[0].begin(), sub_seqs[0].end(),
-                             sub_seqs[1].begin(), sub_seqs[1].end(), result);
+                             sub_seqs[1].begin(), sub_seqs[1].end(), result,
+                             executor, lcs_options);
   } else {
     ABSL_RAW_LOG(FATAL, "Invalid number of sub-sequences left: %d",
                  static_cast<int>(sub_seqs.size()));
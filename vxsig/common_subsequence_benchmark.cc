@@ -0,0 +1,143 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for LongestCommonSubsequence() and CommonSubsequence() on
+// sequences of ids, like the candidate computation uses, and on bytes. The
+// argument is the length of the sequences.
+
+#include <cstdint>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "vxsig/benchmark_util.h"
+#include "vxsig/common_subsequence.h"
+#include "vxsig/longest_common_subsequence.h"
+#include "vxsig/types.h"
+
+namespace security::vxsig {
+namespace {
+
+// Returns num_sequences variants of a random sequence of the specified length.
+// Each variant drops about one in sixteen elements and inserts as many, like
+// versions of a binary that differ in some functions.
+template <typename T>
+std::vector<std::vector<T>> MakeSequences(int num_sequences, int length,
+                                          int alphabet_size) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> value(0, alphabet_size - 1);
+  std::uniform_int_distribution<int> edit(0, 15);
+  std::vector<T> base(length);
+  for (auto& element : base) {
+    element = value(rng);
+  }
+  std::vector<std::vector<T>> sequences(num_sequences);
+  for (auto& sequence : sequences) {
+    sequence.reserve(length);
+    for (const T& element : base) {
+      const int choice = edit(rng);
+      if (choice == 0) {
+        continue;  // Dropped
+      }
+      if (choice == 1) {
+        sequence.push_back(value(rng));  // Inserted
+      }
+      sequence.push_back(element);
+    }
+  }
+  return sequences;
+}
+
+void BM_LongestCommonSubsequenceIds(benchmark::State& state) {
+  const auto sequences = MakeSequences<Ident>(2, state.range(0), 1 << 20);
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    IdentSequence result;
+    LongestCommonSubsequence(sequences[0].begin(), sequences[0].end(),
+                             sequences[1].begin(), sequences[1].end(),
+                             std::back_inserter(result));
+    benchmark::DoNotOptimize(result.data());
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LongestCommonSubsequenceIds)
+    ->RangeMultiplier(4)
+    ->Range(1 << 8, 1 << 14)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_LongestCommonSubsequenceBytes(benchmark::State& state) {
+  const auto sequences = MakeSequences<char>(2, state.range(0), 256);
+  const std::string first(sequences[0].begin(), sequences[0].end());
+  const std::string second(sequences[1].begin(), sequences[1].end());
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    std::string result = LongestCommonSubsequence(first, second);
+    benchmark::DoNotOptimize(result.data());
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LongestCommonSubsequenceBytes)
+    ->RangeMultiplier(4)
+    ->Range(1 << 8, 1 << 14)
+    ->Unit(benchmark::kMicrosecond);
+
+// The second argument is the number of sequences.
+void CommonSubsequenceArgs(benchmark::internal::Benchmark* benchmark) {
+  for (int length : {1 << 8, 1 << 10, 1 << 12}) {
+    for (int num_sequences : {3, 8}) {
+      benchmark->Args({length, num_sequences});
+    }
+  }
+}
+
+void BM_CommonSubsequenceIds(benchmark::State& state) {
+  const auto sequences =
+      MakeSequences<Ident>(state.range(1), state.range(0), 1 << 20);
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    IdentSequence result;
+    CommonSubsequence(sequences, std::back_inserter(result));
+    benchmark::DoNotOptimize(result.data());
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * state.range(0) *
+                          state.range(1));
+}
+BENCHMARK(BM_CommonSubsequenceIds)
+    ->Apply(CommonSubsequenceArgs)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_CommonSubsequenceBytes(benchmark::State& state) {
+  const auto sequences =
+      MakeSequences<char>(state.range(1), state.range(0), 256);
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    std::vector<char> result;
+    CommonSubsequence(sequences, std::back_inserter(result));
+    benchmark::DoNotOptimize(result.data());
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() * state.range(0) *
+                          state.range(1));
+}
+BENCHMARK(BM_CommonSubsequenceBytes)
+    ->Apply(CommonSubsequenceArgs)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+}  // namespace security::vxsig
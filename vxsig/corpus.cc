@@ -0,0 +1,117 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/corpus.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+
+namespace security::vxsig {
+namespace {
+
+absl::Status AddDirectory(const std::string& directory, int64_t max_file_size,
+                          Corpus* corpus) {
+  std::vector<std::string> entries;
+  NA_RETURN_IF_ERROR(GetDirectoryEntries(directory, &entries));
+  // Directory entries are not returned in any particular order. Sort them so
+  // that results computed over a corpus are stable.
+  std::sort(entries.begin(), entries.end());
+  for (const auto& entry : entries) {
+    const std::string path = JoinPath(directory, entry);
+    if (IsDirectory(path)) {
+      NA_RETURN_IF_ERROR(AddDirectory(path, max_file_size, corpus));
+      continue;
+    }
+    if (max_file_size >= 0) {
+      NA_ASSIGN_OR_RETURN(int64_t file_size, GetFileSize(path));
+      if (file_size > max_file_size) {
+        continue;
+      }
+    }
+    NA_ASSIGN_OR_RETURN(std::string data, ReadFileContents(path));
+    corpus->AddFile(path, data);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> ReadFileContents(absl::string_view filename) {
+  std::ifstream file(std::string(filename), std::ios_base::binary);
+  if (!file) {
+    return absl::NotFoundError(absl::StrCat("Cannot open ", filename));
+  }
+  std::string data((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  if (file.bad()) {
+    return absl::InternalError(absl::StrCat("Error reading ", filename));
+  }
+  return data;
+}
+
+absl::Status WriteFileContentsAtomically(absl::string_view filename,
+                                         absl::string_view data) {
+  static std::atomic<int64_t> counter(0);
+  char hostname[256] = {};
+  gethostname(hostname, sizeof(hostname) - 1);
+  const std::string temp_filename = absl::StrCat(
+      filename, ".tmp.", hostname, ".", getpid(), ".", counter++);
+  {
+    std::ofstream file(temp_filename, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    if (!file) {
+      file.close();
+      remove(temp_filename.c_str());
+      return absl::UnknownError(absl::StrCat("Failed to write ", filename));
+    }
+  }
+  if (rename(temp_filename.c_str(), std::string(filename).c_str()) != 0) {
+    absl::Status status = absl::UnknownError(absl::StrCat(
+        "Failed to rename ", temp_filename, ": ", strerror(errno)));
+    remove(temp_filename.c_str());
+    return status;
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<Corpus> Corpus::LoadFromDirectory(absl::string_view directory,
+                                                 int64_t max_file_size) {
+  if (!IsDirectory(directory)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Not a directory: ", directory));
+  }
+  Corpus corpus;
+  NA_RETURN_IF_ERROR(
+      AddDirectory(std::string(directory), max_file_size, &corpus));
+  return corpus;
+}
+
+void Corpus::AddFile(absl::string_view name, absl::string_view data) {
+  files_.push_back({std::string(name), std::string(data)});
+  total_bytes_ += data.size();
+}
+
+}  // namespace security::vxsig
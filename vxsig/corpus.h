@@ -0,0 +1,80 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Provides a simple in-memory file corpus that is used to evaluate generated
+// signatures against local sets of files (for example, a goodware collection
+// or a sample of the files a scanner typically sees).
+
+#ifndef VXSIG_CORPUS_H_
+#define VXSIG_CORPUS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace security::vxsig {
+
+// A single file of a corpus together with its contents.
+struct CorpusFile {
+  std::string name;
+  std::string data;
+};
+
+class Corpus {
+ public:
+  Corpus() = default;
+
+  Corpus(const Corpus&) = delete;
+  Corpus& operator=(const Corpus&) = delete;
+
+  Corpus(Corpus&&) = default;
+  Corpus& operator=(Corpus&&) = default;
+
+  // Recursively loads all regular files in the specified directory. Files
+  // larger than max_file_size bytes are skipped. A negative value means "no
+  // limit".
+  static absl::StatusOr<Corpus> LoadFromDirectory(absl::string_view directory,
+                                                  int64_t max_file_size = -1);
+
+  // Adds a file to the corpus. Useful mainly for testing.
+  void AddFile(absl::string_view name, absl::string_view data);
+
+  const std::vector<CorpusFile>& files() const { return files_; }
+  int size() const { return files_.size(); }
+  bool empty() const { return files_.empty(); }
+
+  // Returns the sum of the sizes of all files in the corpus.
+  int64_t total_bytes() const { return total_bytes_; }
+
+ private:
+  std::vector<CorpusFile> files_;
+  int64_t total_bytes_ = 0;
+};
+
+// Reads the whole contents of the specified file.
+absl::StatusOr<std::string> ReadFileContents(absl::string_view filename);
+
+// Writes the data to a temporary file next to the specified one and renames it
+// into place, so that readers, even on other hosts sharing the file system,
+// either see the old or the complete new contents.
+absl::Status WriteFileContentsAtomically(absl::string_view filename,
+                                         absl::string_view data);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_CORPUS_H_
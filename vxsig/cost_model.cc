@@ -0,0 +1,204 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/cost_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "absl/strings/str_format.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+
+namespace security::vxsig {
+namespace {
+
+// Jobs with less estimated work run serially.
+constexpr absl::Duration kMinParallelTime = absl::Milliseconds(50);
+
+// Above this number of segments, searching for anchors is not worth it.
+constexpr int kMaxAnchoredSegments = 64;
+constexpr int kMaxSegments = 4096;
+
+absl::Duration Nanoseconds(double ns) {
+  return absl::Nanoseconds(static_cast<int64_t>(ns));
+}
+
+// Least squares fit of y = cost * x through the origin.
+double FitCost(absl::Span<const CalibrationSample> samples,
+               const std::function<double(const CalibrationSample&)>& work,
+               const std::function<double(const CalibrationSample&)>& ns,
+               double fallback) {
+  double xy = 0;
+  double xx = 0;
+  for (const auto& sample : samples) {
+    const double x = work(sample);
+    xy += x * ns(sample);
+    xx += x * x;
+  }
+  return xx > 0 ? xy / xx : fallback;
+}
+
+double PhaseNs(const TraceSummary& summary, const char* phase) {
+  auto found = summary.phases.find(phase);
+  return found != summary.phases.end() ? found->second.total_ns : 0;
+}
+
+}  // namespace
+
+int64_t EstimateCommonSubsequenceCells(std::vector<int64_t> lengths) {
+  if (lengths.size() < 2) {
+    return 0;
+  }
+  // The longest sequence is folded with each of the others in turn, each LCS
+  // computing about twice the full matrix due to the Hirschberg recursion.
+  std::sort(lengths.begin(), lengths.end(), std::greater<>());
+  int64_t cells = 0;
+  for (int i = 1; i < lengths.size(); ++i) {
+    cells += 2 * lengths[0] * lengths[i];
+  }
+  return cells;
+}
+
+absl::StatusOr<CostEstimate> EstimateCost(const MatchChainTable& table,
+                                          const CostModel& model) {
+  int64_t ingest_bytes = 0;
+  for (const auto& column : table) {
+    NA_ASSIGN_OR_RETURN(
+        int64_t size,
+        GetFileSize(JoinPath(column->diff_directory(), column->filename())
+                        .append(".BinExport")));
+    ingest_bytes += size;
+  }
+  return EstimateCost(table, ingest_bytes, model);
+}
+
+CostEstimate EstimateCost(const MatchChainTable& table, int64_t ingest_bytes,
+                          const CostModel& model) {
+  CostEstimate estimate;
+  estimate.ingest_bytes = ingest_bytes;
+
+  std::vector<int64_t> num_functions;
+  std::vector<int64_t> num_basic_blocks;
+  for (const auto& column : table) {
+    num_functions.push_back(column->functions_by_address().size());
+    num_basic_blocks.push_back(column->basic_blocks_by_address().size());
+    estimate.regex_bytes += kAverageInstructionBytes *
+                            column->instructions_by_address().size();
+  }
+  estimate.function_lcs_cells = EstimateCommonSubsequenceCells(num_functions);
+  estimate.basic_block_lcs_cells =
+      EstimateCommonSubsequenceCells(num_basic_blocks);
+
+  estimate.ingest_time = Nanoseconds(model.ns_per_ingest_byte * ingest_bytes);
+  estimate.candidate_time = Nanoseconds(
+      model.ns_per_lcs_cell *
+      (estimate.function_lcs_cells + estimate.basic_block_lcs_cells));
+  estimate.regex_time =
+      Nanoseconds(model.ns_per_regex_byte * estimate.regex_bytes);
+  return estimate;
+}
+
+ExecutionPlan PlanExecution(const CostEstimate& estimate, int num_threads,
+                            absl::Duration target_latency) {
+  ExecutionPlan plan;
+  plan.parallel =
+      num_threads > 1 &&
+      estimate.candidate_time + estimate.regex_time >= kMinParallelTime;
+  // Only the two rows of each Hirschberg step run in parallel, while the
+  // basic blocks of the regex stage are independent.
+  const absl::Duration candidate_time =
+      plan.parallel ? estimate.candidate_time / 2 : estimate.candidate_time;
+  const absl::Duration regex_time = plan.parallel
+                                        ? estimate.regex_time / num_threads
+                                        : estimate.regex_time;
+  plan.estimated_time = estimate.ingest_time + candidate_time + regex_time;
+  if (plan.estimated_time <= target_latency ||
+      candidate_time == absl::ZeroDuration()) {
+    return plan;
+  }
+
+  const absl::Duration budget =
+      target_latency - estimate.ingest_time - regex_time;
+  int segments = kMaxSegments;
+  if (budget > absl::ZeroDuration()) {
+    segments = std::clamp(
+        static_cast<int>(std::ceil(absl::FDivDuration(candidate_time, budget))),
+        2, kMaxSegments);
+  }
+  plan.lcs.strategy = segments <= kMaxAnchoredSegments ? LcsStrategy::kAnchored
+                                                       : LcsStrategy::kBanded;
+  plan.lcs.segments = segments;
+  plan.estimated_time =
+      estimate.ingest_time + candidate_time / segments + regex_time;
+  return plan;
+}
+
+CostModel CalibrateCostModel(absl::Span<const CalibrationSample> samples,
+                             const CostModel& model) {
+  CostModel result;
+  result.ns_per_ingest_byte = FitCost(
+      samples,
+      [](const CalibrationSample& s) { return s.estimate.ingest_bytes; },
+      [](const CalibrationSample& s) {
+        return PhaseNs(s.summary, "LoadColumnData");
+      },
+      model.ns_per_ingest_byte);
+  result.ns_per_lcs_cell = FitCost(
+      samples,
+      [](const CalibrationSample& s) {
+        return s.estimate.function_lcs_cells +
+               s.estimate.basic_block_lcs_cells;
+      },
+      [](const CalibrationSample& s) {
+        return PhaseNs(s.summary, "ComputeFunctionCandidates") +
+               PhaseNs(s.summary, "ComputeBasicBlockCandidates");
+      },
+      model.ns_per_lcs_cell);
+  result.ns_per_regex_byte = FitCost(
+      samples,
+      [](const CalibrationSample& s) { return s.estimate.regex_bytes; },
+      [](const CalibrationSample& s) {
+        return PhaseNs(s.summary, "GenericSignatureFromMatches");
+      },
+      model.ns_per_regex_byte);
+  return result;
+}
+
+std::string FormatCostEstimate(const CostEstimate& estimate) {
+  return absl::StrFormat(
+      "%.1f MiB to load, %.3g LCS cells, %.1f KiB of regex input, about %s "
+      "single-threaded",
+      estimate.ingest_bytes / 1048576.0,
+      static_cast<double>(estimate.function_lcs_cells +
+                          estimate.basic_block_lcs_cells),
+      estimate.regex_bytes / 1024.0,
+      absl::FormatDuration(absl::Trunc(estimate.total_time(),
+                                       absl::Milliseconds(1))));
+}
+
+const char* LcsStrategyName(LcsStrategy strategy) {
+  switch (strategy) {
+    case LcsStrategy::kExact:
+      return "exact";
+    case LcsStrategy::kAnchored:
+      return "anchored";
+    case LcsStrategy::kBanded:
+      return "banded";
+  }
+  return "unknown";
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,130 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// An up-front estimate of the work needed to generate a signature. Once the
+// BinDiff results have been parsed into the match chain table, the number of
+// matched functions, basic blocks and instructions per binary is known. From
+// these, the model derives the amount of work for each of the remaining
+// stages:
+//   - ingest: bytes of BinExport data still to be loaded,
+//   - candidates: cells of the LCS matrices for the function and basic block
+//     candidates,
+//   - regex: instruction bytes to fold into the per-basic block regexes.
+// Each amount is multiplied by a per-unit cost that was calibrated against
+// traces of benchmark runs (see CalibrateCostModel()). The estimate is then
+// used to pick an execution plan that meets a target latency.
+
+#ifndef VXSIG_COST_MODEL_H_
+#define VXSIG_COST_MODEL_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "vxsig/longest_common_subsequence.h"
+#include "vxsig/match_chain_table.h"
+#include "vxsig/trace.h"
+
+namespace security::vxsig {
+
+// Average size of an instruction in bytes. Instruction bytes are only loaded
+// with the BinExport files, so the regex size is estimated from the number of
+// matched instructions.
+inline constexpr int kAverageInstructionBytes = 4;
+
+// Per-unit costs in nanoseconds. The defaults were measured on single-threaded
+// runs over the test data.
+struct CostModel {
+  double ns_per_ingest_byte = 66.0;
+  double ns_per_lcs_cell = 0.85;
+  double ns_per_regex_byte = 1200.0;
+};
+
+// Amounts of work of the stages following the parsing of the BinDiff results,
+// together with their estimated single-threaded running times.
+struct CostEstimate {
+  int64_t ingest_bytes = 0;
+  int64_t function_lcs_cells = 0;
+  int64_t basic_block_lcs_cells = 0;
+  int64_t regex_bytes = 0;
+
+  absl::Duration ingest_time;
+  absl::Duration candidate_time;
+  absl::Duration regex_time;
+
+  absl::Duration total_time() const {
+    return ingest_time + candidate_time + regex_time;
+  }
+};
+
+// How to run the remaining stages.
+struct ExecutionPlan {
+  // Whether to use multiple threads. Small jobs run serially, as threads would
+  // only add overhead.
+  bool parallel = false;
+
+  // Strategy for the function and basic block candidate LCS computations.
+  LcsOptions lcs;
+
+  // Estimated running time of the remaining stages with this plan.
+  absl::Duration estimated_time;
+};
+
+// Returns the estimated number of LCS matrix cells that CommonSubsequence()
+// computes for sequences of the specified lengths.
+int64_t EstimateCommonSubsequenceCells(std::vector<int64_t> lengths);
+
+// Estimates the work for a match chain table for which ParseDiffResults() has
+// been run, but whose BinExport data has not yet been loaded. The sizes of the
+// BinExport files are taken from the file system.
+absl::StatusOr<CostEstimate> EstimateCost(const MatchChainTable& table,
+                                          const CostModel& model);
+
+// Same as above, with the number of BinExport bytes to load given explicitly.
+CostEstimate EstimateCost(const MatchChainTable& table, int64_t ingest_bytes,
+                          const CostModel& model);
+
+// Picks the cheapest plan that is still expected to finish within the target
+// latency. Exact LCS is preferred. If it is too slow, the candidate LCS is
+// split into segments, using anchors for moderate and fixed bands for large
+// numbers of segments. With an infinite target latency, the plan is always
+// exact.
+ExecutionPlan PlanExecution(const CostEstimate& estimate, int num_threads,
+                            absl::Duration target_latency);
+
+// A benchmark run used for calibration: the estimate made before the run and
+// the trace summary recorded during the run.
+struct CalibrationSample {
+  CostEstimate estimate;
+  TraceSummary summary;
+};
+
+// Fits the per-unit costs of the model to the measured phase durations using
+// least squares. Costs for which the samples contain no work keep the values
+// from the specified model.
+CostModel CalibrateCostModel(absl::Span<const CalibrationSample> samples,
+                             const CostModel& model = CostModel());
+
+// Returns a one-line, human-readable description of the estimate.
+std::string FormatCostEstimate(const CostEstimate& estimate);
+
+// Returns a human-readable name of the strategy.
+const char* LcsStrategyName(LcsStrategy strategy);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_COST_MODEL_H_
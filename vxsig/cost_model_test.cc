@@ -0,0 +1,129 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/cost_model.h"
+
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::DoubleNear;
+using testing::Eq;
+using testing::Ge;
+using testing::IsFalse;
+using testing::IsTrue;
+using testing::Le;
+
+namespace security::vxsig {
+namespace {
+
+TEST(CostModelTest, EstimateCommonSubsequenceCells) {
+  EXPECT_THAT(EstimateCommonSubsequenceCells({}), Eq(0));
+  EXPECT_THAT(EstimateCommonSubsequenceCells({100}), Eq(0));
+  EXPECT_THAT(EstimateCommonSubsequenceCells({100, 200}), Eq(2 * 100 * 200));
+  EXPECT_THAT(EstimateCommonSubsequenceCells({100, 300, 200}),
+              Eq(2 * 300 * 100 + 2 * 300 * 200));
+}
+
+TEST(CostModelTest, EstimateCostFromTable) {
+  MatchChainTable table;
+  for (int i = 0; i < 2; ++i) {
+    table.emplace_back(std::make_unique<MatchChainColumn>());
+  }
+  // Ten functions with three basic blocks of two instructions each.
+  for (MemoryAddress function = 0; function < 10; ++function) {
+    for (const auto& column : table) {
+      const MemoryAddress base = 0x1000 + function * 0x100;
+      auto* func = column->InsertFunctionMatch({base, base});
+      for (MemoryAddress bb = 0; bb < 3; ++bb) {
+        auto* basic_block =
+            column->InsertBasicBlockMatch(func, {base + bb * 8, base + bb * 8});
+        for (MemoryAddress instr = 0; instr < 2; ++instr) {
+          column->InsertInstructionMatch(
+              basic_block, {base + bb * 8 + instr, base + bb * 8 + instr});
+        }
+      }
+    }
+  }
+
+  CostModel model;
+  model.ns_per_ingest_byte = 10;
+  model.ns_per_lcs_cell = 2;
+  model.ns_per_regex_byte = 1000;
+  const CostEstimate estimate = EstimateCost(table, 5000, model);
+  EXPECT_THAT(estimate.ingest_bytes, Eq(5000));
+  EXPECT_THAT(estimate.function_lcs_cells, Eq(2 * 10 * 10));
+  EXPECT_THAT(estimate.basic_block_lcs_cells, Eq(2 * 30 * 30));
+  EXPECT_THAT(estimate.regex_bytes, Eq(2 * 60 * kAverageInstructionBytes));
+  EXPECT_THAT(estimate.ingest_time, Eq(absl::Microseconds(50)));
+  EXPECT_THAT(estimate.candidate_time, Eq(absl::Nanoseconds(4000)));
+  EXPECT_THAT(estimate.regex_time, Eq(absl::Microseconds(480)));
+  EXPECT_THAT(estimate.total_time(), Eq(absl::Microseconds(534)));
+}
+
+TEST(CostModelTest, PlanExecution) {
+  CostEstimate estimate;
+  estimate.ingest_time = absl::Seconds(1);
+  estimate.candidate_time = absl::Seconds(20);
+  estimate.regex_time = absl::Seconds(4);
+
+  // No target, exact LCS on all threads.
+  ExecutionPlan plan = PlanExecution(estimate, 4, absl::InfiniteDuration());
+  EXPECT_THAT(plan.parallel, IsTrue());
+  EXPECT_THAT(plan.lcs.strategy, Eq(LcsStrategy::kExact));
+  EXPECT_THAT(plan.estimated_time, Eq(absl::Seconds(12)));
+
+  // Single-threaded, a moderate target requires a few anchored segments.
+  plan = PlanExecution(estimate, 1, absl::Seconds(10));
+  EXPECT_THAT(plan.parallel, IsFalse());
+  EXPECT_THAT(plan.lcs.strategy, Eq(LcsStrategy::kAnchored));
+  EXPECT_THAT(plan.lcs.segments, Eq(4));
+  EXPECT_THAT(plan.estimated_time, Le(absl::Seconds(10)));
+
+  // Tight targets fall back to banded LCS.
+  plan = PlanExecution(estimate, 4, absl::Milliseconds(2050));
+  EXPECT_THAT(plan.lcs.strategy, Eq(LcsStrategy::kBanded));
+  EXPECT_THAT(plan.lcs.segments, Ge(200));
+
+  // Small jobs run serially.
+  CostEstimate small;
+  small.candidate_time = absl::Milliseconds(1);
+  plan = PlanExecution(small, 4, absl::InfiniteDuration());
+  EXPECT_THAT(plan.parallel, IsFalse());
+}
+
+TEST(CostModelTest, CalibrateCostModel) {
+  std::vector<CalibrationSample> samples(2);
+  samples[0].estimate.ingest_bytes = 1000;
+  samples[0].estimate.function_lcs_cells = 100;
+  samples[0].estimate.basic_block_lcs_cells = 900;
+  samples[0].summary.phases["LoadColumnData"].total_ns = 50000;
+  samples[0].summary.phases["ComputeFunctionCandidates"].total_ns = 300;
+  samples[0].summary.phases["ComputeBasicBlockCandidates"].total_ns = 2700;
+  samples[1].estimate.ingest_bytes = 3000;
+  samples[1].summary.phases["LoadColumnData"].total_ns = 150000;
+
+  CostModel model;
+  model.ns_per_regex_byte = 123;
+  const CostModel calibrated = CalibrateCostModel(samples, model);
+  EXPECT_THAT(calibrated.ns_per_ingest_byte, DoubleNear(50, 1e-9));
+  EXPECT_THAT(calibrated.ns_per_lcs_cell, DoubleNear(3, 1e-9));
+  // No regex work in the samples, keep the previous cost.
+  EXPECT_THAT(calibrated.ns_per_regex_byte, DoubleNear(123, 1e-9));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,481 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/daemon.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/notification.h"
+#include "google/protobuf/message_lite.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/executor.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/spool.h"
+#include "vxsig/trim_plan.h"
+
+namespace security::vxsig {
+namespace {
+
+// Upper bound for the size of a single message on the socket.
+constexpr uint32_t kMaxMessageSize = 1 << 30;
+
+absl::Status ErrnoStatus(absl::string_view operation) {
+  return absl::UnavailableError(
+      absl::StrCat(operation, " failed: ", strerror(errno)));
+}
+
+absl::Status WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoStatus("send()");
+    }
+    data += written;
+    size -= written;
+  }
+  return absl::OkStatus();
+}
+
+// Returns false on a clean end of stream before the first byte.
+absl::StatusOr<bool> ReadFully(int fd, char* data, size_t size) {
+  size_t total = 0;
+  while (total < size) {
+    const ssize_t bytes_read = recv(fd, data + total, size - total, 0);
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoStatus("recv()");
+    }
+    if (bytes_read == 0) {
+      if (total == 0) {
+        return false;
+      }
+      return absl::DataLossError(
+          "Connection closed in the middle of a message");
+    }
+    total += bytes_read;
+  }
+  return true;
+}
+
+absl::Status WriteMessage(int fd,
+                          const google::protobuf::MessageLite& message) {
+  const std::string data = message.SerializeAsString();
+  if (data.size() > kMaxMessageSize) {
+    return absl::InvalidArgumentError("Message too large");
+  }
+  const uint32_t size = data.size();
+  const char header[4] = {
+      static_cast<char>(size), static_cast<char>(size >> 8),
+      static_cast<char>(size >> 16), static_cast<char>(size >> 24)};
+  NA_RETURN_IF_ERROR(WriteFully(fd, header, sizeof(header)));
+  return WriteFully(fd, data.data(), data.size());
+}
+
+// Returns false on a clean end of stream.
+absl::StatusOr<bool> ReadMessage(int fd,
+                                 google::protobuf::MessageLite* message) {
+  unsigned char header[4];
+  NA_ASSIGN_OR_RETURN(bool more,
+                      ReadFully(fd, reinterpret_cast<char*>(header), 4));
+  if (!more) {
+    return false;
+  }
+  const uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) |
+                        (static_cast<uint32_t>(header[3]) << 24);
+  if (size > kMaxMessageSize) {
+    return absl::InvalidArgumentError("Message too large");
+  }
+  std::string data(size, '\0');
+  NA_ASSIGN_OR_RETURN(more, ReadFully(fd, &data[0], size));
+  if (size > 0 && !more) {
+    return absl::DataLossError(
+        "Connection closed in the middle of a message");
+  }
+  if (!message->ParseFromString(data)) {
+    return absl::InvalidArgumentError("Failed to parse message");
+  }
+  return true;
+}
+
+absl::StatusOr<sockaddr_un> MakeSocketAddress(absl::string_view socket_path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid socket path: ", socket_path));
+  }
+  memcpy(address.sun_path, socket_path.data(), socket_path.size());
+  return address;
+}
+
+// Removes a socket file left behind by a daemon that is no longer running.
+// Fails if the path is not a socket or if another daemon is listening on it.
+absl::Status RemoveStaleSocket(const sockaddr_un& address) {
+  struct stat info;
+  if (lstat(address.sun_path, &info) != 0) {
+    return errno == ENOENT ? absl::OkStatus() : ErrnoStatus("lstat()");
+  }
+  if (!S_ISSOCK(info.st_mode)) {
+    return absl::AlreadyExistsError(
+        absl::StrCat(address.sun_path, " exists and is not a socket"));
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return ErrnoStatus("socket()");
+  }
+  const bool connected =
+      connect(fd, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) == 0;
+  const int connect_errno = errno;
+  close(fd);
+  if (connected) {
+    return absl::AlreadyExistsError(
+        absl::StrCat("Another daemon is listening on ", address.sun_path));
+  }
+  if (connect_errno != ECONNREFUSED) {
+    errno = connect_errno;
+    return ErrnoStatus("connect()");
+  }
+  if (unlink(address.sun_path) != 0 && errno != ENOENT) {
+    return ErrnoStatus("unlink()");
+  }
+  return absl::OkStatus();
+}
+
+DaemonResponse MakeFailedResponse(const std::string& job_id,
+                                  const absl::Status& status) {
+  DaemonResponse response;
+  response.set_job_id(job_id);
+  response.set_state(DaemonResponse::FAILED);
+  response.set_status_code(static_cast<int>(status.code()));
+  response.set_error_message(std::string(status.message()));
+  return response;
+}
+
+}  // namespace
+
+SignatureDaemon::SignatureDaemon(DaemonOptions options)
+    : options_(std::move(options)) {
+  if (!options_.generator.input_cache) {
+    options_.generator.input_cache =
+        std::make_shared<InputCache>(options_.max_input_cache_bytes);
+  }
+  if (!options_.generator.executor) {
+    options_.generator.executor = MakeExecutor(options_.generator.num_threads);
+  }
+  if (options_.max_concurrent_jobs <= 0) {
+    options_.max_concurrent_jobs = DefaultNumThreads();
+  }
+}
+
+SignatureDaemon::~SignatureDaemon() {
+  Shutdown();
+  cancellation_.Cancel();
+  absl::MutexLock lock(&mutex_);
+  mutex_.Await(absl::Condition(this, &SignatureDaemon::IsIdle));
+}
+
+bool SignatureDaemon::IsIdle() const {
+  return running_jobs_ == 0 && open_connections_ == 0;
+}
+
+bool SignatureDaemon::CanStartJob() const {
+  return running_jobs_ < options_.max_concurrent_jobs;
+}
+
+absl::StatusOr<Spool*> SignatureDaemon::GetSpool() {
+  absl::MutexLock lock(&spool_mutex_);
+  if (!spool_) {
+    SpoolOptions spool_options;
+    spool_options.directory = options_.spool_directory;
+    if (spool_options.directory.empty()) {
+      NA_ASSIGN_OR_RETURN(spool_options.directory,
+                          GetOrCreateTempDirectory("vxsig_daemon"));
+    }
+    spool_options.max_unused_bytes = options_.max_spool_bytes;
+    NA_ASSIGN_OR_RETURN(spool_, Spool::Open(spool_options));
+  }
+  return spool_.get();
+}
+
+absl::StatusOr<int64_t> SignatureDaemon::EstimateJobMemory(
+    const BatchManifest::Job& job) {
+  absl::flat_hash_set<std::string> files;
+  for (const auto& diff : job.diff()) {
+    files.insert(diff);
+    // The BinExport files are named in the BinDiff file, like in
+    // AvSignatureGenerator.
+    std::pair<FileMetaData, FileMetaData> metadata;
+    NA_RETURN_IF_ERROR(ReadBinDiffMetaData(diff, &metadata));
+    for (const FileMetaData* file : {&metadata.first, &metadata.second}) {
+      std::string binexport =
+          JoinPath(Dirname(diff), file->filename).append(".BinExport");
+      if (FileExists(binexport)) {
+        files.insert(std::move(binexport));
+      }
+    }
+  }
+  int64_t total = 0;
+  for (const auto& file : files) {
+    NA_ASSIGN_OR_RETURN(int64_t size, GetFileSize(file));
+    total += size;
+  }
+  return total * kMemoryPerInputByte;
+}
+
+void SignatureDaemon::HandleRequest(const DaemonRequest& request,
+                                    const ResponseCallback& respond) {
+  const std::string& job_id = request.job_id();
+  absl::StatusOr<std::unique_ptr<Spool::Files>> files;
+  if (auto spool = GetSpool(); spool.ok()) {
+    files = (*spool)->Add(request);
+  } else {
+    files = spool.status();
+  }
+  if (!files.ok()) {
+    respond(MakeFailedResponse(job_id, files.status()));
+    return;
+  }
+  const BatchManifest::Job& job = (*files)->job();
+
+  const int64_t max_memory = request.max_memory_bytes() > 0
+                                 ? request.max_memory_bytes()
+                                 : options_.default_max_memory_bytes;
+  if (max_memory > 0) {
+    auto memory = EstimateJobMemory(job);
+    if (!memory.ok()) {
+      respond(MakeFailedResponse(job_id, memory.status()));
+      return;
+    }
+    if (*memory > max_memory) {
+      respond(MakeFailedResponse(
+          job_id, absl::ResourceExhaustedError(absl::StrFormat(
+                      "Job needs about %d bytes of memory, budget is %d",
+                      *memory, max_memory))));
+      return;
+    }
+  }
+
+  const absl::Time deadline =
+      absl::Now() + (request.deadline_ms() > 0
+                         ? absl::Milliseconds(request.deadline_ms())
+                         : options_.default_deadline);
+  bool started;
+  {
+    absl::MutexLock lock(&mutex_);
+    started = mutex_.AwaitWithDeadline(
+        absl::Condition(this, &SignatureDaemon::CanStartJob), deadline);
+    if (started) {
+      ++running_jobs_;
+    }
+  }
+  if (!started) {
+    respond(MakeFailedResponse(
+        job_id, absl::DeadlineExceededError("Timed out waiting for a slot")));
+    return;
+  }
+  DaemonResponse accepted;
+  accepted.set_job_id(job_id);
+  accepted.set_state(DaemonResponse::ACCEPTED);
+  respond(accepted);
+
+  // The job runs on its own thread, so that the deadline can be enforced
+  // while it is running. The state is shared with the thread, as the job
+  // outlives this function if it exceeds its deadline.
+  struct JobState {
+    absl::Notification done;
+    absl::Status status;
+    Signature signature;
+  };
+  auto state = std::make_shared<JobState>();
+  std::thread([this, state, deadline, files = *std::move(files)]() mutable {
+    state->status = GenerateJobSignature(files->job(), options_.generator,
+                                         options_.generator.input_cache,
+                                         &state->signature, deadline,
+                                         &cancellation_);
+    if (state->status.ok()) {
+      const TrimPlan plan(state->signature.raw_signature());
+      for (SignatureType format :
+           GetJobOutputFormats(BatchManifest(), files->job())) {
+        if (format == RAW) {
+          continue;
+        }
+        state->status = SignatureFormatter::Create(format)->Format(
+            &state->signature, &plan);
+        if (!state->status.ok()) {
+          break;
+        }
+      }
+    }
+    // Release the inline files before the daemon may destroy the spool.
+    files.reset();
+    state->done.Notify();
+    absl::MutexLock lock(&mutex_);
+    --running_jobs_;
+  }).detach();
+
+  if (!state->done.WaitForNotificationWithDeadline(deadline)) {
+    respond(MakeFailedResponse(
+        job_id, absl::DeadlineExceededError("Job exceeded its deadline")));
+    return;
+  }
+  if (!state->status.ok()) {
+    respond(MakeFailedResponse(job_id, state->status));
+    return;
+  }
+  DaemonResponse done;
+  done.set_job_id(job_id);
+  done.set_state(DaemonResponse::DONE);
+  *done.mutable_signature() = std::move(state->signature);
+  respond(done);
+}
+
+void SignatureDaemon::HandleConnection(int fd) {
+  for (;;) {
+    DaemonRequest request;
+    auto more = ReadMessage(fd, &request);
+    if (!more.ok() || !*more) {
+      break;
+    }
+    absl::Status write_status;
+    HandleRequest(request, [fd, &write_status](const DaemonResponse& response) {
+      if (write_status.ok()) {
+        write_status = WriteMessage(fd, response);
+      }
+    });
+    if (!write_status.ok()) {
+      break;
+    }
+  }
+  absl::MutexLock lock(&mutex_);
+  connection_fds_.erase(fd);
+  close(fd);
+  --open_connections_;
+}
+
+absl::Status SignatureDaemon::Serve(absl::string_view socket_path) {
+  NA_ASSIGN_OR_RETURN(const sockaddr_un address,
+                      MakeSocketAddress(socket_path));
+  NA_RETURN_IF_ERROR(RemoveStaleSocket(address));
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return ErrnoStatus("socket()");
+  }
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) !=
+          0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    const absl::Status status = ErrnoStatus("bind()/listen()");
+    close(fd);
+    return status;
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    if (shutdown_) {
+      close(fd);
+      return absl::OkStatus();
+    }
+    listen_fd_ = fd;
+  }
+
+  for (;;) {
+    const int connection = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (connection < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;  // Shutdown() or a fatal error
+    }
+    absl::MutexLock lock(&mutex_);
+    if (shutdown_) {
+      close(connection);
+      break;
+    }
+    connection_fds_.insert(connection);
+    ++open_connections_;
+    std::thread(&SignatureDaemon::HandleConnection, this, connection).detach();
+  }
+
+  absl::MutexLock lock(&mutex_);
+  listen_fd_ = -1;
+  close(fd);
+  unlink(address.sun_path);
+  return shutdown_ ? absl::OkStatus() : ErrnoStatus("accept()");
+}
+
+void SignatureDaemon::Shutdown() {
+  absl::MutexLock lock(&mutex_);
+  shutdown_ = true;
+  if (listen_fd_ >= 0) {
+    shutdown(listen_fd_, SHUT_RDWR);
+  }
+  // Unblocks connection threads waiting for requests. Responses of running
+  // requests are still delivered until their jobs finish.
+  for (int fd : connection_fds_) {
+    shutdown(fd, SHUT_RD);
+  }
+}
+
+absl::StatusOr<DaemonResponse> SubmitDaemonJob(
+    absl::string_view socket_path, const DaemonRequest& request,
+    const SignatureDaemon::ResponseCallback& on_response) {
+  NA_ASSIGN_OR_RETURN(const sockaddr_un address,
+                      MakeSocketAddress(socket_path));
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return ErrnoStatus("socket()");
+  }
+  auto submit = [&]() -> absl::StatusOr<DaemonResponse> {
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                sizeof(address)) != 0) {
+      return ErrnoStatus("connect()");
+    }
+    NA_RETURN_IF_ERROR(WriteMessage(fd, request));
+    for (;;) {
+      DaemonResponse response;
+      NA_ASSIGN_OR_RETURN(bool more, ReadMessage(fd, &response));
+      if (!more) {
+        return absl::UnavailableError("Daemon closed the connection");
+      }
+      if (on_response) {
+        on_response(response);
+      }
+      if (response.state() != DaemonResponse::ACCEPTED) {
+        return response;
+      }
+    }
+  };
+  auto response = submit();
+  close(fd);
+  return response;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,146 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A long-running signature generation daemon that listens on a local Unix
+// socket. Compared to spawning one process per signature, the daemon keeps
+// decoded input files and the goodware corpus in memory across jobs, so local
+// clients only pay for a request round-trip.
+// The protocol is a sequence of DaemonRequest messages from the client, each
+// answered by an ACCEPTED DaemonResponse and a final DONE or FAILED one. Every
+// message on the socket is preceded by its size as a 32-bit little endian
+// integer. A connection may be used for any number of requests.
+
+#ifndef VXSIG_DAEMON_H_
+#define VXSIG_DAEMON_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "vxsig/batch.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/input_cache.h"
+#include "vxsig/spool.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// Rough number of bytes of memory needed for each byte of input files. Used
+// to check jobs against their memory budget before running them.
+inline constexpr int kMemoryPerInputByte = 4;
+
+struct DaemonOptions {
+  // Generator settings shared by all jobs. If no input cache is set, the
+  // daemon creates one with a memory limit of max_input_cache_bytes. If no
+  // executor is set, the daemon creates one with generator.num_threads
+  // threads that all jobs run on.
+  BatchOptions generator;
+  int64_t max_input_cache_bytes = int64_t{1} << 30;
+
+  // Maximum number of jobs to run at the same time, zero selects a default.
+  int max_concurrent_jobs = 0;
+
+  // Limits for jobs that do not specify their own. A memory budget of zero
+  // means unlimited. It is checked against the estimated memory of the job
+  // alone, the shared input cache is only bounded by max_input_cache_bytes.
+  absl::Duration default_deadline = absl::Minutes(10);
+  int64_t default_max_memory_bytes = 0;
+
+  // Directory for inline files sent with requests. Defaults to a temporary
+  // directory. Only one daemon may use a spool directory at a time.
+  std::string spool_directory;
+
+  // Size limit for inline files of finished jobs, which are kept to serve
+  // repeated requests from the input cache.
+  int64_t max_spool_bytes = SpoolOptions().max_unused_bytes;
+};
+
+// This class is thread-safe.
+class SignatureDaemon {
+ public:
+  using ResponseCallback = std::function<void(const DaemonResponse&)>;
+
+  explicit SignatureDaemon(DaemonOptions options);
+
+  SignatureDaemon(const SignatureDaemon&) = delete;
+  SignatureDaemon& operator=(const SignatureDaemon&) = delete;
+
+  // Cancels all running jobs and waits for them to stop.
+  ~SignatureDaemon();
+
+  // Listens on the specified socket until Shutdown() is called. A stale
+  // socket file is replaced. Fails with an AlreadyExistsError if the path is
+  // not a socket or another daemon is listening on it.
+  absl::Status Serve(absl::string_view socket_path);
+
+  // Makes Serve() return and closes all client connections.
+  void Shutdown();
+
+  // Runs a single request and calls respond for each response. Blocks until
+  // the job is done or its deadline is exceeded. Jobs that exceed their
+  // deadline are reported as failed right away and stop in the background at
+  // their next cancellation check.
+  void HandleRequest(const DaemonRequest& request,
+                     const ResponseCallback& respond);
+
+  const InputCache& input_cache() const {
+    return *options_.generator.input_cache;
+  }
+
+ private:
+  // Returns the spool for inline files, opening it on first use.
+  absl::StatusOr<Spool*> GetSpool();
+
+  // Estimates the memory needed for a job from the sizes of its input files.
+  absl::StatusOr<int64_t> EstimateJobMemory(const BatchManifest::Job& job);
+
+  void HandleConnection(int fd);
+
+  bool IsIdle() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool CanStartJob() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  DaemonOptions options_;
+
+  absl::Mutex spool_mutex_;
+  std::unique_ptr<Spool> spool_ ABSL_GUARDED_BY(spool_mutex_);
+
+  // Cancelled on destruction to stop running jobs.
+  CancellationToken cancellation_;
+
+  mutable absl::Mutex mutex_;
+  int running_jobs_ ABSL_GUARDED_BY(mutex_) = 0;
+  int open_connections_ ABSL_GUARDED_BY(mutex_) = 0;
+  int listen_fd_ ABSL_GUARDED_BY(mutex_) = -1;
+  bool shutdown_ ABSL_GUARDED_BY(mutex_) = false;
+  absl::flat_hash_set<int> connection_fds_ ABSL_GUARDED_BY(mutex_);
+};
+
+// Sends a request to a daemon listening on the specified socket and returns
+// its final response. If on_response is set, it is called for every response,
+// including the final one.
+absl::StatusOr<DaemonResponse> SubmitDaemonJob(
+    absl::string_view socket_path, const DaemonRequest& request,
+    const SignatureDaemon::ResponseCallback& on_response = nullptr);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_DAEMON_H_
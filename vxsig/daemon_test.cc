@@ -0,0 +1,311 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/daemon.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/corpus.h"
+#include "vxsig/test_util.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::Ge;
+using testing::Gt;
+using testing::HasSubstr;
+using testing::IsEmpty;
+using testing::Lt;
+using testing::Not;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kPrimary[] =
+    "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa";
+constexpr char kSecondary[] =
+    "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82";
+
+std::string DiffName() { return absl::StrCat(kPrimary, "_vs_", kSecondary); }
+
+class DaemonTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    options_.generator.default_definition.set_detection_name("daemon_test");
+    options_.spool_directory = JoinPath(getenv("TEST_TMPDIR"), "spool");
+    ASSERT_THAT(CreateDirectories(options_.spool_directory), IsOk());
+  }
+
+  DaemonRequest MakeRequest() {
+    DaemonRequest request;
+    request.set_job_id("job");
+    request.mutable_job()->add_diff(
+        TestDataPath(absl::StrCat(DiffName(), ".BinDiff")));
+    return request;
+  }
+
+  // Runs a request directly and returns all of its responses.
+  std::vector<DaemonResponse> Run(SignatureDaemon* daemon,
+                                  const DaemonRequest& request) {
+    std::vector<DaemonResponse> responses;
+    daemon->HandleRequest(request, [&](const DaemonResponse& response) {
+      responses.push_back(response);
+    });
+    return responses;
+  }
+
+  DaemonOptions options_;
+};
+
+TEST_F(DaemonTest, KeepsInputsBetweenJobs) {
+  SignatureDaemon daemon(options_);
+  auto responses = Run(&daemon, MakeRequest());
+  ASSERT_THAT(responses.size(), Eq(2));
+  EXPECT_THAT(responses[0].state(), Eq(DaemonResponse::ACCEPTED));
+  EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::DONE));
+  EXPECT_THAT(responses[1].job_id(), Eq("job"));
+  EXPECT_THAT(responses[1].signature().yara_signature().data(),
+              HasSubstr("daemon_test"));
+  EXPECT_THAT(daemon.input_cache().hits(), Eq(0));
+
+  responses = Run(&daemon, MakeRequest());
+  ASSERT_THAT(responses.size(), Eq(2));
+  EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::DONE));
+  EXPECT_THAT(daemon.input_cache().hits(), Eq(3));
+  EXPECT_THAT(daemon.input_cache().memory_bytes(), Gt(0));
+}
+
+TEST_F(DaemonTest, LimitsInputCache) {
+  options_.max_input_cache_bytes = 0;
+  SignatureDaemon daemon(options_);
+  for (int i = 0; i < 2; ++i) {
+    auto responses = Run(&daemon, MakeRequest());
+    ASSERT_THAT(responses.size(), Eq(2));
+    EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::DONE));
+  }
+  EXPECT_THAT(daemon.input_cache().memory_bytes(), Eq(0));
+  EXPECT_THAT(daemon.input_cache().hits(), Eq(0));
+}
+
+TEST_F(DaemonTest, DecodesRewrittenInputsAgain) {
+  const std::string directory = JoinPath(getenv("TEST_TMPDIR"), "rewritten");
+  ASSERT_THAT(CreateDirectories(directory), IsOk());
+  const std::string diff_name = absl::StrCat(DiffName(), ".BinDiff");
+  const std::string binexport_name = absl::StrCat(kSecondary, ".BinExport");
+  auto copy = [&directory](const std::string& name) {
+    auto data = ReadFileContents(TestDataPath(name));
+    ASSERT_THAT(data, IsOk());
+    ASSERT_THAT(WriteFileContentsAtomically(JoinPath(directory, name), *data),
+                IsOk());
+  };
+  for (const std::string& name :
+       {diff_name, absl::StrCat(kPrimary, ".BinExport"), binexport_name}) {
+    copy(name);
+  }
+  DaemonRequest request;
+  request.set_job_id("rewritten");
+  request.mutable_job()->add_diff(JoinPath(directory, diff_name));
+
+  SignatureDaemon daemon(options_);
+  auto responses = Run(&daemon, request);
+  ASSERT_THAT(responses.size(), Eq(2));
+  EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::DONE));
+
+  // A rewritten file is not served from the cache.
+  ASSERT_THAT(WriteFileContentsAtomically(JoinPath(directory, binexport_name),
+                                          "incomplete"),
+              IsOk());
+  responses = Run(&daemon, request);
+  ASSERT_THAT(responses.size(), Eq(2));
+  EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::FAILED));
+
+  // Nor is the failure to decode it.
+  copy(binexport_name);
+  responses = Run(&daemon, request);
+  ASSERT_THAT(responses.size(), Eq(2));
+  EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::DONE));
+  EXPECT_THAT(daemon.input_cache().misses(), Eq(5));
+}
+
+TEST_F(DaemonTest, SmallBudgetsKeepCachedInputs) {
+  SignatureDaemon daemon(options_);
+  auto responses = Run(&daemon, MakeRequest());
+  ASSERT_THAT(responses.size(), Eq(2));
+  EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::DONE));
+
+  // A budget that just fits the job does not evict the inputs of others.
+  int64_t input_bytes = 0;
+  for (const std::string& name :
+       {absl::StrCat(DiffName(), ".BinDiff"),
+        absl::StrCat(kPrimary, ".BinExport"),
+        absl::StrCat(kSecondary, ".BinExport")}) {
+    auto size = GetFileSize(TestDataPath(name));
+    ASSERT_THAT(size, IsOk());
+    input_bytes += *size;
+  }
+  DaemonRequest request = MakeRequest();
+  request.set_max_memory_bytes(input_bytes * kMemoryPerInputByte);
+  responses = Run(&daemon, request);
+  ASSERT_THAT(responses.size(), Eq(2));
+  EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::DONE));
+  EXPECT_THAT(daemon.input_cache().hits(), Eq(3));
+}
+
+TEST_F(DaemonTest, EnforcesLimits) {
+  SignatureDaemon daemon(options_);
+  DaemonRequest request = MakeRequest();
+  request.set_max_memory_bytes(1);
+  auto responses = Run(&daemon, request);
+  ASSERT_THAT(responses.size(), Eq(1));
+  EXPECT_THAT(responses[0].state(), Eq(DaemonResponse::FAILED));
+  EXPECT_THAT(responses[0].status_code(),
+              Eq(static_cast<int>(absl::StatusCode::kResourceExhausted)));
+
+  // The estimate includes the BinExport files named in the BinDiff file.
+  auto diff_size = GetFileSize(request.job().diff(0));
+  ASSERT_THAT(diff_size, IsOk());
+  request.set_max_memory_bytes(*diff_size * kMemoryPerInputByte);
+  responses = Run(&daemon, request);
+  ASSERT_THAT(responses.size(), Eq(1));
+  EXPECT_THAT(responses[0].status_code(),
+              Eq(static_cast<int>(absl::StatusCode::kResourceExhausted)));
+
+  request = MakeRequest();
+  request.set_deadline_ms(1);
+  responses = Run(&daemon, request);
+  ASSERT_THAT(responses.size(), Eq(2));
+  EXPECT_THAT(responses[1].state(), Eq(DaemonResponse::FAILED));
+  EXPECT_THAT(responses[1].status_code(),
+              Eq(static_cast<int>(absl::StatusCode::kDeadlineExceeded)));
+}
+
+TEST_F(DaemonTest, ServesInlineFilesOverSocket) {
+  DaemonRequest request;
+  request.set_job_id("inline");
+  for (const std::string& name :
+       {absl::StrCat(DiffName(), ".BinDiff"),
+        absl::StrCat(kPrimary, ".BinExport"),
+        absl::StrCat(kSecondary, ".BinExport")}) {
+    auto data = ReadFileContents(TestDataPath(name));
+    ASSERT_THAT(data, IsOk());
+    auto* file = request.add_inline_file();
+    file->set_name(name);
+    file->set_data(*std::move(data));
+  }
+  request.mutable_job()->add_diff(absl::StrCat(DiffName(), ".BinDiff"));
+
+  // Do not keep the inline files of finished jobs.
+  options_.max_spool_bytes = 0;
+  SignatureDaemon daemon(options_);
+  const std::string socket_path =
+      JoinPath(getenv("TEST_TMPDIR"), "daemon_test.sock");
+  absl::Status serve_status;
+  std::thread server([&]() { serve_status = daemon.Serve(socket_path); });
+
+  // The daemon may not be listening yet.
+  absl::StatusOr<DaemonResponse> response;
+  for (int i = 0; i < 100; ++i) {
+    response = SubmitDaemonJob(socket_path, request);
+    if (response.ok()) {
+      break;
+    }
+    absl::SleepFor(absl::Milliseconds(50));
+  }
+  ASSERT_THAT(response, IsOk());
+  EXPECT_THAT(response->state(), Eq(DaemonResponse::DONE));
+  EXPECT_THAT(response->signature().yara_signature().data(), Not(IsEmpty()));
+  EXPECT_THAT(response->signature().raw_signature().piece_size(), Gt(0));
+  std::vector<std::string> spooled;
+  ASSERT_THAT(GetDirectoryEntries(options_.spool_directory, &spooled), IsOk());
+  EXPECT_THAT(spooled, IsEmpty());
+
+  // Inline file names must not escape the spool directory.
+  request.mutable_inline_file(0)->set_name("../escape.BinDiff");
+  response = SubmitDaemonJob(socket_path, request);
+  ASSERT_THAT(response, IsOk());
+  EXPECT_THAT(response->state(), Eq(DaemonResponse::FAILED));
+
+  daemon.Shutdown();
+  server.join();
+  EXPECT_THAT(serve_status, IsOk());
+}
+
+TEST_F(DaemonTest, ReplacesOnlyStaleSockets) {
+  const std::string socket_path =
+      JoinPath(getenv("TEST_TMPDIR"), "stale_test.sock");
+  ASSERT_THAT(WriteFileContentsAtomically(socket_path, "not a socket"),
+              IsOk());
+  SignatureDaemon daemon(options_);
+  EXPECT_THAT(daemon.Serve(socket_path).code(),
+              Eq(absl::StatusCode::kAlreadyExists));
+  auto contents = ReadFileContents(socket_path);
+  ASSERT_THAT(contents, IsOk());
+  EXPECT_THAT(*contents, Eq("not a socket"));
+
+  // Leave a socket behind that nobody listens on.
+  ASSERT_THAT(remove(socket_path.c_str()), Eq(0));
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  ASSERT_THAT(socket_path.size(), Lt(sizeof(address.sun_path)));
+  memcpy(address.sun_path, socket_path.data(), socket_path.size());
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  ASSERT_THAT(fd, Ge(0));
+  ASSERT_THAT(bind(fd, reinterpret_cast<const sockaddr*>(&address),
+                   sizeof(address)),
+              Eq(0));
+  close(fd);
+
+  absl::Status serve_status;
+  std::thread server([&]() { serve_status = daemon.Serve(socket_path); });
+  absl::StatusOr<DaemonResponse> response;
+  for (int i = 0; i < 100; ++i) {
+    response = SubmitDaemonJob(socket_path, MakeRequest());
+    if (response.ok()) {
+      break;
+    }
+    absl::SleepFor(absl::Milliseconds(50));
+  }
+  ASSERT_THAT(response, IsOk());
+  EXPECT_THAT(response->state(), Eq(DaemonResponse::DONE));
+
+  // A second daemon does not take over the socket.
+  SignatureDaemon second_daemon(options_);
+  EXPECT_THAT(second_daemon.Serve(socket_path).code(),
+              Eq(absl::StatusCode::kAlreadyExists));
+  response = SubmitDaemonJob(socket_path, MakeRequest());
+  ASSERT_THAT(response, IsOk());
+  EXPECT_THAT(response->state(), Eq(DaemonResponse::DONE));
+
+  daemon.Shutdown();
+  server.join();
+  EXPECT_THAT(serve_status, IsOk());
+}
+
+}  // namespace
+}  // namespace security::vxsig
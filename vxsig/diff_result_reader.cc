@@ -24,6 +24,7 @@
 #include "absl/strings/string_view.h"
 #include "absl/strings/substitute.h"
 #include "third_party/sqlite/sqlite3.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
 
 namespace security::vxsig {
 
@@ -50,47 +51,23 @@ Sqlite3Closer::~Sqlite3Closer() {
   sqlite3_close(handle);
 }
 
-absl::Status ParseBinDiff(
-    absl::string_view filename,
-    const MatchReceiverCallback& function_match_receiver,
-    const MatchReceiverCallback& basic_block_match_receiver,
-    const MatchReceiverCallback& instruction_match_receiver,
-    std::pair<FileMetaData, FileMetaData>* metadata) {
-  if (filename.empty()) {
-    return absl::InvalidArgumentError("Empty BinDiff filename");
-  }
+namespace {
 
+// Queries the metadata of the primary and secondary file of an open BinDiff
+// result file and, if similarity is non-null, the overall similarity. If
+// metadata is null, only checks that it is present.
+absl::Status QueryFileMetaData(
+    sqlite3* db, absl::string_view filename,
+    std::pair<FileMetaData, FileMetaData>* metadata,
+    DiffSimilarity* similarity) {
   const char* query =
-      "SELECT file1, file2 FROM \"metadata\";"
-      "SELECT filename, exefilename, hash FROM \"file\" WHERE id=:file;"
-      "SELECT"
-      " f.id, f.address1, f.address2,"
-      " b.id, b.address1, b.address2,"
-      " i.address1, i.address2 "
-      "FROM"
-      " \"function\" AS f,"
-      " \"basicblock\" AS b,"
-      " \"instruction\" AS i "
-      "WHERE"
-      " f.id = b.functionid AND"
-      " b.id = i.basicblockid "
-      "ORDER BY"
-      " f.id, f.address1, f.address2,"
-      " b.id, b.address1, b.address2,"
-      " i.address1, i.address2;";
-  enum { kNumMatchCols = 8 };
-
-  // Open database file without VFS (last argument of sqlite_open_v2).
-  Sqlite3Closer db;
-  if (sqlite3_open_v2(std::string(filename).c_str(), &db.handle,
-                      SQLITE_OPEN_READONLY, nullptr)) {
-    return absl::FailedPreconditionError(
-        absl::StrCat("SQLite open failed for ", filename));
-  }
+      "SELECT file1, file2, similarity, confidence FROM \"metadata\";"
+      "SELECT filename, exefilename, hash, functions, basicblocks, "
+      "instructions FROM \"file\" WHERE id=:file;";
 
   // Get file IDs.
   sqlite3_stmt* stmt;
-  if (sqlite3_prepare_v2(db.handle, query, strlen(query), &stmt, &query) !=
+  if (sqlite3_prepare_v2(db, query, strlen(query), &stmt, &query) !=
           SQLITE_OK ||
       sqlite3_step(stmt) != SQLITE_ROW) {
     return absl::InternalError(absl::StrCat(
@@ -99,13 +76,17 @@ absl::Status ParseBinDiff(
 
   int file1_id = sqlite3_column_int(stmt, 0);
   int file2_id = sqlite3_column_int(stmt, 1);
+  if (similarity != nullptr) {
+    similarity->similarity = sqlite3_column_double(stmt, 2);
+    similarity->confidence = sqlite3_column_double(stmt, 3);
+  }
   if (sqlite3_finalize(stmt) != SQLITE_OK) {
     return absl::InternalError(
         absl::StrCat("SQLite finalize statement failed, file: ", filename));
   }
 
   // Query metadata for primary and secondary file.
-  if (sqlite3_prepare_v2(db.handle, query, strlen(query), &stmt, &query) !=
+  if (sqlite3_prepare_v2(db, query, strlen(query), &stmt, &query) !=
           SQLITE_OK ||
       sqlite3_bind_int(stmt, 1, file1_id) != SQLITE_OK ||
       sqlite3_step(stmt) != SQLITE_ROW) {
@@ -120,6 +101,9 @@ absl::Status ParseBinDiff(
         reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
     metadata->first.original_hash.assign(
         reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
+    metadata->first.num_functions = sqlite3_column_int(stmt, 3);
+    metadata->first.num_basic_blocks = sqlite3_column_int(stmt, 4);
+    metadata->first.num_instructions = sqlite3_column_int(stmt, 5);
     sqlite3_reset(stmt);
     if (sqlite3_bind_int(stmt, 1, file2_id) != SQLITE_OK ||
         sqlite3_step(stmt) != SQLITE_ROW) {
@@ -134,19 +118,77 @@ absl::Status ParseBinDiff(
         reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
     metadata->second.original_hash.assign(
         reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
+    metadata->second.num_functions = sqlite3_column_int(stmt, 3);
+    metadata->second.num_basic_blocks = sqlite3_column_int(stmt, 4);
+    metadata->second.num_instructions = sqlite3_column_int(stmt, 5);
   }
   if (sqlite3_finalize(stmt) != SQLITE_OK) {
     return absl::InternalError(
         absl::StrCat("SQLite finalize statement failed for ", filename));
   }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status ParseBinDiff(
+    absl::string_view filename,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    std::pair<FileMetaData, FileMetaData>* metadata,
+    const StopCondition* stop) {
+  if (filename.empty()) {
+    return absl::InvalidArgumentError("Empty BinDiff filename");
+  }
+
+  const char* query =
+      "SELECT"
+      " f.id, f.address1, f.address2,"
+      " b.id, b.address1, b.address2,"
+      " i.address1, i.address2 "
+      "FROM"
+      " \"function\" AS f,"
+      " \"basicblock\" AS b,"
+      " \"instruction\" AS i "
+      "WHERE"
+      " f.id = b.functionid AND"
+      " b.id = i.basicblockid "
+      "ORDER BY"
+      " f.id, f.address1, f.address2,"
+      " b.id, b.address1, b.address2,"
+      " i.address1, i.address2;";
+  enum { kNumMatchCols = 8 };
+
+  // Open database file without VFS (last argument of sqlite_open_v2).
+  Sqlite3Closer db;
+  if (sqlite3_open_v2(std::string(filename).c_str(), &db.handle,
+                      SQLITE_OPEN_READONLY, nullptr)) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("SQLite open failed for ", filename));
+  }
+  NA_RETURN_IF_ERROR(QueryFileMetaData(db.handle, filename, metadata,
+                                       /*similarity=*/nullptr));
 
   // Query function matches.
+  sqlite3_stmt* stmt;
   if (sqlite3_prepare_v2(db.handle, query, strlen(query), &stmt, nullptr)) {
     return absl::InternalError(absl::StrCat(
         "SQLite prepare statement failed querying function matches, file: ",
         filename));
   }
 
+  // Sorting the matches can take a while for large diffs, so let SQLite check
+  // the stop condition while it executes the query.
+  if (stop != nullptr) {
+    sqlite3_progress_handler(
+        db.handle, kStopCheckInterval,
+        [](void* stop) -> int {
+          return static_cast<const StopCondition*>(stop)->ShouldStop();
+        },
+        const_cast<StopCondition*>(stop));
+  }
+
   int32_t last_function_id = -1;
   int32_t last_basic_block_id = -1;
   MemoryAddressPair function_match, basic_block_match, instruction_match;
@@ -158,6 +200,9 @@ absl::Status ParseBinDiff(
     }
     if (result != SQLITE_ROW) {
       sqlite3_finalize(stmt);
+      if (result == SQLITE_INTERRUPT && stop != nullptr) {
+        return stop->status();
+      }
       return absl::FailedPreconditionError(absl::Substitute(
           "SQLite result error: $0, file $1", result, filename));
     }
@@ -193,4 +238,20 @@ absl::Status ParseBinDiff(
   return absl::OkStatus();
 }
 
+absl::Status ReadBinDiffMetaData(
+    absl::string_view filename,
+    std::pair<FileMetaData, FileMetaData>* metadata,
+    DiffSimilarity* similarity) {
+  if (filename.empty()) {
+    return absl::InvalidArgumentError("Empty BinDiff filename");
+  }
+  Sqlite3Closer db;
+  if (sqlite3_open_v2(std::string(filename).c_str(), &db.handle,
+                      SQLITE_OPEN_READONLY, nullptr)) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("SQLite open failed for ", filename));
+  }
+  return QueryFileMetaData(db.handle, filename, metadata, similarity);
+}
+
 }  // namespace security::vxsig
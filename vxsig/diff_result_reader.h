@@ -23,6 +23,7 @@
 
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "vxsig/cancellation.h"
 #include "vxsig/types.h"
 
 namespace security::vxsig {
@@ -33,6 +34,17 @@ struct FileMetaData {
   std::string filename;
   std::string original_filename;
   std::string original_hash;
+
+  // Sizes of the file as recorded by BinDiff.
+  int num_functions = 0;
+  int num_basic_blocks = 0;
+  int num_instructions = 0;
+};
+
+// Overall similarity and confidence of a BinDiff result, both in [0, 1].
+struct DiffSimilarity {
+  double similarity = 0;
+  double confidence = 0;
 };
 
 // Whenever a match is encountered, this callback gets called with its
@@ -44,12 +56,22 @@ using MatchReceiverCallback = std::function<void(const MemoryAddressPair&)>;
 // non-null, it is filled with metadata that is stored in the BinDiff result
 // file.
 // Requires the callbacks to be a permanent ones and takes ownership.
+// If a stop condition is specified and met while reading, returns its status.
 absl::Status ParseBinDiff(
     absl::string_view filename,
     const MatchReceiverCallback& function_match_receiver,
     const MatchReceiverCallback& basic_block_match_receiver,
     const MatchReceiverCallback& instruction_match_receiver,
-    std::pair<FileMetaData, FileMetaData>* metadata);
+    std::pair<FileMetaData, FileMetaData>* metadata,
+    const StopCondition* stop = nullptr);
+
+// Reads only the metadata of the specified .BinDiff file, without parsing the
+// matches. If similarity is non-null, it is filled with the overall similarity
+// of the two files.
+absl::Status ReadBinDiffMetaData(
+    absl::string_view filename,
+    std::pair<FileMetaData, FileMetaData>* metadata,
+    DiffSimilarity* similarity = nullptr);
 
 }  // namespace security::vxsig
 
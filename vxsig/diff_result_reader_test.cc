@@ -28,6 +28,7 @@
 
 using not_absl::IsOk;
 using testing::Contains;
+using testing::DoubleNear;
 using testing::Eq;
 using testing::IsTrue;
 
@@ -582,5 +583,28 @@ TEST_F(DiffResultReaderTest, ParseWithMetadata) {
               Eq("86781CF0DF581B166A9ACAE32373BEB465704B54"));
 }
 
+TEST_F(DiffResultReaderTest, ReadMetadataOnly) {
+  std::string file_name = JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/sshd.korg_vs_sshd.trojan1.BinDiff");
+  ASSERT_THAT(FileExists(file_name), IsTrue());
+
+  std::pair<FileMetaData, FileMetaData> meta;
+  DiffSimilarity similarity;
+  EXPECT_THAT(ReadBinDiffMetaData(file_name, &meta, &similarity), IsOk());
+  EXPECT_THAT(similarity.similarity, DoubleNear(0.4747, 1e-4));
+  EXPECT_THAT(similarity.confidence, DoubleNear(0.9763, 1e-4));
+  EXPECT_THAT(meta.first.filename, Eq("sshd.korg"));
+  EXPECT_THAT(meta.first.original_hash,
+              Eq("F705209F5671A2F85336717908007769B9FAFE54"));
+  EXPECT_THAT(meta.second.filename, Eq("sshd.trojan1"));
+  EXPECT_THAT(meta.second.original_hash,
+              Eq("86781CF0DF581B166A9ACAE32373BEB465704B54"));
+  EXPECT_THAT(meta.first.num_functions, Eq(417));
+  EXPECT_THAT(meta.first.num_basic_blocks, Eq(257));
+  EXPECT_THAT(meta.first.num_instructions, Eq(2158));
+  EXPECT_THAT(meta.second.num_instructions, Eq(2841));
+}
+
 }  // namespace
 }  // namespace security::vxsig
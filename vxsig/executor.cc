@@ -0,0 +1,194 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/executor.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "absl/memory/memory.h"
+
+namespace security::vxsig {
+namespace {
+
+class InlineExecutor : public Executor {
+ public:
+  int num_threads() const override { return 1; }
+  void Schedule(std::function<void()> fn) override { fn(); }
+};
+
+// The pool and queue index of the current thread, if it is a pool thread.
+thread_local const WorkStealingExecutor* current_executor = nullptr;
+thread_local int current_queue = -1;
+
+}  // namespace
+
+int DefaultNumThreads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void Executor::ParallelFor(int64_t num_items,
+                           const std::function<void(int64_t)>& fn) {
+  const int num_workers =
+      static_cast<int>(std::min<int64_t>(num_threads(), num_items));
+  if (num_workers <= 1) {
+    for (int64_t i = 0; i < num_items; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  // Helper tasks may start after all items are done and this function has
+  // returned, so they share ownership of the state. They never call fn once
+  // all items have been handed out.
+  struct State {
+    bool Done() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex) {
+      return items_done == num_items;
+    }
+
+    const int64_t num_items;
+    std::atomic<int64_t> next_item{0};
+    absl::Mutex mutex;
+    int64_t items_done ABSL_GUARDED_BY(mutex) = 0;
+  };
+  auto state = std::shared_ptr<State>(new State{num_items});
+  auto work = [state, &fn]() {
+    int64_t items_done = 0;
+    for (int64_t i = state->next_item++; i < state->num_items;
+         i = state->next_item++) {
+      fn(i);
+      ++items_done;
+    }
+    if (items_done > 0) {
+      absl::MutexLock lock(&state->mutex);
+      state->items_done += items_done;
+    }
+  };
+  for (int i = 1; i < num_workers; ++i) {
+    Schedule(work);
+  }
+  work();
+
+  // Only items that another thread is already running can be outstanding, so
+  // this cannot deadlock even if all pool threads are waiting here.
+  absl::MutexLock lock(&state->mutex);
+  state->mutex.Await(absl::Condition(state.get(), &State::Done));
+}
+
+Executor* GetInlineExecutor() {
+  static auto* executor = new InlineExecutor();
+  return executor;
+}
+
+WorkStealingExecutor::WorkStealingExecutor(int num_threads)
+    : num_threads_(num_threads > 0 ? num_threads : DefaultNumThreads()) {
+  const int num_pool_threads = num_threads_ - 1;
+  queues_.reserve(num_pool_threads);
+  for (int i = 0; i < num_pool_threads; ++i) {
+    queues_.push_back(absl::make_unique<TaskQueue>());
+  }
+  threads_.reserve(num_pool_threads);
+  for (int i = 0; i < num_pool_threads; ++i) {
+    threads_.emplace_back(&WorkStealingExecutor::WorkerLoop, this, i);
+  }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkStealingExecutor::Schedule(std::function<void()> fn) {
+  if (queues_.empty()) {
+    fn();
+    return;
+  }
+  const int index = current_executor == this
+                        ? current_queue
+                        : next_queue_++ % static_cast<uint32_t>(queues_.size());
+  {
+    auto& queue = *queues_[index];
+    absl::MutexLock lock(&queue.mutex);
+    queue.tasks.push_back(std::move(fn));
+  }
+  absl::MutexLock lock(&mutex_);
+  ++pending_;
+}
+
+bool WorkStealingExecutor::PopOrSteal(int index, std::function<void()>* task) {
+  {
+    auto& own = *queues_[index];
+    absl::MutexLock lock(&own.mutex);
+    if (!own.tasks.empty()) {
+      *task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  const int num_queues = queues_.size();
+  for (int i = 1; i < num_queues; ++i) {
+    auto& other = *queues_[(index + i) % num_queues];
+    absl::MutexLock lock(&other.mutex);
+    if (!other.tasks.empty()) {
+      *task = std::move(other.tasks.front());
+      other.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingExecutor::WorkerLoop(int index) {
+  current_executor = this;
+  current_queue = index;
+  for (;;) {
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(this, &WorkStealingExecutor::HasWork));
+      if (pending_ == 0) {
+        return;  // Stopping and all tasks are done
+      }
+      // Commits to running one task. Tasks are queued before they are
+      // counted, so there is always one to find.
+      --pending_;
+    }
+    std::function<void()> task;
+    while (!PopOrSteal(index, &task)) {
+      std::this_thread::yield();
+    }
+    task();
+  }
+}
+
+std::shared_ptr<Executor> MakeExecutor(int num_threads) {
+  if (num_threads == 1) {
+    return std::shared_ptr<Executor>(GetInlineExecutor(), [](Executor*) {});
+  }
+  return std::make_shared<WorkStealingExecutor>(num_threads);
+}
+
+std::shared_ptr<Executor> GetOrMakeExecutor(Executor* executor,
+                                            int num_threads) {
+  if (executor) {
+    return std::shared_ptr<Executor>(executor, [](Executor*) {});
+  }
+  return MakeExecutor(num_threads);
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,119 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Executors schedule the parallel parts of signature generation. They can be
+// shared between generators, so that all work of a process runs on a single
+// set of threads instead of each component starting its own.
+
+#ifndef VXSIG_EXECUTOR_H_
+#define VXSIG_EXECUTOR_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace security::vxsig {
+
+// Returns the number of threads to use if the caller did not specify any.
+int DefaultNumThreads();
+
+class Executor {
+ public:
+  virtual ~Executor() = default;
+
+  // Number of threads that run tasks concurrently, including the thread that
+  // calls ParallelFor().
+  virtual int num_threads() const = 0;
+
+  // Runs fn at some point, possibly on the calling thread.
+  virtual void Schedule(std::function<void()> fn) = 0;
+
+  // Calls fn(i) for each i in [0, num_items) and returns once all calls are
+  // done. The calling thread takes part in the work, so calls may be nested.
+  // Iterations may run in any order and must not interfere with each other.
+  void ParallelFor(int64_t num_items, const std::function<void(int64_t)>& fn);
+};
+
+// Returns an executor that runs everything on the calling thread.
+Executor* GetInlineExecutor();
+
+// A thread pool with one task queue per thread. Threads take tasks from the
+// back of their own queue and steal from the front of the other queues when
+// theirs is empty. Tasks scheduled from a pool thread go to its own queue,
+// which keeps nested work local to a thread.
+// This class is thread-safe.
+class WorkStealingExecutor : public Executor {
+ public:
+  // Uses num_threads - 1 pool threads, as the calling thread participates in
+  // ParallelFor(). Zero selects DefaultNumThreads().
+  explicit WorkStealingExecutor(int num_threads = 0);
+
+  WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+  WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+  // Runs all scheduled tasks before returning.
+  ~WorkStealingExecutor() override;
+
+  int num_threads() const override { return num_threads_; }
+
+  void Schedule(std::function<void()> fn) override;
+
+ private:
+  struct TaskQueue {
+    absl::Mutex mutex;
+    std::deque<std::function<void()>> tasks ABSL_GUARDED_BY(mutex);
+  };
+
+  // Takes a task from the queue of the specified thread or steals one from
+  // the other queues.
+  bool PopOrSteal(int index, std::function<void()>* task);
+
+  void WorkerLoop(int index);
+
+  bool HasWork() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return pending_ > 0 || stopping_;
+  }
+
+  const int num_threads_;
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<uint32_t> next_queue_{0};
+
+  absl::Mutex mutex_;
+  // Number of scheduled tasks that no thread has committed to run yet.
+  int64_t pending_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool stopping_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+// Returns an executor for the specified number of threads: the inline
+// executor for one thread, a new WorkStealingExecutor otherwise. Zero selects
+// DefaultNumThreads(). The inline executor is returned with a no-op deleter.
+std::shared_ptr<Executor> MakeExecutor(int num_threads);
+
+// Returns the executor with a no-op deleter if it is set, or
+// MakeExecutor(num_threads) otherwise. For components that take an optional
+// executor and a number of threads to use without one.
+std::shared_ptr<Executor> GetOrMakeExecutor(Executor* executor,
+                                            int num_threads);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_EXECUTOR_H_
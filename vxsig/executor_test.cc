@@ -0,0 +1,103 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/executor.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "vxsig/common_subsequence.h"
+
+using testing::ElementsAreArray;
+using testing::Eq;
+
+namespace security::vxsig {
+namespace {
+
+TEST(ExecutorTest, ParallelForVisitsEachItemOnce) {
+  for (int num_threads : {1, 2, 4, 7}) {
+    WorkStealingExecutor executor(num_threads);
+    EXPECT_THAT(executor.num_threads(), Eq(num_threads));
+    std::vector<std::atomic<int>> visits(1000);
+    executor.ParallelFor(visits.size(), [&](int64_t i) { ++visits[i]; });
+    for (const auto& count : visits) {
+      EXPECT_THAT(count.load(), Eq(1));
+    }
+  }
+}
+
+TEST(ExecutorTest, NestedParallelFor) {
+  WorkStealingExecutor executor(4);
+  std::vector<int> sums(16);
+  executor.ParallelFor(sums.size(), [&](int64_t i) {
+    std::vector<int> values(100);
+    executor.ParallelFor(values.size(),
+                         [&](int64_t j) { values[j] = static_cast<int>(i); });
+    for (int value : values) {
+      sums[i] += value;
+    }
+  });
+  for (int i = 0; i < sums.size(); ++i) {
+    EXPECT_THAT(sums[i], Eq(100 * i));
+  }
+}
+
+TEST(ExecutorTest, RunsScheduledTasksBeforeDestruction) {
+  std::atomic<int> num_run(0);
+  {
+    WorkStealingExecutor executor(3);
+    for (int i = 0; i < 100; ++i) {
+      executor.Schedule([&num_run]() { ++num_run; });
+    }
+  }
+  EXPECT_THAT(num_run.load(), Eq(100));
+}
+
+TEST(ExecutorTest, InlineExecutor) {
+  Executor* executor = GetInlineExecutor();
+  EXPECT_THAT(executor->num_threads(), Eq(1));
+  std::vector<int64_t> order;
+  executor->ParallelFor(5, [&](int64_t i) { order.push_back(i); });
+  EXPECT_THAT(order, ElementsAreArray({0, 1, 2, 3, 4}));
+}
+
+TEST(ExecutorTest, CommonSubsequenceIndependentOfThreadCount) {
+  // Long enough sequences so that the LCS is computed in parallel.
+  std::vector<std::string> sequences;
+  uint32_t state = 42;
+  for (int i = 0; i < 5; ++i) {
+    std::string sequence;
+    for (int j = 0; j < 3000; ++j) {
+      state = state * 1103515245 + 12345;
+      sequence.push_back('a' + (state >> 16) % 4);
+    }
+    sequences.push_back(sequence);
+  }
+  std::string expected;
+  CommonSubsequence(sequences, std::back_inserter(expected));
+  for (int num_threads = 1; num_threads <= 8; ++num_threads) {
+    WorkStealingExecutor executor(num_threads);
+    std::string result;
+    CommonSubsequence(sequences, std::back_inserter(result), &executor);
+    EXPECT_THAT(result, Eq(expected)) << num_threads << " threads";
+  }
+}
+
+}  // namespace
+}  // namespace security::vxsig
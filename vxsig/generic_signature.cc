@@ -16,6 +16,7 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
 #include <string>
 #include <vector>
@@ -25,6 +26,7 @@
 #include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
 #include "vxsig/common_subsequence.h"
 #include "vxsig/subsequence_regex.h"
 
@@ -206,7 +208,8 @@ void PenalizeShortAtoms(int min_piece_length, ByteWithExtraString* regex) {
 
 absl::StatusOr<RawSignature> GenericSignatureFromMatches(
     const MatchChainTable& table, const IdentSequence& bb_candidate_ids,
-    bool disable_nibble_masking, int min_piece_length) {
+    bool disable_nibble_masking, int min_piece_length, Executor* executor,
+    const StopCondition* stop, RawSignature* partial) {
   if (bb_candidate_ids.empty()) {
     return absl::InvalidArgumentError("Empty basic block candidate list");
   }
@@ -215,16 +218,15 @@ absl::StatusOr<RawSignature> GenericSignatureFromMatches(
         "Minimum piece length must be at least 1");
   }
 
-  ByteWithExtraString regex;
-
   // Helper function to insert bounded inter-basic-block wildcards into the raw
   // signature. Currently, bounded wildcards are not used.
   WildcardInserter<ByteWithExtraStringBackInserter> insert_wildcard([](
       size_t /*min_qualifier*/, size_t /*max_qualifier*/,
       ByteWithExtraStringBackInserter result) { *result++ = kWildcardByte; });
 
-  // Iterate over all basic block candidates.
-  for (const auto& bb_id : bb_candidate_ids) {
+  // Computes the regex for a single basic block candidate.
+  auto per_bb_regex_for_candidate =
+      [&](Ident bb_id, ByteWithExtraString* per_bb_regex) -> absl::Status {
     std::vector<ByteWithExtraString> bb_sequences;
     bb_sequences.reserve(table.size());
 
@@ -266,12 +268,51 @@ absl::StatusOr<RawSignature> GenericSignatureFromMatches(
     }
 
     ByteWithExtraString bb_cs;
-    CommonSubsequence(bb_sequences, std::back_inserter(bb_cs));
+    LcsOptions lcs_options;
+    lcs_options.stop = stop;
+    CommonSubsequence(bb_sequences, std::back_inserter(bb_cs),
+                      /*executor=*/nullptr, lcs_options);
+    if (ShouldStop(stop)) {
+      return stop->status();
+    }
 
-    ByteWithExtraString per_bb_regex;
     RegexFromSubsequence(bb_cs.begin(), bb_cs.end(), bb_sequences,
-                         insert_wildcard, std::back_inserter(per_bb_regex));
+                         insert_wildcard, std::back_inserter(*per_bb_regex));
+    return absl::OkStatus();
+  };
+
+  // Basic blocks are independent of each other, so they can be processed in
+  // any order. Results are combined in candidate order.
+  const int64_t num_candidates = bb_candidate_ids.size();
+  std::vector<ByteWithExtraString> per_bb_regexes(num_candidates);
+  std::vector<absl::Status> statuses(num_candidates);
+  auto process_candidate = [&](int64_t i) {
+    statuses[i] =
+        ShouldStop(stop)
+            ? stop->status()
+            : per_bb_regex_for_candidate(bb_candidate_ids[i],
+                                         &per_bb_regexes[i]);
+  };
+  if (executor != nullptr) {
+    executor->ParallelFor(num_candidates, process_candidate);
+  } else {
+    for (int64_t i = 0; i < num_candidates; ++i) {
+      process_candidate(i);
+    }
+  }
 
+  // Basic blocks that were not finished due to the stop condition are left
+  // out, so that a partial signature can be returned.
+  absl::Status stop_status;
+  ByteWithExtraString regex;
+  for (int64_t i = 0; i < num_candidates; ++i) {
+    if (stop != nullptr && (absl::IsCancelled(statuses[i]) ||
+                            absl::IsDeadlineExceeded(statuses[i]))) {
+      stop_status = statuses[i];
+      continue;
+    }
+    NA_RETURN_IF_ERROR(statuses[i]);
+    const auto& per_bb_regex = per_bb_regexes[i];
     if (!regex.empty() && regex.back().type != ByteWithExtra::kWildcard) {
       regex.push_back(kWildcardByte);
     }
@@ -281,6 +322,12 @@ absl::StatusOr<RawSignature> GenericSignatureFromMatches(
   }
 
   PenalizeShortAtoms(min_piece_length, &regex);
+  if (!stop_status.ok()) {
+    if (partial != nullptr) {
+      *partial = ToRawSignatureProto(regex);
+    }
+    return stop_status;
+  }
   return ToRawSignatureProto(regex);
 }
 
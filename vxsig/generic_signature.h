@@ -19,6 +19,8 @@
 #define VXSIG_GENERIC_SIGNATURE_H_
 
 #include "absl/status/statusor.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/executor.h"
 #include "vxsig/match_chain_table.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
@@ -36,9 +38,16 @@ namespace security::vxsig {
 // setting their respective weights to zero. This is done, so that constructs
 // like "[-] XX ?? ?? ?? ??" (Yara syntax) are less likely to be included in the
 // final signature.
+// If an executor is specified, the basic blocks are processed in parallel. The
+// result does not depend on the executor.
+// If a stop condition is specified and met, returns its status. In that case,
+// a best-effort signature made from the basic blocks finished until then is
+// stored in partial, if non-null.
 absl::StatusOr<RawSignature> GenericSignatureFromMatches(
     const MatchChainTable& table, const IdentSequence& bb_candidate_ids,
-    bool disable_nibble_masking, int min_piece_length);
+    bool disable_nibble_masking, int min_piece_length,
+    Executor* executor = nullptr, const StopCondition* stop = nullptr,
+    RawSignature* partial = nullptr);
 
 // Returns the size of the signature in bytes. It is defined as the sum of the
 // sizes of all signature pieces in the raw signature data.
@@ -18,14 +18,18 @@
 #include <utility>
 
 #include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/time/time.h"
 #include "base/logging.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/cancellation.h"
 #include "vxsig/vxsig.pb.h"
 
 using not_absl::IsOk;
 using testing::Eq;
+using testing::IsTrue;
 using testing::SizeIs;
 
 namespace security::vxsig {
@@ -154,4 +158,24 @@ TEST_F(GenericSignatureTest,
   }
 }
 
+TEST_F(GenericSignatureTest, StopsWhenCancelled) {
+  IdentSequence bb_cand_ids{1, 2, 3, 4, 5};
+  CancellationToken token;
+  const StopCondition stop(absl::InfiniteFuture(), &token);
+  RawSignature partial;
+  auto signature_or = GenericSignatureFromMatches(
+      table_, bb_cand_ids, /*disable_nibble_masking=*/true,
+      /*min_piece_length=*/4, /*executor=*/nullptr, &stop, &partial);
+  ASSERT_THAT(signature_or, IsOk());
+  EXPECT_THAT(signature_or->piece_size(), Eq(5));
+
+  token.Cancel();
+  signature_or = GenericSignatureFromMatches(
+      table_, bb_cand_ids, /*disable_nibble_masking=*/true,
+      /*min_piece_length=*/4, /*executor=*/nullptr, &stop, &partial);
+  EXPECT_THAT(absl::IsCancelled(signature_or.status()), IsTrue());
+  // No basic block was finished before the cancellation.
+  EXPECT_THAT(partial.piece_size(), Eq(0));
+}
+
 }  // namespace security::vxsig
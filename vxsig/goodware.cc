@@ -0,0 +1,278 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/goodware.h"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/executor.h"
+#include "vxsig/scan_cost.h"
+#include "vxsig/signature_formatter.h"
+
+namespace security::vxsig {
+namespace {
+
+// Minimum piece length of the supported signature engines. Both Yara and
+// ClamAV use a value of 2.
+constexpr int kEngineMinPieceLength = 2;
+
+// Returns the n-gram starting at data[pos], packed into an integer.
+uint64_t PackNgram(absl::string_view data, size_t pos, int ngram_length) {
+  uint64_t ngram = 0;
+  for (int i = ngram_length - 1; i >= 0; --i) {
+    ngram = (ngram << 8) | static_cast<uint8_t>(data[pos + i]);
+  }
+  return ngram;
+}
+
+// Returns a key that uniquely identifies a piece by its bytes and mask.
+std::string PieceKey(const RawSignature::Piece& piece) {
+  CompiledPiece compiled = CompilePiece(piece);
+  return compiled.bytes.append(compiled.mask);
+}
+
+bool IsWeightedTrimming(SignatureDefinition::SignatureTrimAlgorithm algorithm) {
+  return algorithm == SignatureDefinition::TRIM_WEIGHTED ||
+         algorithm == SignatureDefinition::TRIM_WEIGHTED_GREEDY;
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<GoodwareCorpus>> GoodwareCorpus::Load(
+    absl::string_view path) {
+  if (IsDirectory(path)) {
+    NA_ASSIGN_OR_RETURN(Corpus corpus, Corpus::LoadFromDirectory(path));
+    return FromCorpus(std::move(corpus));
+  }
+  NA_ASSIGN_OR_RETURN(std::string data, ReadFileContents(path));
+  GoodwareIndex index;
+  if (!index.ParseFromString(data)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Failed to parse goodware index from ", path));
+  }
+  return FromIndex(std::move(index));
+}
+
+std::unique_ptr<GoodwareCorpus> GoodwareCorpus::FromCorpus(Corpus corpus) {
+  std::unique_ptr<GoodwareCorpus> goodware(new GoodwareCorpus());
+  goodware->names_.reserve(corpus.size());
+  for (const auto& file : corpus.files()) {
+    goodware->names_.push_back(file.name);
+  }
+  goodware->corpus_ = std::move(corpus);
+  return goodware;
+}
+
+absl::StatusOr<std::unique_ptr<GoodwareCorpus>> GoodwareCorpus::FromIndex(
+    GoodwareIndex index) {
+  if (index.ngram_length() < 1 || index.ngram_length() > 8) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid n-gram length: ", index.ngram_length()));
+  }
+  std::unique_ptr<GoodwareCorpus> goodware(new GoodwareCorpus());
+  goodware->ngram_length_ = index.ngram_length();
+  goodware->names_.reserve(index.file_size());
+  goodware->ngrams_.reserve(index.file_size());
+  for (auto& file : *index.mutable_file()) {
+    if (!std::is_sorted(file.ngram().begin(), file.ngram().end())) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("N-grams not sorted for file ", file.name()));
+    }
+    goodware->names_.push_back(std::move(*file.mutable_name()));
+    goodware->ngrams_.emplace_back(file.ngram().begin(), file.ngram().end());
+  }
+  return goodware;
+}
+
+absl::StatusOr<GoodwareIndex> GoodwareCorpus::BuildIndex(const Corpus& corpus,
+                                                         int ngram_length,
+                                                         int num_threads) {
+  if (ngram_length < 1 || ngram_length > 8) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid n-gram length: ", ngram_length));
+  }
+  GoodwareIndex index;
+  index.set_ngram_length(ngram_length);
+  for (const auto& file : corpus.files()) {
+    index.add_file()->set_name(file.name);
+  }
+  MakeExecutor(num_threads)->ParallelFor(corpus.size(), [&](int64_t i) {
+    const absl::string_view data = corpus.files()[i].data;
+    std::vector<uint64_t> ngrams;
+    if (data.size() >= ngram_length) {
+      ngrams.reserve(data.size() - ngram_length + 1);
+      for (size_t pos = 0; pos + ngram_length <= data.size(); ++pos) {
+        ngrams.push_back(PackNgram(data, pos, ngram_length));
+      }
+    }
+    std::sort(ngrams.begin(), ngrams.end());
+    ngrams.erase(std::unique(ngrams.begin(), ngrams.end()), ngrams.end());
+    // Each thread only modifies its own file message.
+    index.mutable_file(i)->mutable_ngram()->Add(ngrams.begin(), ngrams.end());
+  });
+  return index;
+}
+
+std::vector<int> GoodwareCorpus::FindFilesWithPiece(
+    const RawSignature::Piece& piece) const {
+  const CompiledPiece compiled = CompilePiece(piece);
+  std::vector<int> result;
+  if (ngrams_.empty()) {
+    for (int i = 0; i < corpus_.size(); ++i) {
+      if (FindPiece(compiled, corpus_.files()[i].data) !=
+          absl::string_view::npos) {
+        result.push_back(i);
+      }
+    }
+    return result;
+  }
+
+  // Gather all n-grams of the piece that do not contain masked nibbles.
+  std::vector<uint64_t> piece_ngrams;
+  for (size_t pos = 0; pos + ngram_length_ <= compiled.bytes.size(); ++pos) {
+    const absl::string_view window(compiled.mask.data() + pos, ngram_length_);
+    if (window.find_first_not_of('\xff') == absl::string_view::npos) {
+      piece_ngrams.push_back(PackNgram(compiled.bytes, pos, ngram_length_));
+    }
+  }
+  for (int i = 0; i < ngrams_.size(); ++i) {
+    const auto& file_ngrams = ngrams_[i];
+    // Without any n-grams to check, conservatively assume a match.
+    if (std::all_of(piece_ngrams.begin(), piece_ngrams.end(),
+                    [&file_ngrams](uint64_t ngram) {
+                      return std::binary_search(file_ngrams.begin(),
+                                                file_ngrams.end(), ngram);
+                    })) {
+      result.push_back(i);
+    }
+  }
+  return result;
+}
+
+absl::StatusOr<GoodwareStats> RemoveGoodwarePieces(
+    const GoodwareCorpus& goodware, int max_rounds, Executor* executor,
+    Signature* signature) {
+  CHECK(signature);
+  GoodwareStats stats;
+  stats.goodware_files = goodware.num_files();
+  if (goodware.num_files() == 0) {
+    return stats;
+  }
+  const bool weighted =
+      IsWeightedTrimming(signature->definition().trim_algorithm());
+
+  // Goodware files containing each piece, keyed by PieceKey(). Pieces tend to
+  // be part of the trimmed signature in more than one round, so this avoids
+  // scanning for them again.
+  absl::flat_hash_map<std::string, std::vector<int>> occurrences;
+  while (true) {
+    RawSignature subset;
+    NA_RETURN_IF_ERROR(GetRelevantSignatureSubset(
+        *signature, kEngineMinPieceLength, &subset));
+
+    std::vector<std::string> keys;
+    keys.reserve(subset.piece_size());
+    std::vector<int> lookup_pieces;
+    for (int i = 0; i < subset.piece_size(); ++i) {
+      keys.push_back(PieceKey(subset.piece(i)));
+      if (occurrences.emplace(keys.back(), std::vector<int>()).second) {
+        lookup_pieces.push_back(i);
+      }
+    }
+    // The map is not modified while scanning, so the value pointers are
+    // stable.
+    std::vector<std::vector<int>*> lookup_results;
+    lookup_results.reserve(lookup_pieces.size());
+    for (int i : lookup_pieces) {
+      lookup_results.push_back(&occurrences[keys[i]]);
+    }
+    executor->ParallelFor(lookup_pieces.size(), [&](int64_t i) {
+      *lookup_results[i] =
+          goodware.FindFilesWithPiece(subset.piece(lookup_pieces[i]));
+    });
+    ++stats.rounds;
+
+    // A goodware file is hit if it contains all pieces of the subset.
+    std::vector<int> hits = occurrences[keys[0]];
+    for (int i = 1; i < keys.size() && !hits.empty(); ++i) {
+      const auto& files = occurrences[keys[i]];
+      std::vector<int> intersection;
+      std::set_intersection(hits.begin(), hits.end(), files.begin(),
+                            files.end(), std::back_inserter(intersection));
+      hits.swap(intersection);
+    }
+    stats.hits = hits.size();
+    if (hits.empty() || stats.rounds >= max_rounds) {
+      break;
+    }
+    // Drop the most prevalent pieces.
+    size_t max_occurrences = 0;
+    for (const auto& key : keys) {
+      max_occurrences = std::max(occurrences[key].size(), max_occurrences);
+    }
+    absl::flat_hash_set<std::string> drop_keys;
+    for (const auto& key : keys) {
+      if (occurrences[key].size() == max_occurrences) {
+        drop_keys.insert(key);
+      }
+    }
+    RawSignature cleaned;
+    int dropped = 0;
+    for (const auto& piece : signature->raw_signature().piece()) {
+      if (!drop_keys.contains(PieceKey(piece))) {
+        *cleaned.add_piece() = piece;
+        continue;
+      }
+      if (weighted) {
+        if (piece.weight() != 0) {
+          ++dropped;
+        }
+        auto* zero_weight = cleaned.add_piece();
+        *zero_weight = piece;
+        zero_weight->set_weight(0);
+        continue;
+      }
+      ++dropped;
+      if (cleaned.piece_size() > 0) {
+        // The removed bytes are now covered by the wildcard of the previous
+        // piece.
+        auto* previous = cleaned.mutable_piece(cleaned.piece_size() - 1);
+        previous->clear_min_qualifier();
+        previous->clear_max_qualifier();
+      }
+    }
+
+    // Keep the current signature if nothing would be left after trimming.
+    signature->mutable_raw_signature()->Swap(&cleaned);
+    RawSignature remaining;
+    if (!GetRelevantSignatureSubset(*signature, kEngineMinPieceLength,
+                                    &remaining)
+             .ok()) {
+      signature->mutable_raw_signature()->Swap(&cleaned);
+      break;
+    }
+    stats.dropped_pieces += dropped;
+  }
+  return stats;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,114 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Support for checking generated signatures against a corpus of benign files
+// ("goodware") and for removing signature pieces that cause false positives.
+
+#ifndef VXSIG_GOODWARE_H_
+#define VXSIG_GOODWARE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "vxsig/corpus.h"
+#include "vxsig/executor.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// A set of benign files that signatures should not match. The files are
+// either kept in memory or represented by a prebuilt n-gram index (see the
+// GoodwareIndex message). The latter is much more compact, but may over-report
+// piece occurrences for pieces that have masked nibbles or are shorter than the
+// n-gram length.
+// This class is thread-safe.
+class GoodwareCorpus {
+ public:
+  // The default n-gram length matches the default minimum piece length of
+  // signature definitions, so that usually every piece can be checked.
+  static constexpr int kDefaultNgramLength = 4;
+
+  GoodwareCorpus(const GoodwareCorpus&) = delete;
+  GoodwareCorpus& operator=(const GoodwareCorpus&) = delete;
+
+  // Loads a goodware corpus. If path is a directory, all files below it are
+  // loaded into memory. Otherwise, path must point to a serialized
+  // GoodwareIndex.
+  static absl::StatusOr<std::unique_ptr<GoodwareCorpus>> Load(
+      absl::string_view path);
+
+  static std::unique_ptr<GoodwareCorpus> FromCorpus(Corpus corpus);
+  static absl::StatusOr<std::unique_ptr<GoodwareCorpus>> FromIndex(
+      GoodwareIndex index);
+
+  // Builds an n-gram index of the files in a corpus using the specified number
+  // of threads (zero selects a default).
+  static absl::StatusOr<GoodwareIndex> BuildIndex(
+      const Corpus& corpus, int ngram_length = kDefaultNgramLength,
+      int num_threads = 0);
+
+  int num_files() const { return names_.size(); }
+  const std::string& file_name(int index) const { return names_[index]; }
+
+  // Returns the sorted indices of the files that contain the piece.
+  std::vector<int> FindFilesWithPiece(const RawSignature::Piece& piece) const;
+
+ private:
+  GoodwareCorpus() = default;
+
+  std::vector<std::string> names_;
+
+  // Only set if the corpus was loaded from files.
+  Corpus corpus_;
+
+  // Only set if the corpus was loaded from an index. Indexed by file.
+  int ngram_length_ = 0;
+  std::vector<std::vector<uint64_t>> ngrams_;
+};
+
+// Statistics about the goodware check of a signature.
+struct GoodwareStats {
+  int goodware_files = 0;
+
+  // Number of goodware files that the trimmed signature matches.
+  int hits = 0;
+
+  // Number of times the signature has been checked against the corpus.
+  int rounds = 0;
+
+  // Number of raw signature pieces that were removed or given zero weight.
+  int dropped_pieces = 0;
+};
+
+// Checks the relevant (i.e. trimmed) subset of the signature against the
+// goodware corpus. As long as it matches any of the goodware files, this
+// removes the pieces of the subset that occur in the most goodware files and
+// trims again, for at most max_rounds rounds. With weighted trimming, pieces
+// are set to zero weight instead of being removed. Pieces are never dropped if
+// that would leave no signature at all.
+// Note that piece order is not taken into account when checking for matches,
+// so the resulting hit count is an upper bound. The corpus is scanned on the
+// executor.
+absl::StatusOr<GoodwareStats> RemoveGoodwarePieces(
+    const GoodwareCorpus& goodware, int max_rounds, Executor* executor,
+    Signature* signature);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_GOODWARE_H_
@@ -0,0 +1,79 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A program that builds a goodware n-gram index from a directory of benign
+// files. The index can be passed to the signature generator via --goodware
+// instead of the directory itself.
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "vxsig/corpus.h"
+#include "vxsig/goodware.h"
+#include "vxsig/vxsig.pb.h"
+
+ABSL_FLAG(int32_t, ngram_length,
+          security::vxsig::GoodwareCorpus::kDefaultNgramLength,
+          "Length of the indexed n-grams in bytes, at most 8");
+ABSL_FLAG(int64_t, max_file_size, 64 << 20,
+          "Skip files larger than this many bytes");
+ABSL_FLAG(int32_t, num_threads, 0,
+          "Number of threads to use, 0 to use all CPUs");
+
+namespace security::vxsig {
+namespace {
+
+void GoodwareIndexMain(int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc == 3, "Need goodware directory and output filename");
+
+  auto corpus =
+      Corpus::LoadFromDirectory(argv[1], absl::GetFlag(FLAGS_max_file_size));
+  ABSL_RAW_CHECK(corpus.ok(), absl::StrCat("Failed to load corpus: ",
+                                           corpus.status().message())
+                                  .c_str());
+  absl::PrintF("Indexing %d files (%d bytes)\n", corpus->size(),
+               corpus->total_bytes());
+  auto index =
+      GoodwareCorpus::BuildIndex(*corpus, absl::GetFlag(FLAGS_ngram_length),
+                                 absl::GetFlag(FLAGS_num_threads));
+  ABSL_RAW_CHECK(index.ok(), absl::StrCat("Failed to build index: ",
+                                          index.status().message())
+                                 .c_str());
+
+  std::ofstream output(argv[2], std::ios_base::binary | std::ios_base::trunc);
+  ABSL_RAW_CHECK(index->SerializeToOstream(&output) && output.good(),
+                 "Failed to write index");
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Build an n-gram index of a directory of benign files.\n"
+      "usage:\n",
+      argv[0], " [OPTION] DIRECTORY OUTPUT"));
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  security::vxsig::GoodwareIndexMain(args.size(), &args[0]);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/goodware.h"
+
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/executor.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsEmpty;
+using testing::IsTrue;
+
+namespace security::vxsig {
+namespace {
+
+Corpus MakeGoodwareCorpus() {
+  Corpus corpus;
+  corpus.AddFile("first", "xxgood1234yycommon12zz");
+  corpus.AddFile("second", "common12");
+  corpus.AddFile("third", "nothing of interest");
+  return corpus;
+}
+
+std::unique_ptr<GoodwareCorpus> MakeGoodware() {
+  return GoodwareCorpus::FromCorpus(MakeGoodwareCorpus());
+}
+
+TEST(GoodwareTest, CorpusAndIndexAgree) {
+  auto index = GoodwareCorpus::BuildIndex(MakeGoodwareCorpus());
+  ASSERT_THAT(index, IsOk());
+  auto indexed = GoodwareCorpus::FromIndex(*std::move(index));
+  ASSERT_THAT(indexed, IsOk());
+  auto goodware = MakeGoodware();
+  EXPECT_THAT((*indexed)->num_files(), Eq(3));
+  EXPECT_THAT((*indexed)->file_name(1), Eq("second"));
+
+  RawSignature raw;
+  AddSignaturePieces({"common12", "good1234", "evil5678", "of interest"},
+                     &raw);
+  for (const auto& piece : raw.piece()) {
+    EXPECT_THAT((*indexed)->FindFilesWithPiece(piece),
+                Eq(goodware->FindFilesWithPiece(piece)));
+  }
+  EXPECT_THAT(goodware->FindFilesWithPiece(raw.piece(0)), ElementsAre(0, 1));
+  EXPECT_THAT(goodware->FindFilesWithPiece(raw.piece(2)), IsEmpty());
+}
+
+TEST(GoodwareTest, IndexIsConservativeForMaskedPieces) {
+  auto index = GoodwareCorpus::BuildIndex(MakeGoodwareCorpus());
+  ASSERT_THAT(index, IsOk());
+  auto indexed = GoodwareCorpus::FromIndex(*std::move(index));
+  ASSERT_THAT(indexed, IsOk());
+
+  // Masking every other byte leaves no n-gram to look up.
+  RawSignature::Piece piece;
+  piece.set_bytes("evil5678");
+  for (int nibble : {2, 3, 6, 7, 10, 11}) {
+    piece.add_masked_nibble(nibble);
+  }
+  EXPECT_THAT((*indexed)->FindFilesWithPiece(piece), ElementsAre(0, 1, 2));
+  EXPECT_THAT(MakeGoodware()->FindFilesWithPiece(piece), IsEmpty());
+}
+
+TEST(GoodwareTest, InvalidNgramLength) {
+  EXPECT_FALSE(GoodwareCorpus::BuildIndex(MakeGoodwareCorpus(), 9).ok());
+  GoodwareIndex index;
+  EXPECT_FALSE(GoodwareCorpus::FromIndex(index).ok());
+}
+
+TEST(GoodwareTest, RemovesPrevalentPieces) {
+  Signature signature;
+  auto* definition = signature.mutable_definition();
+  definition->set_trim_algorithm(SignatureDefinition::TRIM_LAST);
+  definition->set_trim_length(16);
+  AddSignaturePieces({"good1234", "common12", "evil5678"},
+                     signature.mutable_raw_signature());
+
+  WorkStealingExecutor executor(/*num_threads=*/2);
+  auto stats = RemoveGoodwarePieces(*MakeGoodware(), /*max_rounds=*/10,
+                                    &executor, &signature);
+  ASSERT_THAT(stats, IsOk());
+  EXPECT_THAT(stats->goodware_files, Eq(3));
+  EXPECT_THAT(stats->hits, Eq(0));
+  EXPECT_THAT(stats->rounds, Eq(2));
+  EXPECT_THAT(stats->dropped_pieces, Eq(1));
+  EXPECT_THAT(EquivRawSignature(signature.raw_signature(),
+                                *MakeRawSignature({"good1234", "evil5678"})),
+              IsTrue());
+}
+
+TEST(GoodwareTest, ZeroesWeightsWithWeightedTrimming) {
+  Signature signature;
+  auto* definition = signature.mutable_definition();
+  definition->set_trim_algorithm(SignatureDefinition::TRIM_WEIGHTED_GREEDY);
+  definition->set_trim_length(16);
+  auto* raw = signature.mutable_raw_signature();
+  AddSignaturePieces({"good1234", "common12", "evil5678"}, raw);
+  raw->mutable_piece(0)->set_weight(3);
+  raw->mutable_piece(1)->set_weight(2);
+  raw->mutable_piece(2)->set_weight(1);
+
+  auto stats = RemoveGoodwarePieces(*MakeGoodware(), /*max_rounds=*/10,
+                                    GetInlineExecutor(), &signature);
+  ASSERT_THAT(stats, IsOk());
+  EXPECT_THAT(stats->hits, Eq(0));
+  EXPECT_THAT(stats->dropped_pieces, Eq(1));
+  ASSERT_THAT(raw->piece_size(), Eq(3));
+  EXPECT_THAT(raw->piece(1).weight(), Eq(0));
+}
+
+TEST(GoodwareTest, KeepsLastPieces) {
+  Signature signature;
+  AddSignaturePieces({"common12"}, signature.mutable_raw_signature());
+  auto stats = RemoveGoodwarePieces(*MakeGoodware(), /*max_rounds=*/10,
+                                    GetInlineExecutor(), &signature);
+  ASSERT_THAT(stats, IsOk());
+  EXPECT_THAT(stats->hits, Eq(2));
+  EXPECT_THAT(stats->dropped_pieces, Eq(0));
+  EXPECT_THAT(signature.raw_signature().piece_size(), Eq(1));
+}
+
+}  // namespace
+}  // namespace security::vxsig
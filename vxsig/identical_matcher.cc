@@ -0,0 +1,375 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/identical_matcher.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/bindiff_writer.h"
+#include "vxsig/binexport_reader.h"
+#include "vxsig/types.h"
+
+namespace security::vxsig {
+namespace {
+
+struct BasicBlock {
+  MemoryAddress address = 0;
+  uint64_t hash = 0;
+  std::vector<MemoryAddress> instructions;
+};
+
+struct Function {
+  MemoryAddress address = 0;
+  uint64_t hash = 0;
+  // The entry basic block comes first.
+  std::vector<BasicBlock> basic_blocks;
+};
+
+struct Binary {
+  BinDiffFile file;
+  std::vector<Function> functions;
+};
+
+// Appends the instruction bytes with 32-bit immediates replaced by zeroes, so
+// that relocated data references still compare equal. Immediates that are
+// branch targets are stored relative to the next instruction, like on x86.
+// This uses the same little endian search as the signature generator.
+void AppendMaskedBytes(MemoryAddress address, const std::string& raw_bytes,
+                       const Immediates& immediates, std::string* output) {
+  std::string masked = raw_bytes;
+  std::string encoded(4, '\0');
+  const MemoryAddress next_address = address + raw_bytes.size();
+  for (const auto& [value, size] : immediates) {
+    if (size != kDWord) {
+      continue;
+    }
+    for (const MemoryAddress candidate : {value, value - next_address}) {
+      absl::little_endian::Store32(&encoded[0], candidate);
+      const auto found = raw_bytes.rfind(encoded);
+      if (found != std::string::npos) {
+        masked.replace(found, encoded.size(), encoded.size(), '\0');
+      }
+    }
+  }
+  // Prefix the size, so that the instruction boundaries are part of the
+  // basic block fingerprint.
+  output->push_back(static_cast<char>(masked.size()));
+  output->append(masked);
+}
+
+// Collects the functions of a .BinExport file from the flow graphs that the
+// reader reports and fingerprints them.
+class BinaryLoader {
+ public:
+  absl::StatusOr<Binary> Load(absl::string_view filename, InputCache* cache,
+                              const StopCondition* stop) {
+    const std::string name = ReplaceFileExtension(Basename(filename), "");
+    binary_.file.metadata.filename = name;
+    binary_.file.metadata.original_filename = name;
+    const FunctionReceiverCallback function_receiver =
+        [this](const std::string& sha256, MemoryAddress,
+               BinExport2::CallGraph::Vertex::Type, double) {
+          binary_.file.metadata.original_hash = sha256;
+          ++binary_.file.num_functions;
+        };
+    const InstructionReceiverCallback instruction_receiver =
+        [this](MemoryAddress basic_block_address, MemoryAddress address,
+               const std::string& raw_bytes, const std::string&,
+               const Immediates& immediates) {
+          AddInstruction(basic_block_address, address, raw_bytes, immediates);
+        };
+    const FlowGraphReceiverCallback flow_graph_receiver =
+        [this](MemoryAddress entry_address) { AddFlowGraph(entry_address); };
+    NA_RETURN_IF_ERROR(
+        cache ? cache->ParseBinExport(filename, function_receiver,
+                                      instruction_receiver, stop,
+                                      flow_graph_receiver)
+              : ParseBinExport(filename, function_receiver,
+                               instruction_receiver, stop,
+                               flow_graph_receiver));
+    FinishFunction();
+    binary_.file.num_basic_blocks = basic_blocks_.size();
+    binary_.file.num_instructions = instructions_.size();
+    return std::move(binary_);
+  }
+
+ private:
+  void AddFlowGraph(MemoryAddress entry_address) {
+    FinishFunction();
+    binary_.functions.emplace_back();
+    binary_.functions.back().address = entry_address;
+  }
+
+  void AddInstruction(MemoryAddress basic_block_address, MemoryAddress address,
+                      const std::string& raw_bytes,
+                      const Immediates& immediates) {
+    if (binary_.functions.empty()) {
+      return;
+    }
+    auto& basic_blocks = binary_.functions.back().basic_blocks;
+    if (basic_blocks.empty() ||
+        basic_blocks.back().address != basic_block_address) {
+      FinishBasicBlock();
+      basic_blocks.emplace_back();
+      basic_blocks.back().address = basic_block_address;
+      basic_blocks_.insert(basic_block_address);
+    }
+    basic_blocks.back().instructions.push_back(address);
+    instructions_.insert(address);
+    AppendMaskedBytes(address, raw_bytes, immediates, &bytes_);
+  }
+
+  void FinishBasicBlock() {
+    if (!binary_.functions.empty() &&
+        !binary_.functions.back().basic_blocks.empty()) {
+      binary_.functions.back().basic_blocks.back().hash =
+          absl::Hash<std::string>()(bytes_);
+    }
+    bytes_.clear();
+  }
+
+  // Moves the entry basic block to the front and fingerprints the function.
+  void FinishFunction() {
+    FinishBasicBlock();
+    if (binary_.functions.empty()) {
+      return;
+    }
+    Function& function = binary_.functions.back();
+    auto& basic_blocks = function.basic_blocks;
+    auto entry = std::find_if(basic_blocks.begin(), basic_blocks.end(),
+                              [&function](const BasicBlock& basic_block) {
+                                return basic_block.address == function.address;
+                              });
+    if (entry == basic_blocks.end()) {
+      // Not a valid function, it is never matched.
+      binary_.functions.pop_back();
+      return;
+    }
+    std::rotate(basic_blocks.begin(), entry, entry + 1);
+    std::vector<uint64_t> hashes;
+    hashes.reserve(basic_blocks.size());
+    for (const auto& basic_block : basic_blocks) {
+      hashes.push_back(basic_block.hash);
+    }
+    std::sort(hashes.begin() + 1, hashes.end());
+    function.hash = absl::Hash<std::vector<uint64_t>>()(hashes);
+  }
+
+  Binary binary_;
+  std::string bytes_;
+  // Basic blocks and instructions may be shared between functions, these
+  // count them once.
+  absl::flat_hash_set<MemoryAddress> basic_blocks_;
+  absl::flat_hash_set<MemoryAddress> instructions_;
+};
+
+// Returns the functions whose fingerprint is unique in the binary, by
+// fingerprint.
+absl::flat_hash_map<uint64_t, const Function*> UniqueFunctions(
+    const Binary& binary) {
+  absl::flat_hash_map<uint64_t, const Function*> unique;
+  absl::flat_hash_set<uint64_t> duplicates;
+  for (const auto& function : binary.functions) {
+    if (!unique.emplace(function.hash, &function).second) {
+      duplicates.insert(function.hash);
+    }
+  }
+  for (uint64_t hash : duplicates) {
+    unique.erase(hash);
+  }
+  return unique;
+}
+
+// Pairs the basic blocks of two functions with the same fingerprint. Blocks
+// with the same fingerprint are paired in address order. Returns the pairs
+// ordered by primary address.
+std::vector<std::pair<const BasicBlock*, const BasicBlock*>> PairBasicBlocks(
+    const Function& primary, const Function& secondary) {
+  auto sorted = [](const Function& function) {
+    std::vector<const BasicBlock*> basic_blocks;
+    basic_blocks.reserve(function.basic_blocks.size());
+    for (const auto& basic_block : function.basic_blocks) {
+      basic_blocks.push_back(&basic_block);
+    }
+    std::sort(basic_blocks.begin() + 1, basic_blocks.end(),
+              [](const BasicBlock* first, const BasicBlock* second) {
+                return std::tie(first->hash, first->address) <
+                       std::tie(second->hash, second->address);
+              });
+    return basic_blocks;
+  };
+  const auto primary_blocks = sorted(primary);
+  const auto secondary_blocks = sorted(secondary);
+  std::vector<std::pair<const BasicBlock*, const BasicBlock*>> pairs;
+  pairs.reserve(primary_blocks.size());
+  for (int i = 0;
+       i < primary_blocks.size() && i < secondary_blocks.size(); ++i) {
+    const BasicBlock* first = primary_blocks[i];
+    const BasicBlock* second = secondary_blocks[i];
+    // Guards against fingerprint collisions.
+    if (first->hash == second->hash &&
+        first->instructions.size() == second->instructions.size()) {
+      pairs.emplace_back(first, second);
+    }
+  }
+  std::sort(pairs.begin(), pairs.end(), [](const auto& first,
+                                           const auto& second) {
+    return first.first->address < second.first->address;
+  });
+  return pairs;
+}
+
+// Reports the matches of two loaded binaries and returns the number of
+// instruction matches.
+absl::StatusOr<int64_t> MatchBinaries(
+    const Binary& primary, const Binary& secondary,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    const StopCondition* stop) {
+  const auto secondary_functions = UniqueFunctions(secondary);
+  const auto primary_functions = UniqueFunctions(primary);
+  std::vector<std::pair<const Function*, const Function*>> matches;
+  for (const auto& [hash, function] : primary_functions) {
+    auto found = secondary_functions.find(hash);
+    if (found != secondary_functions.end()) {
+      matches.emplace_back(function, found->second);
+    }
+  }
+  std::sort(matches.begin(), matches.end(),
+            [](const auto& first, const auto& second) {
+              return first.first->address < second.first->address;
+            });
+
+  int64_t num_instruction_matches = 0;
+  for (const auto& [function, other] : matches) {
+    if (ShouldStop(stop)) {
+      return stop->status();
+    }
+    if (function_match_receiver) {
+      function_match_receiver({function->address, other->address});
+    }
+    for (const auto& [basic_block, other_block] :
+         PairBasicBlocks(*function, *other)) {
+      if (basic_block_match_receiver) {
+        basic_block_match_receiver(
+            {basic_block->address, other_block->address});
+      }
+      for (int i = 0; i < basic_block->instructions.size(); ++i) {
+        if (instruction_match_receiver) {
+          instruction_match_receiver(
+              {basic_block->instructions[i], other_block->instructions[i]});
+        }
+      }
+      num_instruction_matches += basic_block->instructions.size();
+    }
+  }
+  return num_instruction_matches;
+}
+
+absl::StatusOr<std::pair<Binary, Binary>> LoadBinaries(
+    absl::string_view primary_filename, absl::string_view secondary_filename,
+    InputCache* cache, const StopCondition* stop) {
+  NA_ASSIGN_OR_RETURN(auto primary,
+                      BinaryLoader().Load(primary_filename, cache, stop));
+  NA_ASSIGN_OR_RETURN(auto secondary,
+                      BinaryLoader().Load(secondary_filename, cache, stop));
+  return std::make_pair(std::move(primary), std::move(secondary));
+}
+
+}  // namespace
+
+absl::Status MatchIdenticalFunctions(
+    absl::string_view primary_filename, absl::string_view secondary_filename,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    std::pair<FileMetaData, FileMetaData>* metadata, InputCache* cache,
+    const StopCondition* stop) {
+  NA_ASSIGN_OR_RETURN(
+      auto binaries,
+      LoadBinaries(primary_filename, secondary_filename, cache, stop));
+  if (metadata) {
+    metadata->first = binaries.first.file.metadata;
+    metadata->second = binaries.second.file.metadata;
+  }
+  return MatchBinaries(binaries.first, binaries.second,
+                       function_match_receiver, basic_block_match_receiver,
+                       instruction_match_receiver, stop)
+      .status();
+}
+
+absl::StatusOr<std::string> WriteIdenticalMatches(
+    absl::string_view primary_filename, absl::string_view secondary_filename,
+    absl::string_view directory, InputCache* cache,
+    const StopCondition* stop) {
+  NA_ASSIGN_OR_RETURN(
+      auto binaries,
+      LoadBinaries(primary_filename, secondary_filename, cache, stop));
+  const Binary& primary = binaries.first;
+  const Binary& secondary = binaries.second;
+  const std::string filename = JoinPath(
+      directory,
+      absl::StrCat(primary.file.metadata.filename, "_vs_",
+                   secondary.file.metadata.filename, ".BinDiff"));
+  NA_ASSIGN_OR_RETURN(auto writer,
+                      BinDiffWriter::Create(filename, "identical"));
+
+  // The receivers cannot fail, keep the first error of the writer.
+  absl::Status status;
+  auto write = [&status](absl::Status result) {
+    if (status.ok()) {
+      status = std::move(result);
+    }
+  };
+  NA_ASSIGN_OR_RETURN(
+      const int64_t num_instruction_matches,
+      MatchBinaries(
+          primary, secondary,
+          [&](const MemoryAddressPair& match) {
+            write(writer->AddFunctionMatch(match));
+          },
+          [&](const MemoryAddressPair& match) {
+            write(writer->AddBasicBlockMatch(match));
+          },
+          [&](const MemoryAddressPair& match) {
+            write(writer->AddInstructionMatch(match));
+          },
+          stop));
+  NA_RETURN_IF_ERROR(status);
+
+  const int64_t num_instructions =
+      primary.file.num_instructions + secondary.file.num_instructions;
+  DiffSimilarity similarity;
+  similarity.similarity =
+      num_instructions > 0
+          ? 2.0 * num_instruction_matches / num_instructions
+          : 0.0;
+  similarity.confidence = 1.0;
+  NA_RETURN_IF_ERROR(writer->Finish(primary.file, secondary.file, similarity));
+  return filename;
+}
+
+}  // namespace security::vxsig
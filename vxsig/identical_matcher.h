@@ -0,0 +1,66 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A native matcher for functions that are identical in two binaries. It only
+// needs the .BinExport files and is much faster than running BinDiff, but it
+// finds only a subset of BinDiff's matches: functions whose code is the same
+// up to immediates and relocated branch targets.
+//
+// Basic blocks are fingerprinted by their masked instruction bytes and
+// functions by their entry basic block and the multiset of their basic
+// blocks. The readers do not expose flow graph edges, so the basic block
+// multiset stands in for the shape of the control flow graph. Only
+// fingerprints that occur exactly once in both binaries are matched.
+
+#ifndef VXSIG_IDENTICAL_MATCHER_H_
+#define VXSIG_IDENTICAL_MATCHER_H_
+
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/input_cache.h"
+
+namespace security::vxsig {
+
+// Matches the identical functions of two .BinExport files and calls the
+// receivers in the same hierarchical order as ParseBinDiff(). The metadata is
+// filled like from a BinDiff result: the file names are the base names of the
+// .BinExport files without extension. If cache is non-null, the decoded files
+// are shared with other callers. If the stop condition is met, returns its
+// status.
+absl::Status MatchIdenticalFunctions(
+    absl::string_view primary_filename, absl::string_view secondary_filename,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    std::pair<FileMetaData, FileMetaData>* metadata,
+    InputCache* cache = nullptr, const StopCondition* stop = nullptr);
+
+// Writes the identical matches of two .BinExport files to a BinDiff result
+// file in the specified directory, named "<primary>_vs_<secondary>.BinDiff"
+// like BinDiff names them, and returns its path. The result can be used in
+// place of BinDiff's, by vxsig and by BinDiff's UI.
+absl::StatusOr<std::string> WriteIdenticalMatches(
+    absl::string_view primary_filename, absl::string_view secondary_filename,
+    absl::string_view directory, InputCache* cache = nullptr,
+    const StopCondition* stop = nullptr);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_IDENTICAL_MATCHER_H_
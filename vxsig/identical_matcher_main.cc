@@ -0,0 +1,72 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A program that matches the identical functions of pairs of .BinExport files
+// and writes the matches as .BinDiff files, so that chains of closely related
+// samples do not need BinDiff. Each pair of consecutive arguments is matched
+// and the resulting diffs are printed in chain order, e.g.:
+//   vxsig_match a.BinExport b.BinExport c.BinExport
+//   vxsig $(vxsig_match a.BinExport b.BinExport c.BinExport)
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "vxsig/identical_matcher.h"
+#include "vxsig/input_cache.h"
+
+ABSL_FLAG(std::string, output_directory, "",
+          "Directory for the .BinDiff files, defaults to the directory of "
+          "each primary .BinExport file");
+
+namespace security::vxsig {
+namespace {
+
+void MatchMain(int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc >= 3, "Need at least two .BinExport files");
+
+  const std::string output_directory = absl::GetFlag(FLAGS_output_directory);
+  // Each inner file is decoded once, for both of its diffs.
+  InputCache cache;
+  for (int i = 1; i + 1 < argc; ++i) {
+    auto diff = WriteIdenticalMatches(
+        argv[i], argv[i + 1],
+        output_directory.empty() ? Dirname(argv[i]) : output_directory,
+        &cache);
+    ABSL_RAW_CHECK(diff.ok(), absl::StrCat("Failed to match ", argv[i], ": ",
+                                           diff.status().message())
+                                  .c_str());
+    absl::PrintF("%s\n", *diff);
+  }
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Match identical functions of .BinExport files without BinDiff.\n"
+      "usage:\n",
+      argv[0], " [OPTION] BINEXPORT1 BINEXPORT2 [BINEXPORT3...]"));
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  security::vxsig::MatchMain(args.size(), &args[0]);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/identical_matcher.h"
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/match_chain_table.h"
+#include "vxsig/siggen.h"
+#include "vxsig/synthetic.h"
+#include "vxsig/test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::Ge;
+using testing::Gt;
+using testing::IsEmpty;
+using testing::Not;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kPrimary[] =
+    "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa";
+constexpr char kSecondary[] =
+    "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82";
+
+std::string BinExportPath(absl::string_view directory,
+                          absl::string_view name) {
+  return JoinPath(directory, absl::StrCat(name, ".BinExport"));
+}
+
+// All matches of a result, by type.
+struct Matches {
+  std::set<MemoryAddressPair> functions;
+  std::set<MemoryAddressPair> basic_blocks;
+  std::set<MemoryAddressPair> instructions;
+
+  MatchReceiverCallback function_receiver() {
+    return [this](const MemoryAddressPair& match) { functions.insert(match); };
+  }
+  MatchReceiverCallback basic_block_receiver() {
+    return [this](const MemoryAddressPair& match) {
+      basic_blocks.insert(match);
+    };
+  }
+  MatchReceiverCallback instruction_receiver() {
+    return [this](const MemoryAddressPair& match) {
+      instructions.insert(match);
+    };
+  }
+};
+
+absl::Status MatchIdentical(absl::string_view primary,
+                            absl::string_view secondary, Matches* matches,
+                            std::pair<FileMetaData, FileMetaData>* metadata) {
+  return MatchIdenticalFunctions(
+      primary, secondary, matches->function_receiver(),
+      matches->basic_block_receiver(), matches->instruction_receiver(),
+      metadata);
+}
+
+absl::Status ReadDiff(absl::string_view filename, Matches* matches) {
+  return ParseBinDiff(filename, matches->function_receiver(),
+                      matches->basic_block_receiver(),
+                      matches->instruction_receiver(), /*metadata=*/nullptr);
+}
+
+int CountCommon(const std::set<MemoryAddressPair>& first,
+                const std::set<MemoryAddressPair>& second) {
+  int common = 0;
+  for (const auto& match : first) {
+    common += second.count(match);
+  }
+  return common;
+}
+
+TEST(IdenticalMatcherTest, AgreesWithBinDiff) {
+  Matches identical;
+  std::pair<FileMetaData, FileMetaData> metadata;
+  ASSERT_THAT(MatchIdentical(BinExportPath(TestDataPath(""), kPrimary),
+                             BinExportPath(TestDataPath(""), kSecondary),
+                             &identical, &metadata),
+              IsOk());
+  EXPECT_THAT(metadata.first.filename, Eq(kPrimary));
+  EXPECT_THAT(metadata.second.filename, Eq(kSecondary));
+
+  Matches bindiff;
+  ASSERT_THAT(
+      ReadDiff(TestDataPath(absl::StrCat(kPrimary, "_vs_", kSecondary,
+                                         ".BinDiff")),
+               &bindiff),
+      IsOk());
+  // The samples share most of their code. Identical functions are a subset of
+  // what BinDiff matches, with few exceptions where either one guessed.
+  ASSERT_THAT(identical.functions.size(), Gt(bindiff.functions.size() / 2));
+  EXPECT_THAT(CountCommon(identical.functions, bindiff.functions),
+              Ge(identical.functions.size() * 95 / 100));
+  EXPECT_THAT(CountCommon(identical.basic_blocks, bindiff.basic_blocks),
+              Ge(identical.basic_blocks.size() * 95 / 100));
+}
+
+class IdenticalMatcherSyntheticTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    auto directory = CreateTestTempDirectory();
+    ASSERT_THAT(directory, IsOk());
+    directory_ = *std::move(directory);
+
+    // Kept functions stay identical.
+    SyntheticOptions options;
+    options.num_functions = 50;
+    options.shared_block_ratio = 1.0;
+    options.mutation_rate = 0;
+    auto diffs = WriteSyntheticChain(options, directory_);
+    ASSERT_THAT(diffs, IsOk());
+    diffs_ = *std::move(diffs);
+    for (const auto& diff : diffs_) {
+      std::pair<FileMetaData, FileMetaData> metadata;
+      ASSERT_THAT(ReadBinDiffMetaData(diff, &metadata), IsOk());
+      if (samples_.empty()) {
+        samples_.push_back(metadata.first.filename);
+      }
+      samples_.push_back(metadata.second.filename);
+    }
+  }
+
+  std::string directory_;
+  std::vector<std::string> diffs_;
+  std::vector<std::string> samples_;
+};
+
+TEST_F(IdenticalMatcherSyntheticTest, MatchesKeptFunctions) {
+  Matches identical;
+  std::pair<FileMetaData, FileMetaData> metadata;
+  ASSERT_THAT(MatchIdentical(BinExportPath(directory_, samples_[0]),
+                             BinExportPath(directory_, samples_[1]),
+                             &identical, &metadata),
+              IsOk());
+  EXPECT_THAT(metadata.first.original_hash, Eq(samples_[0]));
+
+  Matches expected;
+  ASSERT_THAT(ReadDiff(diffs_[0], &expected), IsOk());
+  EXPECT_THAT(identical.functions, Eq(expected.functions));
+  EXPECT_THAT(identical.basic_blocks, Eq(expected.basic_blocks));
+  EXPECT_THAT(identical.instructions, Eq(expected.instructions));
+}
+
+TEST_F(IdenticalMatcherSyntheticTest, WritesBinDiffResult) {
+  const std::string output = JoinPath(directory_, "identical");
+  ASSERT_THAT(CreateDirectories(output), IsOk());
+  auto diff = WriteIdenticalMatches(BinExportPath(directory_, samples_[0]),
+                                    BinExportPath(directory_, samples_[1]),
+                                    output);
+  ASSERT_THAT(diff, IsOk());
+  EXPECT_THAT(Basename(*diff), Eq(Basename(diffs_[0])));
+
+  std::pair<FileMetaData, FileMetaData> metadata;
+  DiffSimilarity similarity;
+  ASSERT_THAT(ReadBinDiffMetaData(*diff, &metadata, &similarity), IsOk());
+  EXPECT_THAT(metadata.first.filename, Eq(samples_[0]));
+  EXPECT_THAT(metadata.second.filename, Eq(samples_[1]));
+  EXPECT_THAT(similarity.similarity, Gt(0.5));
+
+  Matches written;
+  ASSERT_THAT(ReadDiff(*diff, &written), IsOk());
+  Matches identical;
+  ASSERT_THAT(MatchIdentical(BinExportPath(directory_, samples_[0]),
+                             BinExportPath(directory_, samples_[1]),
+                             &identical, /*metadata=*/nullptr),
+              IsOk());
+  EXPECT_THAT(written.functions, Eq(identical.functions));
+  EXPECT_THAT(written.basic_blocks, Eq(identical.basic_blocks));
+  EXPECT_THAT(written.instructions, Eq(identical.instructions));
+}
+
+TEST_F(IdenticalMatcherSyntheticTest, AddsMatchesToColumns) {
+  std::vector<std::pair<std::string, std::string>> diffs;
+  MatchChainColumn column;
+  MatchChainColumn next;
+  ASSERT_THAT(AddIdenticalMatches(BinExportPath(directory_, samples_[0]),
+                                  BinExportPath(directory_, samples_[1]),
+                                  /*last=*/true, &column, &next, &diffs),
+              IsOk());
+  EXPECT_THAT(column.filename(), Eq(samples_[0]));
+  EXPECT_THAT(column.diff_directory(), Eq(directory_));
+  EXPECT_THAT(next.filename(), Eq(samples_[1]));
+  ASSERT_THAT(diffs, SizeIs(1));
+  EXPECT_THAT(diffs[0].second, Eq(samples_[1]));
+
+  MatchChainColumn expected;
+  MatchChainColumn expected_next;
+  ASSERT_THAT(AddDiffResult(diffs_[0], /*last=*/true, &expected,
+                            &expected_next, &diffs),
+              IsOk());
+  EXPECT_THAT(*MatchChainColumn::GetFunctionIndexFromColumn(&column),
+              SizeIs(MatchChainColumn::GetFunctionIndexFromColumn(&expected)
+                         ->size()));
+}
+
+TEST_F(IdenticalMatcherSyntheticTest, GeneratesSignatureWithoutBinDiff) {
+  // Replace the chain's diffs with identical matches.
+  std::vector<std::string> diffs;
+  for (int i = 0; i + 1 < samples_.size(); ++i) {
+    auto diff =
+        WriteIdenticalMatches(BinExportPath(directory_, samples_[i]),
+                              BinExportPath(directory_, samples_[i + 1]),
+                              directory_);
+    ASSERT_THAT(diff, IsOk());
+    diffs.push_back(*std::move(diff));
+  }
+
+  AvSignatureGenerator siggen;
+  siggen.set_verbose(false).set_num_threads(1);
+  siggen.AddDiffResults(diffs);
+  Signature signature;
+  signature.mutable_definition()->set_detection_name("identical_test");
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+  EXPECT_THAT(signature.raw_signature().piece(), Not(IsEmpty()));
+}
+
+}  // namespace
+}  // namespace security::vxsig
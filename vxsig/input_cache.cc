@@ -0,0 +1,281 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/input_cache.h"
+
+#include <sys/stat.h>
+
+#include <limits>
+
+namespace security::vxsig {
+
+int64_t InputCache::MemoryUsage(const DecodedDiff& data) {
+  return sizeof(data) + data.metadata.first.filename.capacity() +
+         data.metadata.second.filename.capacity() +
+         data.matches.capacity() * sizeof(DecodedDiff::Match);
+}
+
+int64_t InputCache::MemoryUsage(const DecodedBinExport& data) {
+  int64_t result =
+      sizeof(data) +
+      data.functions.capacity() * sizeof(DecodedBinExport::Function) +
+      data.instructions.capacity() * sizeof(DecodedBinExport::Instruction) +
+      data.flow_graphs.capacity() * sizeof(DecodedBinExport::FlowGraph);
+  for (const auto& function : data.functions) {
+    result += function.sha256.capacity();
+  }
+  for (const auto& instruction : data.instructions) {
+    result += instruction.raw_bytes.capacity() +
+              instruction.disassembly.capacity() +
+              instruction.immediates.capacity() *
+                  sizeof(Immediates::value_type);
+  }
+  return result;
+}
+
+InputCache::FileStamp InputCache::GetFileStamp(absl::string_view filename) {
+  FileStamp stamp;
+  struct stat info;
+  if (stat(std::string(filename).c_str(), &info) == 0) {
+    stamp.size = info.st_size;
+    stamp.mtime_ns =
+        int64_t{info.st_mtim.tv_sec} * 1000000000 + info.st_mtim.tv_nsec;
+    stamp.device = info.st_dev;
+    stamp.inode = info.st_ino;
+  }
+  return stamp;
+}
+
+template <typename T>
+std::shared_ptr<InputCache::Entry<T>> InputCache::GetEntry(
+    absl::string_view filename, SlotMap<T>* slots) {
+  const FileStamp stamp = GetFileStamp(filename);
+  absl::MutexLock lock(&mutex_);
+  auto& slot = (*slots)[std::string(filename)];
+  if (slot.entry && slot.stamp == stamp) {
+    ++hits_;
+  } else {
+    // Callers still using an entry of an older version keep it alive.
+    ++misses_;
+    memory_bytes_ -= slot.memory_bytes;
+    slot.entry = std::make_shared<Entry<T>>();
+    slot.stamp = stamp;
+    slot.memory_bytes = 0;
+  }
+  slot.last_use = ++use_counter_;
+  return slot.entry;
+}
+
+template <typename T>
+void InputCache::FinishEntry(absl::string_view filename, const Entry<T>* entry,
+                             const absl::Status& status, int64_t memory_bytes,
+                             SlotMap<T>* slots) {
+  absl::MutexLock lock(&mutex_);
+  auto found = slots->find(filename);
+  if (found == slots->end() || found->second.entry.get() != entry) {
+    return;  // Evicted or replaced while decoding
+  }
+  if (!status.ok()) {
+    slots->erase(found);
+    return;
+  }
+  found->second.memory_bytes = memory_bytes;
+  memory_bytes_ += memory_bytes;
+  EvictLocked(max_memory_bytes_);
+}
+
+void InputCache::EvictLocked(int64_t max_memory_bytes) {
+  while (memory_bytes_ > max_memory_bytes) {
+    // Files are few compared to their contents, so a linear search for the
+    // least recently used one is cheap.
+    auto oldest_diff = diffs_.end();
+    auto oldest_binexport = binexports_.end();
+    int64_t oldest_use = std::numeric_limits<int64_t>::max();
+    for (auto it = diffs_.begin(); it != diffs_.end(); ++it) {
+      if (it->second.memory_bytes > 0 && it->second.last_use < oldest_use) {
+        oldest_diff = it;
+        oldest_use = it->second.last_use;
+      }
+    }
+    for (auto it = binexports_.begin(); it != binexports_.end(); ++it) {
+      if (it->second.memory_bytes > 0 && it->second.last_use < oldest_use) {
+        oldest_binexport = it;
+        oldest_use = it->second.last_use;
+      }
+    }
+    if (oldest_binexport != binexports_.end()) {
+      memory_bytes_ -= oldest_binexport->second.memory_bytes;
+      binexports_.erase(oldest_binexport);
+    } else if (oldest_diff != diffs_.end()) {
+      memory_bytes_ -= oldest_diff->second.memory_bytes;
+      diffs_.erase(oldest_diff);
+    } else {
+      break;  // Only files that are still being decoded
+    }
+  }
+}
+
+absl::Status InputCache::ParseBinDiff(
+    absl::string_view filename,
+    const MatchReceiverCallback& function_match_receiver,
+    const MatchReceiverCallback& basic_block_match_receiver,
+    const MatchReceiverCallback& instruction_match_receiver,
+    std::pair<FileMetaData, FileMetaData>* metadata,
+    const StopCondition* stop) {
+  auto entry = GetEntry(filename, &diffs_);
+  int64_t memory_bytes = 0;  // Set if this call decoded the file.
+  absl::Status status;
+  {
+    absl::MutexLock lock(&entry->mutex);
+    if (!entry->loaded) {
+      auto& data = entry->data;
+      entry->status = ::security::vxsig::ParseBinDiff(
+          filename,
+          [&data](const MemoryAddressPair& match) {
+            data.matches.push_back({DecodedDiff::kFunction, match});
+          },
+          [&data](const MemoryAddressPair& match) {
+            data.matches.push_back({DecodedDiff::kBasicBlock, match});
+          },
+          [&data](const MemoryAddressPair& match) {
+            data.matches.push_back({DecodedDiff::kInstruction, match});
+          },
+          &data.metadata);
+      entry->loaded = true;
+      status = entry->status;
+      memory_bytes = MemoryUsage(data);
+    }
+  }
+  if (memory_bytes > 0) {
+    FinishEntry(filename, entry.get(), status, memory_bytes, &diffs_);
+  }
+
+  absl::ReaderMutexLock lock(&entry->mutex);
+  if (!entry->status.ok()) {
+    return entry->status;
+  }
+  const auto& data = entry->data;
+  for (size_t i = 0; i < data.matches.size(); ++i) {
+    if (i % kStopCheckInterval == 0 && ShouldStop(stop)) {
+      return stop->status();
+    }
+    const auto& match = data.matches[i];
+    const MatchReceiverCallback* receiver = nullptr;
+    switch (match.type) {
+      case DecodedDiff::kFunction:
+        receiver = &function_match_receiver;
+        break;
+      case DecodedDiff::kBasicBlock:
+        receiver = &basic_block_match_receiver;
+        break;
+      case DecodedDiff::kInstruction:
+        receiver = &instruction_match_receiver;
+        break;
+    }
+    if (*receiver) {
+      (*receiver)(match.addresses);
+    }
+  }
+  if (metadata) {
+    *metadata = data.metadata;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status InputCache::ParseBinExport(
+    absl::string_view filename,
+    const FunctionReceiverCallback& function_receiver,
+    const InstructionReceiverCallback& instruction_receiver,
+    const StopCondition* stop,
+    const FlowGraphReceiverCallback& flow_graph_receiver) {
+  auto entry = GetEntry(filename, &binexports_);
+  int64_t memory_bytes = 0;  // Set if this call decoded the file.
+  absl::Status status;
+  {
+    absl::MutexLock lock(&entry->mutex);
+    if (!entry->loaded) {
+      auto& data = entry->data;
+      entry->status = ::security::vxsig::ParseBinExport(
+          filename,
+          [&data](const std::string& sha256, MemoryAddress address,
+                  BinExport2::CallGraph::Vertex::Type type, double md_index) {
+            data.functions.push_back({sha256, address, type, md_index});
+          },
+          [&data](MemoryAddress basic_block_address, MemoryAddress address,
+                  const std::string& raw_bytes, const std::string& disassembly,
+                  const Immediates& immediates) {
+            data.instructions.push_back(
+                {basic_block_address, address, raw_bytes, disassembly,
+                 immediates});
+          },
+          /*stop=*/nullptr,
+          [&data](MemoryAddress entry_address) {
+            data.flow_graphs.push_back(
+                {entry_address, data.instructions.size()});
+          });
+      entry->loaded = true;
+      status = entry->status;
+      memory_bytes = MemoryUsage(data);
+    }
+  }
+  if (memory_bytes > 0) {
+    FinishEntry(filename, entry.get(), status, memory_bytes, &binexports_);
+  }
+
+  absl::ReaderMutexLock lock(&entry->mutex);
+  if (!entry->status.ok()) {
+    return entry->status;
+  }
+  for (const auto& function : entry->data.functions) {
+    function_receiver(function.sha256, function.address, function.type,
+                      function.md_index);
+  }
+  const auto& instructions = entry->data.instructions;
+  const auto& flow_graphs = entry->data.flow_graphs;
+  auto flow_graph = flow_graphs.begin();
+  for (size_t i = 0; i < instructions.size(); ++i) {
+    if (i % kStopCheckInterval == 0 && ShouldStop(stop)) {
+      return stop->status();
+    }
+    for (; flow_graph != flow_graphs.end() &&
+           flow_graph->first_instruction == i;
+         ++flow_graph) {
+      if (flow_graph_receiver) {
+        flow_graph_receiver(flow_graph->entry_address);
+      }
+    }
+    const auto& instruction = instructions[i];
+    instruction_receiver(instruction.basic_block_address, instruction.address,
+                         instruction.raw_bytes, instruction.disassembly,
+                         instruction.immediates);
+  }
+  return absl::OkStatus();
+}
+
+int64_t InputCache::hits() const {
+  absl::MutexLock lock(&mutex_);
+  return hits_;
+}
+
+int64_t InputCache::misses() const {
+  absl::MutexLock lock(&mutex_);
+  return misses_;
+}
+
+int64_t InputCache::memory_bytes() const {
+  absl::MutexLock lock(&mutex_);
+  return memory_bytes_;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,196 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A cache for decoded BinDiff and BinExport files. When generating many
+// signatures in one process, the same input files are usually part of several
+// match chains. The cache decodes each file once and replays the recorded
+// callbacks on subsequent requests, so that callers see exactly the same
+// sequence of calls as with ParseBinDiff() and ParseBinExport().
+
+#ifndef VXSIG_INPUT_CACHE_H_
+#define VXSIG_INPUT_CACHE_H_
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "vxsig/binexport_reader.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/types.h"
+
+namespace security::vxsig {
+
+// This class is thread-safe. Concurrent requests for the same file decode it
+// only once. Files are identified by their path together with their size,
+// modification time and inode, so that a file rewritten at the same path is
+// decoded again. Failures are not cached, as the file may be incomplete. If
+// the decoded files exceed the memory limit, the least recently used ones are
+// evicted. Callers still using an evicted file keep it in memory until they
+// are done.
+class InputCache {
+ public:
+  static constexpr int64_t kUnlimitedMemory =
+      std::numeric_limits<int64_t>::max();
+
+  explicit InputCache(int64_t max_memory_bytes = kUnlimitedMemory)
+      : max_memory_bytes_(max_memory_bytes) {}
+
+  InputCache(const InputCache&) = delete;
+  InputCache& operator=(const InputCache&) = delete;
+
+  // Same as the free function ParseBinDiff(), but uses cached results.
+  // Decoding a file is never stopped, as other callers may be waiting for it.
+  // The stop condition is only checked while calling the receivers.
+  absl::Status ParseBinDiff(
+      absl::string_view filename,
+      const MatchReceiverCallback& function_match_receiver,
+      const MatchReceiverCallback& basic_block_match_receiver,
+      const MatchReceiverCallback& instruction_match_receiver,
+      std::pair<FileMetaData, FileMetaData>* metadata,
+      const StopCondition* stop = nullptr);
+
+  // Same as the free function ParseBinExport(), but uses cached results. The
+  // stop condition is handled like in ParseBinDiff().
+  absl::Status ParseBinExport(
+      absl::string_view filename,
+      const FunctionReceiverCallback& function_receiver,
+      const InstructionReceiverCallback& instruction_receiver,
+      const StopCondition* stop = nullptr,
+      const FlowGraphReceiverCallback& flow_graph_receiver = nullptr);
+
+  // Number of requests served from the cache and number of files decoded.
+  int64_t hits() const;
+  int64_t misses() const;
+
+  // Approximate memory used by the decoded files in the cache.
+  int64_t memory_bytes() const;
+
+ private:
+  // Matches are recorded in a single stream, as the receivers rely on the
+  // order of function, basic block and instruction matches.
+  struct DecodedDiff {
+    enum MatchType : uint8_t { kFunction, kBasicBlock, kInstruction };
+    struct Match {
+      MatchType type;
+      MemoryAddressPair addresses;
+    };
+    std::pair<FileMetaData, FileMetaData> metadata;
+    std::vector<Match> matches;
+  };
+
+  struct DecodedBinExport {
+    struct Function {
+      std::string sha256;
+      MemoryAddress address;
+      BinExport2::CallGraph::Vertex::Type type;
+      double md_index;
+    };
+    struct Instruction {
+      MemoryAddress basic_block_address;
+      MemoryAddress address;
+      std::string raw_bytes;
+      std::string disassembly;
+      Immediates immediates;
+    };
+    // Entry address and index of the first instruction of each flow graph.
+    struct FlowGraph {
+      MemoryAddress entry_address;
+      size_t first_instruction;
+    };
+    std::vector<Function> functions;
+    std::vector<Instruction> instructions;
+    std::vector<FlowGraph> flow_graphs;
+  };
+
+  // A cache slot. The slot mutex is held while decoding, so that other
+  // threads requesting the same file wait for the result.
+  template <typename T>
+  struct Entry {
+    absl::Mutex mutex;
+    bool loaded ABSL_GUARDED_BY(mutex) = false;
+    absl::Status status ABSL_GUARDED_BY(mutex);
+    T data ABSL_GUARDED_BY(mutex);
+  };
+
+  // Identifies the version of a file that an entry was decoded from. All
+  // zero if the file does not exist.
+  struct FileStamp {
+    int64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t device = 0;
+    uint64_t inode = 0;
+
+    bool operator==(const FileStamp& other) const {
+      return size == other.size && mtime_ns == other.mtime_ns &&
+             device == other.device && inode == other.inode;
+    }
+  };
+
+  // The bookkeeping for eviction is kept outside of the entries, so that it
+  // can be updated without taking their mutexes.
+  template <typename T>
+  struct Slot {
+    std::shared_ptr<Entry<T>> entry;
+    FileStamp stamp;
+    int64_t memory_bytes = 0;  // Zero until the file is decoded.
+    int64_t last_use = 0;
+  };
+
+  template <typename T>
+  using SlotMap = absl::flat_hash_map<std::string, Slot<T>>;
+
+  static int64_t MemoryUsage(const DecodedDiff& data);
+  static int64_t MemoryUsage(const DecodedBinExport& data);
+
+  static FileStamp GetFileStamp(absl::string_view filename);
+
+  // Returns the entry for the current version of the file. Entries of older
+  // versions are dropped.
+  template <typename T>
+  std::shared_ptr<Entry<T>> GetEntry(absl::string_view filename,
+                                     SlotMap<T>* slots);
+
+  // Records the result of decoding an entry. Failed entries are dropped,
+  // otherwise old entries are evicted if the cache is over its limit.
+  template <typename T>
+  void FinishEntry(absl::string_view filename, const Entry<T>* entry,
+                   const absl::Status& status, int64_t memory_bytes,
+                   SlotMap<T>* slots);
+
+  void EvictLocked(int64_t max_memory_bytes)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const int64_t max_memory_bytes_;
+
+  mutable absl::Mutex mutex_;
+  SlotMap<DecodedDiff> diffs_ ABSL_GUARDED_BY(mutex_);
+  SlotMap<DecodedBinExport> binexports_ ABSL_GUARDED_BY(mutex_);
+  int64_t memory_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t use_counter_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t hits_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t misses_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_INPUT_CACHE_H_
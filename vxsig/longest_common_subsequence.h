@@ -13,8 +13,9 @@
 // limitations under the License.
 
 // A templated version of the longest-common-subsequence algorithm that works
-// on iterator ranges. The implementation below uses the Hirschberg algorithm
-// parallelized using a ManagedQueue.
+// on iterator ranges. The implementation below uses the Hirschberg algorithm,
+// optionally computing the forward and backward rows in parallel. For very
+// long sequences, cheaper approximations can be selected with LcsOptions.
 
 #ifndef VXSIG_LONGEST_COMMON_SUBSEQUENCE_H_
 #define VXSIG_LONGEST_COMMON_SUBSEQUENCE_H_
@@ -31,21 +32,58 @@
 
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/executor.h"
+#include "vxsig/trace.h"
 
 namespace security::vxsig {
 
+enum class LcsStrategy {
+  // Computes the longest common subsequence in O(n * m) time.
+  kExact,
+  // Splits the sequences into segments at equal elements ("anchors") found
+  // near proportional positions and computes the exact LCS of each pair of
+  // segments.
+  kAnchored,
+  // Splits both sequences at proportional positions, restricting the LCS to
+  // blocks along the diagonal. Cheapest, but least accurate if the sequences
+  // are shifted against each other.
+  kBanded,
+};
+
+// The approximate strategies return a common subsequence that is not
+// necessarily the longest one. Their running time is about that of kExact
+// divided by the number of segments.
+// If the stop condition is met, the computation returns early with an
+// incomplete result that callers should discard.
+struct LcsOptions {
+  LcsStrategy strategy = LcsStrategy::kExact;
+  int segments = 1;
+  const StopCondition* stop = nullptr;
+};
+
 namespace detail {
 
 using LcsRowVector = std::vector<int32_t>;
 
+// Number of rows of the LCS length matrix between checks of the stop
+// condition.
+inline constexpr int kLcsRowsPerStopCheck = 256;
+
 // Internal function that computes a single row of the LCS length matrix.
 template <typename IteratorT>
 void ComputeSingleLcsRow(IteratorT first1, IteratorT last1, IteratorT first2,
-                         IteratorT last2, LcsRowVector* result) {
+                         IteratorT last2, LcsRowVector* result,
+                         const StopCondition* stop) {
   ptrdiff_t size2 = std::distance(first2, last2);
+  TraceCount("lcs_cells", std::distance(first1, last1) * size2);
   result->resize(size2 + 1);
   LcsRowVector prev(*result);
+  int rows = 0;
   for (auto it1 = first1; it1 != last1; ++it1) {
+    if (++rows % kLcsRowsPerStopCheck == 0 && ShouldStop(stop)) {
+      return;
+    }
     prev = *result;
     size_t i = 0;
     for (auto it2 = first2; it2 != last2; ++it2, ++i) {
@@ -64,15 +102,20 @@ void ComputeSingleLcsRow(IteratorT first1, IteratorT last1, IteratorT first2,
 // lengths of the sequences.
 //
 // Returns the longest common subsequence of the given sequences in an output
-// iterator.
+// iterator. Stops early if the stop condition is met.
 template <typename IteratorT, typename OutputIteratorT>
 void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
                               IteratorT first2, IteratorT last2,
-                              OutputIteratorT result) {
+                              OutputIteratorT result, Executor* executor,
+                              const StopCondition* stop) {
   using detail::LcsRowVector;
   using detail::ComputeSingleLcsRow;
   using ReverseIteratorT = std::reverse_iterator<IteratorT>;
 
+  if (ShouldStop(stop)) {
+    return;
+  }
+
   // If both sequences have the same prefix, add it to the resulting LCS.
   // This reduces the space needed for the opt array.
   ptrdiff_t size1 = std::distance(first1, last1);
@@ -117,21 +160,24 @@ void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
     LcsRowVector ll_left;
     LcsRowVector ll_right;
 
+    auto compute_left = [&]() {
+      ComputeSingleLcsRow(first1, mid1, first2, nlast2, &ll_left, stop);
+    };
+    auto compute_right = [&]() {
+      ComputeSingleLcsRow(ReverseIteratorT(nlast1), ReverseIteratorT(mid1),
+                          ReverseIteratorT(nlast2), ReverseIteratorT(first2),
+                          &ll_right, stop);
+    };
     // If the input size is rather small, avoid the overhead of parallelization.
     // The choice is rather arbitrary, but empirically resulted in good
     // subjective performance.
-    if (size1 + size2 > 1000) {
-      // TODO(cblichmann): Compute LCS lengths in parallel using OpenMP
-      ComputeSingleLcsRow(first1, mid1, first2, nlast2, &ll_left);
-      ComputeSingleLcsRow(ReverseIteratorT(nlast1), ReverseIteratorT(mid1),
-                          ReverseIteratorT(nlast2), ReverseIteratorT(first2),
-                          &ll_right);
+    if (executor != nullptr && executor->num_threads() > 1 &&
+        size1 + size2 > 1000) {
+      executor->ParallelFor(
+          2, [&](int64_t i) { i == 0 ? compute_left() : compute_right(); });
     } else {
-      // Small input, avoid overhead of ManagedQueue.
-      ComputeSingleLcsRow(first1, mid1, first2, nlast2, &ll_left);
-      ComputeSingleLcsRow(ReverseIteratorT(nlast1), ReverseIteratorT(mid1),
-                          ReverseIteratorT(nlast2), ReverseIteratorT(first2),
-                          &ll_right);
+      compute_left();
+      compute_right();
     }
 
     // Divide: Find optimal position where to split the input sequences.
@@ -145,22 +191,96 @@ void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
       }
     }
 
-    // Conquer: Continue recursively.
-    LongestCommonSubsequence(first1, mid1, first2, first2 + pivot, result);
-    LongestCommonSubsequence(mid1, nlast1, first2 + pivot, nlast2, result);
+    // Conquer: Continue recursively. The calls are qualified, as the executor
+    // argument would otherwise make the public overload viable through ADL.
+    detail::LongestCommonSubsequence(first1, mid1, first2, first2 + pivot,
+                                     result, executor, stop);
+    detail::LongestCommonSubsequence(mid1, nlast1, first2 + pivot, nlast2,
+                                     result, executor, stop);
   }
 
   // Add common suffixes to result.
   std::copy(nlast1, last1, result);
 }
 
+// Computes a common subsequence segment by segment, see LcsStrategy.
+template <typename IteratorT, typename OutputIteratorT>
+void SegmentedCommonSubsequence(IteratorT first1, IteratorT last1,
+                                IteratorT first2, IteratorT last2,
+                                OutputIteratorT result, Executor* executor,
+                                const LcsOptions& options) {
+  const ptrdiff_t size1 = std::distance(first1, last1);
+  const ptrdiff_t size2 = std::distance(first2, last2);
+  const ptrdiff_t segments =
+      std::min<ptrdiff_t>(options.segments, std::min(size1, size2));
+  // Only search a part of each segment for anchors, so that the search does
+  // not cost more than the LCS of the segments.
+  const ptrdiff_t window = segments > 0 ? size2 / segments / 4 : 0;
+
+  auto segment1 = first1;
+  auto segment2 = first2;
+  for (ptrdiff_t i = 1; i < segments; ++i) {
+    auto split1 = first1 + size1 * i / segments;
+    auto split2 = first2 + size2 * i / segments;
+    if (split2 < segment2) {
+      split2 = segment2;
+    }
+    if (options.strategy == LcsStrategy::kAnchored) {
+      // Find the element equal to *split1 that is closest to split2.
+      auto anchor = last2;
+      for (ptrdiff_t d = 0; d <= window && anchor == last2; ++d) {
+        if (std::distance(split2, last2) > d && *(split2 + d) == *split1) {
+          anchor = split2 + d;
+        } else if (d > 0 && std::distance(segment2, split2) >= d &&
+                   *(split2 - d) == *split1) {
+          anchor = split2 - d;
+        }
+      }
+      if (anchor != last2) {
+        detail::LongestCommonSubsequence(segment1, split1, segment2, anchor,
+                                         result, executor, options.stop);
+        *result++ = *split1;
+        segment1 = split1 + 1;
+        segment2 = anchor + 1;
+        continue;
+      }
+    }
+    detail::LongestCommonSubsequence(segment1, split1, segment2, split2,
+                                     result, executor, options.stop);
+    segment1 = split1;
+    segment2 = split2;
+  }
+  detail::LongestCommonSubsequence(segment1, last1, segment2, last2, result,
+                                   executor, options.stop);
+}
+
 }  // namespace detail
 
+// If an executor is specified, large inputs are processed in parallel. The
+// result does not depend on the executor.
 template <typename IteratorT, typename OutputIteratorT>
 void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
                               IteratorT first2, IteratorT last2,
-                              OutputIteratorT result) {
-  detail::LongestCommonSubsequence(first1, last1, first2, last2, result);
+                              OutputIteratorT result,
+                              Executor* executor = nullptr) {
+  detail::LongestCommonSubsequence(first1, last1, first2, last2, result,
+                                   executor, /*stop=*/nullptr);
+}
+
+// Version of LongestCommonSubsequence() that computes an approximate result
+// for strategies other than LcsStrategy::kExact.
+template <typename IteratorT, typename OutputIteratorT>
+void LongestCommonSubsequence(IteratorT first1, IteratorT last1,
+                              IteratorT first2, IteratorT last2,
+                              OutputIteratorT result, Executor* executor,
+                              const LcsOptions& options) {
+  if (options.strategy == LcsStrategy::kExact || options.segments < 2) {
+    detail::LongestCommonSubsequence(first1, last1, first2, last2, result,
+                                     executor, options.stop);
+  } else {
+    detail::SegmentedCommonSubsequence(first1, last1, first2, last2, result,
+                                       executor, options);
+  }
 }
 
 // Convenience version of LongestCommonSubsequence() that operates on
@@ -14,7 +14,10 @@
 
 #include "vxsig/longest_common_subsequence.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -22,8 +25,11 @@
 #include "gtest/gtest.h"
 
 using testing::Eq;
+using testing::Gt;
 using testing::IsEmpty;
+using testing::IsTrue;
 using testing::ElementsAre;
+using testing::Le;
 
 namespace security::vxsig {
 
@@ -158,4 +164,64 @@ TEST(LongestCommonSubsequenceTest, OperateOnVectors) {
   TestLongestCommonSubsequenceOnVectors<int64_t>();
 }
 
+bool IsSubsequence(const std::vector<int>& sub, const std::vector<int>& seq) {
+  auto it = seq.begin();
+  for (int value : sub) {
+    it = std::find(it, seq.end(), value);
+    if (it == seq.end()) {
+      return false;
+    }
+    ++it;
+  }
+  return true;
+}
+
+TEST(LongestCommonSubsequenceTest, ApproximateStrategies) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> value(0, 9);
+  std::vector<int> first(1000);
+  for (auto& v : first) {
+    v = value(rng);
+  }
+  // Second sequence is the first one with some elements removed and a
+  // prefix added, so that the diagonal is shifted.
+  std::vector<int> second(50, 10);
+  for (int i = 0; i < first.size(); ++i) {
+    if (i % 7 != 0) {
+      second.push_back(first[i]);
+    }
+  }
+
+  std::vector<int> exact;
+  LongestCommonSubsequence(first.begin(), first.end(), second.begin(),
+                           second.end(), std::back_inserter(exact));
+  std::vector<int> exact_again;
+  LongestCommonSubsequence(first.begin(), first.end(), second.begin(),
+                           second.end(), std::back_inserter(exact_again),
+                           nullptr, LcsOptions{LcsStrategy::kExact, 8});
+  EXPECT_THAT(exact_again, Eq(exact));
+
+  for (auto strategy : {LcsStrategy::kAnchored, LcsStrategy::kBanded}) {
+    for (int segments : {2, 8, 64, 5000}) {
+      std::vector<int> result;
+      LongestCommonSubsequence(first.begin(), first.end(), second.begin(),
+                               second.end(), std::back_inserter(result),
+                               nullptr, LcsOptions{strategy, segments});
+      EXPECT_THAT(IsSubsequence(result, first), IsTrue());
+      EXPECT_THAT(IsSubsequence(result, second), IsTrue());
+      EXPECT_THAT(result.size(), Le(exact.size()));
+      if (segments <= 8) {
+        EXPECT_THAT(result.size(), Gt(exact.size() / 2));
+      }
+    }
+  }
+
+  // Identical sequences are found completely if anchors exist.
+  std::vector<int> result;
+  LongestCommonSubsequence(first.begin(), first.end(), first.begin(),
+                           first.end(), std::back_inserter(result), nullptr,
+                           LcsOptions{LcsStrategy::kAnchored, 16});
+  EXPECT_THAT(result, Eq(first));
+}
+
 }  // namespace security::vxsig
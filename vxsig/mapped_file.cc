@@ -0,0 +1,86 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+namespace security::vxsig {
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : address_(std::exchange(other.address_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Unmap();
+    address_ = std::exchange(other.address_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+MappedFile::~MappedFile() { Unmap(); }
+
+void MappedFile::Unmap() {
+  if (address_) {
+    munmap(address_, size_);
+    address_ = nullptr;
+    size_ = 0;
+  }
+}
+
+absl::StatusOr<MappedFile> MappedFile::Open(absl::string_view filename) {
+  const std::string path(filename);
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return absl::NotFoundError(
+        absl::StrCat("Cannot open ", filename, ": ", strerror(errno)));
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    close(fd);
+    return absl::FailedPreconditionError(
+        absl::StrCat("Not a regular file: ", filename));
+  }
+  MappedFile file;
+  if (info.st_size > 0) {
+    void* address =
+        mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, /*offset=*/0);
+    const int mmap_errno = errno;
+    if (address == MAP_FAILED) {
+      close(fd);
+      return absl::InternalError(absl::StrCat("Cannot map ", filename, ": ",
+                                              strerror(mmap_errno)));
+    }
+    file.address_ = address;
+    file.size_ = info.st_size;
+  }
+  // The mapping stays valid after closing the descriptor.
+  close(fd);
+  return file;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,56 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Read-only memory mappings of input files, so that large inputs like process
+// memory images are paged in on demand instead of being copied to the heap.
+
+#ifndef VXSIG_MAPPED_FILE_H_
+#define VXSIG_MAPPED_FILE_H_
+
+#include <cstddef>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace security::vxsig {
+
+class MappedFile {
+ public:
+  MappedFile() = default;
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  ~MappedFile();
+
+  // Maps the whole file. Empty files are valid and have empty data.
+  static absl::StatusOr<MappedFile> Open(absl::string_view filename);
+
+  absl::string_view data() const {
+    return absl::string_view(static_cast<const char*>(address_), size_);
+  }
+
+ private:
+  void Unmap();
+
+  void* address_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_MAPPED_FILE_H_
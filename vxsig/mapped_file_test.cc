@@ -0,0 +1,64 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/mapped_file.h"
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/corpus.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::IsEmpty;
+
+namespace security::vxsig {
+namespace {
+
+std::string TestFile(absl::string_view name) {
+  return JoinPath(getenv("TEST_TMPDIR"), name);
+}
+
+TEST(MappedFileTest, MapsContents) {
+  const std::string filename = TestFile("mapped");
+  const std::string contents("\x00\x01mapped\xff", 9);
+  ASSERT_THAT(WriteFileContentsAtomically(filename, contents), IsOk());
+  auto file = MappedFile::Open(filename);
+  ASSERT_THAT(file, IsOk());
+  EXPECT_THAT(file->data(), Eq(contents));
+
+  // Moving transfers the mapping.
+  MappedFile moved = *std::move(file);
+  EXPECT_THAT(moved.data(), Eq(contents));
+}
+
+TEST(MappedFileTest, MapsEmptyFile) {
+  const std::string filename = TestFile("empty");
+  ASSERT_THAT(WriteFileContentsAtomically(filename, ""), IsOk());
+  auto file = MappedFile::Open(filename);
+  ASSERT_THAT(file, IsOk());
+  EXPECT_THAT(file->data(), IsEmpty());
+}
+
+TEST(MappedFileTest, FailsForMissingFile) {
+  EXPECT_THAT(MappedFile::Open(TestFile("missing")).ok(), Eq(false));
+}
+
+}  // namespace
+}  // namespace security::vxsig
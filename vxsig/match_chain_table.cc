@@ -26,6 +26,8 @@
 #include "third_party/zynamics/binexport/util/status_macros.h"
 #include "vxsig/binexport_reader.h"
 #include "vxsig/diff_result_reader.h"
+#include "vxsig/identical_matcher.h"
+#include "vxsig/trace.h"
 
 namespace security::vxsig {
 
@@ -227,39 +229,110 @@ void MatchChainColumn::BuildIdIndices() {
   BuildIdIndexFromAddressIndex(basic_blocks_by_address_, &basic_blocks_by_id_);
 }
 
+namespace {
+
+// Records where the files of the column, and of the next one if it is the
+// last, are found and finishes the chain.
+void LinkColumns(const std::pair<FileMetaData, FileMetaData>& metadata,
+                 const std::string& directory,
+                 const std::string& next_directory, bool last,
+                 MatchChainColumn* column, MatchChainColumn* next,
+                 std::vector<std::pair<std::string, std::string>>* diffs) {
+  column->set_filename(metadata.first.filename);
+  column->set_diff_directory(directory);
+  if (last) {
+    next->set_filename(metadata.second.filename);
+    next->set_diff_directory(next_directory);
+    next->FinishChain(column);
+  }
+  diffs->emplace_back(metadata.first.filename, metadata.second.filename);
+}
+
+}  // namespace
+
 absl::Status AddDiffResult(
     absl::string_view filename, bool last, MatchChainColumn* column,
     MatchChainColumn* next,
-    std::vector<std::pair<std::string, std::string>>* diffs) {
-  namespace arg = ::std::placeholders;
-
+    std::vector<std::pair<std::string, std::string>>* diffs,
+    InputCache* cache, const StopCondition* stop, bool reversed) {
   MatchChainInserter match_inserter(column);
   std::pair<FileMetaData, FileMetaData> metadata;
 
+  TraceSpan span("AddDiffResult");
+  int64_t rows_read = 0;
+  // Matches are reported hierarchically, so swapping the addresses of each
+  // pair is enough to use the diff in the opposite direction.
+  auto oriented = [reversed](const MemoryAddressPair& match) {
+    return reversed ? MemoryAddressPair(match.second, match.first) : match;
+  };
+  const MatchReceiverCallback function_receiver =
+      [&match_inserter, &rows_read, &oriented](const MemoryAddressPair& match) {
+        ++rows_read;
+        match_inserter.AddFunctionMatch(oriented(match));
+      };
+  const MatchReceiverCallback basic_block_receiver =
+      [&match_inserter, &rows_read, &oriented](const MemoryAddressPair& match) {
+        ++rows_read;
+        match_inserter.AddBasicBlockMatch(oriented(match));
+      };
+  const MatchReceiverCallback instruction_receiver =
+      [&match_inserter, &rows_read, &oriented](const MemoryAddressPair& match) {
+        ++rows_read;
+        match_inserter.AddInstructionMatch(oriented(match));
+      };
   NA_RETURN_IF_ERROR(
-      ParseBinDiff(filename,
-                   std::bind(&MatchChainInserter::AddFunctionMatch,
-                             &match_inserter, arg::_1),
-                   std::bind(&MatchChainInserter::AddBasicBlockMatch,
-                             &match_inserter, arg::_1),
-                   std::bind(&MatchChainInserter::AddInstructionMatch,
-                             &match_inserter, arg::_1),
-                   &metadata));
+      cache ? cache->ParseBinDiff(filename, function_receiver,
+                                  basic_block_receiver, instruction_receiver,
+                                  &metadata, stop)
+            : ParseBinDiff(filename, function_receiver, basic_block_receiver,
+                           instruction_receiver, &metadata, stop));
+  span.Arg("rows", rows_read);
+  TraceCount("diff_rows_read", rows_read);
+  if (reversed) {
+    std::swap(metadata.first, metadata.second);
+  }
 
   const std::string diff_directory = Dirname(filename);
-  column->set_filename(metadata.first.filename);
-  column->set_diff_directory(diff_directory);
-  if (last) {
-    next->set_filename(metadata.second.filename);
-    next->set_diff_directory(diff_directory);
-    next->FinishChain(column);
-  }
-  diffs->emplace_back(metadata.first.filename, metadata.second.filename);
+  LinkColumns(metadata, diff_directory, diff_directory, last, column, next,
+              diffs);
+  return absl::OkStatus();
+}
+
+absl::Status AddIdenticalMatches(
+    absl::string_view primary_filename, absl::string_view secondary_filename,
+    bool last, MatchChainColumn* column, MatchChainColumn* next,
+    std::vector<std::pair<std::string, std::string>>* diffs,
+    InputCache* cache, const StopCondition* stop) {
+  MatchChainInserter match_inserter(column);
+  std::pair<FileMetaData, FileMetaData> metadata;
+
+  TraceSpan span("AddIdenticalMatches");
+  int64_t matches = 0;
+  NA_RETURN_IF_ERROR(MatchIdenticalFunctions(
+      primary_filename, secondary_filename,
+      [&match_inserter, &matches](const MemoryAddressPair& match) {
+        ++matches;
+        match_inserter.AddFunctionMatch(match);
+      },
+      [&match_inserter, &matches](const MemoryAddressPair& match) {
+        ++matches;
+        match_inserter.AddBasicBlockMatch(match);
+      },
+      [&match_inserter, &matches](const MemoryAddressPair& match) {
+        ++matches;
+        match_inserter.AddInstructionMatch(match);
+      },
+      &metadata, cache, stop));
+  span.Arg("matches", matches);
+
+  LinkColumns(metadata, Dirname(primary_filename), Dirname(secondary_filename),
+              last, column, next, diffs);
   return absl::OkStatus();
 }
 
 absl::Status AddFunctionData(absl::string_view filename,
-                             MatchChainColumn* column) {
+                             MatchChainColumn* column, InputCache* cache,
+                             const StopCondition* stop) {
   auto metadata_callback(
       [column](const std::string& sha256, MemoryAddress address,
                BinExport2::CallGraph::Vertex::Type type, double /*md_index*/) {
@@ -280,7 +353,9 @@ absl::Status AddFunctionData(absl::string_view filename,
         }
       });
 
-  auto basic_block_callback([column](MemoryAddress bb_address,
+  TraceSpan span("AddFunctionData");
+  int64_t rows_read = 0;
+  auto basic_block_callback([column, &rows_read](MemoryAddress bb_address,
                                      MemoryAddress instr_address,
                                      const std::string& instr_bytes,
                                      const std::string& disassembly,
@@ -289,6 +364,7 @@ absl::Status AddFunctionData(absl::string_view filename,
     // present in this column. However, loading all instruction bytes makes the
     // logic a bit simpler and also gracefully handles instructions that are
     // shared with unmatched basic blocks. This fixes b/26509651.
+    ++rows_read;
     auto* instr = column->FindInstructionByAddress(instr_address);
     if (!instr) {
       // Instruction not found in this column, because it was not matched.
@@ -309,7 +385,14 @@ absl::Status AddFunctionData(absl::string_view filename,
     }
   });
 
-  return ParseBinExport(filename, metadata_callback, basic_block_callback);
+  NA_RETURN_IF_ERROR(
+      cache ? cache->ParseBinExport(filename, metadata_callback,
+                                    basic_block_callback, stop)
+            : ParseBinExport(filename, metadata_callback, basic_block_callback,
+                             stop));
+  span.Arg("rows", rows_read);
+  TraceCount("binexport_rows_read", rows_read);
+  return absl::OkStatus();
 }
 
 template <typename IndexT>
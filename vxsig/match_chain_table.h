@@ -49,6 +49,8 @@
 #include "absl/strings/string_view.h"
 #include "third_party/zynamics/binexport/binexport2.pb.h"
 #include "vxsig/binexport_reader.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/input_cache.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
 
@@ -184,6 +186,12 @@ class MatchChainColumn {
   const FunctionAddressIndex& functions_by_address() const {
     return functions_by_address_;
   }
+  const BasicBlockAddressIndex& basic_blocks_by_address() const {
+    return basic_blocks_by_address_;
+  }
+  const InstructionAddressIndex& instructions_by_address() const {
+    return instructions_by_address_;
+  }
   static FunctionAddressIndex* GetFunctionIndexFromColumn(
       MatchChainColumn* column) {
     return &column->functions_by_address_;
@@ -241,16 +249,35 @@ class MatchChainColumn {
 // Multiple MatchChainColumns make up the match chain table.
 using MatchChainTable = std::vector<std::unique_ptr<MatchChainColumn>>;
 
-// Adds a diff result file to the table in the specified column.
+// Adds a diff result file to the table in the specified column. If cache is
+// non-null, the decoded diff is shared with other callers. If the stop
+// condition is met while reading, returns its status and leaves the column
+// partially filled. If reversed is set, the diff is used from its secondary to
+// its primary binary.
 absl::Status AddDiffResult(
     absl::string_view filename, bool last, MatchChainColumn* column,
     MatchChainColumn* next,
-    std::vector<std::pair<std::string, std::string>>* diffs);
+    std::vector<std::pair<std::string, std::string>>* diffs,
+    InputCache* cache = nullptr, const StopCondition* stop = nullptr,
+    bool reversed = false);
+
+// Like AddDiffResult(), but adds the identical functions of two .BinExport
+// files, as found by MatchIdenticalFunctions(), instead of a diff result. The
+// column is linked to the primary and next to the secondary file.
+absl::Status AddIdenticalMatches(
+    absl::string_view primary_filename, absl::string_view secondary_filename,
+    bool last, MatchChainColumn* column, MatchChainColumn* next,
+    std::vector<std::pair<std::string, std::string>>* diffs,
+    InputCache* cache = nullptr, const StopCondition* stop = nullptr);
 
 // Loads function metadata and raw instruction bytes from the specified
-// .BinExport file and adds it to the table in the specified column.
+// .BinExport file and adds it to the table in the specified column. If cache
+// is non-null, the decoded file is shared with other callers. The stop
+// condition is handled like in AddDiffResult().
 absl::Status AddFunctionData(absl::string_view filename,
-                             MatchChainColumn* column);
+                             MatchChainColumn* column,
+                             InputCache* cache = nullptr,
+                             const StopCondition* stop = nullptr);
 
 // Imposes an order on the matches of each column/binary in the table. The
 // first column is used as the "master column", i.e. the matches of the
@@ -14,12 +14,17 @@
 
 #include "vxsig/match_chain_table.h"
 
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "absl/memory/memory.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
 
+using not_absl::IsOk;
 using testing::Contains;
 using testing::Eq;
 using testing::NotNull;
@@ -177,5 +182,40 @@ TEST(MatchChainColumnTest, PropagateIdsAndBuildIndices) {
   }
 }
 
+TEST(MatchChainTableTest, AddReversedDiffResult) {
+  const std::string file_name = JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/sshd.korg_vs_sshd.trojan1.BinDiff");
+  std::vector<std::pair<std::string, std::string>> diffs;
+  MatchChainColumn column;
+  MatchChainColumn next;
+  ASSERT_THAT(AddDiffResult(file_name, /*last=*/true, &column, &next, &diffs),
+              IsOk());
+  MatchChainColumn reversed_column;
+  MatchChainColumn reversed_next;
+  ASSERT_THAT(AddDiffResult(file_name, /*last=*/true, &reversed_column,
+                            &reversed_next, &diffs, /*cache=*/nullptr,
+                            /*stop=*/nullptr, /*reversed=*/true),
+              IsOk());
+
+  EXPECT_THAT(reversed_column.filename(), Eq(next.filename()));
+  EXPECT_THAT(reversed_next.filename(), Eq(column.filename()));
+  ASSERT_THAT(diffs, SizeIs(2));
+  EXPECT_THAT(diffs[1].first, Eq("sshd.trojan1"));
+  EXPECT_THAT(diffs[1].second, Eq("sshd.korg"));
+
+  auto* functions = MatchChainColumn::GetFunctionIndexFromColumn(&column);
+  EXPECT_THAT(
+      *MatchChainColumn::GetFunctionIndexFromColumn(&reversed_column),
+      SizeIs(functions->size()));
+  for (const auto& [address, function] : *functions) {
+    auto* reversed =
+        reversed_column.FindFunctionByAddress(function->match.address_in_next);
+    ASSERT_THAT(reversed, NotNull());
+    EXPECT_THAT(reversed->match.address_in_next, Eq(address));
+    EXPECT_THAT(reversed->basic_blocks, SizeIs(function->basic_blocks.size()));
+  }
+}
+
 }  // namespace
 }  // namespace security::vxsig
@@ -0,0 +1,204 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/minimize.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "vxsig/scan_cost.h"
+
+namespace security::vxsig {
+namespace {
+
+// Per-piece data needed for the set cover.
+struct PieceInfo {
+  bool matches_samples = false;
+  int quality = 0;
+
+  // Sorted indices of the goodware files that do not contain the piece.
+  std::vector<int> excluded_files;
+};
+
+// A piece in the greedy selection queue. Larger compares better.
+struct Candidate {
+  int gain;  // Number of goodware files newly excluded by this piece
+  int quality;
+  int length;
+  int index;
+
+  bool operator<(const Candidate& other) const {
+    // Prefer earlier pieces on ties, so that results are stable.
+    return std::tie(gain, quality, length, other.index) <
+           std::tie(other.gain, other.quality, other.length, index);
+  }
+};
+
+// Copies the pieces with the specified indices, which must be sorted. Bytes
+// of pieces that are left out are covered by an unbounded wildcard.
+RawSignature CopyPieces(const RawSignature& raw,
+                        const std::vector<int>& indices) {
+  RawSignature result;
+  int last_index = -1;
+  for (int index : indices) {
+    if (last_index >= 0 && index != last_index + 1) {
+      auto* previous = result.mutable_piece(result.piece_size() - 1);
+      previous->clear_min_qualifier();
+      previous->clear_max_qualifier();
+    }
+    *result.add_piece() = raw.piece(index);
+    last_index = index;
+  }
+  return result;
+}
+
+}  // namespace
+
+absl::StatusOr<MinimizedSignature> MinimizeSignature(
+    const RawSignature& raw, absl::Span<const std::string> samples,
+    const GoodwareCorpus* goodware, const MinimizeOptions& options) {
+  if (options.min_pieces < 1) {
+    return absl::InvalidArgumentError("Need to keep at least one piece");
+  }
+  const int num_pieces = raw.piece_size();
+  const int num_goodware = goodware != nullptr ? goodware->num_files() : 0;
+
+  const std::shared_ptr<Executor> executor =
+      GetOrMakeExecutor(options.executor, options.num_threads);
+  std::vector<PieceInfo> infos(num_pieces);
+  executor->ParallelFor(num_pieces, [&](int64_t i) {
+    const auto& piece = raw.piece(i);
+    const CompiledPiece compiled = CompilePiece(piece);
+    if (compiled.bytes.empty()) {
+      return;
+    }
+    auto& info = infos[i];
+    info.matches_samples =
+        std::all_of(samples.begin(), samples.end(),
+                    [&compiled](absl::string_view sample) {
+                      return FindPiece(compiled, sample) !=
+                             absl::string_view::npos;
+                    });
+    if (!info.matches_samples) {
+      return;
+    }
+    info.quality = ExtractBestAtom(compiled).quality;
+    if (goodware == nullptr) {
+      return;
+    }
+    const std::vector<int> present = goodware->FindFilesWithPiece(piece);
+    auto it = present.begin();
+    for (int file = 0; file < num_goodware; ++file) {
+      if (it != present.end() && *it == file) {
+        ++it;
+      } else {
+        info.excluded_files.push_back(file);
+      }
+    }
+  });
+
+  MinimizedSignature result;
+  std::priority_queue<Candidate> queue;
+  for (int i = 0; i < num_pieces; ++i) {
+    const auto& info = infos[i];
+    if (!info.matches_samples) {
+      ++result.rejected_pieces;
+      continue;
+    }
+    queue.push({static_cast<int>(info.excluded_files.size()), info.quality,
+                static_cast<int>(raw.piece(i).bytes().size()), i});
+  }
+  if (queue.empty()) {
+    return absl::FailedPreconditionError(
+        "No signature piece matches all samples");
+  }
+
+  // Greedy set cover with lazy gain updates: the gain of a piece can only
+  // decrease over time, so a piece whose updated gain still beats the rest of
+  // the queue is the best choice. All remaining pieces are ranked as well, to
+  // order the fallback pieces.
+  std::vector<bool> excluded(num_goodware);
+  int num_uncovered = num_goodware;
+  std::vector<int> order;
+  order.reserve(queue.size());
+  int num_covering = 0;
+  while (!queue.empty()) {
+    Candidate top = queue.top();
+    queue.pop();
+    if (top.gain > 0) {
+      const auto& files = infos[top.index].excluded_files;
+      const int gain =
+          std::count_if(files.begin(), files.end(),
+                        [&excluded](int file) { return !excluded[file]; });
+      if (gain < top.gain) {
+        top.gain = gain;
+        queue.push(top);
+        continue;
+      }
+      for (int file : files) {
+        excluded[file] = true;
+      }
+      num_uncovered -= gain;
+    }
+    order.push_back(top.index);
+    if (top.gain > 0) {
+      num_covering = order.size();
+    }
+  }
+  result.uncovered_goodware = num_uncovered;
+
+  const int num_selected = std::min<int>(
+      order.size(), std::max(options.min_pieces, num_covering));
+  std::vector<int> selected(order.begin(), order.begin() + num_selected);
+  std::sort(selected.begin(), selected.end());
+  result.signature = CopyPieces(raw, selected);
+
+  std::vector<int> fallback(order.begin() + num_selected, order.end());
+  std::vector<int> weights(num_pieces);
+  for (int rank = 0; rank < fallback.size(); ++rank) {
+    weights[fallback[rank]] = fallback.size() - rank;
+  }
+  std::sort(fallback.begin(), fallback.end());
+  result.fallback = CopyPieces(raw, fallback);
+  for (int i = 0; i < fallback.size(); ++i) {
+    result.fallback.mutable_piece(i)->set_weight(weights[fallback[i]]);
+  }
+  return result;
+}
+
+std::string SampleImageFromColumn(const MatchChainColumn& column) {
+  // Basic blocks may be shared between functions, so collect the instructions
+  // first.
+  std::map<MemoryAddress, const MatchedInstruction*> instructions;
+  for (const auto& function : column.functions_by_address()) {
+    for (const auto* basic_block : function.second->basic_blocks) {
+      for (const auto* instruction : basic_block->instructions) {
+        instructions.emplace(instruction->match.address, instruction);
+      }
+    }
+  }
+  std::string image;
+  for (const auto& instruction : instructions) {
+    image.append(instruction.second->raw_instruction_bytes);
+  }
+  return image;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,83 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Signature minimization: selects a small subset of the pieces of a raw
+// signature that still matches all samples while not matching any goodware.
+// This is an instance of the set cover problem: a piece "covers" each goodware
+// file it does not occur in, as a signature does not match a file if any of
+// its pieces is missing. The minimizer uses the greedy approximation, which is
+// within a logarithmic factor of the optimum.
+
+#ifndef VXSIG_MINIMIZE_H_
+#define VXSIG_MINIMIZE_H_
+
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "vxsig/executor.h"
+#include "vxsig/goodware.h"
+#include "vxsig/match_chain_table.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+struct MinimizeOptions {
+  // Minimum number of pieces to keep, even if fewer pieces would suffice to
+  // exclude all goodware. Without a goodware corpus, this is the number of
+  // pieces that will be selected.
+  int min_pieces = 4;
+
+  // Number of threads to use if no executor is set, zero selects a default.
+  int num_threads = 0;
+
+  // Optional executor for scanning the samples, used instead of num_threads.
+  // Not owned.
+  Executor* executor = nullptr;
+};
+
+struct MinimizedSignature {
+  // The selected pieces, in their original order.
+  RawSignature signature;
+
+  // The remaining pieces that match all samples, in their original order.
+  // Weights rank the pieces by the order in which the minimizer would have
+  // picked them next, with higher weights coming first.
+  RawSignature fallback;
+
+  // Number of goodware files that the minimized signature still matches,
+  // because they contain every piece.
+  int uncovered_goodware = 0;
+
+  // Number of pieces that were discarded because they did not match all
+  // samples.
+  int rejected_pieces = 0;
+};
+
+// Minimizes a raw signature. Each sample is the byte image of one input binary
+// and pieces that do not match every sample are never selected. The goodware
+// corpus is optional and may be nullptr. Pieces are preferred by the number of
+// goodware files they exclude, then by atom quality and length.
+absl::StatusOr<MinimizedSignature> MinimizeSignature(
+    const RawSignature& raw, absl::Span<const std::string> samples,
+    const GoodwareCorpus* goodware, const MinimizeOptions& options);
+
+// Returns the instruction bytes of all functions of a match chain column in
+// address order. This approximates the code of the binary the column
+// represents.
+std::string SampleImageFromColumn(const MatchChainColumn& column);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_MINIMIZE_H_
@@ -0,0 +1,123 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/minimize.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::IsTrue;
+
+namespace security::vxsig {
+namespace {
+
+class MinimizeTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    AddSignaturePieces(
+        {"alpha123", "bravo456", "reject00", "charlie7", "delta890"}, &raw_);
+    samples_ = {"alpha123 bravo456 charlie7 delta890 reject00",
+                "delta890 charlie7 bravo456 alpha123"};
+  }
+
+  RawSignature raw_;
+  std::vector<std::string> samples_;
+};
+
+TEST_F(MinimizeTest, WithoutGoodware) {
+  MinimizeOptions options;
+  options.min_pieces = 2;
+  auto result = MinimizeSignature(raw_, samples_, /*goodware=*/nullptr,
+                                  options);
+  ASSERT_THAT(result, IsOk());
+  EXPECT_THAT(result->rejected_pieces, Eq(1));
+  EXPECT_THAT(result->uncovered_goodware, Eq(0));
+  EXPECT_THAT(result->signature.piece_size(), Eq(2));
+  EXPECT_THAT(result->fallback.piece_size(), Eq(2));
+  for (const auto& piece : result->fallback.piece()) {
+    EXPECT_THAT(piece.weight() > 0, IsTrue());
+  }
+}
+
+TEST_F(MinimizeTest, SelectsPiecesExcludingGoodware) {
+  Corpus corpus;
+  corpus.AddFile("g0", "alpha123 bravo456");
+  corpus.AddFile("g1", "alpha123 charlie7");
+  corpus.AddFile("g2", "alpha123 bravo456 charlie7");
+  auto goodware = GoodwareCorpus::FromCorpus(std::move(corpus));
+
+  MinimizeOptions options;
+  options.min_pieces = 1;
+  options.num_threads = 2;
+  auto result = MinimizeSignature(raw_, samples_, goodware.get(), options);
+  ASSERT_THAT(result, IsOk());
+  EXPECT_THAT(result->uncovered_goodware, Eq(0));
+  EXPECT_THAT(EquivRawSignature(result->signature,
+                                *MakeRawSignature({"delta890"})),
+              IsTrue());
+  EXPECT_THAT(EquivRawSignature(
+                  result->fallback,
+                  *MakeRawSignature({"alpha123", "bravo456", "charlie7"})),
+              IsTrue());
+}
+
+TEST_F(MinimizeTest, CombinesPiecesToExcludeGoodware) {
+  Corpus corpus;
+  corpus.AddFile("g0", "alpha123 bravo456 delta890");
+  corpus.AddFile("g1", "alpha123 charlie7 delta890");
+  corpus.AddFile("g2", "alpha123 bravo456 charlie7 delta890");
+  auto goodware = GoodwareCorpus::FromCorpus(std::move(corpus));
+
+  MinimizeOptions options;
+  options.min_pieces = 1;
+  auto result = MinimizeSignature(raw_, samples_, goodware.get(), options);
+  ASSERT_THAT(result, IsOk());
+  // The last goodware file contains all pieces and cannot be excluded.
+  EXPECT_THAT(result->uncovered_goodware, Eq(1));
+  EXPECT_THAT(EquivRawSignature(result->signature,
+                                *MakeRawSignature({"bravo456", "charlie7"})),
+              IsTrue());
+}
+
+TEST_F(MinimizeTest, NoPieceMatchesAllSamples) {
+  samples_.push_back("nothing");
+  EXPECT_FALSE(
+      MinimizeSignature(raw_, samples_, nullptr, MinimizeOptions()).ok());
+}
+
+TEST(SampleImageTest, ConcatenatesInstructionsInAddressOrder) {
+  MatchChainColumn column;
+  auto* function = column.InsertFunctionMatch({0x1000, 0x2000});
+  auto* second_block = column.InsertBasicBlockMatch(function, {0x1010, 0});
+  auto* first_block = column.InsertBasicBlockMatch(function, {0x1000, 0});
+  column.InsertInstructionMatch(second_block, {0x1010, 0})
+      ->raw_instruction_bytes = "\xc3";
+  column.InsertInstructionMatch(first_block, {0x1000, 0})
+      ->raw_instruction_bytes = "\x55";
+  column.InsertInstructionMatch(first_block, {0x1001, 0})
+      ->raw_instruction_bytes = "\x8b\xec";
+  EXPECT_THAT(SampleImageFromColumn(column), Eq("\x55\x8b\xec\xc3"));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,447 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/raw_image_signature.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/mapped_file.h"
+#include "vxsig/scan_cost.h"
+#include "vxsig/trace.h"
+
+namespace security::vxsig {
+namespace {
+
+// Multiplier of the polynomial rolling hash, computed modulo 2^64.
+constexpr uint64_t kHashBase = 0x100000001b3;
+
+// The reference image is scanned in chunks of at least this size in parallel.
+constexpr size_t kMinChunkSize = 64 << 10;
+
+// Runs of at least this many equal bytes are trimmed from common sequences.
+constexpr size_t kMinTrimmedRun = 4;
+
+// Hashes of the n-grams of an image and their first offset, sorted by hash.
+using NGramIndex = std::vector<std::pair<uint64_t, size_t>>;
+
+uint64_t HashNGram(absl::string_view ngram) {
+  uint64_t hash = 0;
+  for (const char c : ngram) {
+    hash = hash * kHashBase + static_cast<uint8_t>(c);
+  }
+  return hash;
+}
+
+// Returns kHashBase^n, the factor of the byte leaving the window.
+uint64_t OutgoingFactor(int n) {
+  uint64_t factor = 1;
+  for (int i = 0; i < n; ++i) {
+    factor *= kHashBase;
+  }
+  return factor;
+}
+
+NGramIndex IndexImage(absl::string_view image, int n) {
+  NGramIndex index;
+  if (image.size() < n) {
+    return index;
+  }
+  index.reserve(image.size() - n + 1);
+  const uint64_t outgoing_factor = OutgoingFactor(n);
+  uint64_t hash = 0;
+  int run = 0;  // Length of the run of equal bytes ending at i
+  for (size_t i = 0; i < image.size(); ++i) {
+    hash = hash * kHashBase + static_cast<uint8_t>(image[i]);
+    if (i >= n) {
+      hash -= outgoing_factor * static_cast<uint8_t>(image[i - n]);
+    }
+    run = i > 0 && image[i] == image[i - 1] ? run + 1 : 1;
+    if (i + 1 >= n && run < n) {
+      index.emplace_back(hash, i + 1 - n);
+    }
+  }
+  std::sort(index.begin(), index.end());
+  index.erase(std::unique(index.begin(), index.end(),
+                          [](const auto& first, const auto& second) {
+                            return first.first == second.first;
+                          }),
+              index.end());
+  index.shrink_to_fit();
+  return index;
+}
+
+bool FindNGram(const NGramIndex& index, uint64_t hash, size_t* offset) {
+  auto found = std::lower_bound(
+      index.begin(), index.end(), hash,
+      [](const auto& entry, uint64_t value) { return entry.first < value; });
+  if (found == index.end() || found->first != hash) {
+    return false;
+  }
+  *offset = found->second;
+  return true;
+}
+
+size_t CommonPrefixLength(absl::string_view first, absl::string_view second) {
+  const size_t length = std::min(first.size(), second.size());
+  size_t i = 0;
+  while (i < length && first[i] == second[i]) {
+    ++i;
+  }
+  return i;
+}
+
+// A byte sequence of the reference image that occurs at the offsets in the
+// other images.
+struct Sequence {
+  size_t reference_offset = 0;
+  size_t length = 0;
+  std::vector<size_t> offsets;
+};
+
+// Finds the common sequences that start in [begin, end) of the reference.
+// Sequences are extended past the end of the range.
+std::vector<Sequence> FindCommonSequences(
+    absl::string_view reference, absl::Span<const absl::string_view> others,
+    absl::Span<const NGramIndex> indices, int n, size_t begin, size_t end,
+    const StopCondition& stop, std::atomic<bool>* stopped) {
+  std::vector<Sequence> sequences;
+  const uint64_t outgoing_factor = OutgoingFactor(n);
+  std::vector<size_t> offsets(others.size());
+  bool hashed = false;
+  uint64_t hash = 0;
+  for (size_t p = begin, steps = 0; p < end && p + n <= reference.size();
+       ++steps) {
+    if (steps % kStopCheckInterval == 0 &&
+        (*stopped || stop.ShouldStop())) {
+      *stopped = true;
+      return sequences;
+    }
+    if (!hashed) {
+      hash = HashNGram(reference.substr(p, n));
+      hashed = true;
+    }
+    size_t length = 0;
+    bool found = true;
+    for (int i = 0; found && i < others.size(); ++i) {
+      found = FindNGram(indices[i], hash, &offsets[i]);
+    }
+    if (found) {
+      length = reference.size() - p;
+      for (int i = 0; i < others.size(); ++i) {
+        length = std::min(
+            length, CommonPrefixLength(reference.substr(p, length),
+                                       others[i].substr(offsets[i])));
+      }
+    }
+    // Shorter sequences are hash collisions.
+    if (length >= n) {
+      sequences.push_back({p, length, offsets});
+      p += length;
+      hashed = false;
+      continue;
+    }
+    if (p + n < reference.size()) {
+      hash = hash * kHashBase + static_cast<uint8_t>(reference[p + n]) -
+             outgoing_factor * static_cast<uint8_t>(reference[p]);
+    }
+    ++p;
+  }
+  return sequences;
+}
+
+// A candidate piece, cut from a common sequence.
+struct Candidate {
+  Sequence sequence;
+  int quality = 0;
+  int distinct_bytes = 0;
+};
+
+int CountDistinctBytes(absl::string_view bytes) {
+  std::bitset<256> seen;
+  for (const char c : bytes) {
+    seen.set(static_cast<uint8_t>(c));
+  }
+  return seen.count();
+}
+
+// Returns the lengths of the runs of equal bytes at the start and at the end
+// of the data.
+size_t LeadingRunLength(absl::string_view data) {
+  size_t length = 0;
+  while (length < data.size() && data[length] == data.front()) {
+    ++length;
+  }
+  return length;
+}
+
+size_t TrailingRunLength(absl::string_view data) {
+  size_t length = 0;
+  while (length < data.size() &&
+         data[data.size() - 1 - length] == data.back()) {
+    ++length;
+  }
+  return length;
+}
+
+// Cuts pieces from the sequences. Runs of equal bytes at either end of a
+// sequence, like the end of a zero-filled page in front of code, are left out.
+std::vector<Candidate> CutCandidates(absl::string_view reference,
+                                     absl::Span<const Sequence> sequences,
+                                     const RawImageOptions& options) {
+  std::vector<Candidate> candidates;
+  for (const auto& sequence : sequences) {
+    absl::string_view bytes =
+        reference.substr(sequence.reference_offset, sequence.length);
+    if (const size_t run = LeadingRunLength(bytes); run >= kMinTrimmedRun) {
+      bytes.remove_prefix(run);
+    }
+    if (const size_t run = TrailingRunLength(bytes); run >= kMinTrimmedRun) {
+      bytes.remove_suffix(run);
+    }
+    const size_t first = bytes.data() - reference.data();
+    const size_t skipped = first - sequence.reference_offset;
+    for (size_t start = skipped; start < skipped + bytes.size();
+         start += options.max_piece_length) {
+      const size_t length = std::min<size_t>(options.max_piece_length,
+                                             skipped + bytes.size() - start);
+      if (length < options.min_piece_length) {
+        break;
+      }
+      Candidate candidate;
+      candidate.sequence.reference_offset = sequence.reference_offset + start;
+      candidate.sequence.length = length;
+      for (const size_t offset : sequence.offsets) {
+        candidate.sequence.offsets.push_back(offset + start);
+      }
+      const absl::string_view piece_bytes =
+          reference.substr(candidate.sequence.reference_offset, length);
+      candidate.distinct_bytes = CountDistinctBytes(piece_bytes);
+      if (candidate.distinct_bytes < options.min_distinct_bytes) {
+        continue;
+      }
+      RawSignature::Piece piece;
+      piece.set_bytes(std::string(piece_bytes));
+      candidate.quality = ExtractBestAtom(CompilePiece(piece)).quality;
+      candidates.push_back(std::move(candidate));
+    }
+  }
+  return candidates;
+}
+
+// Whether first ends before second starts in all images.
+bool Precedes(const Sequence& first, const Sequence& second) {
+  if (first.reference_offset + first.length > second.reference_offset) {
+    return false;
+  }
+  for (int i = 0; i < first.offsets.size(); ++i) {
+    if (first.offsets[i] + first.length > second.offsets[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the indices of the chain of candidates, which must be sorted by
+// reference offset, with the most bytes that occurs in order in all images.
+std::vector<int> LongestOrderedChain(absl::Span<const Candidate> candidates) {
+  const int num_candidates = candidates.size();
+  std::vector<size_t> best_length(num_candidates);
+  std::vector<int> previous(num_candidates, -1);
+  int best_end = -1;
+  for (int i = 0; i < num_candidates; ++i) {
+    best_length[i] = candidates[i].sequence.length;
+    for (int j = 0; j < i; ++j) {
+      if (best_length[j] + candidates[i].sequence.length > best_length[i] &&
+          Precedes(candidates[j].sequence, candidates[i].sequence)) {
+        best_length[i] = best_length[j] + candidates[i].sequence.length;
+        previous[i] = j;
+      }
+    }
+    if (best_end < 0 || best_length[i] > best_length[best_end]) {
+      best_end = i;
+    }
+  }
+  std::vector<int> chain;
+  for (int i = best_end; i >= 0; i = previous[i]) {
+    chain.push_back(i);
+  }
+  std::reverse(chain.begin(), chain.end());
+  return chain;
+}
+
+// Orders candidates by preference, best first.
+bool BetterCandidate(const Candidate& first, const Candidate& second) {
+  return std::make_tuple(-first.quality, -first.distinct_bytes,
+                         first.sequence.reference_offset) <
+         std::make_tuple(-second.quality, -second.distinct_bytes,
+                         second.sequence.reference_offset);
+}
+
+bool ByReferenceOffset(const Candidate& first, const Candidate& second) {
+  return first.sequence.reference_offset < second.sequence.reference_offset;
+}
+
+absl::Status CheckOptions(const RawImageOptions& options) {
+  if (options.ngram_size < 4 ||
+      options.ngram_size > options.min_piece_length ||
+      options.min_piece_length > options.max_piece_length ||
+      options.max_pieces < 1) {
+    return absl::InvalidArgumentError(
+        "Need 4 <= ngram_size <= min_piece_length <= max_piece_length and at "
+        "least one piece");
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<RawSignature> RawSignatureFromImages(
+    absl::Span<const absl::string_view> images, const RawImageOptions& options,
+    const StopCondition& stop) {
+  NA_RETURN_IF_ERROR(CheckOptions(options));
+  if (images.size() < 2) {
+    return absl::InvalidArgumentError("Need at least two images");
+  }
+  TraceSpan span("RawSignatureFromImages");
+  const int n = options.ngram_size;
+
+  // The smallest image has the fewest n-grams to look up.
+  std::vector<absl::string_view> others(images.begin(), images.end());
+  auto smallest = std::min_element(
+      others.begin(), others.end(),
+      [](absl::string_view first, absl::string_view second) {
+        return first.size() < second.size();
+      });
+  const absl::string_view reference = *smallest;
+  others.erase(smallest);
+
+  const std::shared_ptr<Executor> executor =
+      GetOrMakeExecutor(options.executor, options.num_threads);
+  std::vector<NGramIndex> indices(others.size());
+  executor->ParallelFor(others.size(), [&](int64_t i) {
+    indices[i] = IndexImage(others[i], n);
+  });
+  if (stop.ShouldStop()) {
+    return stop.status();
+  }
+
+  const size_t chunk_size = std::max(
+      kMinChunkSize, reference.size() / (4 * executor->num_threads()) + 1);
+  const size_t num_chunks = (reference.size() + chunk_size - 1) / chunk_size;
+  std::vector<std::vector<Sequence>> chunk_sequences(num_chunks);
+  std::atomic<bool> stopped = false;
+  executor->ParallelFor(num_chunks, [&](int64_t i) {
+    chunk_sequences[i] = FindCommonSequences(
+        reference, others, indices, n, i * chunk_size,
+        std::min(reference.size(), (i + 1) * chunk_size), stop, &stopped);
+  });
+  if (stopped) {
+    return stop.status();
+  }
+
+  // Sequences that were extended into the next chunk overlap the ones found
+  // there. Trim those to the part after the previous sequence.
+  std::vector<Sequence> sequences;
+  for (auto& chunk : chunk_sequences) {
+    for (auto& sequence : chunk) {
+      const size_t covered =
+          sequences.empty() ? 0
+                            : sequences.back().reference_offset +
+                                  sequences.back().length;
+      if (sequence.reference_offset < covered) {
+        const size_t overlap = covered - sequence.reference_offset;
+        if (overlap + n > sequence.length) {
+          continue;
+        }
+        sequence.reference_offset += overlap;
+        sequence.length -= overlap;
+        for (auto& offset : sequence.offsets) {
+          offset += overlap;
+        }
+      }
+      sequences.push_back(std::move(sequence));
+    }
+  }
+  span.Arg("sequences", sequences.size());
+
+  std::vector<Candidate> candidates =
+      CutCandidates(reference, sequences, options);
+  // Ordering is quadratic in the number of candidates, so only consider a
+  // multiple of the pieces that are needed.
+  const size_t max_candidates = 4 * options.max_pieces;
+  if (candidates.size() > max_candidates) {
+    std::nth_element(candidates.begin(),
+                     candidates.begin() + max_candidates, candidates.end(),
+                     BetterCandidate);
+    candidates.resize(max_candidates);
+  }
+  std::sort(candidates.begin(), candidates.end(), ByReferenceOffset);
+  std::vector<Candidate> chain;
+  for (const int i : LongestOrderedChain(candidates)) {
+    chain.push_back(std::move(candidates[i]));
+  }
+  if (chain.size() > options.max_pieces) {
+    std::nth_element(chain.begin(), chain.begin() + options.max_pieces,
+                     chain.end(), BetterCandidate);
+    chain.resize(options.max_pieces);
+    std::sort(chain.begin(), chain.end(), ByReferenceOffset);
+  }
+
+  RawSignature signature;
+  for (const auto& candidate : chain) {
+    const Sequence& sequence = candidate.sequence;
+    auto* piece = signature.add_piece();
+    piece->set_bytes(std::string(
+        reference.substr(sequence.reference_offset, sequence.length)));
+    piece->set_weight(1);
+    piece->add_origin_disassembly(absl::StrCat(
+        absl::Hex(sequence.reference_offset, absl::kZeroPad8), ": ",
+        sequence.length, " bytes common to all images"));
+  }
+  span.Arg("pieces", signature.piece_size());
+  return signature;
+}
+
+absl::Status GenerateRawImageSignature(absl::Span<const std::string> filenames,
+                                       const RawImageOptions& options,
+                                       Signature* signature,
+                                       const StopCondition& stop) {
+  std::vector<MappedFile> files;
+  std::vector<absl::string_view> images;
+  files.reserve(filenames.size());
+  for (const auto& filename : filenames) {
+    NA_ASSIGN_OR_RETURN(auto file, MappedFile::Open(filename));
+    files.push_back(std::move(file));
+    images.push_back(files.back().data());
+  }
+  NA_ASSIGN_OR_RETURN(RawSignature raw,
+                      RawSignatureFromImages(images, options, stop));
+  if (raw.piece_size() == 0) {
+    return absl::NotFoundError("No byte sequences common to all images");
+  }
+  *signature->mutable_raw_signature() = std::move(raw);
+  return absl::OkStatus();
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,82 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A signature engine for raw byte images, like process memory dumps, for which
+// no BinExport and BinDiff files are available. It finds long byte sequences
+// that all images have in common, in the same order, and emits them as a raw
+// signature for the usual formatters.
+//
+// The smallest image serves as the reference. The n-grams of each other image
+// are indexed by a rolling hash. Every n-gram of the reference that occurs in
+// all other images anchors a common sequence, which is extended byte by byte.
+// Of the common sequences, the best ones that occur in the same order in every
+// image are selected. Runs of a single byte value, like zero-filled pages, are
+// never indexed.
+
+#ifndef VXSIG_RAW_IMAGE_SIGNATURE_H_
+#define VXSIG_RAW_IMAGE_SIGNATURE_H_
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/executor.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+struct RawImageOptions {
+  // Length of the hashed n-grams. Shorter n-grams find more common sequences
+  // at the cost of more spurious anchors.
+  int ngram_size = 16;
+
+  // Common sequences are cut into pieces of at most the maximum length. Pieces
+  // shorter than the minimum are dropped.
+  int min_piece_length = 24;
+  int max_piece_length = 64;
+
+  // Pieces with fewer distinct byte values are dropped, which removes fill
+  // patterns and tables of small integers.
+  int min_distinct_bytes = 8;
+
+  // Maximum number of pieces in the signature. Pieces with better atoms (see
+  // AtomQuality()) are preferred.
+  int max_pieces = 64;
+
+  // Number of threads to use if no executor is set, zero selects a default.
+  int num_threads = 0;
+
+  // Optional executor for indexing and matching the images. Not owned.
+  Executor* executor = nullptr;
+};
+
+// Computes a raw signature whose pieces occur in all images, in order. Needs
+// at least two images. The pieces are separated by unbounded wildcards. If the
+// stop condition is met, returns its status.
+absl::StatusOr<RawSignature> RawSignatureFromImages(
+    absl::Span<const absl::string_view> images, const RawImageOptions& options,
+    const StopCondition& stop = StopCondition());
+
+// Same as above, but memory maps the images from the specified files and
+// stores the result in the raw signature of the signature.
+absl::Status GenerateRawImageSignature(
+    absl::Span<const std::string> filenames, const RawImageOptions& options,
+    Signature* signature, const StopCondition& stop = StopCondition());
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_RAW_IMAGE_SIGNATURE_H_
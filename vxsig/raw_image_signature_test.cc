@@ -0,0 +1,157 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/raw_image_signature.h"
+
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/corpus.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::Ge;
+using testing::HasSubstr;
+using testing::IsEmpty;
+using testing::Le;
+using testing::Ne;
+using testing::Not;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+std::string RandomBytes(int size, std::mt19937* random) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::string bytes(size, '\0');
+  for (auto& c : bytes) {
+    c = byte(*random);
+  }
+  return bytes;
+}
+
+// Expects the pieces to occur in the image in order.
+void ExpectPiecesInOrder(const RawSignature& signature,
+                         absl::string_view image) {
+  size_t position = 0;
+  for (const auto& piece : signature.piece()) {
+    const size_t found = image.find(piece.bytes(), position);
+    ASSERT_THAT(found, Ne(absl::string_view::npos));
+    position = found + piece.bytes().size();
+  }
+}
+
+TEST(RawImageSignatureTest, FindsSharedBlocksInOrder) {
+  std::mt19937 random(42);
+  std::vector<std::string> shared;
+  for (int i = 0; i < 5; ++i) {
+    shared.push_back(RandomBytes(48, &random));
+  }
+  // Each image interleaves the shared blocks with its own bytes and a page of
+  // zeros, which must not make it into the signature.
+  std::vector<std::string> images(3);
+  for (auto& image : images) {
+    image = RandomBytes(1000, &random) + std::string(4096, '\0');
+    for (const auto& block : shared) {
+      absl::StrAppend(&image, block, RandomBytes(300, &random));
+    }
+  }
+  // A block that only two of the images have.
+  images[0] += shared[0] + RandomBytes(64, &random);
+  images[1] += RandomBytes(64, &random);
+
+  RawImageOptions options;
+  options.max_piece_length = 48;
+  auto signature = RawSignatureFromImages(
+      std::vector<absl::string_view>(images.begin(), images.end()), options);
+  ASSERT_THAT(signature, IsOk());
+  ASSERT_THAT(signature->piece(), SizeIs(shared.size()));
+  for (int i = 0; i < shared.size(); ++i) {
+    EXPECT_THAT(signature->piece(i).bytes(), Eq(shared[i]));
+  }
+}
+
+TEST(RawImageSignatureTest, KeepsPiecesInOrderOfAllImages) {
+  std::mt19937 random(7);
+  const std::string first = RandomBytes(64, &random);
+  const std::string second = RandomBytes(64, &random);
+  const std::string third = RandomBytes(64, &random);
+  // The second image swaps the last two blocks, so only two of them can be
+  // part of an ordered signature.
+  const std::vector<std::string> images = {
+      absl::StrCat(first, RandomBytes(100, &random), second,
+                   RandomBytes(100, &random), third),
+      absl::StrCat(first, RandomBytes(100, &random), third,
+                   RandomBytes(100, &random), second)};
+  auto signature = RawSignatureFromImages(
+      std::vector<absl::string_view>(images.begin(), images.end()),
+      RawImageOptions());
+  ASSERT_THAT(signature, IsOk());
+  for (const auto& image : images) {
+    ExpectPiecesInOrder(*signature, image);
+  }
+  int total_bytes = 0;
+  for (const auto& piece : signature->piece()) {
+    total_bytes += piece.bytes().size();
+  }
+  EXPECT_THAT(total_bytes, Eq(128));
+}
+
+TEST(RawImageSignatureTest, RejectsSingleImage) {
+  const std::string image = "single";
+  EXPECT_THAT(RawSignatureFromImages({image}, RawImageOptions()).ok(),
+              Eq(false));
+}
+
+TEST(RawImageSignatureTest, GeneratesSignatureFromMemoryImages) {
+  std::vector<std::string> filenames;
+  for (const char* name :
+       {"1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa",
+        "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82",
+        "1d3949acb5eb175af3cbc5f448ece50669a44743faec91e3d574dad9596a9d83"}) {
+    filenames.push_back(
+        JoinPath(getenv("TEST_SRCDIR"), "com_google_vxsig/vxsig/testdata",
+                 absl::StrCat(name, "-dump.ProcessMemoryImage")));
+  }
+  RawImageOptions options;
+  Signature signature;
+  signature.mutable_definition()->set_detection_name("raw_image_test");
+  ASSERT_THAT(
+      GenerateRawImageSignature(filenames, options, &signature), IsOk());
+  EXPECT_THAT(signature.raw_signature().piece(), Not(IsEmpty()));
+  EXPECT_THAT(signature.raw_signature().piece_size(),
+              Le(options.max_pieces));
+  for (const auto& filename : filenames) {
+    auto image = ReadFileContents(filename);
+    ASSERT_THAT(image, IsOk());
+    ExpectPiecesInOrder(signature.raw_signature(), *image);
+  }
+
+  // The usual formatters apply.
+  ASSERT_THAT(SignatureFormatter::Create(YARA)->Format(&signature), IsOk());
+  EXPECT_THAT(signature.yara_signature().data(), HasSubstr("raw_image_test"));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,86 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for reading the BinDiff and BinExport files of the test data
+// chain. The argument selects the file in the chain.
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "benchmark/benchmark.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "vxsig/benchmark_util.h"
+#include "vxsig/binexport_reader.h"
+#include "vxsig/diff_result_reader.h"
+
+namespace security::vxsig {
+namespace {
+
+void BM_ParseBinDiff(benchmark::State& state) {
+  const std::string filename = BenchmarkDiffs()[state.range(0)];
+  auto file_size = GetFileSize(filename);
+  if (!CheckBenchmarkStatus(file_size.status(), state)) {
+    return;
+  }
+  int64_t matches = 0;
+  const MatchReceiverCallback receiver =
+      [&matches](const MemoryAddressPair& /*match*/) { ++matches; };
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    std::pair<FileMetaData, FileMetaData> metadata;
+    if (!CheckBenchmarkStatus(ParseBinDiff(filename, receiver, receiver,
+                                           receiver, &metadata),
+                              state)) {
+      return;
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() * *file_size);
+  state.SetItemsProcessed(matches);
+}
+BENCHMARK(BM_ParseBinDiff)->DenseRange(0, 1)->Unit(benchmark::kMillisecond);
+
+void BM_ParseBinExport(benchmark::State& state) {
+  const std::string filename = BenchmarkBinExports()[state.range(0)];
+  auto file_size = GetFileSize(filename);
+  if (!CheckBenchmarkStatus(file_size.status(), state)) {
+    return;
+  }
+  int64_t instructions = 0;
+  const FunctionReceiverCallback function_receiver =
+      [](const std::string& /*sha256*/, MemoryAddress /*address*/,
+         BinExport2::CallGraph::Vertex::Type /*type*/, double /*md_index*/) {};
+  const InstructionReceiverCallback instruction_receiver =
+      [&instructions](MemoryAddress /*basic_block_address*/,
+                      MemoryAddress /*instruction_address*/,
+                      const std::string& /*raw_bytes*/,
+                      const std::string& /*disassembly*/,
+                      const Immediates& /*immediates*/) { ++instructions; };
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    if (!CheckBenchmarkStatus(
+            ParseBinExport(filename, function_receiver, instruction_receiver),
+            state)) {
+      return;
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() * *file_size);
+  state.SetItemsProcessed(instructions);
+}
+BENCHMARK(BM_ParseBinExport)->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,425 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/scan_cost.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <limits>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/signature_formatter.h"
+
+namespace security::vxsig {
+namespace {
+
+constexpr double kBytesPerMb = 1024.0 * 1024.0;
+
+uint32_t LoadAtomKey(const char* data, int length) {
+  uint32_t key = 0;
+  memcpy(&key, data, length);
+  return key;
+}
+
+bool IsCommonByte(uint8_t value) {
+  return value == 0x00 || value == 0x20 || value == 0xcc || value == 0xff;
+}
+
+// Returns whether the positions of the pieces of a rule allow for an ordered,
+// non-overlapping match of all of them. Positions must be sorted.
+bool MatchInOrder(const ScanRule& rule,
+                  const std::vector<std::vector<size_t>>& positions) {
+  size_t next_start = 0;
+  for (int i = 0; i < rule.pieces.size(); ++i) {
+    const auto& piece_positions = positions[i];
+    auto found = std::lower_bound(piece_positions.begin(),
+                                  piece_positions.end(), next_start);
+    if (found == piece_positions.end()) {
+      return false;
+    }
+    next_start = *found + rule.pieces[i].bytes.size();
+  }
+  return true;
+}
+
+double ToMbPerSecond(int64_t bytes, absl::Duration elapsed) {
+  const double seconds = absl::ToDoubleSeconds(elapsed);
+  return seconds > 0 ? bytes / kBytesPerMb / seconds : 0;
+}
+
+}  // namespace
+
+CompiledPiece CompilePiece(const RawSignature::Piece& piece) {
+  CompiledPiece result;
+  result.bytes = piece.bytes();
+  result.mask.assign(piece.bytes().size(), '\xff');
+  for (const auto& masked_nibble : piece.masked_nibble()) {
+    const int i = masked_nibble / 2;
+    if (i < 0 || i >= result.mask.size()) {
+      continue;
+    }
+    // Even nibble indices refer to the high nibble, just like in the
+    // formatted hex strings.
+    result.mask[i] &= masked_nibble % 2 == 0 ? 0x0f : 0xf0;
+  }
+  for (int i = 0; i < result.bytes.size(); ++i) {
+    result.bytes[i] &= result.mask[i];
+  }
+  return result;
+}
+
+bool MatchPieceAt(const CompiledPiece& piece, absl::string_view data,
+                  size_t pos) {
+  const size_t size = piece.bytes.size();
+  if (pos > data.size() || data.size() - pos < size) {
+    return false;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if ((data[pos + i] & piece.mask[i]) != piece.bytes[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t FindPiece(const CompiledPiece& piece, absl::string_view data,
+                 size_t start) {
+  if (piece.bytes.empty()) {
+    return start <= data.size() ? start : absl::string_view::npos;
+  }
+  // The first byte of a piece is never masked, see ToRawSignatureProto().
+  // Use it to quickly skip to candidate positions.
+  const char first = piece.bytes[0];
+  const bool first_unmasked = piece.mask[0] == '\xff';
+  while (start < data.size()) {
+    if (first_unmasked) {
+      const void* found =
+          memchr(data.data() + start, first, data.size() - start);
+      if (found == nullptr) {
+        break;
+      }
+      start = static_cast<const char*>(found) - data.data();
+    }
+    if (MatchPieceAt(piece, data, start)) {
+      return start;
+    }
+    ++start;
+  }
+  return absl::string_view::npos;
+}
+
+int AtomQuality(absl::string_view bytes, absl::string_view mask) {
+  std::bitset<256> seen_bytes;
+  int quality = 0;
+  int unique_bytes = 0;
+  for (int i = 0; i < bytes.size(); ++i) {
+    const uint8_t value = bytes[i];
+    switch (static_cast<uint8_t>(mask[i])) {
+      case 0x00:
+        quality -= 10;
+        break;
+      case 0x0f:
+      case 0xf0:
+        quality += 4;
+        break;
+      case 0xff:
+        if (IsCommonByte(value)) {
+          quality += 12;
+        } else if (absl::ascii_isalpha(value)) {
+          // Yara prefers atoms outside of [a-zA-Z] because of case-insensitive
+          // string matching.
+          quality += 18;
+        } else {
+          quality += 20;
+        }
+        if (!seen_bytes[value]) {
+          seen_bytes[value] = true;
+          ++unique_bytes;
+        }
+        break;
+      default:
+        // Other masks cannot be expressed in hex strings.
+        break;
+    }
+  }
+  if (unique_bytes == 1 && (seen_bytes[0x00] || seen_bytes[0x20] ||
+                            seen_bytes[0x90] || seen_bytes[0xcc] ||
+                            seen_bytes[0xff])) {
+    // Heavily penalize atoms consisting of a single, very common byte.
+    quality -= 10 * bytes.size();
+  } else {
+    quality += 2 * unique_bytes;
+  }
+  return kMaxAtomQuality - 22 * kMaxAtomLength + quality;
+}
+
+Atom ExtractBestAtom(const CompiledPiece& piece) {
+  Atom best;
+  best.quality = std::numeric_limits<int>::min();
+  const int size = piece.bytes.size();
+  for (int start = 0; start < size; ++start) {
+    // Only consider unmasked windows, starting with the longest possible.
+    int length = 0;
+    while (length < kMaxAtomLength && start + length < size &&
+           piece.mask[start + length] == '\xff') {
+      ++length;
+    }
+    if (length == 0) {
+      continue;
+    }
+    const absl::string_view bytes(&piece.bytes[start], length);
+    const int quality =
+        AtomQuality(bytes, absl::string_view(&piece.mask[start], length));
+    if (quality > best.quality) {
+      best.bytes = std::string(bytes);
+      best.offset = start;
+      best.quality = quality;
+    }
+  }
+  if (best.bytes.empty()) {
+    best.quality = 0;
+  }
+  return best;
+}
+
+ScanRule MakeScanRule(absl::string_view name, const RawSignature& raw) {
+  ScanRule rule;
+  rule.name = std::string(name);
+  rule.pieces.reserve(raw.piece_size());
+  rule.atoms.reserve(raw.piece_size());
+  for (const auto& piece : raw.piece()) {
+    rule.pieces.push_back(CompilePiece(piece));
+    rule.atoms.push_back(ExtractBestAtom(rule.pieces.back()));
+  }
+  return rule;
+}
+
+absl::StatusOr<ScanRule> MakeScanRule(const Signature& signature,
+                                      int engine_min_piece_len) {
+  const auto& definition = signature.definition();
+  std::string name = definition.detection_name();
+  if (name.empty()) {
+    name = definition.unique_signature_id();
+  }
+  RawSignature subset;
+  NA_RETURN_IF_ERROR(
+      GetRelevantSignatureSubset(signature, engine_min_piece_len, &subset));
+  return MakeScanRule(name, subset);
+}
+
+RuleScanner::RuleScanner(absl::Span<const ScanRule> rules)
+    : rules_(rules), first_byte_(1 << 8), first_two_bytes_(1 << 16) {
+  for (int i = 0; i < rules_.size(); ++i) {
+    const auto& rule = rules_[i];
+    for (int j = 0; j < rule.atoms.size(); ++j) {
+      const auto& atom = rule.atoms[j];
+      const int length = atom.bytes.size();
+      if (length == 0) {
+        continue;
+      }
+      atoms_[length - 1][LoadAtomKey(atom.bytes.data(), length)].push_back(
+          {i, j, atom.offset});
+      first_byte_[static_cast<uint8_t>(atom.bytes[0])] = true;
+      if (length >= 2) {
+        first_two_bytes_[LoadAtomKey(atom.bytes.data(), 2)] = true;
+      }
+    }
+  }
+}
+
+void RuleScanner::Scan(absl::string_view data, ScanResult* result) const {
+  const int num_rules = rules_.size();
+  result->atom_hits.assign(num_rules, 0);
+  result->verified_pieces.assign(num_rules, 0);
+  result->matched.assign(num_rules, false);
+
+  // Positions of verified pieces, indexed by rule and piece.
+  std::vector<std::vector<std::vector<size_t>>> positions(num_rules);
+  for (int i = 0; i < num_rules; ++i) {
+    positions[i].resize(rules_[i].pieces.size());
+  }
+
+  const size_t size = data.size();
+  for (size_t pos = 0; pos < size; ++pos) {
+    if (!first_byte_[static_cast<uint8_t>(data[pos])]) {
+      continue;
+    }
+    const bool two_bytes_match =
+        size - pos >= 2 && first_two_bytes_[LoadAtomKey(&data[pos], 2)];
+    for (int length = 1; length <= kMaxAtomLength && length <= size - pos;
+         ++length) {
+      const auto& table = atoms_[length - 1];
+      if (table.empty() || (length >= 2 && !two_bytes_match)) {
+        continue;
+      }
+      auto found = table.find(LoadAtomKey(&data[pos], length));
+      if (found == table.end()) {
+        continue;
+      }
+      for (const auto& ref : found->second) {
+        ++result->atom_hits[ref.rule];
+        if (pos < ref.offset) {
+          continue;
+        }
+        const size_t start = pos - ref.offset;
+        if (MatchPieceAt(rules_[ref.rule].pieces[ref.piece], data, start)) {
+          ++result->verified_pieces[ref.rule];
+          positions[ref.rule][ref.piece].push_back(start);
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < num_rules; ++i) {
+    const auto& rule = rules_[i];
+    if (rule.pieces.empty() || result->verified_pieces[i] == 0) {
+      continue;
+    }
+    // Positions were added in increasing order of the atom position, which is
+    // not necessarily sorted for the piece start.
+    for (auto& piece_positions : positions[i]) {
+      std::sort(piece_positions.begin(), piece_positions.end());
+    }
+    result->matched[i] = MatchInOrder(rule, positions[i]);
+  }
+}
+
+int ScanCostReport::num_over_budget() const {
+  return std::count_if(rules.begin(), rules.end(), [](const RuleScanCost& r) {
+    return !r.budget_violations.empty();
+  });
+}
+
+ScanCostReport EstimateScanCost(absl::Span<const ScanRule> rules,
+                                const Corpus& corpus,
+                                const ScanCostOptions& options) {
+  ScanCostReport report;
+  report.corpus_files = corpus.size();
+  report.corpus_bytes = corpus.total_bytes();
+  report.rules.resize(rules.size());
+
+  RuleScanner scanner(rules);
+  ScanResult result;
+  const absl::Time start = absl::Now();
+  for (const auto& file : corpus.files()) {
+    scanner.Scan(file.data, &result);
+    for (int i = 0; i < rules.size(); ++i) {
+      auto& cost = report.rules[i];
+      cost.atom_hits += result.atom_hits[i];
+      cost.verified_pieces += result.verified_pieces[i];
+      cost.files_with_atom_hits += result.atom_hits[i] > 0 ? 1 : 0;
+      cost.matched_files += result.matched[i] ? 1 : 0;
+    }
+  }
+  report.ruleset_mb_per_second =
+      ToMbPerSecond(corpus.total_bytes(), absl::Now() - start);
+
+  const double corpus_mb = corpus.total_bytes() / kBytesPerMb;
+  const auto& budget = options.budget;
+  for (int i = 0; i < rules.size(); ++i) {
+    const auto& rule = rules[i];
+    auto& cost = report.rules[i];
+    cost.name = rule.name;
+    cost.num_pieces = rule.pieces.size();
+    cost.min_atom_quality = rule.atoms.empty() ? 0 : kMaxAtomQuality;
+    double quality_sum = 0;
+    for (const auto& atom : rule.atoms) {
+      cost.min_atom_quality = std::min(cost.min_atom_quality, atom.quality);
+      quality_sum += atom.quality;
+    }
+    cost.mean_atom_quality =
+        rule.atoms.empty() ? 0 : quality_sum / rule.atoms.size();
+    cost.verifications_per_mb = corpus_mb > 0 ? cost.atom_hits / corpus_mb : 0;
+
+    if (options.measure_per_rule_throughput) {
+      RuleScanner rule_scanner(rules.subspan(i, 1));
+      ScanResult rule_result;
+      const absl::Time rule_start = absl::Now();
+      for (const auto& file : corpus.files()) {
+        rule_scanner.Scan(file.data, &rule_result);
+      }
+      cost.mb_per_second =
+          ToMbPerSecond(corpus.total_bytes(), absl::Now() - rule_start);
+    }
+
+    if (cost.verifications_per_mb > budget.max_verifications_per_mb) {
+      cost.budget_violations.push_back(absl::StrFormat(
+          "%.1f verifications/MB > %.1f", cost.verifications_per_mb,
+          budget.max_verifications_per_mb));
+    }
+    if (cost.min_atom_quality < budget.min_atom_quality) {
+      cost.budget_violations.push_back(
+          absl::StrFormat("atom quality %d < %d", cost.min_atom_quality,
+                          budget.min_atom_quality));
+    }
+    if (options.measure_per_rule_throughput && budget.min_mb_per_second > 0 &&
+        cost.mb_per_second < budget.min_mb_per_second) {
+      cost.budget_violations.push_back(
+          absl::StrFormat("%.1f MB/s < %.1f", cost.mb_per_second,
+                          budget.min_mb_per_second));
+    }
+    if (cost.matched_files > budget.max_matched_files) {
+      cost.budget_violations.push_back(
+          absl::StrFormat("matches %d corpus files > %d", cost.matched_files,
+                          budget.max_matched_files));
+    }
+  }
+  return report;
+}
+
+absl::StatusOr<ScanCostReport> EstimateScanCost(
+    const Signatures& signatures, const Corpus& corpus,
+    const ScanCostOptions& options) {
+  std::vector<ScanRule> rules;
+  rules.reserve(signatures.signature_size());
+  for (const auto& signature : signatures.signature()) {
+    NA_ASSIGN_OR_RETURN(auto rule,
+                        MakeScanRule(signature, options.engine_min_piece_len));
+    rules.push_back(std::move(rule));
+  }
+  return EstimateScanCost(rules, corpus, options);
+}
+
+std::string FormatScanCostReport(const ScanCostReport& report) {
+  std::string result = absl::StrFormat(
+      "Corpus: %d files, %.2f MB, ruleset throughput %.1f MB/s\n",
+      report.corpus_files, report.corpus_bytes / kBytesPerMb,
+      report.ruleset_mb_per_second);
+  absl::StrAppendFormat(&result, "%-40s %6s %7s %7s %12s %10s %6s %8s  %s\n",
+                        "rule", "pieces", "min_aq", "mean_aq", "verif/MB",
+                        "hit_files", "match", "MB/s", "budget");
+  for (const auto& rule : report.rules) {
+    absl::StrAppendFormat(
+        &result, "%-40s %6d %7d %7.1f %12.2f %10d %6d %8.1f  %s\n",
+        rule.name.substr(0, 40), rule.num_pieces, rule.min_atom_quality,
+        rule.mean_atom_quality, rule.verifications_per_mb,
+        rule.files_with_atom_hits, rule.matched_files, rule.mb_per_second,
+        rule.budget_violations.empty()
+            ? "ok"
+            : absl::StrCat("OVER: ", absl::StrJoin(rule.budget_violations,
+                                                    "; ")));
+  }
+  absl::StrAppendFormat(&result, "%d of %d rules over budget\n",
+                        report.num_over_budget(), report.rules.size());
+  return result;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,216 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A simple model of an atom-based scan engine (like Yara or ClamAV) that is
+// used to estimate the cost of scanning with generated signatures before they
+// are deployed.
+// The model works like this: for each signature piece, the scanner selects a
+// short "atom" of at most kMaxAtomLength bytes using Yara's heuristic atom
+// quality. Scanning a file means looking up every file position in the atom
+// table. Each atom hit triggers a verification of the full piece at that
+// position. A rule matches if all of its pieces match in order.
+// The number of verifications per scanned megabyte is the main cost driver,
+// which is what the estimator reports for each rule.
+
+#ifndef VXSIG_SCAN_COST_H_
+#define VXSIG_SCAN_COST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "vxsig/corpus.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// Maximum length of an atom, same as YR_MAX_ATOM_LENGTH in Yara.
+inline constexpr int kMaxAtomLength = 4;
+
+// Maximum atom quality, same as YR_MAX_ATOM_QUALITY in Yara.
+inline constexpr int kMaxAtomQuality = 255;
+
+// Yara warns about strings slowing down scanning if their atom quality is
+// below this value.
+inline constexpr int kAtomQualityWarningThreshold =
+    kMaxAtomQuality - 22 * kMaxAtomLength + 38;
+
+// A signature piece prepared for matching. The mask has one byte for each
+// byte in bytes, with the bits that are not masked out set.
+struct CompiledPiece {
+  std::string bytes;
+  std::string mask;
+};
+
+// Converts a raw signature piece into its compiled form.
+CompiledPiece CompilePiece(const RawSignature::Piece& piece);
+
+// Returns whether the piece matches the data at the specified position.
+bool MatchPieceAt(const CompiledPiece& piece, absl::string_view data,
+                  size_t pos);
+
+// Returns the first position at or after start where the piece matches the
+// data or absl::string_view::npos if there is no such position.
+size_t FindPiece(const CompiledPiece& piece, absl::string_view data,
+                 size_t start = 0);
+
+// An atom selected from a signature piece.
+struct Atom {
+  std::string bytes;
+  int offset = 0;  // Offset of the atom within its piece
+  int quality = 0;
+};
+
+// Computes the quality of an atom using the same heuristic as Yara's
+// yr_atoms_heuristic_quality(). Higher is better. The mask must have the same
+// size as bytes.
+int AtomQuality(absl::string_view bytes, absl::string_view mask);
+
+// Selects the unmasked window of at most kMaxAtomLength bytes with the best
+// atom quality from the specified piece.
+Atom ExtractBestAtom(const CompiledPiece& piece);
+
+// A signature as seen by the scanner model.
+struct ScanRule {
+  std::string name;
+  std::vector<CompiledPiece> pieces;
+  std::vector<Atom> atoms;  // One atom per piece
+};
+
+// Builds a scan rule from the relevant subset of a signature, i.e. the pieces
+// that would end up in a formatted signature after trimming.
+absl::StatusOr<ScanRule> MakeScanRule(const Signature& signature,
+                                      int engine_min_piece_len);
+
+// Builds a scan rule from all pieces of a raw signature, without trimming.
+ScanRule MakeScanRule(absl::string_view name, const RawSignature& raw);
+
+// Per-file scan statistics for a set of rules. All vectors are indexed by
+// rule.
+struct ScanResult {
+  std::vector<int64_t> atom_hits;
+  std::vector<int64_t> verified_pieces;
+  std::vector<bool> matched;
+};
+
+// Scans data for a fixed set of rules using the atom-based model described at
+// the top of this file. This class is thread-compatible and Scan() may be
+// called concurrently from multiple threads.
+class RuleScanner {
+ public:
+  // Does not take ownership, the rules need to outlive the scanner.
+  explicit RuleScanner(absl::Span<const ScanRule> rules);
+
+  RuleScanner(const RuleScanner&) = delete;
+  RuleScanner& operator=(const RuleScanner&) = delete;
+
+  void Scan(absl::string_view data, ScanResult* result) const;
+
+ private:
+  struct AtomRef {
+    int rule;
+    int piece;
+    int offset;
+  };
+  using AtomTable = absl::flat_hash_map<uint32_t, std::vector<AtomRef>>;
+
+  absl::Span<const ScanRule> rules_;
+
+  // Atoms indexed by their length minus one.
+  AtomTable atoms_[kMaxAtomLength];
+
+  // Quick rejection filters on the first one and two bytes of all atoms.
+  std::vector<bool> first_byte_;
+  std::vector<bool> first_two_bytes_;
+};
+
+// Limits on the scan cost of a single rule. Rules exceeding any of them are
+// flagged in the report.
+struct ScanCostBudget {
+  // Maximum average number of piece verifications per scanned megabyte.
+  double max_verifications_per_mb = 100.0;
+
+  // Minimum atom quality of all pieces, see AtomQuality().
+  int min_atom_quality = kAtomQualityWarningThreshold;
+
+  // Minimum throughput when scanning the corpus with just this rule. Zero
+  // disables this check, as it depends on the machine running the estimate.
+  double min_mb_per_second = 0.0;
+
+  // Maximum number of corpus files the rule may match.
+  int max_matched_files = 0;
+};
+
+struct RuleScanCost {
+  std::string name;
+  int num_pieces = 0;
+  int min_atom_quality = 0;
+  double mean_atom_quality = 0;
+  int64_t atom_hits = 0;  // Equals the number of verifications
+  int64_t verified_pieces = 0;
+  int files_with_atom_hits = 0;
+  int matched_files = 0;
+  double verifications_per_mb = 0;
+  double mb_per_second = 0;  // Only if measured, see ScanCostOptions.
+
+  // Non-empty, if the rule exceeds its budget. Contains a human readable
+  // description of the limits that were exceeded.
+  std::vector<std::string> budget_violations;
+};
+
+struct ScanCostReport {
+  std::vector<RuleScanCost> rules;
+  int corpus_files = 0;
+  int64_t corpus_bytes = 0;
+
+  // Throughput when scanning the corpus with all rules at once.
+  double ruleset_mb_per_second = 0;
+
+  int num_over_budget() const;
+};
+
+struct ScanCostOptions {
+  ScanCostBudget budget;
+
+  // Minimum piece length of the target engine, see
+  // GetRelevantSignatureSubset().
+  int engine_min_piece_len = 2;
+
+  // Whether to time a separate scan of the corpus for each rule to obtain
+  // per-rule throughput numbers. This is slow for large rule sets.
+  bool measure_per_rule_throughput = true;
+};
+
+// Estimates the scan cost of each of the specified signatures on a corpus of
+// representative files.
+absl::StatusOr<ScanCostReport> EstimateScanCost(
+    const Signatures& signatures, const Corpus& corpus,
+    const ScanCostOptions& options);
+
+// Like above, but operates on already prepared scan rules.
+ScanCostReport EstimateScanCost(absl::Span<const ScanRule> rules,
+                                const Corpus& corpus,
+                                const ScanCostOptions& options);
+
+// Renders a report as a human readable table.
+std::string FormatScanCostReport(const ScanCostReport& report);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_SCAN_COST_H_
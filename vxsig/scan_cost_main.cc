@@ -0,0 +1,107 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A program that estimates the scan cost of signatures on a local corpus of
+// files before they are deployed. Signatures can be specified as Yara rules
+// (.yar), ClamAV databases (.ndb) or as serialized Signatures protos (which
+// will be trimmed according to their signature definitions). The program exits
+// with a non-zero exit code if any rule exceeds its budget.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "vxsig/corpus.h"
+#include "vxsig/scan_cost.h"
+#include "vxsig/signature_parser.h"
+#include "vxsig/vxsig.pb.h"
+
+ABSL_FLAG(std::string, corpus, "",
+          "Directory with representative files to scan");
+ABSL_FLAG(int64_t, max_file_size, 64 << 20,
+          "Skip corpus files larger than this many bytes");
+ABSL_FLAG(double, max_verifications_per_mb, 100.0,
+          "Budget: maximum piece verifications per scanned MB");
+ABSL_FLAG(int32_t, min_atom_quality,
+          security::vxsig::kAtomQualityWarningThreshold,
+          "Budget: minimum atom quality of each signature piece");
+ABSL_FLAG(double, min_mb_per_second, 0.0,
+          "Budget: minimum throughput for a single rule, 0 to disable");
+ABSL_FLAG(int32_t, max_matched_files, 0,
+          "Budget: maximum number of corpus files a rule may match");
+ABSL_FLAG(int32_t, engine_min_piece_length, 2,
+          "Minimum piece length of the target engine, applied to raw "
+          "signatures");
+ABSL_FLAG(bool, per_rule_throughput, true,
+          "Measure throughput separately for each rule");
+
+namespace security::vxsig {
+namespace {
+
+int ScanCostMain(int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc >= 2, "Need at least one signature file");
+  ABSL_RAW_CHECK(!absl::GetFlag(FLAGS_corpus).empty(), "Need --corpus");
+
+  Signatures signatures;
+  for (int i = 1; i < argc; ++i) {
+    auto parsed = ReadSignaturesFromFile(argv[i]);
+    ABSL_RAW_CHECK(parsed.ok(), absl::StrCat("Failed to read signatures: ",
+                                             parsed.status().message())
+                                    .c_str());
+    signatures.MergeFrom(*parsed);
+  }
+
+  auto corpus = Corpus::LoadFromDirectory(absl::GetFlag(FLAGS_corpus),
+                                          absl::GetFlag(FLAGS_max_file_size));
+  ABSL_RAW_CHECK(corpus.ok(), absl::StrCat("Failed to load corpus: ",
+                                           corpus.status().message())
+                                  .c_str());
+
+  ScanCostOptions options;
+  options.budget.max_verifications_per_mb =
+      absl::GetFlag(FLAGS_max_verifications_per_mb);
+  options.budget.min_atom_quality = absl::GetFlag(FLAGS_min_atom_quality);
+  options.budget.min_mb_per_second = absl::GetFlag(FLAGS_min_mb_per_second);
+  options.budget.max_matched_files = absl::GetFlag(FLAGS_max_matched_files);
+  options.engine_min_piece_len = absl::GetFlag(FLAGS_engine_min_piece_length);
+  options.measure_per_rule_throughput =
+      absl::GetFlag(FLAGS_per_rule_throughput);
+
+  auto report = EstimateScanCost(signatures, *corpus, options);
+  ABSL_RAW_CHECK(report.ok(), absl::StrCat("Failed to estimate scan cost: ",
+                                           report.status().message())
+                                  .c_str());
+  absl::PrintF("%s", FormatScanCostReport(*report));
+  return report->num_over_budget() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Estimate the scan cost of signatures on a corpus of files.\n"
+      "usage:\n",
+      argv[0], " --corpus=DIR [OPTION] SIGNATURES..."));
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  return security::vxsig::ScanCostMain(args.size(), &args[0]);
+}
@@ -0,0 +1,138 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/scan_cost.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::Gt;
+using testing::IsEmpty;
+using testing::Not;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+TEST(ScanCostTest, CompilePieceMasksNibbles) {
+  RawSignature::Piece piece;
+  piece.set_bytes("\x12\x34\x56");
+  piece.add_masked_nibble(2);  // High nibble of second byte
+  piece.add_masked_nibble(5);  // Low nibble of third byte
+  const auto compiled = CompilePiece(piece);
+  EXPECT_THAT(compiled.mask, Eq(std::string("\xff\x0f\xf0")));
+  EXPECT_THAT(compiled.bytes, Eq(std::string("\x12\x04\x50")));
+  EXPECT_TRUE(MatchPieceAt(compiled, "\x12\xf4\x5f", 0));
+  EXPECT_FALSE(MatchPieceAt(compiled, "\x12\xf5\x5f", 0));
+  EXPECT_FALSE(MatchPieceAt(compiled, "\x12\xf4", 0));
+}
+
+TEST(ScanCostTest, FindPiece) {
+  RawSignature::Piece piece;
+  piece.set_bytes("abc");
+  const auto compiled = CompilePiece(piece);
+  EXPECT_THAT(FindPiece(compiled, "xxabcxabc"), Eq(2));
+  EXPECT_THAT(FindPiece(compiled, "xxabcxabc", 3), Eq(6));
+  EXPECT_THAT(FindPiece(compiled, "xxabxab"), Eq(absl::string_view::npos));
+}
+
+TEST(ScanCostTest, AtomQuality) {
+  const std::string full_mask(4, '\xff');
+  // Best possible atom: four unique, uncommon bytes.
+  EXPECT_THAT(AtomQuality("\x8b\xec\x83\xe4", full_mask), Eq(kMaxAtomQuality));
+  // Common bytes are worse than uncommon ones.
+  EXPECT_THAT(AtomQuality(std::string("\x00\x00\x00\x00", 4), full_mask),
+              Eq(kMaxAtomQuality - 88 + 48 - 40));
+  EXPECT_THAT(AtomQuality("\x8b\xec", "\xff\xff"),
+              Eq(kMaxAtomQuality - 88 + 44));
+}
+
+TEST(ScanCostTest, ExtractBestAtomAvoidsMaskedBytes) {
+  RawSignature::Piece piece;
+  piece.set_bytes(std::string("\x00\x00\x00\x00\xe8\x12\x34\x56\x78", 9));
+  piece.add_masked_nibble(10);
+  piece.add_masked_nibble(11);
+  const auto atom = ExtractBestAtom(CompilePiece(piece));
+  EXPECT_THAT(atom.offset, Eq(6));
+  EXPECT_THAT(atom.bytes, Eq("\x34\x56\x78"));
+}
+
+TEST(ScanCostTest, ScannerMatchesPiecesInOrder) {
+  RawSignature raw;
+  AddSignaturePieces({"hello", "world"}, &raw);
+  std::vector<ScanRule> rules = {MakeScanRule("greeting", raw)};
+  RuleScanner scanner(rules);
+
+  ScanResult result;
+  scanner.Scan("say hello to the world", &result);
+  EXPECT_TRUE(result.matched[0]);
+  EXPECT_THAT(result.verified_pieces[0], Eq(2));
+
+  scanner.Scan("the world says hello", &result);
+  EXPECT_FALSE(result.matched[0]);
+  EXPECT_THAT(result.verified_pieces[0], Eq(2));
+
+  scanner.Scan("nothing to see here", &result);
+  EXPECT_FALSE(result.matched[0]);
+  EXPECT_THAT(result.verified_pieces[0], Eq(0));
+}
+
+TEST(ScanCostTest, EstimateFlagsExpensiveRules) {
+  Corpus corpus;
+  corpus.AddFile("zeroes", std::string(1 << 16, '\0'));
+  corpus.AddFile("text", "some text that does not match");
+
+  Signatures signatures;
+  {
+    auto* signature = signatures.add_signature();
+    signature->mutable_definition()->set_detection_name("cheap");
+    AddSignaturePieces({"\x8b\xec\x83\xe4\x11", "\x55\x8b\xec\x56\x57"},
+                       signature->mutable_raw_signature());
+  }
+  {
+    auto* signature = signatures.add_signature();
+    signature->mutable_definition()->set_detection_name("expensive");
+    AddSignaturePieces({std::string(8, '\0')},
+                       signature->mutable_raw_signature());
+  }
+
+  ScanCostOptions options;
+  options.measure_per_rule_throughput = false;
+  auto report = EstimateScanCost(signatures, corpus, options);
+  ASSERT_THAT(report, IsOk());
+  ASSERT_THAT(report->rules, SizeIs(2));
+  EXPECT_THAT(report->corpus_files, Eq(2));
+
+  const auto& cheap = report->rules[0];
+  EXPECT_THAT(cheap.name, Eq("cheap"));
+  EXPECT_THAT(cheap.atom_hits, Eq(0));
+  EXPECT_THAT(cheap.budget_violations, IsEmpty());
+
+  const auto& expensive = report->rules[1];
+  EXPECT_THAT(expensive.atom_hits, Gt(60000));
+  EXPECT_THAT(expensive.matched_files, Eq(1));
+  EXPECT_THAT(expensive.budget_violations, Not(IsEmpty()));
+  EXPECT_THAT(report->num_over_budget(), Eq(1));
+  EXPECT_THAT(FormatScanCostReport(*report), testing::HasSubstr("OVER"));
+}
+
+}  // namespace
+}  // namespace security::vxsig
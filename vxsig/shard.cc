@@ -0,0 +1,329 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/shard.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <thread>  // NOLINT
+#include <utility>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/notification.h"
+#include "google/protobuf/text_format.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/corpus.h"
+#include "vxsig/executor.h"
+#include "vxsig/trace.h"
+
+namespace security::vxsig {
+namespace {
+
+std::string DefaultWorkerId() {
+  char hostname[256] = {};
+  gethostname(hostname, sizeof(hostname) - 1);
+  return absl::StrCat(hostname, "-", getpid());
+}
+
+// The files of the shared work directory, see shard.h.
+class WorkDirectory {
+ public:
+  WorkDirectory(const ShardOptions& options, std::string worker_id)
+      : options_(options), worker_id_(std::move(worker_id)) {}
+
+  absl::Status Create() const {
+    for (const char* directory : {"claims", "workers", "done"}) {
+      NA_RETURN_IF_ERROR(
+          CreateDirectories(JoinPath(options_.work_directory, directory)));
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status WriteHeartbeat() const {
+    return WriteFileContentsAtomically(
+        HeartbeatPath(worker_id_),
+        absl::StrCat(absl::ToUnixMicros(absl::Now())));
+  }
+
+  // Returns true if this worker now holds the claim for the job. Takes over
+  // claims of dead workers.
+  absl::StatusOr<bool> TryClaim(absl::string_view job) const {
+    const std::string claim = ClaimPath(job);
+    NA_ASSIGN_OR_RETURN(bool claimed, Link(claim));
+    if (claimed) {
+      return true;
+    }
+    auto owner = ReadFileContents(claim);
+    if (!owner.ok()) {
+      return false;
+    }
+    // Claims only outlive a round of this worker if a previous worker with the
+    // same id died.
+    if (*owner == worker_id_) {
+      return true;
+    }
+    if (IsAlive(*owner)) {
+      return false;
+    }
+    // Only one of the workers that try to take over the claim succeeds in
+    // renaming it.
+    const std::string stale = absl::StrCat(claim, ".stale.", worker_id_);
+    if (rename(claim.c_str(), stale.c_str()) != 0) {
+      return false;
+    }
+    remove(stale.c_str());
+    return Link(claim);
+  }
+
+  bool IsDone(absl::string_view job) const {
+    return FileExists(RecordPath(job));
+  }
+
+  absl::Status WriteRecord(absl::string_view job,
+                           const BatchJobRecord& record) const {
+    std::string data;
+    if (!google::protobuf::TextFormat::PrintToString(record, &data)) {
+      return absl::InternalError("Failed to serialize job record");
+    }
+    NA_RETURN_IF_ERROR(WriteFileContentsAtomically(RecordPath(job), data));
+    // The claim is no longer needed.
+    remove(ClaimPath(job).c_str());
+    return absl::OkStatus();
+  }
+
+  absl::StatusOr<BatchJobRecord> ReadRecord(absl::string_view job) const {
+    NA_ASSIGN_OR_RETURN(std::string data, ReadFileContents(RecordPath(job)));
+    BatchJobRecord record;
+    if (!google::protobuf::TextFormat::ParseFromString(data, &record)) {
+      return absl::DataLossError(
+          absl::StrCat("Failed to parse job record: ", RecordPath(job)));
+    }
+    return record;
+  }
+
+ private:
+  std::string ClaimPath(absl::string_view job) const {
+    return JoinPath(options_.work_directory, "claims",
+                    absl::StrCat(job, ".claim"));
+  }
+  std::string RecordPath(absl::string_view job) const {
+    return JoinPath(options_.work_directory, "done",
+                    absl::StrCat(job, ".record"));
+  }
+  std::string HeartbeatPath(absl::string_view worker_id) const {
+    return JoinPath(options_.work_directory, "workers",
+                    absl::StrCat(worker_id, ".alive"));
+  }
+
+  bool IsAlive(absl::string_view worker_id) const {
+    auto data = ReadFileContents(HeartbeatPath(worker_id));
+    int64_t micros;
+    return data.ok() && absl::SimpleAtoi(*data, &micros) &&
+           absl::Now() - absl::FromUnixMicros(micros) <
+               options_.heartbeat_timeout;
+  }
+
+  // Atomically creates the file with the worker id as its contents. Returns
+  // false if it already exists.
+  absl::StatusOr<bool> Link(const std::string& path) const {
+    const std::string temp = absl::StrCat(path, ".tmp.", worker_id_);
+    {
+      std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+      file << worker_id_;
+      if (!file) {
+        return absl::UnknownError(absl::StrCat("Failed to write ", temp));
+      }
+    }
+    const int result = link(temp.c_str(), path.c_str());
+    const int link_errno = errno;
+    remove(temp.c_str());
+    if (result == 0) {
+      return true;
+    }
+    if (link_errno == EEXIST) {
+      return false;
+    }
+    return absl::UnknownError(absl::StrCat("link() failed for ", path, ": ",
+                                           strerror(link_errno)));
+  }
+
+  const ShardOptions& options_;
+  const std::string worker_id_;
+};
+
+// Renews the heartbeat of the worker until destroyed.
+class Heartbeat {
+ public:
+  Heartbeat(const WorkDirectory& directory, absl::Duration interval)
+      : thread_([&directory, interval, this]() {
+          while (!stop_.WaitForNotificationWithTimeout(interval)) {
+            // A missed heartbeat is retried on the next interval.
+            directory.WriteHeartbeat().IgnoreError();
+          }
+        }) {}
+
+  ~Heartbeat() {
+    stop_.Notify();
+    thread_.join();
+  }
+
+ private:
+  absl::Notification stop_;
+  std::thread thread_;
+};
+
+BatchJobRecord::Result ToRecordResult(const BatchJobResult& result) {
+  BatchJobRecord::Result record_result;
+  record_result.set_name(result.name);
+  record_result.set_status_code(static_cast<int>(result.status.code()));
+  record_result.set_error_message(std::string(result.status.message()));
+  for (const auto& file : result.output_files) {
+    record_result.add_output_file(file);
+  }
+  return record_result;
+}
+
+BatchJobResult FromRecordResult(const BatchJobRecord::Result& record_result) {
+  BatchJobResult result;
+  result.name = record_result.name();
+  result.status =
+      absl::Status(static_cast<absl::StatusCode>(record_result.status_code()),
+                   record_result.error_message());
+  result.output_files.assign(record_result.output_file().begin(),
+                             record_result.output_file().end());
+  return result;
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<BatchJobResult>> RunBatchWorker(
+    const BatchManifest& manifest, const BatchOptions& options,
+    const ShardOptions& shard_options) {
+  if (shard_options.work_directory.empty()) {
+    return absl::InvalidArgumentError("Missing work directory");
+  }
+  std::vector<std::string> names;
+  absl::flat_hash_set<std::string> unique_names;
+  for (int i = 0; i < manifest.job_size(); ++i) {
+    const auto& job = manifest.job(i);
+    std::string name = job.has_name() ? job.name() : absl::StrCat("job", i);
+    if (name.empty() || absl::StrContains(name, '/') ||
+        !unique_names.insert(name).second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Empty, invalid or duplicate job name: \"", name, "\""));
+    }
+    names.push_back(std::move(name));
+  }
+
+  const std::string worker_id = !shard_options.worker_id.empty()
+                                    ? shard_options.worker_id
+                                    : DefaultWorkerId();
+  WorkDirectory directory(shard_options, worker_id);
+  NA_RETURN_IF_ERROR(directory.Create());
+  NA_RETURN_IF_ERROR(directory.WriteHeartbeat());
+  {
+    Heartbeat heartbeat(directory, shard_options.heartbeat_interval);
+
+    // Clustering is done per job, so that the results can be recorded per
+    // job.
+    BatchOptions round_options = options;
+    round_options.cluster_samples = false;
+    if (!round_options.input_cache) {
+      round_options.input_cache = std::make_shared<InputCache>();
+    }
+    const int round_size =
+        options.num_threads > 0 ? options.num_threads : DefaultNumThreads();
+    while (true) {
+      std::vector<int> claimed;
+      bool waiting = false;
+      for (int i = 0; i < names.size(); ++i) {
+        if (directory.IsDone(names[i])) {
+          continue;
+        }
+        if (claimed.size() >= round_size) {
+          waiting = true;
+          break;
+        }
+        NA_ASSIGN_OR_RETURN(bool claimed_job, directory.TryClaim(names[i]));
+        if (claimed_job) {
+          claimed.push_back(i);
+        } else {
+          waiting = true;
+        }
+      }
+      if (claimed.empty()) {
+        if (!waiting) {
+          break;
+        }
+        // Wait for the other workers to finish or to die.
+        absl::SleepFor(shard_options.poll_interval);
+        continue;
+      }
+
+      TraceSpan span("BatchWorkerRound");
+      span.Arg("jobs", claimed.size());
+      BatchManifest round = manifest;
+      round.clear_job();
+      std::vector<int> round_jobs;  // Index in the manifest of each job
+      for (int i : claimed) {
+        BatchManifest job_manifest;
+        auto* job = job_manifest.add_job();
+        *job = manifest.job(i);
+        job->set_name(names[i]);
+        if (options.cluster_samples) {
+          job_manifest =
+              SplitJobsByCluster(job_manifest, options.clustering,
+                                 round_options.input_cache.get(),
+                                 options.num_threads);
+        }
+        for (auto& round_job : *job_manifest.mutable_job()) {
+          *round.add_job() = std::move(round_job);
+          round_jobs.push_back(i);
+        }
+      }
+      NA_ASSIGN_OR_RETURN(std::vector<BatchJobResult> results,
+                          RunBatch(round, round_options));
+      for (int i : claimed) {
+        BatchJobRecord record;
+        record.set_worker_id(worker_id);
+        for (int j = 0; j < results.size(); ++j) {
+          if (round_jobs[j] == i) {
+            *record.add_result() = ToRecordResult(results[j]);
+          }
+        }
+        NA_RETURN_IF_ERROR(directory.WriteRecord(names[i], record));
+      }
+    }
+  }
+
+  std::vector<BatchJobResult> results;
+  for (const auto& name : names) {
+    NA_ASSIGN_OR_RETURN(BatchJobRecord record, directory.ReadRecord(name));
+    for (const auto& record_result : record.result()) {
+      results.push_back(FromRecordResult(record_result));
+    }
+  }
+  return results;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,72 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs the jobs of a BatchManifest with several worker processes, possibly on
+// different hosts, that share a work directory. Coordination only relies on
+// atomic file system operations, so no other services are needed:
+//   claims/<job>.claim      Created with link(), which fails if the file
+//                           exists. Holds the id of the claiming worker.
+//   workers/<worker>.alive  Heartbeat, rewritten regularly via rename().
+//   done/<job>.record       A BatchJobRecord, written via rename() once the
+//                           job has finished.
+// Workers whose heartbeat is older than the timeout are considered dead, and
+// their claims are taken over by renaming them away. When a claim is taken
+// over at the same time as it is renewed, a job may run twice. This is
+// harmless, as outputs are written atomically and do not depend on the
+// worker.
+// Start the same command on every host:
+//   vxsig --manifest=jobs.textproto --shard_work_dir=/shared/work
+
+#ifndef VXSIG_SHARD_H_
+#define VXSIG_SHARD_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "vxsig/batch.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+struct ShardOptions {
+  // The work directory shared by all workers. Created if it does not exist.
+  std::string work_directory;
+
+  // Identifies this worker in claims and heartbeats and must be unique among
+  // the workers. Defaults to "<hostname>-<pid>".
+  std::string worker_id;
+
+  // How often the heartbeat is renewed and after how long without renewal a
+  // worker is considered dead.
+  absl::Duration heartbeat_interval = absl::Seconds(10);
+  absl::Duration heartbeat_timeout = absl::Minutes(2);
+
+  // How long to wait before checking again for jobs claimed by other workers.
+  absl::Duration poll_interval = absl::Seconds(5);
+};
+
+// Claims and runs jobs of the manifest until all of them are done, by this or
+// other workers. Each round claims as many jobs as the batch options allow to
+// run concurrently and runs them with RunBatch(). Returns the results of all
+// jobs, read from the work directory, in manifest order. Job names must not
+// contain slashes.
+absl::StatusOr<std::vector<BatchJobResult>> RunBatchWorker(
+    const BatchManifest& manifest, const BatchOptions& options,
+    const ShardOptions& shard_options);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_SHARD_H_
@@ -0,0 +1,165 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/shard.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/corpus.h"
+#include "vxsig/test_util.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::Ge;
+using testing::IsFalse;
+using testing::IsTrue;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+constexpr char kDiff[] =
+    "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1ecf30fa_vs_"
+    "1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7262cd9689ed25f82.BinDiff";
+
+class ShardTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // Start without any claims or records of previous runs.
+    auto directory = CreateTestTempDirectory();
+    ASSERT_THAT(directory, IsOk());
+    output_directory_ = JoinPath(*directory, "output");
+    ASSERT_THAT(CreateDirectories(output_directory_), IsOk());
+    options_.output_directory = output_directory_;
+    options_.default_definition.set_detection_name("shard_test");
+    options_.num_threads = 1;
+    shard_options_.work_directory = JoinPath(*directory, "work");
+    shard_options_.heartbeat_interval = absl::Milliseconds(100);
+    shard_options_.poll_interval = absl::Milliseconds(100);
+  }
+
+  void AddJobs(int num_jobs) {
+    for (int i = 0; i < num_jobs; ++i) {
+      auto* job = manifest_.add_job();
+      job->set_name(absl::StrCat("job", i));
+      job->add_diff(TestDataPath(kDiff));
+    }
+  }
+
+  BatchJobRecord ReadRecord(absl::string_view job) {
+    BatchJobRecord record;
+    auto data = ReadFileContents(JoinPath(
+        shard_options_.work_directory, "done", absl::StrCat(job, ".record")));
+    EXPECT_THAT(data, IsOk());
+    if (data.ok()) {
+      EXPECT_THAT(google::protobuf::TextFormat::ParseFromString(*data, &record),
+                  IsTrue());
+    }
+    return record;
+  }
+
+  std::string output_directory_;
+  BatchManifest manifest_;
+  BatchOptions options_;
+  ShardOptions shard_options_;
+};
+
+TEST_F(ShardTest, SharesJobsBetweenProcesses) {
+  constexpr int kNumJobs = 3;
+  constexpr int kNumWorkers = 3;
+  AddJobs(kNumJobs);
+  std::vector<pid_t> workers;
+  for (int i = 0; i < kNumWorkers; ++i) {
+    const pid_t pid = fork();
+    ASSERT_THAT(pid, Ge(0));
+    if (pid == 0) {
+      ShardOptions shard_options = shard_options_;
+      shard_options.worker_id = absl::StrCat("worker", i);
+      auto results = RunBatchWorker(manifest_, options_, shard_options);
+      _exit(results.ok() && results->size() == kNumJobs ? 0 : 1);
+    }
+    workers.push_back(pid);
+  }
+  for (pid_t pid : workers) {
+    int status;
+    ASSERT_THAT(waitpid(pid, &status, 0), Eq(pid));
+    EXPECT_THAT(WIFEXITED(status) && WEXITSTATUS(status) == 0, IsTrue());
+  }
+
+  // All jobs are done, so this worker only collects the results.
+  shard_options_.worker_id = "collector";
+  auto results = RunBatchWorker(manifest_, options_, shard_options_);
+  ASSERT_THAT(results, IsOk());
+  ASSERT_THAT(*results, SizeIs(kNumJobs));
+  for (int i = 0; i < kNumJobs; ++i) {
+    const auto& result = (*results)[i];
+    EXPECT_THAT(result.name, Eq(absl::StrCat("job", i)));
+    EXPECT_THAT(result.status, IsOk());
+    ASSERT_THAT(result.output_files, SizeIs(1));
+    EXPECT_THAT(FileExists(result.output_files[0]), IsTrue());
+    EXPECT_THAT(absl::StartsWith(ReadRecord(result.name).worker_id(), "worker"),
+                IsTrue());
+  }
+}
+
+TEST_F(ShardTest, TakesOverClaimsOfDeadWorkers) {
+  AddJobs(2);
+  const std::string claims = JoinPath(shard_options_.work_directory, "claims");
+  const std::string workers =
+      JoinPath(shard_options_.work_directory, "workers");
+  ASSERT_THAT(CreateDirectories(claims), IsOk());
+  ASSERT_THAT(CreateDirectories(workers), IsOk());
+  // One worker never sent a heartbeat, the other one stopped long ago.
+  ASSERT_THAT(
+      WriteFileContentsAtomically(JoinPath(claims, "job0.claim"), "crashed"),
+      IsOk());
+  ASSERT_THAT(
+      WriteFileContentsAtomically(JoinPath(claims, "job1.claim"), "stopped"),
+      IsOk());
+  const absl::Time stopped = absl::Now() - absl::Hours(1);
+  ASSERT_THAT(
+      WriteFileContentsAtomically(JoinPath(workers, "stopped.alive"),
+                                  absl::StrCat(absl::ToUnixMicros(stopped))),
+      IsOk());
+
+  shard_options_.worker_id = "survivor";
+  auto results = RunBatchWorker(manifest_, options_, shard_options_);
+  ASSERT_THAT(results, IsOk());
+  ASSERT_THAT(*results, SizeIs(2));
+  for (const auto& result : *results) {
+    EXPECT_THAT(result.status, IsOk());
+    EXPECT_THAT(ReadRecord(result.name).worker_id(), Eq("survivor"));
+  }
+  EXPECT_THAT(FileExists(JoinPath(claims, "job0.claim")), IsFalse());
+}
+
+TEST_F(ShardTest, RejectsInvalidJobNames) {
+  manifest_.add_job()->set_name("a/b");
+  EXPECT_THAT(RunBatchWorker(manifest_, options_, shard_options_).ok(),
+              IsFalse());
+}
+
+}  // namespace
+}  // namespace security::vxsig
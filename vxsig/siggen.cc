@@ -18,6 +18,8 @@
 #include <cstddef>
 #include <iterator>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "absl/base/internal/raw_logging.h"
 #include "absl/container/flat_hash_map.h"
@@ -25,14 +27,24 @@
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/string_view.h"
 #include "absl/time/time.h"
 #include "base/logging.h"
 #include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/cancellation.h"
 #include "vxsig/candidates.h"
+#include "vxsig/chain_planner.h"
+#include "vxsig/cost_model.h"
+#include "vxsig/diff_result_reader.h"
 #include "vxsig/generic_signature.h"
+#include "vxsig/goodware.h"
 #include "vxsig/match_chain_table.h"
+#include "vxsig/minimize.h"
+#include "vxsig/signature_cache.h"
+#include "vxsig/signature_definition_hash.h"
+#include "vxsig/trace.h"
 
 namespace security::vxsig {
 namespace {
@@ -116,6 +128,25 @@ void FillSignatureMetadata(Signature* signature) {
   }
 }
 
+void AddIntMetadata(absl::string_view key, int64_t value,
+                    SignatureDefinition* signature_definition) {
+  auto& meta = *signature_definition->add_meta();
+  meta.set_key(std::string(key));
+  meta.set_int_value(value);
+}
+
+// Records the results of the goodware check, so that false positive rates can
+// be related to the goodware corpus used during signature generation.
+void AddGoodwareMetadata(const GoodwareStats& stats, Signature* signature) {
+  auto* signature_definition = signature->mutable_definition();
+  AddIntMetadata("vxsig_goodware_files", stats.goodware_files,
+                 signature_definition);
+  AddIntMetadata("vxsig_goodware_hits", stats.hits, signature_definition);
+  AddIntMetadata("vxsig_goodware_rounds", stats.rounds, signature_definition);
+  AddIntMetadata("vxsig_goodware_dropped_pieces", stats.dropped_pieces,
+                 signature_definition);
+}
+
 }  // namespace
 
 void AvSignatureGenerator::AddDiffResultsFromCommandLineArguments(
@@ -127,28 +158,52 @@ void AvSignatureGenerator::AddDiffResults(absl::Span<const std::string> files) {
   AddDiffResults(files.begin(), files.end());
 }
 
-absl::Status AvSignatureGenerator::LoadColumnData() {
-  absl::PrintF("Loading function metadata and instruction data\n");
+absl::Status AvSignatureGenerator::LoadColumnData(const StopCondition& stop) {
+  Progress("Loading function metadata and instruction data\n");
+  TraceSpan span("LoadColumnData");
+  int column_index = 0;
   for (const auto& column : match_chain_table_) {
+    TraceSpan column_span("LoadColumn");
+    column_span.Arg("column", column_index++).Arg("file", column->filename());
     NA_RETURN_IF_ERROR(
         AddFunctionData(JoinPath(column->diff_directory(), column->filename())
                             .append(".BinExport"),
-                        column.get()));
+                        column.get(), input_cache_.get(), &stop));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status AvSignatureGenerator::OrderDiffResults() {
+  Progress("Ordering %d diff results\n", diff_results_.size());
+  TraceSpan span("OrderDiffResults");
+  NA_ASSIGN_OR_RETURN(DiffChain chain, PlanDiffChain(diff_results_));
+  diff_results_.clear();
+  diff_reversed_.clear();
+  for (const auto& diff : chain.diffs) {
+    diff_results_.push_back(diff.filename);
+    diff_reversed_.push_back(diff.reversed);
   }
+  span.Arg("binaries", chain.binaries.size());
+  Progress("  Chain: %s (similarity %.4f)\n",
+           absl::StrJoin(chain.binaries, " -> "), chain.similarity);
   return absl::OkStatus();
 }
 
-absl::Status AvSignatureGenerator::ParseDiffResults() {
+absl::Status AvSignatureGenerator::ParseDiffResults(
+    const StopCondition& stop) {
   const auto num_diffs = diff_results_.size();
 
-  absl::PrintF("Parsing diff results\n");
+  Progress("Parsing diff results\n");
+  TraceSpan span("ParseDiffResults");
+  span.Arg("diffs", num_diffs);
   std::vector<std::pair<std::string, std::string>> diff_file_pairs;
   auto column = match_chain_table_.begin();
   for (int i = 0; i < num_diffs; ++i, ++column) {
     auto next = column + 1;
     NA_RETURN_IF_ERROR(
         AddDiffResult(diff_results_[i], i == num_diffs - 1 /* Last column */,
-                      column->get(), next->get(), &diff_file_pairs));
+                      column->get(), next->get(), &diff_file_pairs,
+                      input_cache_.get(), &stop, diff_reversed_[i]));
   }
   for (int i = 0; i < diff_file_pairs.size(); ++i) {
     const auto& pair = diff_file_pairs[i];
@@ -161,6 +216,45 @@ absl::Status AvSignatureGenerator::ParseDiffResults() {
   return absl::OkStatus();
 }
 
+int AvSignatureGenerator::NumThreads() const {
+  if (executor_) {
+    return executor_->num_threads();
+  }
+  return num_threads_ > 0 ? num_threads_ : DefaultNumThreads();
+}
+
+absl::Status AvSignatureGenerator::PlanExecution() {
+  TraceSpan span("PlanExecution");
+  const int num_threads = NumThreads();
+  NA_ASSIGN_OR_RETURN(cost_estimate_,
+                      EstimateCost(match_chain_table_, cost_model_));
+  execution_plan_ =
+      vxsig::PlanExecution(cost_estimate_, num_threads, target_latency_);
+  // An executor set by the caller is always used.
+  if (executor_) {
+    execution_plan_.parallel = num_threads > 1;
+  }
+  span.Arg("ingest_bytes", cost_estimate_.ingest_bytes)
+      .Arg("lcs_cells", cost_estimate_.function_lcs_cells +
+                            cost_estimate_.basic_block_lcs_cells)
+      .Arg("regex_bytes", cost_estimate_.regex_bytes)
+      .Arg("estimated_ms",
+           absl::ToInt64Milliseconds(execution_plan_.estimated_time))
+      .Arg("strategy", LcsStrategyName(execution_plan_.lcs.strategy));
+  Progress("  Estimated work: %s\n", FormatCostEstimate(cost_estimate_));
+  Progress("  Plan: %s LCS", LcsStrategyName(execution_plan_.lcs.strategy));
+  if (execution_plan_.lcs.strategy != LcsStrategy::kExact) {
+    Progress(" with %d segments", execution_plan_.lcs.segments);
+  }
+  Progress(", %s, about %s\n",
+           execution_plan_.parallel
+               ? absl::StrCat(num_threads, " threads")
+               : std::string("single-threaded"),
+           absl::FormatDuration(absl::Trunc(execution_plan_.estimated_time,
+                                            absl::Milliseconds(1))));
+  return absl::OkStatus();
+}
+
 absl::Status AvSignatureGenerator::SetFunctionWeights(
     const IdentSequence& func_candidate_ids) {
   // TODO(cblichmann): Query for function occurrence counts and fill the map.
@@ -186,14 +280,29 @@ absl::Status AvSignatureGenerator::SetFunctionWeights(
   return absl::OkStatus();
 }
 
-absl::Status AvSignatureGenerator::ComputeCandidates() {
-  absl::PrintF("Building id chains and indices\n");
-  PropagateIds(&match_chain_table_);
-  BuildIdIndices(&match_chain_table_);
+absl::Status AvSignatureGenerator::ComputeCandidates(
+    Executor* executor, const StopCondition& stop) {
+  LcsOptions lcs_options = execution_plan_.lcs;
+  lcs_options.stop = &stop;
+
+  Progress("Building id chains and indices\n");
+  {
+    TraceSpan span("PropagateIds");
+    PropagateIds(&match_chain_table_);
+    BuildIdIndices(&match_chain_table_);
+  }
 
-  absl::PrintF("Computing function candidates\n");
+  Progress("Computing function candidates\n");
   IdentSequence func_candidate_ids;
-  ComputeFunctionCandidates(match_chain_table_, &func_candidate_ids);
+  {
+    TraceSpan span("ComputeFunctionCandidates");
+    ComputeFunctionCandidates(match_chain_table_, &func_candidate_ids,
+                              executor, lcs_options);
+    span.Arg("candidates", func_candidate_ids.size());
+  }
+  if (stop.ShouldStop()) {
+    return stop.status();
+  }
   if (func_candidate_ids.empty()) {
     if (debug_match_chain_) {
       // Report if we couldn't find any function candidates. This won't help the
@@ -203,38 +312,127 @@ absl::Status AvSignatureGenerator::ComputeCandidates() {
     }
     return absl::FailedPreconditionError("No function candidates found");
   }
-  absl::PrintF("  Function candidates found: %d\n", func_candidate_ids.size());
+  Progress("  Function candidates found: %d\n", func_candidate_ids.size());
   if (debug_match_chain_) {
     DumpMatchChainTable(match_chain_table_, func_candidate_ids);
   }
 
-  absl::PrintF("  Querying for function prevalence per candidate\n");
+  Progress("  Querying for function prevalence per candidate\n");
   NA_RETURN_IF_ERROR(SetFunctionWeights(func_candidate_ids));
 
-  absl::PrintF("Computing basic block candidates\n");
-  ComputeBasicBlockCandidates(match_chain_table_, func_candidate_ids,
-                              &bb_candidate_ids_);
+  Progress("Computing basic block candidates\n");
+  {
+    TraceSpan span("ComputeBasicBlockCandidates");
+    ComputeBasicBlockCandidates(match_chain_table_, func_candidate_ids,
+                                &bb_candidate_ids_, executor,
+                                lcs_options);
+    span.Arg("candidates", bb_candidate_ids_.size());
+  }
+  if (stop.ShouldStop()) {
+    return stop.status();
+  }
   if (bb_candidate_ids_.empty()) {
     return absl::FailedPreconditionError("No basic block candidates found");
   }
-  absl::PrintF("  Basic block candidates found: %d\n",
-               bb_candidate_ids_.size());
+  Progress("  Basic block candidates found: %d\n", bb_candidate_ids_.size());
   return absl::OkStatus();
 }
 
 absl::Status AvSignatureGenerator::Generate(Signature* signature) {
+  return Generate(signature, absl::InfiniteFuture());
+}
+
+absl::Status AvSignatureGenerator::Generate(
+    Signature* signature, absl::Time deadline,
+    const CancellationToken* cancellation) {
   if (!signature) {
     return absl::InvalidArgumentError("Need non-null signature object");
   }
-  const auto& signature_definition = signature->definition();
+  TraceSpan span("Generate");
+  const StopCondition stop(deadline, cancellation);
+  NA_RETURN_IF_ERROR(LoadInputs(signature->definition(), stop));
+  return GenerateFromInputs(signature, stop);
+}
+
+absl::Status AvSignatureGenerator::StopWithPartialSignature(
+    absl::Status stop_status, RawSignature partial,
+    Signature* signature) const {
+  if (partial_signature_on_stop_ && partial.piece_size() > 0) {
+    signature->clear_clam_av_signature();
+    signature->clear_yara_signature();
+    signature->clear_fallback_signature();
+    *signature->mutable_raw_signature() = std::move(partial);
+    FillSignatureMetadata(signature);
+    AddIntMetadata("vxsig_partial", 1, signature->mutable_definition());
+    Progress("  Stopped early, returning a partial signature\n");
+  }
+  return stop_status;
+}
+
+absl::StatusOr<std::string> AvSignatureGenerator::SignatureCacheKey(
+    const SignatureDefinition& signature_definition) const {
+  // Consecutive diffs of a chain share a BinExport file.
+  std::vector<std::string> files(diff_results_.begin(), diff_results_.end());
+  std::string last_binexport;
+  std::string reversed;
+  for (int i = 0; i < diff_results_.size(); ++i) {
+    const std::string& diff = diff_results_[i];
+    std::pair<FileMetaData, FileMetaData> metadata;
+    NA_RETURN_IF_ERROR(ReadBinDiffMetaData(diff, &metadata));
+    if (diff_reversed_[i]) {
+      std::swap(metadata.first, metadata.second);
+    }
+    reversed.push_back(diff_reversed_[i] ? 'r' : 'f');
+    for (const auto* file : {&metadata.first, &metadata.second}) {
+      std::string binexport =
+          JoinPath(Dirname(diff), file->filename).append(".BinExport");
+      if (binexport != last_binexport) {
+        files.push_back(binexport);
+        last_binexport = std::move(binexport);
+      }
+    }
+  }
+  return RawSignatureCacheKey(
+      files,
+      absl::StrFormat(
+          "%016x %d %s",
+          SignatureDefinitionHasher(signature_definition)
+              .GetRawSignatureParamsHash(),
+          minimize_ ? minimize_min_pieces_ : 0, reversed));
+}
 
+absl::Status AvSignatureGenerator::LoadInputs(
+    const SignatureDefinition& signature_definition,
+    const StopCondition& stop) {
   if (diff_results_.empty()) {
     return absl::FailedPreconditionError(
         "Need to call one of the methods from the AddDiffResults*() family "
         "first");
   }
 
+  TraceSpan span("LoadInputs");
+  inputs_loaded_ = false;
+  if (order_diffs_) {
+    NA_RETURN_IF_ERROR(OrderDiffResults());
+  }
+  signature_cache_key_.clear();
+  cached_signature_.reset();
+  cost_estimate_ = CostEstimate();
+  execution_plan_ = ExecutionPlan();
   match_chain_table_.clear();
+  if (signature_cache_ && !(minimize_ && goodware_)) {
+    TraceSpan cache_span("SignatureCacheLookup");
+    NA_ASSIGN_OR_RETURN(signature_cache_key_,
+                        SignatureCacheKey(signature_definition));
+    cached_signature_ = signature_cache_->Lookup(signature_cache_key_);
+    cache_span.Arg("hit", cached_signature_.has_value());
+    if (cached_signature_) {
+      Progress("Using cached raw signature %s\n", signature_cache_key_);
+      inputs_loaded_ = true;
+      return absl::OkStatus();
+    }
+  }
+
   auto num_diffs = diff_results_.size();
   // One more binary than there are diffs.
   match_chain_table_.reserve(num_diffs + 1);
@@ -249,35 +447,137 @@ absl::Status AvSignatureGenerator::Generate(Signature* signature) {
     column->AddFilteredFunction(address);
   }
 
-  NA_RETURN_IF_ERROR(ParseDiffResults());
-  NA_RETURN_IF_ERROR(LoadColumnData());
-  NA_RETURN_IF_ERROR(ComputeCandidates());
+  NA_RETURN_IF_ERROR(ParseDiffResults(stop));
+  NA_RETURN_IF_ERROR(PlanExecution());
+  NA_RETURN_IF_ERROR(LoadColumnData(stop));
+  inputs_loaded_ = true;
+  return absl::OkStatus();
+}
+
+absl::Status AvSignatureGenerator::GenerateFromInputs(
+    Signature* signature, const StopCondition& stop) {
+  if (!signature) {
+    return absl::InvalidArgumentError("Need non-null signature object");
+  }
+  if (!inputs_loaded_) {
+    return absl::FailedPreconditionError("Need to call LoadInputs() first");
+  }
+  // The candidate computation modifies the table, so it cannot be reused.
+  inputs_loaded_ = false;
+  // Minimization and the goodware check are not covered by the plan and
+  // always use all threads.
+  const std::shared_ptr<Executor> executor =
+      executor_ ? executor_ : MakeExecutor(NumThreads());
+  signature->clear_clam_av_signature();
+  signature->clear_yara_signature();
+  signature->clear_fallback_signature();
+  if (cached_signature_) {
+    *signature->mutable_raw_signature() =
+        std::move(*cached_signature_->mutable_raw_signature());
+    if (cached_signature_->has_fallback_signature()) {
+      *signature->mutable_fallback_signature() =
+          std::move(*cached_signature_->mutable_fallback_signature());
+    }
+    cached_signature_.reset();
+  } else {
+    NA_RETURN_IF_ERROR(GenerateRawSignature(executor.get(), stop, signature));
+  }
+  Progress("  Regex: %d raw bytes (not counting wildcards)\n",
+           GetSignatureSize(*signature));
 
-  absl::PrintF("Filtering basic block overlaps and removing gaps\n");
+  FillSignatureMetadata(signature);
+  if (goodware_) {
+    Progress("Checking against %d goodware files\n", goodware_->num_files());
+    TraceSpan span("RemoveGoodwarePieces");
+    span.Arg("goodware_files", goodware_->num_files());
+    NA_ASSIGN_OR_RETURN(
+        GoodwareStats stats,
+        RemoveGoodwarePieces(*goodware_, goodware_max_rounds_,
+                             executor.get(), signature));
+    Progress("  %d hits after %d rounds, dropped %d pieces\n", stats.hits,
+             stats.rounds, stats.dropped_pieces);
+    AddGoodwareMetadata(stats, signature);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status AvSignatureGenerator::GenerateRawSignature(
+    Executor* executor, const StopCondition& stop, Signature* signature) {
+  const auto& signature_definition = signature->definition();
+  Executor* candidate_executor =
+      executor_ || execution_plan_.parallel ? executor : GetInlineExecutor();
+
+  NA_RETURN_IF_ERROR(ComputeCandidates(candidate_executor, stop));
+
+  Progress("Filtering basic block overlaps and removing gaps\n");
   size_t size_before = bb_candidate_ids_.size();
-  FilterBasicBlockOverlaps(match_chain_table_, &bb_candidate_ids_);
-  absl::PrintF("  Removed %d, %d remain\n",
-               size_before - bb_candidate_ids_.size(),
-               bb_candidate_ids_.size());
+  {
+    TraceSpan span("FilterBasicBlockOverlaps");
+    FilterBasicBlockOverlaps(match_chain_table_, &bb_candidate_ids_);
+    span.Arg("removed", size_before - bb_candidate_ids_.size());
+  }
+  Progress("  Removed %d, %d remain\n", size_before - bb_candidate_ids_.size(),
+           bb_candidate_ids_.size());
   if (bb_candidate_ids_.empty()) {
     return absl::FailedPreconditionError(
         "All basic blocks overlap, input data is probably bad");
   }
 
-  absl::PrintF("Constructing regular expression\n");
-  NA_ASSIGN_OR_RETURN(
-      auto raw_signature,
-      GenericSignatureFromMatches(match_chain_table_, bb_candidate_ids_,
-                                  signature_definition.disable_nibble_masking(),
-                                  signature_definition.min_piece_length()));
+  Progress("Constructing regular expression\n");
+  RawSignature raw_signature;
+  {
+    TraceSpan span("GenericSignatureFromMatches");
+    RawSignature partial;
+    auto generic_signature = GenericSignatureFromMatches(
+        match_chain_table_, bb_candidate_ids_,
+        signature_definition.disable_nibble_masking(),
+        signature_definition.min_piece_length(), candidate_executor, &stop,
+        &partial);
+    if (absl::IsDeadlineExceeded(generic_signature.status()) ||
+        absl::IsCancelled(generic_signature.status())) {
+      return StopWithPartialSignature(generic_signature.status(),
+                                      std::move(partial), signature);
+    }
+    NA_ASSIGN_OR_RETURN(raw_signature, std::move(generic_signature));
+    span.Arg("basic_blocks", bb_candidate_ids_.size())
+        .Arg("pieces", raw_signature.piece_size());
+  }
+  if (stop.ShouldStop()) {
+    return StopWithPartialSignature(stop.status(), std::move(raw_signature),
+                                    signature);
+  }
 
-  signature->clear_clam_av_signature();
-  signature->clear_yara_signature();
+  if (minimize_) {
+    Progress("Minimizing signature\n");
+    TraceSpan span("MinimizeSignature");
+    std::vector<std::string> samples;
+    samples.reserve(match_chain_table_.size());
+    for (const auto& column : match_chain_table_) {
+      samples.push_back(SampleImageFromColumn(*column));
+    }
+    MinimizeOptions options;
+    options.min_pieces = minimize_min_pieces_;
+    options.executor = executor;
+    NA_ASSIGN_OR_RETURN(
+        MinimizedSignature minimized,
+        MinimizeSignature(raw_signature, samples, goodware_.get(), options));
+    Progress("  Kept %d of %d pieces, %d goodware files not excluded\n",
+             minimized.signature.piece_size(), raw_signature.piece_size(),
+             minimized.uncovered_goodware);
+    raw_signature = std::move(minimized.signature);
+    *signature->mutable_fallback_signature() = std::move(minimized.fallback);
+  }
   *signature->mutable_raw_signature() = std::move(raw_signature);
-  absl::PrintF("  Regex: %d raw bytes (not counting wildcards)\n",
-               GetSignatureSize(*signature));
 
-  FillSignatureMetadata(signature);
+  // Approximate results would be served to requests without a target latency.
+  if (!signature_cache_key_.empty() &&
+      execution_plan_.lcs.strategy == LcsStrategy::kExact) {
+    if (absl::Status status =
+            signature_cache_->Insert(signature_cache_key_, *signature);
+        !status.ok()) {
+      Progress("  Failed to cache raw signature: %s\n", status.ToString());
+    }
+  }
   return absl::OkStatus();
 }
 
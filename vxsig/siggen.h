@@ -28,14 +28,25 @@
 #include <algorithm>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/cost_model.h"
+#include "vxsig/executor.h"
 #include "vxsig/generic_signature.h"
+#include "vxsig/goodware.h"
+#include "vxsig/input_cache.h"
 #include "vxsig/match_chain_table.h"
+#include "vxsig/minimize.h"
+#include "vxsig/signature_cache.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
 
@@ -62,6 +73,119 @@ class AvSignatureGenerator {
     return *this;
   }
 
+  // Sets a corpus of benign files to check generated signatures against. If
+  // set, Generate() removes signature pieces that cause the trimmed signature
+  // to match any of the goodware files (see RemoveGoodwarePieces()).
+  AvSignatureGenerator& set_goodware(
+      std::shared_ptr<const GoodwareCorpus> goodware) {
+    goodware_ = std::move(goodware);
+    return *this;
+  }
+
+  // Maximum number of times a signature is checked against the goodware
+  // corpus.
+  AvSignatureGenerator& set_goodware_max_rounds(int value) {
+    goodware_max_rounds_ = value;
+    return *this;
+  }
+
+  // Enables signature minimization (see MinimizeSignature()). The raw
+  // signature is reduced to a small set of pieces that match the byte data of
+  // all input binaries and exclude the goodware corpus, if one is set. The
+  // removed pieces are stored in the fallback signature.
+  AvSignatureGenerator& set_minimize(bool value) {
+    minimize_ = value;
+    return *this;
+  }
+
+  // Minimum number of pieces to keep when minimizing.
+  AvSignatureGenerator& set_minimize_min_pieces(int value) {
+    minimize_min_pieces_ = value;
+    return *this;
+  }
+
+  // Number of threads to use if no executor is set. Zero selects a default
+  // based on the number of CPUs.
+  AvSignatureGenerator& set_num_threads(int value) {
+    num_threads_ = value;
+    return *this;
+  }
+
+  // Sets the executor for computing candidates and the per-basic block
+  // regular expressions. The executor may be shared with other generators.
+  // Minimization and checking against the goodware corpus also run on the
+  // executor. If no executor is set, one with num_threads threads is created
+  // for each call to Generate(). The generated signature does not depend on
+  // the executor.
+  AvSignatureGenerator& set_executor(std::shared_ptr<Executor> executor) {
+    executor_ = std::move(executor);
+    return *this;
+  }
+
+  // Sets a cache for decoded input files that may be shared with other
+  // generators, possibly running on other threads.
+  AvSignatureGenerator& set_input_cache(std::shared_ptr<InputCache> cache) {
+    input_cache_ = std::move(cache);
+    return *this;
+  }
+
+  // Sets a cache for raw signatures that may be shared with other generators.
+  // If the raw signature for the same input files and generation-relevant
+  // settings was generated before, LoadInputs() only reads the BinDiff
+  // metadata and hashes the input files, and GenerateFromInputs() continues
+  // with the cached raw signature. Signatures generated with an approximate
+  // execution plan are not stored. The cache is not used when minimizing
+  // against a goodware corpus.
+  AvSignatureGenerator& set_signature_cache(
+      std::shared_ptr<RawSignatureCache> cache) {
+    signature_cache_ = std::move(cache);
+    return *this;
+  }
+
+  // Target running time for generating a signature. After parsing the BinDiff
+  // results, the remaining work is estimated (see EstimateCost()). If exact
+  // candidate computation is expected to take longer than the target, an
+  // approximate LCS strategy is used (see PlanExecution()). Independently of
+  // the target, small jobs run on a single thread if no executor is set.
+  // Defaults to no target, i.e. always exact.
+  AvSignatureGenerator& set_target_latency(absl::Duration value) {
+    target_latency_ = value;
+    return *this;
+  }
+
+  // Per-unit costs used for the estimate.
+  AvSignatureGenerator& set_cost_model(const CostModel& value) {
+    cost_model_ = value;
+    return *this;
+  }
+
+  // Whether Generate() stores a best-effort signature if it is stopped by its
+  // deadline or cancellation token while constructing the regular
+  // expression. The partial signature only contains the basic blocks finished
+  // until then and is marked with the "vxsig_partial" metadata. The returned
+  // status is still an error. Defaults to false.
+  AvSignatureGenerator& set_partial_signature_on_stop(bool value) {
+    partial_signature_on_stop_ = value;
+    return *this;
+  }
+
+  // Whether LoadInputs() first reorders the diff results into the chain with
+  // the highest total similarity (see PlanDiffChain()). This allows the diffs
+  // to be specified in any order and direction, and to contain more than one
+  // diff per binary, like the diffs of an all-pairs comparison. Diffs that are
+  // not part of the chain are ignored. Defaults to false, i.e. the diffs must
+  // already form a chain.
+  AvSignatureGenerator& set_order_diffs(bool value) {
+    order_diffs_ = value;
+    return *this;
+  }
+
+  // Whether to print progress messages to stdout. Defaults to true.
+  AvSignatureGenerator& set_verbose(bool value) {
+    verbose_ = value;
+    return *this;
+  }
+
   // Adds the matches of the BinDiff result files specified to the table. For
   // convenience, this method takes the same arguments as the main function. It
   // expects, however, that the argument zero has already been processed, like
@@ -77,22 +201,80 @@ class AvSignatureGenerator {
   void AddDiffResults(IteratorT first, IteratorT last) {
     diff_results_.clear();
     diff_results_.insert(diff_results_.end(), first, last);
+    diff_reversed_.assign(diff_results_.size(), false);
   }
 
   // Generates the actual AV signature. Parses BinDiff result files, loads
   // metadata and computes a generic regular expression suitable for formatting
   // to the requested output format. One of the methods from the AddDiffResult*
   // family of methods must have been called before calling this method.
+  // This is the same as calling LoadInputs() followed by
+  // GenerateFromInputs().
   absl::Status Generate(Signature* signature);
 
+  // Same as above, but stops early once the deadline has passed or the
+  // cancellation token, if non-null, has been cancelled. The reading of input
+  // files, the candidate computation and the construction of the regular
+  // expression check for this regularly. Returns DEADLINE_EXCEEDED or
+  // CANCELLED, respectively, if stopped. See also
+  // set_partial_signature_on_stop().
+  absl::Status Generate(Signature* signature, absl::Time deadline,
+                        const CancellationToken* cancellation = nullptr);
+
+  // The two stages of Generate(), so that the I/O-bound loading of one
+  // signature can overlap the computation of another one. LoadInputs() parses
+  // the BinDiff and BinExport files into the match chain table, using the
+  // function filter from the signature definition. GenerateFromInputs()
+  // computes the signature from the loaded table and must be called with the
+  // same signature definition. Both stop early if the stop condition is met.
+  absl::Status LoadInputs(const SignatureDefinition& signature_definition,
+                          const StopCondition& stop = StopCondition());
+  absl::Status GenerateFromInputs(Signature* signature,
+                                  const StopCondition& stop = StopCondition());
+
+  // The estimate and plan made by the last call to LoadInputs().
+  const CostEstimate& cost_estimate() const { return cost_estimate_; }
+  const ExecutionPlan& execution_plan() const { return execution_plan_; }
+
  private:
+  template <typename... Args>
+  void Progress(const absl::FormatSpec<Args...>& format,
+                const Args&... args) const {
+    if (verbose_) {
+      absl::PrintF(format, args...);
+    }
+  }
+
   // Reads and parses the BinExport data for the BinDiff results in the match
   // chain table.
-  absl::Status LoadColumnData();
+  absl::Status LoadColumnData(const StopCondition& stop);
+
+  // Replaces the diff results with the best chain of diffs among them.
+  absl::Status OrderDiffResults();
 
   // Parses BinDiff result files and adds matches to the table. Returns true on
   // success.
-  absl::Status ParseDiffResults();
+  absl::Status ParseDiffResults(const StopCondition& stop);
+
+  // Estimates the remaining work after ParseDiffResults() and plans how to
+  // run it.
+  absl::Status PlanExecution();
+
+  // Returns the number of threads of the executor or, if there is none, the
+  // number of threads to create one with.
+  int NumThreads() const;
+
+  // Returns the key of the raw signature cache for the BinDiff results and the
+  // BinExport files referenced by them.
+  absl::StatusOr<std::string> SignatureCacheKey(
+      const SignatureDefinition& signature_definition) const;
+
+  // Computes the raw signature from the loaded table and stores it, along
+  // with the fallback signature if minimizing, in the signature. Minimizes on
+  // the executor, candidates are computed on it only if the plan allows.
+  absl::Status GenerateRawSignature(Executor* executor,
+                                    const StopCondition& stop,
+                                    Signature* signature);
 
   // Placeholder function that should query the occurrence count of the
   // specified function candidate ids and convert them into weights.
@@ -101,14 +283,26 @@ class AvSignatureGenerator {
   // Computes a list of function and basic block candidates for the signature
   // generation. Function/basic block candidates are functions/basic blocks
   // that appear in all matched binaries in the same order.
-  absl::Status ComputeCandidates();
+  absl::Status ComputeCandidates(Executor* executor,
+                                 const StopCondition& stop);
+
+  // Stores a partial signature if requested (see
+  // set_partial_signature_on_stop()) and returns the status of the stop
+  // condition.
+  absl::Status StopWithPartialSignature(absl::Status stop_status,
+                                        RawSignature partial,
+                                        Signature* signature) const;
 
   // Filenames of the BinDiff result files to work on
   std::vector<std::string> diff_results_;
+  // Whether each diff is used from its secondary to its primary binary
+  std::vector<bool> diff_reversed_;
+  bool order_diffs_ = false;
 
   // Siggen's core data structure that holds all loaded function, basic block
   // and instruction matches
   MatchChainTable match_chain_table_;
+  bool inputs_loaded_ = false;
 
   // A sequence of basic block ids that are to be considered for inclusion in
   // the final signature
@@ -117,6 +311,33 @@ class AvSignatureGenerator {
   // Whether to output debug information about the internal state of the match
   // chain table.
   bool debug_match_chain_ = false;
+
+  // Optional corpus of benign files used to avoid false positives
+  std::shared_ptr<const GoodwareCorpus> goodware_;
+  int goodware_max_rounds_ = 10;
+
+  bool minimize_ = false;
+  int minimize_min_pieces_ = MinimizeOptions().min_pieces;
+
+  int num_threads_ = 0;
+  std::shared_ptr<Executor> executor_;
+
+  absl::Duration target_latency_ = absl::InfiniteDuration();
+  CostModel cost_model_;
+  CostEstimate cost_estimate_;
+  ExecutionPlan execution_plan_;
+
+  // Optional cache for decoded BinDiff and BinExport files
+  std::shared_ptr<InputCache> input_cache_;
+
+  // Optional cache for raw signatures. The key of the current inputs and, if
+  // LoadInputs() found one, the cached entry.
+  std::shared_ptr<RawSignatureCache> signature_cache_;
+  std::string signature_cache_key_;
+  std::optional<Signature> cached_signature_;
+
+  bool partial_signature_on_stop_ = false;
+  bool verbose_ = true;
 };
 
 }  // namespace security::vxsig
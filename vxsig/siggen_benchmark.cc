@@ -0,0 +1,196 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for the stages of signature generation that run after the input
+// files have been read, on the chain of diffs from the test data. The inputs
+// are loaded once and shared by all benchmarks.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "benchmark/benchmark.h"
+#include "vxsig/benchmark_util.h"
+#include "vxsig/generic_signature.h"
+#include "vxsig/match_chain_table.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/trim_plan.h"
+#include "vxsig/types.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+namespace {
+
+struct Inputs {
+  absl::Status status;
+  MatchChainTable table;
+  IdentSequence bb_candidate_ids;
+  Signature signature;
+};
+
+const Inputs& GetInputs() {
+  static const Inputs* inputs = []() {
+    auto* inputs = new Inputs();
+    inputs->status = LoadMatchChainTable(BenchmarkDiffs(), &inputs->table);
+    if (!inputs->status.ok()) {
+      return inputs;
+    }
+    ComputeBenchmarkCandidates(&inputs->table, &inputs->bb_candidate_ids);
+    auto raw_signature = GenericSignatureFromMatches(
+        inputs->table, inputs->bb_candidate_ids,
+        /*disable_nibble_masking=*/false, /*min_piece_length=*/4);
+    if (!raw_signature.ok()) {
+      inputs->status = raw_signature.status();
+      return inputs;
+    }
+    *inputs->signature.mutable_raw_signature() = *std::move(raw_signature);
+    inputs->signature.mutable_definition()->set_detection_name("benchmark");
+    return inputs;
+  }();
+  return *inputs;
+}
+
+void BM_PropagateIds(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  if (!CheckBenchmarkStatus(inputs.status, state)) {
+    return;
+  }
+  // Assigns the same ids on every run.
+  auto* table = const_cast<MatchChainTable*>(&inputs.table);
+  int64_t basic_blocks = 0;
+  for (const auto& column : *table) {
+    basic_blocks += column->basic_blocks_by_address().size();
+  }
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    PropagateIds(table);
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * basic_blocks);
+}
+BENCHMARK(BM_PropagateIds)->Unit(benchmark::kMillisecond);
+
+void BM_GenericSignatureFromMatches(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  if (!CheckBenchmarkStatus(inputs.status, state)) {
+    return;
+  }
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    auto raw_signature = GenericSignatureFromMatches(
+        inputs.table, inputs.bb_candidate_ids,
+        /*disable_nibble_masking=*/false, /*min_piece_length=*/4);
+    benchmark::DoNotOptimize(raw_signature);
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() *
+                          inputs.bb_candidate_ids.size());
+}
+BENCHMARK(BM_GenericSignatureFromMatches)->Unit(benchmark::kMillisecond);
+
+// The argument is the trim algorithm.
+void BM_GetRelevantSignatureSubset(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  if (!CheckBenchmarkStatus(inputs.status, state)) {
+    return;
+  }
+  Signature signature = inputs.signature;
+  auto* definition = signature.mutable_definition();
+  definition->set_trim_algorithm(
+      static_cast<SignatureDefinition::SignatureTrimAlgorithm>(
+          state.range(0)));
+  definition->set_trim_length(GetSignatureSize(signature) / 2);
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    RawSignature subset;
+    if (!CheckBenchmarkStatus(
+            GetRelevantSignatureSubset(signature, /*engine_min_piece_len=*/4,
+                                       &subset),
+            state)) {
+      return;
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() *
+                          signature.raw_signature().piece_size());
+}
+BENCHMARK(BM_GetRelevantSignatureSubset)
+    ->Arg(SignatureDefinition::TRIM_NONE)
+    ->Arg(SignatureDefinition::TRIM_LAST)
+    ->Arg(SignatureDefinition::TRIM_RANDOM)
+    ->Unit(benchmark::kMicrosecond);
+
+// Trims one raw signature to many lengths, like a variant search. The argument
+// is the trim algorithm.
+void BM_TrimPlan(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  if (!CheckBenchmarkStatus(inputs.status, state)) {
+    return;
+  }
+  SignatureDefinition definition = inputs.signature.definition();
+  definition.set_trim_algorithm(
+      static_cast<SignatureDefinition::SignatureTrimAlgorithm>(
+          state.range(0)));
+  const int64_t size = GetSignatureSize(inputs.signature);
+  constexpr int kNumLengths = 16;
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    const TrimPlan plan(inputs.signature.raw_signature());
+    std::vector<int> indices;
+    for (int i = 1; i <= kNumLengths; ++i) {
+      definition.set_trim_length(size * i / kNumLengths);
+      if (!CheckBenchmarkStatus(
+              plan.GetSubsetIndices(definition, /*engine_min_piece_len=*/4,
+                                    &indices),
+              state)) {
+        return;
+      }
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetItemsProcessed(state.iterations() * kNumLengths);
+}
+BENCHMARK(BM_TrimPlan)
+    ->Arg(SignatureDefinition::TRIM_LAST)
+    ->Arg(SignatureDefinition::TRIM_RANDOM)
+    ->Unit(benchmark::kMicrosecond);
+
+// The argument is the SignatureType.
+void BM_Format(benchmark::State& state) {
+  const Inputs& inputs = GetInputs();
+  if (!CheckBenchmarkStatus(inputs.status, state)) {
+    return;
+  }
+  auto formatter =
+      SignatureFormatter::Create(static_cast<SignatureType>(state.range(0)));
+  // Each call replaces the output of the previous one.
+  Signature signature = inputs.signature;
+  AllocationCounter allocations;
+  for (auto _ : state) {
+    if (!CheckBenchmarkStatus(formatter->Format(&signature), state)) {
+      return;
+    }
+  }
+  ReportAllocations(allocations, state);
+  state.SetBytesProcessed(state.iterations() *
+                          GetSignatureSize(inputs.signature));
+}
+BENCHMARK(BM_Format)
+    ->Arg(CLAMAV)
+    ->Arg(YARA)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+}  // namespace security::vxsig
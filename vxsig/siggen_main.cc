@@ -15,12 +15,16 @@
 // A program that implements AV signature generation from sets of binaries.
 // Siggen operates on similar binaries that have been bindiffed pairwise.
 
+#include <unistd.h>
+
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <limits>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/base/internal/raw_logging.h"
 #include "absl/flags/flag.h"
@@ -28,10 +32,23 @@
 #include "absl/flags/usage.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
+#include "absl/time/time.h"
+#include "vxsig/batch.h"
+#include "vxsig/corpus.h"
+#include "vxsig/daemon.h"
+#include "vxsig/goodware.h"
+#include "vxsig/input_cache.h"
+#include "vxsig/raw_image_signature.h"
+#include "vxsig/shard.h"
 #include "vxsig/siggen.h"
+#include "vxsig/signature_cache.h"
 #include "vxsig/signature_formatter.h"
+#include "vxsig/trace.h"
 #include "vxsig/types.h"
+#include "vxsig/variant_search.h"
 #include "vxsig/vxsig.pb.h"
 
 ABSL_FLAG(std::string, detection_name, "VxSig_Signature",
@@ -48,13 +65,130 @@ ABSL_FLAG(std::string, function_includes, "",
           "consider for the signature. Mutually exclusive with "
           "function_excludes.");
 ABSL_FLAG(std::string, function_excludes, "", "Inverse of function_includes");
+ABSL_FLAG(bool, order_diffs, false,
+          "Accept the diffs in any order and direction, and use the chain of "
+          "diffs with the highest total BinDiff similarity among them");
+ABSL_FLAG(bool, raw_images, false,
+          "Treat the arguments as raw byte images, like process memory dumps, "
+          "and build the signature from the byte sequences that all of them "
+          "share. Does not need BinExport or BinDiff files.");
+ABSL_FLAG(std::string, goodware, "",
+          "Directory of benign files or goodware index file. If set, pieces "
+          "that cause false positives are removed from the signature.");
+ABSL_FLAG(int32_t, goodware_max_rounds, 10,
+          "Maximum number of times to check the signature against the "
+          "goodware corpus");
+ABSL_FLAG(bool, minimize, false,
+          "Reduce the signature to a small set of pieces that match all input "
+          "binaries and exclude the goodware corpus");
+ABSL_FLAG(int32_t, minimize_min_pieces, 4,
+          "Minimum number of pieces to keep when minimizing");
+ABSL_FLAG(int32_t, search_variants, 0,
+          "If set, try this many TRIM_RANDOM variants and keep the best "
+          "scoring one");
+ABSL_FLAG(std::string, search_trim_lengths, "",
+          "Comma-separated list of trim lengths to search");
+ABSL_FLAG(std::string, search_min_piece_lengths, "",
+          "Comma-separated list of minimum piece lengths to search");
+ABSL_FLAG(std::string, search_corpus, "",
+          "Directory of representative files to estimate scan cost during the "
+          "search");
+
+ABSL_FLAG(std::string, manifest, "",
+          "Batch mode: run all jobs of this BatchManifest (in text format) "
+          "instead of generating a single signature");
+ABSL_FLAG(std::string, output_directory, "",
+          "Batch mode: directory for the output files, overrides the "
+          "manifest");
+ABSL_FLAG(std::string, shard_work_dir, "",
+          "Batch mode: run as one of several worker processes that share "
+          "the jobs of the manifest through this directory");
+ABSL_FLAG(std::string, worker_id, "",
+          "Batch mode: unique id of this worker, defaults to <hostname>-<pid>");
+ABSL_FLAG(bool, cluster_samples, false,
+          "Batch mode: split each job into one job per cluster of samples "
+          "that share most of their functions");
+ABSL_FLAG(double, cluster_min_similarity, 0.4,
+          "Batch mode: minimum estimated share of common functions for two "
+          "samples to be in the same cluster");
+ABSL_FLAG(int32_t, num_threads, 0,
+          "Number of threads to use, 0 to use all available cores. In batch "
+          "mode, this is the number of jobs to run concurrently.");
+ABSL_FLAG(int64_t, target_latency_ms, 0,
+          "Target time for generating the signature in milliseconds. If the "
+          "estimated time is longer, candidates are computed with an "
+          "approximate LCS. 0 to always compute the exact LCS.");
+
+ABSL_FLAG(std::string, trace_file, "",
+          "Write a trace of all generation phases in Chrome trace-event "
+          "format to this file");
+ABSL_FLAG(std::string, trace_summary_file, "",
+          "Write a JSON summary of phase timings and counters to this file");
+
+ABSL_FLAG(std::string, serve, "",
+          "Daemon mode: listen for jobs on this Unix socket and keep inputs "
+          "in memory between them");
+ABSL_FLAG(std::string, daemon, "",
+          "Send the job to the daemon listening on this Unix socket instead "
+          "of generating the signature in this process");
+ABSL_FLAG(int64_t, deadline_ms, 0,
+          "Daemon mode: deadline for each job in milliseconds, 0 for the "
+          "default of 10 minutes");
+ABSL_FLAG(int64_t, max_memory_bytes, 0,
+          "Daemon mode: memory budget for each job, 0 for unlimited");
+ABSL_FLAG(std::string, signature_cache_dir, "",
+          "Directory for caching raw signatures across runs");
+ABSL_FLAG(int64_t, signature_cache_max_bytes, int64_t{1} << 30,
+          "Size limit for the signature cache directory");
 
 namespace security::vxsig {
 namespace {
 
-void SiggenMain(int argc, char* argv[]) {
-  ABSL_RAW_CHECK(argc >= 2, "Need at least one .BinDiff file");
+std::vector<int> ParseIntList(absl::string_view list) {
+  std::vector<int> result;
+  for (const auto& value : absl::StrSplit(list, ',', absl::SkipWhitespace())) {
+    int parsed;
+    ABSL_RAW_CHECK(absl::SimpleAtoi(value, &parsed), "Failed to parse integer");
+    result.push_back(parsed);
+  }
+  return result;
+}
 
+void SearchSignatureDefinitions(const GoodwareCorpus* goodware,
+                                Signature* signature) {
+  VariantSearchOptions options;
+  for (int i = 0; i < absl::GetFlag(FLAGS_search_variants); ++i) {
+    options.variants.push_back(i);
+  }
+  options.trim_lengths = ParseIntList(absl::GetFlag(FLAGS_search_trim_lengths));
+  options.min_piece_lengths =
+      ParseIntList(absl::GetFlag(FLAGS_search_min_piece_lengths));
+  options.goodware = goodware;
+  Corpus scan_corpus;
+  if (!absl::GetFlag(FLAGS_search_corpus).empty()) {
+    auto corpus = Corpus::LoadFromDirectory(absl::GetFlag(FLAGS_search_corpus));
+    ABSL_RAW_CHECK(corpus.ok(), absl::StrCat("Failed to load corpus: ",
+                                             corpus.status().message())
+                                    .c_str());
+    scan_corpus = *std::move(corpus);
+    options.scan_corpus = &scan_corpus;
+  }
+
+  absl::PrintF("Searching signature definitions\n");
+  auto result = SearchVariants(*signature, options);
+  ABSL_RAW_CHECK(result.ok(), absl::StrCat("Failed to search variants: ",
+                                           result.status().message())
+                                  .c_str());
+  const auto& best = result->candidates[result->best_candidate];
+  absl::PrintF(
+      "  Best of %d: variant %d, trim length %d, min piece length %d "
+      "(score %.1f)\n",
+      result->candidates.size(), best.variant, best.trim_length,
+      best.min_piece_length, best.score);
+  *signature = std::move(result->best);
+}
+
+SignatureDefinition SignatureDefinitionFromFlags() {
   auto trim_algorithm = SignatureDefinition::TRIM_NONE;
   if (!SignatureDefinition::SignatureTrimAlgorithm_Parse(
           absl::GetFlag(FLAGS_trim_algorithm), &trim_algorithm)) {
@@ -67,8 +201,7 @@ void SiggenMain(int argc, char* argv[]) {
           absl::GetFlag(FLAGS_function_excludes).empty(),
       "function_includes and function_excludes are mutually exclusive");
 
-  Signature signature;
-  auto& signature_definition = *signature.mutable_definition();
+  SignatureDefinition signature_definition;
   signature_definition.set_detection_name(absl::GetFlag(FLAGS_detection_name));
   signature_definition.set_trim_length(absl::GetFlag(FLAGS_trim_length));
   signature_definition.set_trim_algorithm(trim_algorithm);
@@ -95,18 +228,215 @@ void SiggenMain(int argc, char* argv[]) {
       signature_definition.add_filtered_function_address(address);
     }
   }
+  return signature_definition;
+}
+
+std::shared_ptr<const GoodwareCorpus> LoadGoodwareFromFlags() {
+  const std::string goodware_path = absl::GetFlag(FLAGS_goodware);
+  if (goodware_path.empty()) {
+    return nullptr;
+  }
+  auto loaded = GoodwareCorpus::Load(goodware_path);
+  ABSL_RAW_CHECK(loaded.ok(), absl::StrCat("Failed to load goodware: ",
+                                           loaded.status().message())
+                                  .c_str());
+  return std::move(*loaded);
+}
+
+// Returns the raw signature cache selected by the flags or null if none.
+std::shared_ptr<RawSignatureCache> OpenSignatureCacheFromFlags() {
+  RawSignatureCacheOptions options;
+  options.directory = absl::GetFlag(FLAGS_signature_cache_dir);
+  if (options.directory.empty()) {
+    return nullptr;
+  }
+  options.max_disk_bytes = absl::GetFlag(FLAGS_signature_cache_max_bytes);
+  auto cache = RawSignatureCache::Open(options);
+  ABSL_RAW_CHECK(cache.ok(), absl::StrCat("Failed to open signature cache: ",
+                                          cache.status().message())
+                                 .c_str());
+  return std::move(*cache);
+}
+
+BatchOptions BatchOptionsFromFlags() {
+  BatchOptions options;
+  options.default_definition = SignatureDefinitionFromFlags();
+  options.output_directory = absl::GetFlag(FLAGS_output_directory);
+  options.goodware = LoadGoodwareFromFlags();
+  options.goodware_max_rounds = absl::GetFlag(FLAGS_goodware_max_rounds);
+  options.minimize = absl::GetFlag(FLAGS_minimize);
+  options.minimize_min_pieces = absl::GetFlag(FLAGS_minimize_min_pieces);
+  options.order_diffs = absl::GetFlag(FLAGS_order_diffs);
+  options.cluster_samples = absl::GetFlag(FLAGS_cluster_samples);
+  options.clustering.min_similarity =
+      absl::GetFlag(FLAGS_cluster_min_similarity);
+  options.input_cache = std::make_shared<InputCache>();
+  options.signature_cache = OpenSignatureCacheFromFlags();
+  options.num_threads = absl::GetFlag(FLAGS_num_threads);
+  return options;
+}
+
+// Runs all jobs of a batch manifest. Returns false if any job failed.
+bool BatchMain(const std::string& manifest_path) {
+  auto manifest = ReadBatchManifest(manifest_path);
+  ABSL_RAW_CHECK(manifest.ok(), absl::StrCat("Failed to read manifest: ",
+                                             manifest.status().message())
+                                    .c_str());
+
+  const BatchOptions options = BatchOptionsFromFlags();
+  absl::PrintF("Running %d jobs\n", manifest->job_size());
+  absl::StatusOr<std::vector<BatchJobResult>> results;
+  if (const std::string work_dir = absl::GetFlag(FLAGS_shard_work_dir);
+      !work_dir.empty()) {
+    ShardOptions shard_options;
+    shard_options.work_directory = work_dir;
+    shard_options.worker_id = absl::GetFlag(FLAGS_worker_id);
+    results = RunBatchWorker(*manifest, options, shard_options);
+  } else {
+    results = RunBatch(*manifest, options);
+  }
+  ABSL_RAW_CHECK(results.ok(), absl::StrCat("Failed to run batch: ",
+                                            results.status().message())
+                                   .c_str());
+  int num_failed = 0;
+  for (const auto& result : *results) {
+    if (result.status.ok()) {
+      absl::PrintF("  %s: %s\n", result.name,
+                   absl::StrJoin(result.output_files, ", "));
+    } else {
+      ++num_failed;
+      absl::PrintF("  %s: FAILED: %s\n", result.name,
+                   result.status.message());
+    }
+  }
+  absl::PrintF("%d of %d jobs failed, %d of %d input files from cache\n",
+               num_failed, results->size(), options.input_cache->hits(),
+               options.input_cache->hits() + options.input_cache->misses());
+  if (options.signature_cache) {
+    absl::PrintF("%d of %d raw signatures from cache\n",
+                 options.signature_cache->hits(),
+                 options.signature_cache->hits() +
+                     options.signature_cache->misses());
+  }
+  return num_failed == 0;
+}
+
+// Serves signature generation jobs until the process is terminated.
+void ServeMain(const std::string& socket_path) {
+  DaemonOptions options;
+  options.generator = BatchOptionsFromFlags();
+  // Repeated requests are common, so cache raw signatures at least in memory.
+  if (!options.generator.signature_cache) {
+    options.generator.signature_cache = std::make_shared<RawSignatureCache>();
+  }
+  options.max_concurrent_jobs = absl::GetFlag(FLAGS_num_threads);
+  if (absl::GetFlag(FLAGS_deadline_ms) > 0) {
+    options.default_deadline =
+        absl::Milliseconds(absl::GetFlag(FLAGS_deadline_ms));
+  }
+  options.default_max_memory_bytes = absl::GetFlag(FLAGS_max_memory_bytes);
+  SignatureDaemon daemon(std::move(options));
+  absl::PrintF("Listening on %s\n", socket_path);
+  absl::Status status = daemon.Serve(socket_path);
+  ABSL_RAW_CHECK(status.ok(),
+                 absl::StrCat("Daemon failed: ", status.message()).c_str());
+}
+
+// Sends the diff results on the command line to a running daemon and prints
+// the resulting YARA signature. Returns false if the job failed.
+bool DaemonClientMain(const std::string& socket_path, int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc >= 2, "Need at least one .BinDiff file");
+  DaemonRequest request;
+  request.set_job_id(absl::StrCat(getpid()));
+  request.set_deadline_ms(absl::GetFlag(FLAGS_deadline_ms));
+  request.set_max_memory_bytes(absl::GetFlag(FLAGS_max_memory_bytes));
+  auto* job = request.mutable_job();
+  *job->mutable_definition() = SignatureDefinitionFromFlags();
+  job->add_output_format(YARA);
+  for (int i = 1; i < argc; ++i) {
+    // The daemon may run in a different working directory.
+    char* path = realpath(argv[i], nullptr);
+    ABSL_RAW_CHECK(path != nullptr,
+                   absl::StrCat("Invalid path: ", argv[i]).c_str());
+    job->add_diff(path);
+    free(path);
+  }
+
+  auto response = SubmitDaemonJob(socket_path, request);
+  ABSL_RAW_CHECK(response.ok(), absl::StrCat("Failed to submit job: ",
+                                             response.status().message())
+                                    .c_str());
+  if (response->state() != DaemonResponse::DONE) {
+    absl::PrintF("Job failed: %s\n", response->error_message());
+    return false;
+  }
+  std::cout << "----8<--------8<---- Signature ----8<--------8<----\n";
+  printf("%s\n", response->signature().yara_signature().data().c_str());
+  std::cout << "---->8-------->8---- Signature ---->8-------->8----\n";
+  return true;
+}
+
+// Generates the signature from the diff results on the command line.
+void GenerateFromDiffs(int argc, char* argv[],
+                       std::shared_ptr<const GoodwareCorpus> goodware,
+                       Signature* signature) {
+  ABSL_RAW_CHECK(argc >= 2, "Need at least one .BinDiff file");
 
   AvSignatureGenerator siggen;
+  if (goodware) {
+    siggen.set_goodware(goodware).set_goodware_max_rounds(
+        absl::GetFlag(FLAGS_goodware_max_rounds));
+  }
+  siggen.set_minimize(absl::GetFlag(FLAGS_minimize))
+      .set_minimize_min_pieces(absl::GetFlag(FLAGS_minimize_min_pieces))
+      .set_order_diffs(absl::GetFlag(FLAGS_order_diffs))
+      .set_num_threads(absl::GetFlag(FLAGS_num_threads));
+  if (const int64_t target_latency_ms = absl::GetFlag(FLAGS_target_latency_ms);
+      target_latency_ms > 0) {
+    siggen.set_target_latency(absl::Milliseconds(target_latency_ms));
+  }
+  if (auto signature_cache = OpenSignatureCacheFromFlags()) {
+    siggen.set_signature_cache(std::move(signature_cache));
+  }
   siggen.AddDiffResultsFromCommandLineArguments(--argc, ++argv);
-  absl::Status status(siggen.Generate(&signature));
+  absl::Status status(siggen.Generate(signature));
   ABSL_RAW_CHECK(
       status.ok(),
       absl::StrCat("Failed to generate signature: ", status.message()).c_str());
+}
+
+// Generates the signature from raw byte images instead of diff results.
+void GenerateFromRawImages(int argc, char* argv[], Signature* signature) {
+  ABSL_RAW_CHECK(argc >= 3, "Need at least two images");
+  RawImageOptions options;
+  options.num_threads = absl::GetFlag(FLAGS_num_threads);
+  absl::Status status = GenerateRawImageSignature(
+      std::vector<std::string>(&argv[1], &argv[argc]), options, signature);
+  ABSL_RAW_CHECK(
+      status.ok(),
+      absl::StrCat("Failed to generate signature: ", status.message()).c_str());
+}
+
+void SiggenMain(int argc, char* argv[]) {
+  Signature signature;
+  *signature.mutable_definition() = SignatureDefinitionFromFlags();
+  std::shared_ptr<const GoodwareCorpus> goodware = LoadGoodwareFromFlags();
+  if (absl::GetFlag(FLAGS_raw_images)) {
+    GenerateFromRawImages(argc, argv, &signature);
+  } else {
+    GenerateFromDiffs(argc, argv, goodware, &signature);
+  }
+
+  if (absl::GetFlag(FLAGS_search_variants) > 0 ||
+      !absl::GetFlag(FLAGS_search_trim_lengths).empty() ||
+      !absl::GetFlag(FLAGS_search_min_piece_lengths).empty()) {
+    SearchSignatureDefinitions(goodware.get(), &signature);
+  }
 
   // Output the signature itself to stdout, so we can use redirected output
   // from this tool in scripts.
   std::cout << "----8<--------8<---- Signature ----8<--------8<----\n";
-  status = SignatureFormatter::Create(YARA)->Format(&signature);
+  absl::Status status = SignatureFormatter::Create(YARA)->Format(&signature);
   ABSL_RAW_CHECK(
       status.ok(),
       absl::StrCat("Failed to format signature: ", status.message()).c_str());
@@ -114,6 +444,43 @@ void SiggenMain(int argc, char* argv[]) {
   std::cout << "---->8-------->8---- Signature ---->8-------->8----\n";
 }
 
+void WriteTraceFiles(const Tracer& tracer) {
+  const std::string trace_file = absl::GetFlag(FLAGS_trace_file);
+  if (!trace_file.empty()) {
+    absl::Status status = tracer.WriteChromeTrace(trace_file);
+    ABSL_RAW_CHECK(
+        status.ok(),
+        absl::StrCat("Failed to write trace: ", status.message()).c_str());
+  }
+  const std::string summary_file = absl::GetFlag(FLAGS_trace_summary_file);
+  if (!summary_file.empty()) {
+    absl::Status status = tracer.WriteSummary(summary_file);
+    ABSL_RAW_CHECK(status.ok(), absl::StrCat("Failed to write trace summary: ",
+                                             status.message())
+                                    .c_str());
+  }
+}
+
+// Runs the mode selected by the flags and returns the exit code.
+int RunMode(std::vector<char*>& args) {
+  const std::string manifest = absl::GetFlag(FLAGS_manifest);
+  if (!manifest.empty()) {
+    return BatchMain(manifest) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  const std::string serve = absl::GetFlag(FLAGS_serve);
+  if (!serve.empty()) {
+    ServeMain(serve);
+    return EXIT_SUCCESS;
+  }
+  const std::string daemon = absl::GetFlag(FLAGS_daemon);
+  if (!daemon.empty()) {
+    return DaemonClientMain(daemon, args.size(), &args[0]) ? EXIT_SUCCESS
+                                                           : EXIT_FAILURE;
+  }
+  SiggenMain(args.size(), &args[0]);
+  return EXIT_SUCCESS;
+}
+
 }  // namespace
 }  // namespace security::vxsig
 
@@ -121,8 +488,22 @@ int main(int argc, char* argv[]) {
   absl::SetProgramUsageMessage(absl::StrCat(
       "Automatically generate byte-signature for sets of binaires.\n"
       "usage:\n",
-      argv[0], " [OPTION] BINDIFF..."));
+      argv[0], " [OPTION] BINDIFF...\n",
+      argv[0], " --raw_images [OPTION] IMAGE...\n",
+      argv[0], " --manifest=FILE [OPTION]\n",
+      argv[0], " --serve=SOCKET [OPTION]\n",
+      argv[0], " --daemon=SOCKET [OPTION] BINDIFF..."));
   std::vector<char*> args = absl::ParseCommandLine(argc, argv);
-  security::vxsig::SiggenMain(args.size(), &args[0]);
-  return EXIT_SUCCESS;
+  security::vxsig::Tracer tracer;
+  const bool tracing = !absl::GetFlag(FLAGS_trace_file).empty() ||
+                       !absl::GetFlag(FLAGS_trace_summary_file).empty();
+  if (tracing) {
+    security::vxsig::SetGlobalTracer(&tracer);
+  }
+  const int exit_code = security::vxsig::RunMode(args);
+  if (tracing) {
+    security::vxsig::SetGlobalTracer(nullptr);
+    security::vxsig::WriteTraceFiles(tracer);
+  }
+  return exit_code;
 }
@@ -15,22 +15,30 @@
 #include "vxsig/siggen.h"
 
 #include <memory>
+#include <thread>  // NOLINT
 
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/cancellation.h"
+#include "vxsig/executor.h"
 #include "vxsig/generic_signature.h"
+#include "vxsig/signature_cache.h"
 #include "vxsig/signature_formatter.h"
 #include "vxsig/yara_signature_test_util.h"
 
 using not_absl::IsOk;
+using testing::Eq;
 using testing::HasSubstr;
 using testing::IsEmpty;
 using testing::IsTrue;
+using testing::Lt;
 using testing::Not;
 using testing::StrEq;
 
@@ -65,6 +73,13 @@ void SiggenTest::SetupDefaultSignature(AvSignatureGenerator* siggen) {
   EXPECT_THAT(siggen->Generate(&signature_), IsOk());
 }
 
+std::vector<std::string> FirstDiffOnly() {
+  return {JoinPath(getenv("TEST_SRCDIR"), "com_google_vxsig/vxsig/testdata/",
+                   "1794a0afbfc38411dec87fa2660d6dd6515cf8d03cb32bb24a1d7a8e1e"
+                   "cf30fa_vs_1b0a84953909816c1945c2153605c2ddeb3b138fb4c262c7"
+                   "262cd9689ed25f82.BinDiff")};
+}
+
 TEST_F(SiggenTest, GenerateClamAVSignature) {
   AvSignatureGenerator siggen;
   SetupDefaultSignature(&siggen);
@@ -176,6 +191,93 @@ TEST_F(SiggenTest, EmptyRawSignaturePieces) {
   }
 }
 
+TEST_F(SiggenTest, OutputIndependentOfThreadCount) {
+  // Checks that the output is byte-identical for 1 to kMaxThreads threads.
+  constexpr int kMaxThreads = 8;
+  std::string expected_raw;
+  std::string expected_yara;
+  for (int num_threads = 1; num_threads <= kMaxThreads; ++num_threads) {
+    AvSignatureGenerator siggen;
+    siggen.set_verbose(false).set_executor(MakeExecutor(num_threads));
+    signature_.Clear();
+    signature_.mutable_definition()->set_detection_name("test_malware");
+    SetupDefaultSignature(&siggen);
+    ASSERT_THAT(SignatureFormatter::Create(YARA)->Format(&signature_), IsOk());
+    if (num_threads == 1) {
+      expected_raw = signature_.raw_signature().SerializeAsString();
+      expected_yara = signature_.yara_signature().data();
+      continue;
+    }
+    EXPECT_THAT(signature_.raw_signature().SerializeAsString(),
+                StrEq(expected_raw))
+        << num_threads << " threads";
+    EXPECT_THAT(signature_.yara_signature().data(), StrEq(expected_yara))
+        << num_threads << " threads";
+  }
+}
+
+TEST_F(SiggenTest, ReusesCachedRawSignature) {
+  const std::string file_name(JoinPath(
+      getenv("TEST_SRCDIR"),
+      "com_google_vxsig/vxsig/testdata/"
+      "592fb377afa9f93670a23159aa585e0eca908b97571ab3218e026fea3598cc16_vs_"
+      "65d25a86feb6d15527e398d7b5d043e7712b00e674bc6e8cf2a709a0c6f9b97b."
+      "BinDiff"));
+  auto cache = std::make_shared<RawSignatureCache>();
+  std::string expected_raw;
+  for (int trim_length : {-1, 16}) {
+    AvSignatureGenerator siggen;
+    siggen.set_verbose(false).set_signature_cache(cache);
+    siggen.AddDiffResults(std::vector<std::string>(1 /* size */, file_name));
+    Signature signature;
+    signature.mutable_definition()->set_trim_length(trim_length);
+    ASSERT_THAT(siggen.Generate(&signature), IsOk());
+    if (expected_raw.empty()) {
+      expected_raw = signature.raw_signature().SerializeAsString();
+      continue;
+    }
+    EXPECT_THAT(signature.raw_signature().SerializeAsString(),
+                StrEq(expected_raw));
+    EXPECT_THAT(signature.definition().meta(), Not(IsEmpty()));
+  }
+  EXPECT_THAT(cache->hits(), Eq(1));
+  EXPECT_THAT(cache->misses(), Eq(1));
+
+  // A different minimum piece length is a new entry.
+  AvSignatureGenerator siggen;
+  siggen.set_verbose(false).set_signature_cache(cache);
+  siggen.AddDiffResults(std::vector<std::string>(1 /* size */, file_name));
+  Signature signature;
+  signature.mutable_definition()->set_min_piece_length(8);
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+  EXPECT_THAT(cache->misses(), Eq(2));
+}
+
+TEST_F(SiggenTest, StopsAtDeadline) {
+  AvSignatureGenerator siggen;
+  siggen.set_verbose(false).AddDiffResults(FirstDiffOnly());
+  const absl::Status status = siggen.Generate(&signature_, absl::Now());
+  EXPECT_THAT(absl::IsDeadlineExceeded(status), IsTrue()) << status;
+}
+
+TEST_F(SiggenTest, StopsWhenCancelled) {
+  AvSignatureGenerator siggen;
+  siggen.set_verbose(false).set_partial_signature_on_stop(true);
+  siggen.AddDiffResults(FirstDiffOnly());
+  CancellationToken token;
+  std::thread canceller([&token]() {
+    absl::SleepFor(absl::Milliseconds(500));
+    token.Cancel();
+  });
+  const absl::Time start = absl::Now();
+  const absl::Status status =
+      siggen.Generate(&signature_, absl::InfiniteFuture(), &token);
+  canceller.join();
+  EXPECT_THAT(absl::IsCancelled(status), IsTrue()) << status;
+  // The full signature takes several seconds.
+  EXPECT_THAT(absl::Now() - start, Lt(absl::Seconds(2)));
+}
+
 TEST_F(SiggenTest, NotADiffChain) {
   AvSignatureGenerator siggen;
   constexpr char kTestData[] = "com_google_vxsig/vxsig/testdata/";
@@ -195,4 +297,21 @@ TEST_F(SiggenTest, NotADiffChain) {
               HasSubstr("Input files do not form a chain of diffs"));
 }
 
+TEST_F(SiggenTest, OrdersDiffChain) {
+  AvSignatureGenerator siggen;
+  constexpr char kTestData[] = "com_google_vxsig/vxsig/testdata/";
+  siggen.set_verbose(false).set_order_diffs(true);
+  siggen.AddDiffResults({JoinPath(getenv("TEST_SRCDIR"), kTestData,
+                                  "1b0a84953909816c1945c2153605c2ddeb3b138f"
+                                  "b4c262c7262cd9689ed25f82_vs_"
+                                  "1d3949acb5eb175af3cbc5f448ece50669a44743"
+                                  "faec91e3d574dad9596a9d83.BinDiff"),
+                         JoinPath(getenv("TEST_SRCDIR"), kTestData,
+                                  "1794a0afbfc38411dec87fa2660d6dd6515cf8d0"
+                                  "3cb32bb24a1d7a8e1ecf30fa_vs_"
+                                  "1b0a84953909816c1945c2153605c2ddeb3b138f"
+                                  "b4c262c7262cd9689ed25f82.BinDiff")});
+  EXPECT_THAT(siggen.LoadInputs(SignatureDefinition()), IsOk());
+}
+
 }  // namespace security::vxsig
@@ -0,0 +1,244 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/signature_cache.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <tuple>
+#include <vector>
+
+#include "absl/hash/internal/city.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/corpus.h"
+
+namespace security::vxsig {
+namespace {
+
+// Changes whenever signature generation changes in a way that makes existing
+// entries invalid.
+constexpr char kCacheFormat[] = "vxsig-rawsig-1";
+
+constexpr char kEntryExtension[] = ".rawsig";
+
+// Seeds for the two halves of the 128-bit hashes.
+constexpr uint64_t kSeedLow = 0x9e3779b97f4a7c15;
+constexpr uint64_t kSeedHigh = 0xc2b2ae3d27d4eb4f;
+
+std::string Hash128(absl::string_view data) {
+  return absl::StrFormat(
+      "%016x%016x",
+      absl::hash_internal::CityHash64WithSeed(data.data(), data.size(),
+                                              kSeedHigh),
+      absl::hash_internal::CityHash64WithSeed(data.data(), data.size(),
+                                              kSeedLow));
+}
+
+int64_t EntrySize(const Signature& entry) { return entry.ByteSizeLong(); }
+
+absl::Status ErrnoStatus(absl::string_view operation,
+                         absl::string_view path) {
+  return absl::UnavailableError(
+      absl::StrCat(operation, " failed for ", path, ": ", strerror(errno)));
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> RawSignatureCacheKey(
+    absl::Span<const std::string> input_files, absl::string_view params) {
+  std::string key_data = absl::StrCat(kCacheFormat, "\n", params, "\n");
+  for (const auto& file : input_files) {
+    NA_ASSIGN_OR_RETURN(std::string data, ReadFileContents(file));
+    absl::StrAppend(&key_data, Hash128(data), "\n");
+  }
+  return Hash128(key_data);
+}
+
+RawSignatureCache::RawSignatureCache(int64_t max_memory_bytes)
+    : RawSignatureCache([max_memory_bytes]() {
+        RawSignatureCacheOptions options;
+        options.max_memory_bytes = max_memory_bytes;
+        return options;
+      }()) {}
+
+RawSignatureCache::RawSignatureCache(const RawSignatureCacheOptions& options)
+    : options_(options) {}
+
+absl::StatusOr<std::unique_ptr<RawSignatureCache>> RawSignatureCache::Open(
+    const RawSignatureCacheOptions& options) {
+  auto cache = absl::WrapUnique(new RawSignatureCache(options));
+  if (options.directory.empty()) {
+    return cache;
+  }
+  NA_RETURN_IF_ERROR(CreateDirectories(options.directory));
+  std::vector<std::string> entries;
+  NA_RETURN_IF_ERROR(GetDirectoryEntries(options.directory, &entries));
+  absl::MutexLock lock(&cache->mutex_);
+  for (const auto& entry : entries) {
+    if (absl::EndsWith(entry, kEntryExtension)) {
+      NA_ASSIGN_OR_RETURN(int64_t size,
+                          GetFileSize(JoinPath(options.directory, entry)));
+      cache->disk_bytes_ += size;
+    }
+  }
+  NA_RETURN_IF_ERROR(cache->EvictFromDisk());
+  return cache;
+}
+
+std::string RawSignatureCache::EntryPath(absl::string_view key) const {
+  return JoinPath(options_.directory, absl::StrCat(key, kEntryExtension));
+}
+
+std::optional<Signature> RawSignatureCache::Lookup(absl::string_view key) {
+  absl::MutexLock lock(&mutex_);
+  if (auto found = index_.find(key); found != index_.end()) {
+    entries_.splice(entries_.begin(), entries_, found->second);
+    ++hits_;
+    return found->second->second;
+  }
+  if (!options_.directory.empty()) {
+    const std::string path = EntryPath(key);
+    if (auto data = ReadFileContents(path); data.ok()) {
+      Signature entry;
+      if (entry.ParseFromString(*data)) {
+        // Mark as recently used for eviction from disk.
+        utime(path.c_str(), /*times=*/nullptr);
+        ++hits_;
+        InsertInMemory(std::string(key), entry);
+        return entry;
+      }
+      if (remove(path.c_str()) == 0) {
+        disk_bytes_ -= data->size();
+      }
+    }
+  }
+  ++misses_;
+  return std::nullopt;
+}
+
+absl::Status RawSignatureCache::Insert(absl::string_view key,
+                                       const Signature& signature) {
+  Signature entry;
+  *entry.mutable_raw_signature() = signature.raw_signature();
+  if (signature.has_fallback_signature()) {
+    *entry.mutable_fallback_signature() = signature.fallback_signature();
+  }
+
+  absl::MutexLock lock(&mutex_);
+  if (!options_.directory.empty()) {
+    const std::string data = entry.SerializeAsString();
+    const std::string path = EntryPath(key);
+    // Write to a temporary file first, so that concurrent readers never see
+    // incomplete entries.
+    const std::string temp_path = absl::StrCat(path, ".tmp", getpid());
+    {
+      std::ofstream output(temp_path, std::ios::binary | std::ios::trunc);
+      output.write(data.data(), data.size());
+      if (!output) {
+        output.close();
+        remove(temp_path.c_str());
+        InsertInMemory(std::string(key), std::move(entry));
+        return absl::UnknownError(absl::StrCat("Failed to write ", temp_path));
+      }
+    }
+    const bool replaced = FileExists(path);
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+      absl::Status status = ErrnoStatus("rename()", temp_path);
+      remove(temp_path.c_str());
+      InsertInMemory(std::string(key), std::move(entry));
+      return status;
+    }
+    if (!replaced) {
+      disk_bytes_ += data.size();
+    }
+  }
+  InsertInMemory(std::string(key), std::move(entry));
+  return EvictFromDisk();
+}
+
+void RawSignatureCache::InsertInMemory(std::string key, Signature entry) {
+  if (auto found = index_.find(key); found != index_.end()) {
+    memory_bytes_ -= EntrySize(found->second->second);
+    entries_.erase(found->second);
+    index_.erase(found);
+  }
+  memory_bytes_ += EntrySize(entry);
+  entries_.emplace_front(key, std::move(entry));
+  index_[std::move(key)] = entries_.begin();
+  while (memory_bytes_ > options_.max_memory_bytes && !entries_.empty()) {
+    memory_bytes_ -= EntrySize(entries_.back().second);
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+absl::Status RawSignatureCache::EvictFromDisk() {
+  if (options_.directory.empty() || disk_bytes_ <= options_.max_disk_bytes) {
+    return absl::OkStatus();
+  }
+  std::vector<std::string> names;
+  NA_RETURN_IF_ERROR(GetDirectoryEntries(options_.directory, &names));
+  // Oldest access first.
+  std::vector<std::tuple<int64_t, int64_t, std::string>> files;
+  disk_bytes_ = 0;
+  for (const auto& name : names) {
+    if (!absl::EndsWith(name, kEntryExtension)) {
+      continue;
+    }
+    std::string path = JoinPath(options_.directory, name);
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+      continue;  // Removed concurrently
+    }
+    disk_bytes_ += info.st_size;
+    files.emplace_back(
+        int64_t{info.st_mtim.tv_sec} * 1000000000 + info.st_mtim.tv_nsec,
+        info.st_size, std::move(path));
+  }
+  std::sort(files.begin(), files.end());
+  for (const auto& [mtime, size, path] : files) {
+    if (disk_bytes_ <= options_.max_disk_bytes) {
+      break;
+    }
+    if (remove(path.c_str()) != 0 && errno != ENOENT) {
+      return ErrnoStatus("remove()", path);
+    }
+    disk_bytes_ -= size;
+  }
+  return absl::OkStatus();
+}
+
+int64_t RawSignatureCache::hits() const {
+  absl::MutexLock lock(&mutex_);
+  return hits_;
+}
+
+int64_t RawSignatureCache::misses() const {
+  absl::MutexLock lock(&mutex_);
+  return misses_;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,123 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A content-addressed cache for generated raw signatures. Signatures are often
+// requested again for the same diffs, with only the trimming or output
+// settings changed. These are applied after the raw signature has been
+// generated, so the expensive part can be reused. Entries are keyed by the
+// contents of the input files and the generation-relevant fields of the
+// signature definition (see RawSignatureCacheKey()).
+// Use like this:
+//   NA_ASSIGN_OR_RETURN(auto cache, RawSignatureCache::Open(options));
+//   siggen.set_signature_cache(std::move(cache));
+
+#ifndef VXSIG_SIGNATURE_CACHE_H_
+#define VXSIG_SIGNATURE_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// Returns the cache key for a raw signature generated from the specified input
+// files. The key covers the contents and order of the files as well as the
+// params string, which should describe all settings that influence the raw
+// signature. The key is a 32 character hex string.
+absl::StatusOr<std::string> RawSignatureCacheKey(
+    absl::Span<const std::string> input_files, absl::string_view params);
+
+struct RawSignatureCacheOptions {
+  // Directory for the on-disk backend. If empty, entries are only kept in
+  // memory.
+  std::string directory;
+
+  // Size limits for the entries in memory and on disk. Least recently used
+  // entries are evicted first.
+  int64_t max_memory_bytes = 64 << 20;
+  int64_t max_disk_bytes = int64_t{1} << 30;
+};
+
+// This class is thread-safe. Several processes may share a cache directory,
+// but each of them only enforces the size limit for the entries it knows
+// about.
+class RawSignatureCache {
+ public:
+  // Creates a cache that only keeps entries in memory.
+  explicit RawSignatureCache(
+      int64_t max_memory_bytes = RawSignatureCacheOptions().max_memory_bytes);
+
+  RawSignatureCache(const RawSignatureCache&) = delete;
+  RawSignatureCache& operator=(const RawSignatureCache&) = delete;
+
+  // Opens a cache with the specified options. Creates the cache directory if
+  // it does not exist and reuses the entries already in it.
+  static absl::StatusOr<std::unique_ptr<RawSignatureCache>> Open(
+      const RawSignatureCacheOptions& options);
+
+  // Returns the entry for the key or nothing if there is none. Entries only
+  // have their raw and fallback signatures set. Unreadable entries on disk are
+  // removed and treated as missing.
+  std::optional<Signature> Lookup(absl::string_view key);
+
+  // Stores the raw and fallback signatures of the specified signature under
+  // the key. Returns an error if the entry could not be written to disk, in
+  // which case it is still cached in memory.
+  absl::Status Insert(absl::string_view key, const Signature& signature);
+
+  // Number of successful and failed lookups.
+  int64_t hits() const;
+  int64_t misses() const;
+
+ private:
+  explicit RawSignatureCache(const RawSignatureCacheOptions& options);
+
+  std::string EntryPath(absl::string_view key) const;
+
+  // Adds an entry to the in-memory LRU list and evicts old ones.
+  void InsertInMemory(std::string key, Signature entry)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes the least recently used files until the cache directory is within
+  // its size limit.
+  absl::Status EvictFromDisk() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const RawSignatureCacheOptions options_;
+
+  mutable absl::Mutex mutex_;
+  // Most recently used entries first.
+  std::list<std::pair<std::string, Signature>> entries_ ABSL_GUARDED_BY(mutex_);
+  absl::flat_hash_map<std::string, decltype(entries_)::iterator> index_
+      ABSL_GUARDED_BY(mutex_);
+  int64_t memory_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t disk_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t hits_ ABSL_GUARDED_BY(mutex_) = 0;
+  int64_t misses_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_SIGNATURE_CACHE_H_
@@ -0,0 +1,148 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/signature_cache.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::IsFalse;
+using testing::IsTrue;
+using testing::Ne;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+std::string TempPath(absl::string_view name) {
+  return JoinPath(getenv("TEST_TMPDIR"), name);
+}
+
+void WriteFile(const std::string& path, absl::string_view data) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+}
+
+// Returns a signature whose raw signature has a single piece of the
+// specified size.
+Signature MakeSignature(int piece_size, char fill = 'A') {
+  Signature signature;
+  signature.mutable_raw_signature()->add_piece()->set_bytes(
+      std::string(piece_size, fill));
+  return signature;
+}
+
+TEST(SignatureCacheTest, KeyCoversContentsAndParams) {
+  const std::string first = TempPath("key_first");
+  const std::string second = TempPath("key_second");
+  WriteFile(first, "first");
+  WriteFile(second, "second");
+
+  auto key = RawSignatureCacheKey({first, second}, "params");
+  ASSERT_THAT(key, IsOk());
+  EXPECT_THAT(*key, SizeIs(32));
+  EXPECT_THAT(*RawSignatureCacheKey({first, second}, "params"), Eq(*key));
+  EXPECT_THAT(*RawSignatureCacheKey({second, first}, "params"), Ne(*key));
+  EXPECT_THAT(*RawSignatureCacheKey({first, second}, "other"), Ne(*key));
+
+  WriteFile(second, "changed");
+  EXPECT_THAT(*RawSignatureCacheKey({first, second}, "params"), Ne(*key));
+
+  EXPECT_THAT(RawSignatureCacheKey({TempPath("key_missing")}, "params").ok(),
+              IsFalse());
+}
+
+TEST(SignatureCacheTest, EvictsLeastRecentlyUsedFromMemory) {
+  const int64_t entry_size = MakeSignature(100).ByteSizeLong();
+  RawSignatureCache cache(2 * entry_size);
+  EXPECT_THAT(cache.Insert("a", MakeSignature(100)), IsOk());
+  EXPECT_THAT(cache.Insert("b", MakeSignature(100)), IsOk());
+  EXPECT_THAT(cache.Lookup("a").has_value(), IsTrue());  // "b" is now oldest
+  EXPECT_THAT(cache.Insert("c", MakeSignature(100)), IsOk());
+
+  EXPECT_THAT(cache.Lookup("b").has_value(), IsFalse());
+  auto entry = cache.Lookup("a");
+  ASSERT_THAT(entry.has_value(), IsTrue());
+  EXPECT_THAT(entry->raw_signature().piece(0).bytes(), SizeIs(100));
+  EXPECT_THAT(cache.Lookup("c").has_value(), IsTrue());
+  EXPECT_THAT(cache.hits(), Eq(3));
+  EXPECT_THAT(cache.misses(), Eq(1));
+}
+
+TEST(SignatureCacheTest, OnlyStoresRawAndFallbackSignatures) {
+  RawSignatureCache cache;
+  Signature signature = MakeSignature(10);
+  signature.mutable_definition()->set_detection_name("test");
+  signature.mutable_yara_signature()->set_data("rule test {}");
+  *signature.mutable_fallback_signature() = MakeSignature(5).raw_signature();
+  EXPECT_THAT(cache.Insert("key", signature), IsOk());
+
+  auto entry = cache.Lookup("key");
+  ASSERT_THAT(entry.has_value(), IsTrue());
+  EXPECT_THAT(entry->has_definition(), IsFalse());
+  EXPECT_THAT(entry->has_yara_signature(), IsFalse());
+  EXPECT_THAT(entry->raw_signature().piece(0).bytes(), SizeIs(10));
+  EXPECT_THAT(entry->fallback_signature().piece(0).bytes(), SizeIs(5));
+}
+
+TEST(SignatureCacheTest, PersistsOnDisk) {
+  RawSignatureCacheOptions options;
+  options.directory = TempPath("persist_cache");
+  {
+    auto cache = RawSignatureCache::Open(options);
+    ASSERT_THAT(cache, IsOk());
+    EXPECT_THAT((*cache)->Insert("good", MakeSignature(10, 'G')), IsOk());
+  }
+  WriteFile(JoinPath(options.directory, "bad.rawsig"), "not a proto");
+
+  auto cache = RawSignatureCache::Open(options);
+  ASSERT_THAT(cache, IsOk());
+  auto entry = (*cache)->Lookup("good");
+  ASSERT_THAT(entry.has_value(), IsTrue());
+  EXPECT_THAT(entry->raw_signature().piece(0).bytes(),
+              Eq(std::string(10, 'G')));
+
+  // Unreadable entries are removed.
+  EXPECT_THAT((*cache)->Lookup("bad").has_value(), IsFalse());
+  EXPECT_THAT(FileExists(JoinPath(options.directory, "bad.rawsig")),
+              IsFalse());
+}
+
+TEST(SignatureCacheTest, EvictsFromDisk) {
+  RawSignatureCacheOptions options;
+  options.directory = TempPath("evict_cache");
+  options.max_disk_bytes = 3 * MakeSignature(1000).ByteSizeLong();
+  auto cache = RawSignatureCache::Open(options);
+  ASSERT_THAT(cache, IsOk());
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_THAT((*cache)->Insert(absl::StrCat("entry", i), MakeSignature(1000)),
+                IsOk());
+  }
+  std::vector<std::string> entries;
+  ASSERT_THAT(GetDirectoryEntries(options.directory, &entries), IsOk());
+  EXPECT_THAT(entries, SizeIs(3));
+  EXPECT_THAT(FileExists(JoinPath(options.directory, "entry9.rawsig")),
+              IsTrue());
+}
+
+}  // namespace
+}  // namespace security::vxsig
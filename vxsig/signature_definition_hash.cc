@@ -94,4 +94,20 @@ std::string SignatureDefinitionHasher::GetSignatureId(int32_t rand) const {
   return result;
 }
 
+uint64_t SignatureDefinitionHasher::GetRawSignatureParamsHash() const {
+  // Set all fields explicitly, so that default values hash the same as
+  // explicitly set ones.
+  SignatureDefinition params;
+  params.set_disable_nibble_masking(sig_def_.disable_nibble_masking());
+  params.set_min_piece_length(sig_def_.min_piece_length());
+  params.set_function_filter(sig_def_.function_filter());
+  if (sig_def_.function_filter() != SignatureDefinition::FILTER_NONE) {
+    *params.mutable_filtered_function_address() =
+        sig_def_.filtered_function_address();
+  }
+  std::string serialized = params.SerializeAsString();
+  return absl::hash_internal::CityHash64(serialized.c_str(),
+                                         serialized.size());
+}
+
 }  // namespace security::vxsig
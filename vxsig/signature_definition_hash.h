@@ -60,6 +60,13 @@ class SignatureDefinitionHasher {
   std::string GetSignatureIdPrefixUpToParamsHash() const;
   std::string GetSignatureId(int32_t rand) const;
 
+  // Returns a hash over the fields that influence the raw signature generated
+  // from a set of inputs: the nibble masking, the minimum piece length and the
+  // function filter. Definitions that only differ in trimming, metadata or
+  // identification have the same hash. Unlike the signature ids, the full 64
+  // bits are used, as the hash is meant for cache keys.
+  uint64_t GetRawSignatureParamsHash() const;
+
  private:
   SignatureDefinition sig_def_;
 };
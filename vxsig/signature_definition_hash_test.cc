@@ -18,6 +18,7 @@
 #include "gtest/gtest.h"
 
 using testing::Eq;
+using testing::Ne;
 
 namespace security::vxsig {
 
@@ -68,4 +69,34 @@ TEST_F(SignatureDefinitionHashTest, ValidSignatureDefinition) {
   EXPECT_THAT(hasher.GetSignatureId(0), Eq("sig_63ad6eaa162e_07510000"));
 }
 
+TEST_F(SignatureDefinitionHashTest, RawSignatureParamsHash) {
+  const uint64_t hash =
+      SignatureDefinitionHasher(sig_def_).GetRawSignatureParamsHash();
+  EXPECT_THAT(SignatureDefinitionHasher(SignatureDefinition())
+                  .GetRawSignatureParamsHash(),
+              Eq(hash));
+
+  // Output-only settings do not matter.
+  SignatureDefinition other(sig_def_);
+  other.set_trim_length(100);
+  other.set_variant(1);
+  other.set_detection_name("another_virus");
+  other.set_min_piece_length(4);  // Same as the default
+  other.add_filtered_function_address(0x1000);  // Ignored with FILTER_NONE
+  EXPECT_THAT(SignatureDefinitionHasher(other).GetRawSignatureParamsHash(),
+              Eq(hash));
+
+  other.set_function_filter(SignatureDefinition::FILTER_EXCLUDE);
+  EXPECT_THAT(SignatureDefinitionHasher(other).GetRawSignatureParamsHash(),
+              Ne(hash));
+  other = sig_def_;
+  other.set_min_piece_length(8);
+  EXPECT_THAT(SignatureDefinitionHasher(other).GetRawSignatureParamsHash(),
+              Ne(hash));
+  other = sig_def_;
+  other.set_disable_nibble_masking(true);
+  EXPECT_THAT(SignatureDefinitionHasher(other).GetRawSignatureParamsHash(),
+              Ne(hash));
+}
+
 }  // namespace security::vxsig
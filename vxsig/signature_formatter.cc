@@ -14,9 +14,11 @@
 
 #include "vxsig/signature_formatter.h"
 
-#include <algorithm>
-#include <random>
+#include <optional>
+#include <string>
+#include <utility>
 
+#include "absl/flags/flag.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
@@ -24,221 +26,119 @@
 #include "third_party/zynamics/binexport/util/status_macros.h"
 #include "vxsig/clamav_signature_formatter.h"
 #include "vxsig/generic_signature.h"
+#include "vxsig/trace.h"
+#include "vxsig/trim_plan.h"
 #include "vxsig/yara_signature_formatter.h"
 
+ABSL_FLAG(bool, siggen_yara_debug_masking, false,
+          "Include unmasked hex bytes in signature output");
+ABSL_FLAG(bool, siggen_yara_debug_weights, false,
+          "Include signature piece weights in output");
+
 namespace security::vxsig {
 
+FormatterOptions FormatterOptionsFromFlags() {
+  FormatterOptions options;
+  options.yara_debug_masking = absl::GetFlag(FLAGS_siggen_yara_debug_masking);
+  options.yara_debug_weights = absl::GetFlag(FLAGS_siggen_yara_debug_weights);
+  return options;
+}
+
 std::unique_ptr<SignatureFormatter> SignatureFormatter::Create(
     SignatureType type) {
+  return Create(type, FormatterOptionsFromFlags());
+}
+
+std::unique_ptr<SignatureFormatter> SignatureFormatter::Create(
+    SignatureType type, const FormatterOptions& options) {
   switch (type) {
     case SignatureType::CLAMAV:
-      return absl::make_unique<ClamAvSignatureFormatter>();
+      return absl::make_unique<ClamAvSignatureFormatter>(options);
     case SignatureType::YARA:
-      return absl::make_unique<YaraSignatureFormatter>();
+      return absl::make_unique<YaraSignatureFormatter>(options);
     default:
       ABSL_RAW_LOG(FATAL, "Invalid signature type");
       return nullptr;  // Not reached
   }
 }
 
-absl::Status SignatureFormatter::Format(Signature* signature) const {
+absl::Status SignatureFormatter::Format(Signature* signature,
+                                        const TrimPlan* plan) const {
   if (!signature) {
     return absl::InvalidArgumentError("Signature must not be nullptr");
   }
-  return DoFormat(signature);
-}
-
-absl::Status SignatureFormatter::FormatDatabase(
-    const Signatures& signatures, std::string* database) const {
-  return DoFormatDatabase(signatures, ABSL_DIE_IF_NULL(database));
-}
-
-namespace {
-
-absl::Status SolveKnapsack(const int64_t max_byte_len,
-                           const RawSignature& raw_signature,
-                           std::vector<int>* piece_indices) {
-  if (!piece_indices) {
-    return absl::InvalidArgumentError("Piece indices must be non-nullptr");
-  }
-  // The code below is disabled for now, as piece weights need a function
-  // corpus.
-  // When enabling, include "ortools/linear_solver/linear_solver.h".
-#if 0
-  MPSolver solver("SolverSiggen", MPSolver::SCIP_MIXED_INTEGER_PROGRAMMING);
-  solver.SetSolverSpecificParametersAsString(
-      absl::StrCat("limits/memory = ", 8ULL << 30 /* 8 GiB */,
-                   "\nlimits/time = ", 1800 /* 30min */, "\n"));
-  solver.MutableObjective()->SetMaximization();
-  MPConstraint* contraint = solver.MakeRowConstraint(0.0, max_byte_len);
-
-  // Gather maximum weight and size values to scale later.
-  double max_weight = 0;
-  double max_size = 0;
-  for (const auto& piece : raw_signature.piece()) {
-    max_weight = std::max(static_cast<double>(piece.weight()), max_weight);
-    max_size = std::max(static_cast<double>(piece.bytes().size()), max_size);
+  if (plan && &plan->raw_signature() != &signature->raw_signature()) {
+    return absl::InvalidArgumentError(
+        "Trim plan was not built for this signature");
   }
-
-  std::vector<MPVariable*> vars(piece_indices->size());
-  const double log_max_weight = log(max_weight);
-  for (int i = 0; i < vars.size(); ++i) {
-    const auto& piece = raw_signature.piece((*piece_indices)[i]);
-    auto& var = vars[i];
-    var = solver.MakeBoolVar(/*name=*/"");
-    double weight = piece.weight();
-    if (weight > 0) {
-      // Log scale the weight and map into a (0, 100] range. The "+ 1" ensures
-      // that we never end up with zero weights. The log scale is useful since
-      // we're ultimately dealing with function frequencies.
-      const double scaled_log_weight =
-          (1 + log(weight)) / (1 + log_max_weight) * 100;
-      // Scale the piece length into (0, 100] range. Since the pieces are not
-      // allowed to be empty, we cannot end up with a zero size.
-      const double scaled_size = piece.bytes().size() / max_size * 100;
-      // Set the weight used for solving the implicit Knapsack problem. By
-      // scaling down the per-piece weight and multiplying with the scaled
-      // per-piece length, we prefer including longer pieces in the final
-      // signature.
-      weight = scaled_log_weight * scaled_size;
-    }
-    solver.MutableObjective()->SetCoefficient(var, weight);
-    contraint->SetCoefficient(var, piece.bytes().size());
-  }
-  const auto solver_result = solver.Solve();
-  if (solver_result != MPSolver::OPTIMAL) {
-    return absl::InternalError(
-        absl::StrCat("Solver failed with code: ", solver_result));
+  std::optional<TrimPlan> local_plan;
+  if (!plan) {
+    plan = &local_plan.emplace(signature->raw_signature());
   }
-  RawSignature result;
-  for (int i = 0; i < vars.size(); ++i) {
-    if (vars[i]->solution_value() == 0.0) {
-      (*piece_indices)[i] = -1;
-    }
+  if (GetGlobalTracer() == nullptr) {
+    return DoFormat(signature, *plan);
   }
-  piece_indices->erase(
-      std::remove_if(piece_indices->begin(), piece_indices->end(),
-                     [](int i) { return i < 0; }),
-      piece_indices->end());
-#endif
-  return absl::OkStatus();
-}
-
-void TrimLast(const int64_t max_length, const RawSignature& raw_sig,
-              std::vector<int>* piece_indices) {
-  int current_length = 0;
-  int j = 0;
-  for (; j < piece_indices->size(); ++j) {
-    const int i = (*piece_indices)[j];
-    int64_t new_length = current_length + raw_sig.piece(i).bytes().size();
-    if (new_length > max_length) {
-      break;
-    }
-    current_length = new_length;
-  }
-  piece_indices->resize(j);
+  TraceSpan span("Format");
+  absl::Status status = DoFormat(signature, *plan);
+  // Count the output of this formatter, not the one of other formats that
+  // the signature may already contain.
+  const int64_t bytes_emitted =
+      status.ok() ? GetOutput(*signature).size() : 0;
+  span.Arg("pieces", signature->raw_signature().piece_size())
+      .Arg("bytes", bytes_emitted);
+  TraceCount("bytes_emitted", bytes_emitted);
+  return status;
 }
 
-void TrimLowWeight(const int64_t max_length, const RawSignature& raw_sig,
-                   std::vector<int>* piece_indices) {
-  std::sort(
-      piece_indices->begin(), piece_indices->end(), [&raw_sig](int a, int b) {
-        // Prefer higher weight.
-        int compare = raw_sig.piece(a).weight() - raw_sig.piece(b).weight();
-        if (compare == 0) {
-          // Prefer longer pieces.
-          compare =
-              raw_sig.piece(a).bytes().size() - raw_sig.piece(b).bytes().size();
-        }
-        return compare > 0;
-      });
-
-  std::vector<int> keep_indices;
-  int current_length = 0;
-  for (const auto& i : *piece_indices) {
-    int64_t new_length = current_length + raw_sig.piece(i).bytes().size();
-    if (new_length > max_length) {
-      // Don't give up yet, shorter pieces may follow.
-      continue;
-    }
-    keep_indices.push_back(i);
-    current_length = new_length;
-  }
-  piece_indices->swap(keep_indices);
+absl::Status SignatureFormatter::FormatDatabase(
+    const Signatures& signatures, std::string* database) const {
+  return DoFormatDatabase(signatures, ABSL_DIE_IF_NULL(database));
 }
 
-}  // namespace
-
 absl::Status GetRelevantSignatureSubset(const Signature& input,
                                         int engine_min_piece_len,
                                         RawSignature* output) {
   CHECK(output);
-  const auto& raw_sig = input.raw_signature();
-  const auto& definition = input.definition();
-
-  // Gather all signature pieces of a minimum length.
-  const int min_piece_len =
-      std::max(engine_min_piece_len, definition.min_piece_length());
   std::vector<int> piece_indices;
-  piece_indices.reserve(raw_sig.piece_size());
-  const auto algorithm = definition.trim_algorithm();
-  for (int i = 0; i < raw_sig.piece_size(); ++i) {
-    const auto& piece = raw_sig.piece(i);
-    if ((algorithm == SignatureDefinition::TRIM_WEIGHTED ||
-         algorithm == SignatureDefinition::TRIM_WEIGHTED_GREEDY) &&
-        piece.weight() == 0) {
-      continue;
-    }
-    if (piece.bytes().size() >= min_piece_len) {
-      piece_indices.push_back(i);
-    }
+  NA_RETURN_IF_ERROR(GetRelevantSignatureSubsetIndices(
+      input.definition(), input.raw_signature(), engine_min_piece_len,
+      &piece_indices));
+  const auto& raw_sig = input.raw_signature();
+  for (const auto& i : piece_indices) {
+    *output->add_piece() = raw_sig.piece(i);
   }
+  return absl::OkStatus();
+}
 
-  int max_length = definition.trim_length();
-  if (max_length < 0 &&
-      definition.trim_algorithm() != SignatureDefinition::TRIM_NONE) {
-    return absl::InvalidArgumentError("Unbounded signature trimming requested");
-  }
-  switch (definition.trim_algorithm()) {
-    case SignatureDefinition::TRIM_NONE:
-      break;
-    case SignatureDefinition::TRIM_LAST:
-      TrimLast(max_length, raw_sig, &piece_indices);
-      break;
-    case SignatureDefinition::TRIM_FIRST:
-      std::reverse(piece_indices.begin(), piece_indices.end());
-      TrimLast(max_length, raw_sig, &piece_indices);
-      break;
-    case SignatureDefinition::TRIM_RANDOM: {
-      // Mix the signature variant into the PRNG's seed.
-      std::string seed = absl::StrCat(
-          definition.variant() ^ 0x1599C98B /* Random number to mask 0 */,
-          "369ea79bcded92881284" /* Random bytes */);
-      std::mt19937 random(
-          absl::hash_internal::CityHash64(seed.c_str(), seed.size()));
-      std::shuffle(piece_indices.begin(), piece_indices.end(), random);
-      TrimLast(max_length, raw_sig, &piece_indices);
-      break;
-    }
-    case SignatureDefinition::TRIM_WEIGHTED:
-      NA_RETURN_IF_ERROR(SolveKnapsack(max_length, raw_sig, &piece_indices));
-      break;
-    case SignatureDefinition::TRIM_WEIGHTED_GREEDY:
-      TrimLowWeight(max_length, raw_sig, &piece_indices);
-      break;
-    default:
-      return absl::InvalidArgumentError("Unknown signature trimming algorithm");
+void AppendHex(absl::string_view bytes, std::string* output) {
+  static constexpr char kHexDigits[] = "0123456789abcdef";
+  size_t pos = output->size();
+  output->resize(pos + 2 * bytes.size());
+  for (const unsigned char byte : bytes) {
+    (*output)[pos++] = kHexDigits[byte >> 4];
+    (*output)[pos++] = kHexDigits[byte & 0xf];
   }
+}
 
-  if (piece_indices.empty()) {
-    return absl::InvalidArgumentError("No byte piece to create signature");
+void AppendPieceHex(const RawSignature::Piece& piece, int num_bytes,
+                    std::string* output) {
+  const absl::string_view bytes =
+      absl::string_view(piece.bytes()).substr(0, num_bytes);
+  const size_t start = output->size();
+  AppendHex(bytes, output);
+  const int size = bytes.size();
+  for (const int masked_nibble : piece.masked_nibble()) {
+    if (masked_nibble / 2 < size) {
+      (*output)[start + masked_nibble] = '?';
+    }
   }
+}
 
-  std::sort(piece_indices.begin(), piece_indices.end());
-  for (const auto& i : piece_indices) {
-    *output->add_piece() = raw_sig.piece(i);
-  }
-  return absl::OkStatus();
+absl::Status GetRelevantSignatureSubsetIndices(
+    const SignatureDefinition& definition, const RawSignature& raw_sig,
+    int engine_min_piece_len, std::vector<int>* indices) {
+  return TrimPlan(raw_sig).GetSubsetIndices(definition, engine_min_piece_len,
+                                            indices);
 }
 
 }  // namespace security::vxsig
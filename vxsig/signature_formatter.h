@@ -21,17 +21,35 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/strings/string_view.h"
+#include "vxsig/trim_plan.h"
 #include "vxsig/types.h"
 #include "vxsig/vxsig.pb.h"
 
 namespace security::vxsig {
 
+// Settings of a formatter, fixed when it is created.
+struct FormatterOptions {
+  // Include the unmasked hex bytes of each piece in YARA signatures.
+  bool yara_debug_masking = false;
+
+  // Include the weight of each piece in YARA signatures.
+  bool yara_debug_weights = false;
+};
+
+// Returns the options set by the --siggen_yara_debug_masking and
+// --siggen_yara_debug_weights flags.
+FormatterOptions FormatterOptionsFromFlags();
+
 // The SignatureFormatter class allows to convert raw signatures into a target
 // signature format. It follows the factory pattern to instantiate formatters
 // for specific formats.
+// Formatters do not change after creation. All methods are const and
+// thread-safe, so a single instance may format different signatures from
+// many threads concurrently.
 class SignatureFormatter {
  public:
   SignatureFormatter(const SignatureFormatter&) = delete;
@@ -41,28 +59,44 @@ class SignatureFormatter {
   virtual ~SignatureFormatter() = default;
 
   // Creates a new SignatureFormatter for the specified signature format, as
-  // defined in //security/vxclass/proto/siggen.proto.
+  // defined in //security/vxclass/proto/siggen.proto. The first overload uses
+  // the options from the flags at the time of the call.
   static std::unique_ptr<SignatureFormatter> Create(SignatureType type);
+  static std::unique_ptr<SignatureFormatter> Create(
+      SignatureType type, const FormatterOptions& options);
 
   // Formats the specified raw signature into an engine-specific signature
   // Will fill the type specific fields of "signature". Returns false on error.
   // The content of "signature" is undefined at that point.
-  absl::Status Format(Signature* signature) const;
+  // Callers that format the same signature repeatedly, for example into
+  // several formats, may pass a plan built from its raw signature to avoid
+  // rebuilding it on every call.
+  absl::Status Format(Signature* signature,
+                      const TrimPlan* plan = nullptr) const;
 
   // Like above, but combine multiple signatures into one signature database of
   // the target format.
   absl::Status FormatDatabase(const Signatures& signatures,
                               std::string* database) const;
 
+  const FormatterOptions& options() const { return options_; }
+
  protected:
   // Make constructor accessible from the deriving formatter classes.
-  SignatureFormatter() = default;
+  explicit SignatureFormatter(const FormatterOptions& options)
+      : options_(options) {}
 
  private:
   // These perform the actual formatting.
-  virtual absl::Status DoFormat(Signature* signature) const = 0;
+  virtual absl::Status DoFormat(Signature* signature,
+                                const TrimPlan& plan) const = 0;
   virtual absl::Status DoFormatDatabase(const Signatures& signatures,
                                         std::string* database) const = 0;
+
+  // Returns the field of the signature that DoFormat() fills.
+  virtual const std::string& GetOutput(const Signature& signature) const = 0;
+
+  const FormatterOptions options_;
 };
 
 // Checks the truncation strategy and fills the relevant signature subset into
@@ -71,6 +105,23 @@ absl::Status GetRelevantSignatureSubset(const Signature& input,
                                         int engine_min_piece_len,
                                         RawSignature* output);
 
+// Like GetRelevantSignatureSubset(), but returns the sorted indices of the
+// relevant pieces in the raw signature instead of copying them. The definition
+// is passed separately, so that different definitions can be applied to the
+// same raw signature without copying it.
+absl::Status GetRelevantSignatureSubsetIndices(
+    const SignatureDefinition& definition, const RawSignature& raw_sig,
+    int engine_min_piece_len, std::vector<int>* indices);
+
+// Appends the lowercase hex representation of the bytes to the output.
+void AppendHex(absl::string_view bytes, std::string* output);
+
+// Appends the hex representation of the first num_bytes bytes of the piece to
+// the output, with its masked nibbles replaced by '?'. Formatters use this to
+// write pieces without copying them.
+void AppendPieceHex(const RawSignature::Piece& piece, int num_bytes,
+                    std::string* output);
+
 }  // namespace security::vxsig
 
 #endif  // VXSIG_SIGNATURE_FORMATTER_H_
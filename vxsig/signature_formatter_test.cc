@@ -21,6 +21,8 @@
 #include "gtest/gtest.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
 #include "vxsig/signature_test_util.h"
+#include "vxsig/trace.h"
+#include "vxsig/trim_plan.h"
 #include "vxsig/vxsig.pb.h"
 
 using not_absl::IsOk;
@@ -115,6 +117,66 @@ TEST_F(SignatureFormatterTest, TrimRandom) {
   }
 }
 
+TEST_F(SignatureFormatterTest, AppendPieceHex) {
+  RawSignature::Piece piece;
+  piece.set_bytes(std::string("\x01\xab\xff\x00", 4));
+  piece.add_masked_nibble(1);
+  piece.add_masked_nibble(6);
+  std::string output = "x";
+  AppendPieceHex(piece, /*num_bytes=*/100, &output);
+  EXPECT_THAT(output, Eq("x0?abff?0"));
+  output.clear();
+  AppendPieceHex(piece, /*num_bytes=*/2, &output);
+  EXPECT_THAT(output, Eq("0?ab"));
+  output.clear();
+  AppendHex(piece.bytes(), &output);
+  EXPECT_THAT(output, Eq("01abff00"));
+}
+
+TEST_F(SignatureFormatterTest, TracesEmittedBytes) {
+  *signature_.mutable_raw_signature() =
+      *MakeRawSignature({"0000", "1111", "2222"});
+  sig_def_->set_detection_name("test");
+  Tracer tracer;
+  SetGlobalTracer(&tracer);
+  const auto yara = SignatureFormatter::Create(YARA);
+  const auto clam_av = SignatureFormatter::Create(CLAMAV);
+  ASSERT_THAT(yara->Format(&signature_), IsOk());
+  ASSERT_THAT(clam_av->Format(&signature_), IsOk());
+  // Formatting again yields the same output, which still counts.
+  ASSERT_THAT(yara->Format(&signature_), IsOk());
+  SetGlobalTracer(nullptr);
+  EXPECT_THAT(tracer.Summarize().counters["bytes_emitted"],
+              Eq(2 * signature_.yara_signature().data().size() +
+                 signature_.clam_av_signature().data().size()));
+}
+
+TEST_F(SignatureFormatterTest, FormatsWithSharedPlan) {
+  *signature_.mutable_raw_signature() =
+      *MakeRawSignature({"0000", "1111", "2222"});
+  sig_def_->set_detection_name("test");
+  sig_def_->set_trim_algorithm(SignatureDefinition::TRIM_LAST);
+  sig_def_->set_trim_length(8);
+  const auto yara = SignatureFormatter::Create(YARA);
+  const auto clam_av = SignatureFormatter::Create(CLAMAV);
+  ASSERT_THAT(yara->Format(&signature_), IsOk());
+  ASSERT_THAT(clam_av->Format(&signature_), IsOk());
+  const std::string yara_data = signature_.yara_signature().data();
+  const std::string clam_av_data = signature_.clam_av_signature().data();
+
+  const TrimPlan plan(signature_.raw_signature());
+  ASSERT_THAT(yara->Format(&signature_, &plan), IsOk());
+  ASSERT_THAT(clam_av->Format(&signature_, &plan), IsOk());
+  EXPECT_THAT(signature_.yara_signature().data(), Eq(yara_data));
+  EXPECT_THAT(signature_.clam_av_signature().data(), Eq(clam_av_data));
+
+  // Plans of other raw signatures are rejected.
+  const Signature other = signature_;
+  const TrimPlan other_plan(other.raw_signature());
+  EXPECT_THAT(yara->Format(&signature_, &other_plan).code(),
+              Eq(absl::StatusCode::kInvalidArgument));
+}
+
 TEST_F(SignatureFormatterTest, DISABLED_TrimWeighted) {
   auto& raw_signature = *signature_.mutable_raw_signature();
   raw_signature =
@@ -0,0 +1,382 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/signature_parser.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/corpus.h"
+
+namespace security::vxsig {
+namespace {
+
+// Incrementally builds the pieces of a raw signature.
+class PieceBuilder {
+ public:
+  explicit PieceBuilder(RawSignature* raw) : raw_(raw) {}
+
+  // Adds a byte given by two hex digits, each of which may be '?'.
+  absl::Status AddHexByte(char high, char low) {
+    int value = 0;
+    for (int i = 0; i < 2; ++i) {
+      const char digit = i == 0 ? high : low;
+      value <<= 4;
+      if (digit == '?') {
+        masked_nibbles_.push_back(bytes_.size() * 2 + i);
+      } else if (absl::ascii_isxdigit(digit)) {
+        value |= HexDigitValue(digit);
+      } else {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Invalid hex digit: '", std::string(1, digit), "'"));
+      }
+    }
+    bytes_.push_back(static_cast<char>(value));
+    return absl::OkStatus();
+  }
+
+  // Ends the current piece, if any, followed by a wildcard. A negative
+  // max_qualifier means unbounded.
+  void AddJump(int64_t min_qualifier, int64_t max_qualifier) {
+    auto* piece = FinishPiece();
+    if (piece != nullptr) {
+      piece->set_min_qualifier(min_qualifier);
+      piece->set_max_qualifier(max_qualifier);
+    }
+  }
+
+  RawSignature::Piece* FinishPiece() {
+    if (bytes_.empty()) {
+      return nullptr;
+    }
+    auto* piece = raw_->add_piece();
+    piece->set_bytes(bytes_);
+    for (int nibble : masked_nibbles_) {
+      piece->add_masked_nibble(nibble);
+    }
+    bytes_.clear();
+    masked_nibbles_.clear();
+    return piece;
+  }
+
+ private:
+  static int HexDigitValue(char digit) {
+    return absl::ascii_isdigit(digit) ? digit - '0'
+                                      : absl::ascii_tolower(digit) - 'a' + 10;
+  }
+
+  RawSignature* raw_;
+  std::string bytes_;
+  std::vector<int> masked_nibbles_;
+};
+
+// Parses a jump range of the form "n", "n-m", "-m", "n-" or "-". Unspecified
+// bounds default to zero and unbounded, respectively.
+absl::Status ParseJumpRange(absl::string_view range, int64_t* min_qualifier,
+                            int64_t* max_qualifier) {
+  range = absl::StripAsciiWhitespace(range);
+  *min_qualifier = 0;
+  *max_qualifier = -1;
+  std::vector<absl::string_view> bounds = absl::StrSplit(range, '-');
+  if (bounds.size() > 2) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid jump: ", range));
+  }
+  const auto lower = absl::StripAsciiWhitespace(bounds[0]);
+  if (!lower.empty() && !absl::SimpleAtoi(lower, min_qualifier)) {
+    return absl::InvalidArgumentError(absl::StrCat("Invalid jump: ", range));
+  }
+  if (bounds.size() == 1) {
+    // Fixed size jump.
+    *max_qualifier = *min_qualifier;
+    return absl::OkStatus();
+  }
+  const auto upper = absl::StripAsciiWhitespace(bounds[1]);
+  if (!upper.empty() && !absl::SimpleAtoi(upper, max_qualifier)) {
+    return absl::InvalidArgumentError(absl::StrCat("Invalid jump: ", range));
+  }
+  return absl::OkStatus();
+}
+
+// Parses the contents of a Yara hex string (without the enclosing braces).
+absl::Status ParseYaraHexString(absl::string_view hex, PieceBuilder* builder) {
+  for (size_t i = 0; i < hex.size();) {
+    const char c = hex[i];
+    if (absl::ascii_isspace(c)) {
+      ++i;
+    } else if (c == '[') {
+      const size_t end = hex.find(']', i);
+      if (end == absl::string_view::npos) {
+        return absl::InvalidArgumentError("Unterminated jump in hex string");
+      }
+      int64_t min_qualifier;
+      int64_t max_qualifier;
+      NA_RETURN_IF_ERROR(ParseJumpRange(hex.substr(i + 1, end - i - 1),
+                                        &min_qualifier, &max_qualifier));
+      builder->AddJump(min_qualifier, max_qualifier);
+      i = end + 1;
+    } else if (c == '(' || c == '|' || c == '~') {
+      return absl::UnimplementedError(
+          "Alternatives and negations in hex strings are not supported");
+    } else {
+      if (i + 1 >= hex.size()) {
+        return absl::InvalidArgumentError("Odd number of hex digits");
+      }
+      NA_RETURN_IF_ERROR(builder->AddHexByte(c, hex[i + 1]));
+      i += 2;
+    }
+  }
+  builder->FinishPiece();
+  return absl::OkStatus();
+}
+
+// Removes C and C++ style comments, leaving quoted strings intact.
+std::string StripComments(absl::string_view data) {
+  std::string result;
+  result.reserve(data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    const char c = data[i];
+    if (c == '"') {
+      // Copy quoted string, including escapes.
+      result.push_back(c);
+      for (++i; i < data.size() && data[i] != '"'; ++i) {
+        if (data[i] == '\\' && i + 1 < data.size()) {
+          result.push_back(data[i++]);
+        }
+        result.push_back(data[i]);
+      }
+      if (i < data.size()) {
+        result.push_back('"');
+      }
+    } else if (absl::StartsWith(data.substr(i), "//")) {
+      i = data.find('\n', i);
+      if (i == absl::string_view::npos) {
+        break;
+      }
+      result.push_back('\n');
+    } else if (absl::StartsWith(data.substr(i), "/*")) {
+      i = data.find("*/", i + 2);
+      if (i == absl::string_view::npos) {
+        break;
+      }
+      ++i;
+      result.push_back(' ');
+    } else {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+
+bool IsIdentifierChar(char c) { return absl::ascii_isalnum(c) || c == '_'; }
+
+// Parses the strings section of a Yara rule body.
+absl::Status ParseYaraStrings(absl::string_view strings, RawSignature* raw) {
+  PieceBuilder builder(raw);
+  for (size_t i = strings.find('$'); i != absl::string_view::npos;
+       i = strings.find('$', i)) {
+    const size_t equals = strings.find('=', i);
+    if (equals == absl::string_view::npos) {
+      return absl::InvalidArgumentError("Expected '=' after string name");
+    }
+    size_t value = equals + 1;
+    while (value < strings.size() && absl::ascii_isspace(strings[value])) {
+      ++value;
+    }
+    if (value >= strings.size() || strings[value] != '{') {
+      return absl::UnimplementedError(
+          "Only hex strings are supported in Yara rules");
+    }
+    const size_t end = strings.find('}', value);
+    if (end == absl::string_view::npos) {
+      return absl::InvalidArgumentError("Unterminated hex string");
+    }
+    NA_RETURN_IF_ERROR(ParseYaraHexString(
+        strings.substr(value + 1, end - value - 1), &builder));
+    i = end + 1;
+  }
+  return absl::OkStatus();
+}
+
+// Finds the matching closing brace for the opening brace at position start,
+// skipping quoted strings.
+size_t FindClosingBrace(absl::string_view data, size_t start) {
+  int depth = 0;
+  for (size_t i = start; i < data.size(); ++i) {
+    switch (data[i]) {
+      case '"':
+        for (++i; i < data.size() && data[i] != '"'; ++i) {
+          if (data[i] == '\\') {
+            ++i;
+          }
+        }
+        break;
+      case '{':
+        ++depth;
+        break;
+      case '}':
+        if (--depth == 0) {
+          return i;
+        }
+        break;
+    }
+  }
+  return absl::string_view::npos;
+}
+
+void InitParsedSignature(absl::string_view name, Signature* signature) {
+  auto* definition = signature->mutable_definition();
+  definition->set_detection_name(std::string(name));
+  // Formatted signatures have been trimmed already, keep all of their pieces.
+  definition->set_trim_algorithm(SignatureDefinition::TRIM_NONE);
+  definition->set_min_piece_length(1);
+}
+
+}  // namespace
+
+absl::StatusOr<Signatures> ParseYaraSignatures(absl::string_view data) {
+  const std::string stripped = StripComments(data);
+  const absl::string_view text(stripped);
+  Signatures signatures;
+  size_t pos = 0;
+  while (true) {
+    pos = text.find("rule", pos);
+    if (pos == absl::string_view::npos) {
+      break;
+    }
+    // Make sure we have the keyword and not just part of an identifier.
+    const bool keyword =
+        (pos == 0 || !IsIdentifierChar(text[pos - 1])) &&
+        pos + 4 < text.size() && absl::ascii_isspace(text[pos + 4]);
+    if (!keyword) {
+      pos += 4;
+      continue;
+    }
+    size_t name_start = pos + 4;
+    while (name_start < text.size() && absl::ascii_isspace(text[name_start])) {
+      ++name_start;
+    }
+    size_t name_end = name_start;
+    while (name_end < text.size() && IsIdentifierChar(text[name_end])) {
+      ++name_end;
+    }
+    const size_t body_start = text.find('{', name_end);
+    const size_t body_end = body_start != absl::string_view::npos
+                                ? FindClosingBrace(text, body_start)
+                                : absl::string_view::npos;
+    if (name_end == name_start || body_end == absl::string_view::npos) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Malformed Yara rule at offset ", pos));
+    }
+    const absl::string_view body =
+        text.substr(body_start + 1, body_end - body_start - 1);
+    const absl::string_view name =
+        text.substr(name_start, name_end - name_start);
+
+    size_t strings_start = body.find("strings:");
+    if (strings_start == absl::string_view::npos) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Rule ", name, " has no strings section"));
+    }
+    strings_start += strlen("strings:");
+    const size_t strings_end = body.find("condition:", strings_start);
+    const absl::string_view strings =
+        body.substr(strings_start, strings_end - strings_start);
+    auto* signature = signatures.add_signature();
+    InitParsedSignature(name, signature);
+    NA_RETURN_IF_ERROR(
+        ParseYaraStrings(strings, signature->mutable_raw_signature()));
+    pos = body_end + 1;
+  }
+  return signatures;
+}
+
+absl::StatusOr<Signatures> ParseClamAvSignatures(absl::string_view data) {
+  Signatures signatures;
+  for (absl::string_view line : absl::StrSplit(data, '\n', absl::SkipEmpty())) {
+    line = absl::StripAsciiWhitespace(line);
+    if (line.empty() || absl::StartsWith(line, "#")) {
+      continue;
+    }
+    // Name:TargetType:Offset:HexSignature[:MinFL[:MaxFL]]
+    std::vector<absl::string_view> fields = absl::StrSplit(line, ':');
+    if (fields.size() < 4) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Malformed ClamAV signature: ", line));
+    }
+    auto* signature = signatures.add_signature();
+    InitParsedSignature(fields[0], signature);
+    PieceBuilder builder(signature->mutable_raw_signature());
+    const absl::string_view hex = fields[3];
+    for (size_t i = 0; i < hex.size();) {
+      const char c = hex[i];
+      if (c == '*') {
+        builder.AddJump(0, -1);
+        ++i;
+      } else if (c == '{') {
+        const size_t end = hex.find('}', i);
+        if (end == absl::string_view::npos) {
+          return absl::InvalidArgumentError(
+              absl::StrCat("Unterminated jump: ", line));
+        }
+        int64_t min_qualifier;
+        int64_t max_qualifier;
+        NA_RETURN_IF_ERROR(ParseJumpRange(hex.substr(i + 1, end - i - 1),
+                                          &min_qualifier, &max_qualifier));
+        builder.AddJump(min_qualifier, max_qualifier);
+        i = end + 1;
+      } else if (c == '(' || c == '!' || c == '[') {
+        return absl::UnimplementedError(absl::StrCat(
+            "Alternatives and anchored bytes are not supported: ", line));
+      } else {
+        if (i + 1 >= hex.size()) {
+          return absl::InvalidArgumentError(
+              absl::StrCat("Odd number of hex digits: ", line));
+        }
+        NA_RETURN_IF_ERROR(builder.AddHexByte(c, hex[i + 1]));
+        i += 2;
+      }
+    }
+    builder.FinishPiece();
+  }
+  return signatures;
+}
+
+absl::StatusOr<Signatures> ReadSignaturesFromFile(absl::string_view filename) {
+  NA_ASSIGN_OR_RETURN(std::string data, ReadFileContents(filename));
+  if (absl::EndsWith(filename, ".yar") || absl::EndsWith(filename, ".yara")) {
+    return ParseYaraSignatures(data);
+  }
+  if (absl::EndsWith(filename, ".ndb")) {
+    return ParseClamAvSignatures(data);
+  }
+  Signatures signatures;
+  if (!signatures.ParseFromString(data)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Failed to parse signatures from ", filename));
+  }
+  return signatures;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,44 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Functions to convert formatted signatures back into raw signatures. Only the
+// subset of the Yara and ClamAV syntax that is produced by the signature
+// formatters in this directory is supported: hex strings consisting of plain
+// bytes, masked nibbles and unbounded or bounded jumps.
+
+#ifndef VXSIG_SIGNATURE_PARSER_H_
+#define VXSIG_SIGNATURE_PARSER_H_
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+// Parses a Yara rule file. Each rule results in one signature. If a rule
+// contains more than one hex string, the pieces of all of them are combined
+// in order of appearance. Text strings and regular expressions are rejected.
+absl::StatusOr<Signatures> ParseYaraSignatures(absl::string_view data);
+
+// Parses a ClamAV extended signature database (.ndb), one signature per line.
+absl::StatusOr<Signatures> ParseClamAvSignatures(absl::string_view data);
+
+// Parses signatures based on the extension of the specified file: ".yar" and
+// ".yara" for Yara rules, ".ndb" for ClamAV databases. All other files are
+// expected to contain a binary Signatures message.
+absl::StatusOr<Signatures> ReadSignaturesFromFile(absl::string_view filename);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_SIGNATURE_PARSER_H_
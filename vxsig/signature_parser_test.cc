@@ -0,0 +1,123 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/signature_parser.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/signature_test_util.h"
+
+using not_absl::IsOk;
+using not_absl::StatusIs;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsTrue;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+TEST(SignatureParserTest, RoundTripYara) {
+  Signature signature;
+  auto* definition = signature.mutable_definition();
+  definition->set_detection_name("round_trip");
+  definition->set_min_piece_length(1);
+  auto* raw = signature.mutable_raw_signature();
+  AddSignaturePieces({"\x8b\xec\x83", "\x55\x56"}, raw);
+  raw->mutable_piece(0)->add_masked_nibble(3);  // Low nibble of second byte
+
+  auto formatter = SignatureFormatter::Create(SignatureType::YARA);
+  ASSERT_THAT(formatter->Format(&signature), IsOk());
+
+  auto parsed = ParseYaraSignatures(signature.yara_signature().data());
+  ASSERT_THAT(parsed, IsOk());
+  ASSERT_THAT(parsed->signature(), SizeIs(1));
+  const auto& result = parsed->signature(0);
+  EXPECT_THAT(result.definition().detection_name(), Eq("round_trip"));
+  ASSERT_THAT(result.raw_signature().piece(), SizeIs(2));
+  // Masked nibbles are zeroed by the formatter.
+  EXPECT_THAT(result.raw_signature().piece(0).bytes(), Eq("\x8b\xe0\x83"));
+  EXPECT_THAT(result.raw_signature().piece(0).masked_nibble(),
+              ElementsAre(3));
+  EXPECT_THAT(result.raw_signature().piece(1).bytes(), Eq("\x55\x56"));
+}
+
+TEST(SignatureParserTest, YaraCommentsAndJumps) {
+  auto parsed = ParseYaraSignatures(
+      "// rule commented { strings: $ = { 00 } condition: all of them }\n"
+      "rule a {\n"
+      "  strings:\n"
+      "    $ = { 41 42 [2-4] 43 ?4 [-] 45 } /* rule b { } */\n"
+      "  condition:\n"
+      "    all of them\n"
+      "}\n");
+  ASSERT_THAT(parsed, IsOk());
+  ASSERT_THAT(parsed->signature(), SizeIs(1));
+  const auto& raw = parsed->signature(0).raw_signature();
+  ASSERT_THAT(raw.piece(), SizeIs(3));
+  EXPECT_THAT(raw.piece(0).bytes(), Eq("AB"));
+  EXPECT_THAT(raw.piece(0).min_qualifier(), Eq(2));
+  EXPECT_THAT(raw.piece(0).max_qualifier(), Eq(4));
+  EXPECT_THAT(raw.piece(1).bytes(), Eq("\x43\x04"));
+  EXPECT_THAT(raw.piece(1).masked_nibble(), ElementsAre(2));
+  EXPECT_THAT(raw.piece(1).max_qualifier(), Eq(-1));
+  EXPECT_THAT(raw.piece(2).bytes(), Eq("E"));
+}
+
+TEST(SignatureParserTest, YaraRejectsAlternatives) {
+  EXPECT_THAT(ParseYaraSignatures(
+                  "rule a { strings: $ = { 41 ( 42 | 43 ) } condition: all "
+                  "of them }")
+                  .status(),
+              StatusIs(absl::StatusCode::kUnimplemented));
+}
+
+TEST(SignatureParserTest, ClamAv) {
+  auto parsed = ParseClamAvSignatures(
+      "# Comment\n"
+      "first:0:*:4142*4344\n"
+      "second:1:*:41??42{1-3}43\n");
+  ASSERT_THAT(parsed, IsOk());
+  ASSERT_THAT(parsed->signature(), SizeIs(2));
+
+  const auto& first = parsed->signature(0);
+  EXPECT_THAT(first.definition().detection_name(), Eq("first"));
+  EXPECT_THAT(EquivRawSignature(first.raw_signature(),
+                                *MakeRawSignature({"AB", "CD"})),
+              IsTrue());
+
+  const auto& second = parsed->signature(1).raw_signature();
+  ASSERT_THAT(second.piece(), SizeIs(2));
+  EXPECT_THAT(second.piece(0).bytes(), Eq(std::string("A\0B", 3)));
+  EXPECT_THAT(second.piece(0).masked_nibble(), ElementsAre(2, 3));
+  EXPECT_THAT(second.piece(0).min_qualifier(), Eq(1));
+  EXPECT_THAT(second.piece(0).max_qualifier(), Eq(3));
+  EXPECT_THAT(second.piece(1).bytes(), Eq("C"));
+}
+
+TEST(SignatureParserTest, ClamAvMalformed) {
+  EXPECT_THAT(ParseClamAvSignatures("name:0:*").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(ParseClamAvSignatures("name:0:*:414").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,285 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/spool.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/internal/city.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/corpus.h"
+
+namespace security::vxsig {
+namespace {
+
+// Seed for the hash of the inline files. Changing it invalidates the
+// subdirectories of earlier runs.
+constexpr uint64_t kSpoolSeed = 0x9e3779b97f4a7c15;
+
+// Number of names to try if subdirectories in use have the same hash.
+constexpr int kMaxNameAttempts = 16;
+
+constexpr char kTempInfix[] = ".tmp.";
+
+uint64_t HashInlineFiles(const DaemonRequest& request) {
+  uint64_t hash = kSpoolSeed;
+  for (const auto& file : request.inline_file()) {
+    hash = absl::hash_internal::CityHash64WithSeed(
+        file.name().data(), file.name().size(), hash);
+    hash = absl::hash_internal::CityHash64WithSeed(file.data().data(),
+                                                   file.data().size(), hash);
+  }
+  return hash;
+}
+
+// Returns whether the directory contains the inline files of the request.
+bool ContainsInlineFiles(const std::string& directory,
+                         const DaemonRequest& request) {
+  for (const auto& file : request.inline_file()) {
+    const std::string filename = JoinPath(directory, file.name());
+    auto size = GetFileSize(filename);
+    if (!size.ok() || *size != static_cast<int64_t>(file.data().size())) {
+      return false;
+    }
+    auto data = ReadFileContents(filename);
+    if (!data.ok() || *data != file.data()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Writes the inline files of a request to a directory, replacing its
+// contents. Writes to a temporary directory first, so that a failed request
+// or a crash does not leave incomplete files behind.
+absl::Status WriteInlineFiles(const std::string& directory,
+                              const DaemonRequest& request) {
+  if (IsDirectory(directory)) {
+    NA_RETURN_IF_ERROR(RemoveAll(directory));
+  }
+  const std::string temp_directory =
+      absl::StrCat(directory, kTempInfix, getpid());
+  RemoveAll(temp_directory).IgnoreError();
+  NA_RETURN_IF_ERROR(CreateDirectories(temp_directory));
+  for (const auto& file : request.inline_file()) {
+    const std::string filename = JoinPath(temp_directory, file.name());
+    std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+    output.write(file.data().data(), file.data().size());
+    if (!output) {
+      RemoveAll(temp_directory).IgnoreError();
+      return absl::UnknownError(absl::StrCat("Failed to write ", filename));
+    }
+  }
+  if (rename(temp_directory.c_str(), directory.c_str()) != 0) {
+    absl::Status status = absl::UnavailableError(
+        absl::StrCat("rename() failed: ", strerror(errno)));
+    RemoveAll(temp_directory).IgnoreError();
+    return status;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+Spool::Files::~Files() {
+  if (spool_) {
+    spool_->Release(name_);
+  }
+}
+
+absl::StatusOr<std::unique_ptr<Spool>> Spool::Open(
+    const SpoolOptions& options) {
+  if (options.directory.empty()) {
+    return absl::InvalidArgumentError("Spool directory must not be empty");
+  }
+  auto spool = absl::WrapUnique(new Spool(options));
+  NA_RETURN_IF_ERROR(CreateDirectories(options.directory));
+  std::vector<std::string> names;
+  NA_RETURN_IF_ERROR(GetDirectoryEntries(options.directory, &names));
+  absl::MutexLock lock(&spool->mutex_);
+  for (auto& name : names) {
+    const std::string path = JoinPath(options.directory, name);
+    if (!IsDirectory(path)) {
+      continue;
+    }
+    if (absl::StrContains(name, kTempInfix)) {
+      // Left by a crashed run.
+      RemoveAll(path).IgnoreError();
+      continue;
+    }
+    std::vector<std::string> files;
+    NA_RETURN_IF_ERROR(GetDirectoryEntries(path, &files));
+    int64_t bytes = 0;
+    for (const auto& file : files) {
+      NA_ASSIGN_OR_RETURN(int64_t size, GetFileSize(JoinPath(path, file)));
+      bytes += size;
+    }
+    spool->unused_.push_back(name);
+    Entry& entry = spool->entries_[std::move(name)];
+    entry.bytes = bytes;
+    entry.unused = std::prev(spool->unused_.end());
+    spool->unused_bytes_ += bytes;
+  }
+  spool->EvictUnused();
+  return spool;
+}
+
+absl::StatusOr<std::unique_ptr<Spool::Files>> Spool::Add(
+    const DaemonRequest& request) {
+  if (request.inline_file().empty()) {
+    return absl::WrapUnique(new Files(nullptr, "", request.job()));
+  }
+
+  absl::flat_hash_set<std::string> names;
+  int64_t bytes = 0;
+  for (const auto& file : request.inline_file()) {
+    const std::string& name = file.name();
+    if (name.empty() || name == "." || name == ".." ||
+        name.find('/') != std::string::npos || !names.insert(name).second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid inline file name: \"", name, "\""));
+    }
+    bytes += file.data().size();
+  }
+  BatchManifest::Job job = request.job();
+  for (const auto& diff : job.diff()) {
+    if (!names.contains(diff)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Diff is not an inline file: ", diff));
+    }
+  }
+
+  const std::string hash =
+      absl::StrFormat("%016x", HashInlineFiles(request));
+  absl::MutexLock lock(&mutex_);
+  for (int attempt = 0; attempt < kMaxNameAttempts; ++attempt) {
+    std::string name =
+        attempt == 0 ? hash : absl::StrCat(hash, "-", attempt);
+    const std::string directory = JoinPath(options_.directory, name);
+    struct IdleCondition {
+      bool Eval() const { return spool->IsIdle(*name); }
+      const Spool* spool;
+      const std::string* name;
+    } idle{this, &name};
+    mutex_.Await(absl::Condition(&idle, &IdleCondition::Eval));
+
+    // The entry is reserved while its files are written or compared. Its user
+    // keeps it from being evicted meanwhile.
+    auto found = entries_.find(name);
+    const bool is_new = found == entries_.end();
+    Entry& entry = entries_[name];
+    entry.busy = true;
+    if (is_new) {
+      entry.users = 1;
+      entry.bytes = bytes;
+    } else {
+      AddUser(&entry);
+    }
+    mutex_.Unlock();
+    // The hash only selects the subdirectory, its contents may differ. New
+    // entries replace directories not created by this spool.
+    bool write = is_new || !ContainsInlineFiles(directory, request);
+    mutex_.Lock();
+    if (write && !is_new && entries_[name].users > 1) {
+      // Used by other jobs with different files.
+      entries_[name].busy = false;
+      ReleaseLocked(name);
+      continue;
+    }
+    absl::Status status;
+    if (write) {
+      entries_[name].bytes = bytes;
+      mutex_.Unlock();
+      status = WriteInlineFiles(directory, request);
+      mutex_.Lock();
+    }
+    entries_[name].busy = false;
+    if (!status.ok()) {
+      // No other job uses the entry.
+      entries_.erase(name);
+      return status;
+    }
+    for (auto& diff : *job.mutable_diff()) {
+      diff = JoinPath(directory, diff);
+    }
+    return absl::WrapUnique(new Files(this, std::move(name), std::move(job)));
+  }
+  return absl::ResourceExhaustedError(
+      "Too many spooled requests with the same hash");
+}
+
+bool Spool::IsIdle(const std::string& name) const {
+  auto found = entries_.find(name);
+  return found == entries_.end() || !found->second.busy;
+}
+
+void Spool::AddUser(Entry* entry) {
+  if (entry->users++ == 0) {
+    unused_.erase(entry->unused);
+    unused_bytes_ -= entry->bytes;
+  }
+}
+
+int64_t Spool::unused_bytes() const {
+  absl::MutexLock lock(&mutex_);
+  return unused_bytes_;
+}
+
+void Spool::Release(const std::string& name) {
+  absl::MutexLock lock(&mutex_);
+  ReleaseLocked(name);
+}
+
+void Spool::ReleaseLocked(const std::string& name) {
+  Entry& entry = entries_[name];
+  if (--entry.users > 0) {
+    return;
+  }
+  unused_.push_front(name);
+  entry.unused = unused_.begin();
+  unused_bytes_ += entry.bytes;
+  EvictUnused();
+}
+
+void Spool::RemoveUnused(const std::string& name) {
+  // The name may refer to the list entry that is erased below.
+  const std::string directory = JoinPath(options_.directory, name);
+  auto found = entries_.find(name);
+  unused_.erase(found->second.unused);
+  unused_bytes_ -= found->second.bytes;
+  entries_.erase(found);
+  RemoveAll(directory).IgnoreError();
+}
+
+void Spool::EvictUnused() {
+  while (unused_bytes_ > options_.max_unused_bytes && !unused_.empty()) {
+    RemoveUnused(unused_.back());
+  }
+}
+
+}  // namespace security::vxsig
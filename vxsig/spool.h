@@ -0,0 +1,145 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The readers for BinDiff and BinExport files work on files, so inputs that
+// callers pass in memory are written to a spool directory first.
+// Use like this:
+//   NA_ASSIGN_OR_RETURN(auto spool, Spool::Open(options));
+//   NA_ASSIGN_OR_RETURN(auto files, spool->Add(request));
+//   ... run files->job() ...
+//   files.reset();  // The files may now be removed.
+
+#ifndef VXSIG_SPOOL_H_
+#define VXSIG_SPOOL_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+struct SpoolOptions {
+  // Directory for the spooled files. Created if it does not exist.
+  std::string directory;
+
+  // Size limit for spooled files that no job uses. These are kept so that
+  // repeated requests are served from the input cache. Least recently used
+  // files are removed first.
+  int64_t max_unused_bytes = 256 << 20;
+};
+
+// This class is thread-safe. Identical inline files end up in the same
+// subdirectory, whose name is derived from their contents, so that files left
+// by an earlier run are reused. Files are written and compared without
+// holding the lock of the spool, so requests with different inline files do
+// not wait for each other. Only one process may use a spool directory at a
+// time.
+class Spool {
+ public:
+  // The inline files of a request in the spool. They are kept until this
+  // object is destroyed, which must happen before the spool is destroyed.
+  class Files {
+   public:
+    Files(const Files&) = delete;
+    Files& operator=(const Files&) = delete;
+
+    ~Files();
+
+    // The job of the request, with its diffs pointing to the spooled files.
+    const BatchManifest::Job& job() const { return job_; }
+
+   private:
+    friend class Spool;
+
+    Files(Spool* spool, std::string name, BatchManifest::Job job)
+        : spool_(spool), name_(std::move(name)), job_(std::move(job)) {}
+
+    Spool* spool_;  // Not owned, nullptr if the request had no inline files.
+    std::string name_;
+    BatchManifest::Job job_;
+  };
+
+  Spool(const Spool&) = delete;
+  Spool& operator=(const Spool&) = delete;
+
+  // Opens a spool with the specified options. Subdirectories left by earlier
+  // runs count as unused files.
+  static absl::StatusOr<std::unique_ptr<Spool>> Open(
+      const SpoolOptions& options);
+
+  // Writes the inline files of a request to a subdirectory of the spool
+  // directory, or reuses an existing subdirectory with the same contents.
+  absl::StatusOr<std::unique_ptr<Files>> Add(const DaemonRequest& request);
+
+  const std::string& directory() const { return options_.directory; }
+
+  // Total size of the spooled files that no job uses.
+  int64_t unused_bytes() const;
+
+ private:
+  struct Entry {
+    int users = 0;
+    int64_t bytes = 0;
+    // Set while an Add() call writes or compares the subdirectory. Other calls
+    // for the same name wait until it is cleared.
+    bool busy = false;
+    // Position in unused_, only valid while there are no users.
+    std::list<std::string>::iterator unused;
+  };
+
+  explicit Spool(const SpoolOptions& options) : options_(options) {}
+
+  // Called by Files on destruction.
+  void Release(const std::string& name);
+
+  // Whether no Add() call is writing or comparing the subdirectory.
+  bool IsIdle(const std::string& name) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Adds a user to the entry, so that it is not evicted.
+  void AddUser(Entry* entry) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes a user and marks the entry as unused if it was the last one.
+  void ReleaseLocked(const std::string& name)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes a subdirectory that no job uses.
+  void RemoveUnused(const std::string& name)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes the least recently used subdirectories until the unused files are
+  // within their size limit.
+  void EvictUnused() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  const SpoolOptions options_;
+
+  mutable absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  // Subdirectories without users, most recently used first.
+  std::list<std::string> unused_ ABSL_GUARDED_BY(mutex_);
+  int64_t unused_bytes_ ABSL_GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_SPOOL_H_
@@ -0,0 +1,186 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/spool.h"
+
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/corpus.h"
+#include "vxsig/test_util.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::Ne;
+
+namespace security::vxsig {
+namespace {
+
+class SpoolTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    auto directory = CreateTestTempDirectory();
+    ASSERT_THAT(directory, IsOk());
+    options_.directory = *std::move(directory);
+  }
+
+  static DaemonRequest MakeRequest(const std::string& data) {
+    DaemonRequest request;
+    auto* file = request.add_inline_file();
+    file->set_name("a.BinDiff");
+    file->set_data(data);
+    request.mutable_job()->add_diff("a.BinDiff");
+    return request;
+  }
+
+  SpoolOptions options_;
+};
+
+TEST_F(SpoolTest, SharesIdenticalFiles) {
+  auto spool = Spool::Open(options_);
+  ASSERT_THAT(spool.status(), IsOk());
+  auto first = (*spool)->Add(MakeRequest("data"));
+  auto second = (*spool)->Add(MakeRequest("data"));
+  auto other = (*spool)->Add(MakeRequest("other"));
+  ASSERT_THAT(first.status(), IsOk());
+  ASSERT_THAT(second.status(), IsOk());
+  ASSERT_THAT(other.status(), IsOk());
+  const std::string path = (*first)->job().diff(0);
+  EXPECT_THAT((*second)->job().diff(0), Eq(path));
+  EXPECT_THAT((*other)->job().diff(0), Ne(path));
+  EXPECT_THAT(ReadFileContents(path).value(), Eq("data"));
+
+  // Files in use are kept.
+  first->reset();
+  EXPECT_THAT((*spool)->unused_bytes(), Eq(0));
+  EXPECT_TRUE(FileExists(path));
+  second->reset();
+  EXPECT_THAT((*spool)->unused_bytes(), Eq(4));
+}
+
+TEST_F(SpoolTest, EvictsUnusedFiles) {
+  options_.max_unused_bytes = 4;
+  auto spool = Spool::Open(options_);
+  ASSERT_THAT(spool.status(), IsOk());
+  auto first = (*spool)->Add(MakeRequest("1111"));
+  ASSERT_THAT(first.status(), IsOk());
+  const std::string first_path = (*first)->job().diff(0);
+  first->reset();
+  EXPECT_TRUE(FileExists(first_path));
+
+  auto second = (*spool)->Add(MakeRequest("2222"));
+  ASSERT_THAT(second.status(), IsOk());
+  const std::string second_path = (*second)->job().diff(0);
+  second->reset();
+  EXPECT_FALSE(FileExists(first_path));
+  EXPECT_TRUE(FileExists(second_path));
+  EXPECT_THAT((*spool)->unused_bytes(), Eq(4));
+}
+
+TEST_F(SpoolTest, ReusesFilesOfEarlierRuns) {
+  std::string path;
+  {
+    auto spool = Spool::Open(options_);
+    ASSERT_THAT(spool.status(), IsOk());
+    auto files = (*spool)->Add(MakeRequest("data"));
+    ASSERT_THAT(files.status(), IsOk());
+    path = (*files)->job().diff(0);
+  }
+  auto spool = Spool::Open(options_);
+  ASSERT_THAT(spool.status(), IsOk());
+  EXPECT_THAT((*spool)->unused_bytes(), Eq(4));
+  auto files = (*spool)->Add(MakeRequest("data"));
+  ASSERT_THAT(files.status(), IsOk());
+  EXPECT_THAT((*files)->job().diff(0), Eq(path));
+  EXPECT_THAT((*spool)->unused_bytes(), Eq(0));
+}
+
+TEST_F(SpoolTest, ReplacesChangedFiles) {
+  auto spool = Spool::Open(options_);
+  ASSERT_THAT(spool.status(), IsOk());
+  std::string path;
+  {
+    auto files = (*spool)->Add(MakeRequest("data"));
+    ASSERT_THAT(files.status(), IsOk());
+    path = (*files)->job().diff(0);
+  }
+  ASSERT_THAT(WriteFileContentsAtomically(path, "changed"), IsOk());
+  {
+    auto files = (*spool)->Add(MakeRequest("data"));
+    ASSERT_THAT(files.status(), IsOk());
+    EXPECT_THAT((*files)->job().diff(0), Eq(path));
+    EXPECT_THAT(ReadFileContents(path).value(), Eq("data"));
+
+    // Files in use are not replaced, the request uses another name instead.
+    ASSERT_THAT(WriteFileContentsAtomically(path, "changed"), IsOk());
+    auto other = (*spool)->Add(MakeRequest("data"));
+    ASSERT_THAT(other.status(), IsOk());
+    EXPECT_THAT((*other)->job().diff(0), Ne(path));
+    EXPECT_THAT(ReadFileContents((*other)->job().diff(0)).value(),
+                Eq("data"));
+  }
+}
+
+TEST_F(SpoolTest, ConcurrentRequests) {
+  auto spool = Spool::Open(options_);
+  ASSERT_THAT(spool.status(), IsOk());
+  constexpr int kNumThreads = 8;
+  std::vector<absl::StatusOr<std::unique_ptr<Spool::Files>>> files(
+      kNumThreads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&spool, &files, i]() {
+      // Pairs of threads send the same files.
+      files[i] = (*spool)->Add(MakeRequest(std::string(1 << 20, 'a' + i / 2)));
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    ASSERT_THAT(files[i].status(), IsOk());
+    const std::string& path = (*files[i])->job().diff(0);
+    EXPECT_THAT(ReadFileContents(path).value(),
+                Eq(std::string(1 << 20, 'a' + i / 2)));
+  }
+  for (int i = 0; i < kNumThreads; i += 2) {
+    const std::string& path = (*files[i])->job().diff(0);
+    EXPECT_THAT((*files[i + 1])->job().diff(0), Eq(path));
+    EXPECT_THAT((*files[(i + 2) % kNumThreads])->job().diff(0), Ne(path));
+  }
+  files.clear();
+  EXPECT_THAT((*spool)->unused_bytes(), Eq(kNumThreads / 2 << 20));
+}
+
+TEST_F(SpoolTest, RejectsInvalidNames) {
+  auto spool = Spool::Open(options_);
+  ASSERT_THAT(spool.status(), IsOk());
+  DaemonRequest request = MakeRequest("data");
+  request.mutable_inline_file(0)->set_name("../a.BinDiff");
+  EXPECT_FALSE((*spool)->Add(request).ok());
+
+  request = MakeRequest("data");
+  request.mutable_job()->set_diff(0, "b.BinDiff");
+  EXPECT_FALSE((*spool)->Add(request).ok());
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,462 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/synthetic.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "absl/base/internal/endian.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "third_party/zynamics/binexport/binexport2.pb.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+#include "vxsig/bindiff_writer.h"
+#include "vxsig/diff_result_reader.h"
+
+namespace security::vxsig {
+namespace {
+
+// The instructions that samples are made of. Immediates are 32-bit and
+// stored little endian at the end of the instruction, like on x86.
+struct InstructionTemplate {
+  const char* mnemonic;
+  int num_registers;
+  bool immediate;
+  int size;
+};
+
+constexpr InstructionTemplate kTemplates[] = {
+    {"nop", 0, false, 1},  {"ret", 0, false, 1},  {"push", 1, false, 1},
+    {"pop", 1, false, 1},  {"inc", 1, false, 1},  {"dec", 1, false, 1},
+    {"mov", 2, false, 2},  {"add", 2, false, 2},  {"sub", 2, false, 2},
+    {"xor", 2, false, 2},  {"cmp", 2, false, 2},  {"test", 2, false, 2},
+    {"mov", 1, true, 5},   {"add", 1, true, 6},   {"sub", 1, true, 6},
+    {"cmp", 1, true, 6},   {"and", 1, true, 6},   {"push", 0, true, 5},
+    {"call", 0, true, 5},  {"jmp", 0, true, 5},
+};
+
+constexpr const char* kRegisters[] = {"eax", "ecx", "edx", "ebx",
+                                      "esp", "ebp", "esi", "edi"};
+
+// Functions start at addresses aligned to this.
+constexpr int kFunctionAlignment = 16;
+
+// Elements that are kept from one sample to the next one keep their id, so
+// that the diff can match them.
+struct Instruction {
+  uint64_t id;
+  int template_index;
+  int registers[2];
+  uint32_t immediate;
+  std::string raw_bytes;
+};
+
+struct BasicBlock {
+  uint64_t id;
+  MemoryAddress address;
+  std::vector<Instruction> instructions;
+};
+
+struct Function {
+  uint64_t id;
+  std::vector<BasicBlock> basic_blocks;
+};
+
+struct Sample {
+  std::string hash;
+  std::vector<Function> functions;
+  int64_t num_basic_blocks = 0;
+  int64_t num_instructions = 0;
+};
+
+class SampleGenerator {
+ public:
+  explicit SampleGenerator(const SyntheticOptions& options)
+      : options_(options), random_(options.seed) {}
+
+  Sample NewSample() {
+    Sample sample;
+    sample.hash = NewHash();
+    sample.functions.reserve(options_.num_functions);
+    for (int i = 0; i < options_.num_functions; ++i) {
+      sample.functions.push_back(NewFunction());
+    }
+    AssignAddresses(&sample);
+    return sample;
+  }
+
+  Sample DeriveSample(const Sample& previous) {
+    Sample sample;
+    sample.hash = NewHash();
+    sample.functions.reserve(previous.functions.size());
+    for (const Function& previous_function : previous.functions) {
+      if (!Bernoulli(options_.shared_function_ratio)) {
+        sample.functions.push_back(NewFunction());
+        continue;
+      }
+      Function function;
+      function.id = previous_function.id;
+      for (const BasicBlock& previous_block : previous_function.basic_blocks) {
+        if (!Bernoulli(options_.shared_block_ratio)) {
+          function.basic_blocks.push_back(NewBasicBlock());
+          continue;
+        }
+        BasicBlock basic_block = previous_block;
+        for (Instruction& instruction : basic_block.instructions) {
+          if (Bernoulli(options_.mutation_rate)) {
+            instruction = NewInstruction(
+                kTemplates[instruction.template_index].size);
+          }
+        }
+        function.basic_blocks.push_back(std::move(basic_block));
+      }
+      sample.functions.push_back(std::move(function));
+    }
+    AssignAddresses(&sample);
+    return sample;
+  }
+
+ private:
+  std::string NewHash() {
+    return absl::StrFormat("%016x%016x%016x%016x", random_(), random_(),
+                           random_(), random_());
+  }
+
+  int Uniform(int min, int max) {
+    return std::uniform_int_distribution<int>(min, std::max(min, max))(
+        random_);
+  }
+
+  bool Bernoulli(double probability) {
+    return std::bernoulli_distribution(probability)(random_);
+  }
+
+  // Returns a new instruction, of the specified size if it is non-zero.
+  Instruction NewInstruction(int size = 0) {
+    int template_index;
+    do {
+      template_index = Uniform(0, std::size(kTemplates) - 1);
+    } while (size != 0 && kTemplates[template_index].size != size);
+    const InstructionTemplate& instruction_template =
+        kTemplates[template_index];
+
+    Instruction instruction;
+    instruction.id = next_id_++;
+    instruction.template_index = template_index;
+    for (int& reg : instruction.registers) {
+      reg = Uniform(0, std::size(kRegisters) - 1);
+    }
+    instruction.raw_bytes.resize(instruction_template.size);
+    for (char& byte : instruction.raw_bytes) {
+      byte = static_cast<char>(Uniform(0, 255));
+    }
+    instruction.immediate = 0;
+    if (instruction_template.immediate) {
+      instruction.immediate = static_cast<uint32_t>(random_());
+      absl::little_endian::Store32(
+          &instruction.raw_bytes[instruction_template.size - 4],
+          instruction.immediate);
+    }
+    return instruction;
+  }
+
+  BasicBlock NewBasicBlock() {
+    BasicBlock basic_block;
+    basic_block.id = next_id_++;
+    basic_block.address = 0;
+    const int num_instructions =
+        Uniform(options_.min_instructions, options_.max_instructions);
+    basic_block.instructions.reserve(num_instructions);
+    for (int i = 0; i < num_instructions; ++i) {
+      basic_block.instructions.push_back(NewInstruction());
+    }
+    return basic_block;
+  }
+
+  Function NewFunction() {
+    Function function;
+    function.id = next_id_++;
+    const int num_basic_blocks =
+        Uniform(options_.min_basic_blocks, options_.max_basic_blocks);
+    function.basic_blocks.reserve(num_basic_blocks);
+    for (int i = 0; i < num_basic_blocks; ++i) {
+      function.basic_blocks.push_back(NewBasicBlock());
+    }
+    return function;
+  }
+
+  void AssignAddresses(Sample* sample) const {
+    MemoryAddress address = options_.base_address;
+    for (Function& function : sample->functions) {
+      address = (address + kFunctionAlignment - 1) &
+                ~MemoryAddress{kFunctionAlignment - 1};
+      for (BasicBlock& basic_block : function.basic_blocks) {
+        basic_block.address = address;
+        for (const Instruction& instruction : basic_block.instructions) {
+          address += instruction.raw_bytes.size();
+        }
+        sample->num_instructions += basic_block.instructions.size();
+      }
+      sample->num_basic_blocks += function.basic_blocks.size();
+    }
+  }
+
+  const SyntheticOptions& options_;
+  std::mt19937_64 random_;
+  uint64_t next_id_ = 1;
+};
+
+// Builds the BinExport2 proto of a sample, sharing identical mnemonics,
+// expressions and operands like BinExport does.
+class BinExportBuilder {
+ public:
+  absl::Status Write(const Sample& sample, const std::string& filename) {
+    auto* meta = proto_.mutable_meta_information();
+    meta->set_executable_name(sample.hash);
+    meta->set_executable_id(sample.hash);
+    meta->set_architecture_name("x86-32");
+    size_prefix_ = proto_.expression_size();
+    auto* size_prefix = proto_.add_expression();
+    size_prefix->set_type(BinExport2::Expression::SIZE_PREFIX);
+    size_prefix->set_symbol("b4");
+
+    for (const Function& function : sample.functions) {
+      auto* vertex = proto_.mutable_call_graph()->add_vertex();
+      vertex->set_address(function.basic_blocks.front().address);
+      vertex->set_type(BinExport2::CallGraph::Vertex::NORMAL);
+
+      auto* flow_graph = proto_.add_flow_graph();
+      for (const BasicBlock& basic_block : function.basic_blocks) {
+        const int basic_block_index = proto_.basic_block_size();
+        if (flow_graph->basic_block_index_size() > 0) {
+          auto* edge = flow_graph->add_edge();
+          edge->set_source_basic_block_index(basic_block_index - 1);
+          edge->set_target_basic_block_index(basic_block_index);
+          edge->set_type(BinExport2::FlowGraph::Edge::UNCONDITIONAL);
+        } else {
+          flow_graph->set_entry_basic_block_index(basic_block_index);
+        }
+        flow_graph->add_basic_block_index(basic_block_index);
+        auto* range = proto_.add_basic_block()->add_instruction_index();
+        range->set_begin_index(proto_.instruction_size());
+        MemoryAddress address = basic_block.address;
+        for (const Instruction& instruction : basic_block.instructions) {
+          AddInstruction(instruction, address);
+          address = 0;
+        }
+        range->set_end_index(proto_.instruction_size());
+      }
+    }
+
+    std::ofstream file(filename, std::ios_base::binary | std::ios_base::trunc);
+    if (!proto_.SerializeToOstream(&file) || !file) {
+      return absl::UnknownError(absl::StrCat("Failed to write ", filename));
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  // Adds the instruction, with its address if non-zero. Instructions without
+  // an address directly follow the previous one.
+  void AddInstruction(const Instruction& instruction, MemoryAddress address) {
+    const InstructionTemplate& instruction_template =
+        kTemplates[instruction.template_index];
+    auto* proto_instruction = proto_.add_instruction();
+    if (address != 0) {
+      proto_instruction->set_address(address);
+    }
+    proto_instruction->set_mnemonic_index(
+        MnemonicIndex(instruction_template.mnemonic));
+    for (int i = 0; i < instruction_template.num_registers; ++i) {
+      proto_instruction->add_operand_index(
+          OperandIndex({RegisterIndex(instruction.registers[i])}));
+    }
+    if (instruction_template.immediate) {
+      proto_instruction->add_operand_index(OperandIndex(
+          {size_prefix_, ImmediateIndex(instruction.immediate)}));
+    }
+    proto_instruction->set_raw_bytes(instruction.raw_bytes);
+  }
+
+  int MnemonicIndex(const char* name) {
+    auto [it, inserted] = mnemonics_.emplace(name, proto_.mnemonic_size());
+    if (inserted) {
+      proto_.add_mnemonic()->set_name(name);
+    }
+    return it->second;
+  }
+
+  int RegisterIndex(int reg) {
+    auto [it, inserted] = registers_.emplace(reg, proto_.expression_size());
+    if (inserted) {
+      auto* expression = proto_.add_expression();
+      expression->set_type(BinExport2::Expression::REGISTER);
+      expression->set_symbol(kRegisters[reg]);
+    }
+    return it->second;
+  }
+
+  int ImmediateIndex(uint32_t immediate) {
+    auto [it, inserted] =
+        immediates_.emplace(immediate, proto_.expression_size());
+    if (inserted) {
+      auto* expression = proto_.add_expression();
+      expression->set_type(BinExport2::Expression::IMMEDIATE_INT);
+      expression->set_immediate(immediate);
+      expression->set_parent_index(size_prefix_);
+    }
+    return it->second;
+  }
+
+  int OperandIndex(std::vector<int> expressions) {
+    auto [it, inserted] =
+        operands_.emplace(std::move(expressions), proto_.operand_size());
+    if (inserted) {
+      auto* operand = proto_.add_operand();
+      for (int expression : it->first) {
+        operand->add_expression_index(expression);
+      }
+    }
+    return it->second;
+  }
+
+  BinExport2 proto_;
+  int size_prefix_ = 0;
+  absl::flat_hash_map<std::string, int> mnemonics_;
+  absl::flat_hash_map<int, int> registers_;
+  absl::flat_hash_map<uint32_t, int> immediates_;
+  absl::flat_hash_map<std::vector<int>, int> operands_;
+};
+
+absl::Status WriteBinDiff(const Sample& primary, const Sample& secondary,
+                          const std::string& filename) {
+  NA_ASSIGN_OR_RETURN(auto writer,
+                      BinDiffWriter::Create(filename, "synthetic"));
+  absl::flat_hash_map<uint64_t, const Function*> secondary_functions;
+  for (const Function& function : secondary.functions) {
+    secondary_functions.emplace(function.id, &function);
+  }
+  int64_t total_matched_instructions = 0;
+  for (const Function& function : primary.functions) {
+    auto found = secondary_functions.find(function.id);
+    if (found == secondary_functions.end()) {
+      continue;
+    }
+    const Function& other = *found->second;
+    absl::flat_hash_map<uint64_t, const BasicBlock*> other_basic_blocks;
+    int64_t num_instructions = 0;
+    for (const BasicBlock& basic_block : other.basic_blocks) {
+      other_basic_blocks.emplace(basic_block.id, &basic_block);
+      num_instructions += basic_block.instructions.size();
+    }
+    // Matched instructions have the same id in the same position of a kept
+    // basic block.
+    std::vector<std::pair<const BasicBlock*, const BasicBlock*>> matched;
+    int64_t matched_instructions = 0;
+    for (const BasicBlock& basic_block : function.basic_blocks) {
+      num_instructions += basic_block.instructions.size();
+      auto found_block = other_basic_blocks.find(basic_block.id);
+      if (found_block == other_basic_blocks.end()) {
+        continue;
+      }
+      matched.emplace_back(&basic_block, found_block->second);
+      for (int i = 0; i < basic_block.instructions.size(); ++i) {
+        matched_instructions += basic_block.instructions[i].id ==
+                                found_block->second->instructions[i].id;
+      }
+    }
+    total_matched_instructions += matched_instructions;
+
+    NA_RETURN_IF_ERROR(writer->AddFunctionMatch(
+        {function.basic_blocks.front().address,
+         other.basic_blocks.front().address},
+        num_instructions > 0 ? 2.0 * matched_instructions / num_instructions
+                             : 0.0));
+    for (const auto& [basic_block, other_block] : matched) {
+      NA_RETURN_IF_ERROR(writer->AddBasicBlockMatch(
+          {basic_block->address, other_block->address}));
+      // Kept basic blocks keep the size of their instructions.
+      MemoryAddress address = basic_block->address;
+      MemoryAddress other_address = other_block->address;
+      for (int i = 0; i < basic_block->instructions.size(); ++i) {
+        if (basic_block->instructions[i].id ==
+            other_block->instructions[i].id) {
+          NA_RETURN_IF_ERROR(
+              writer->AddInstructionMatch({address, other_address}));
+        }
+        address += basic_block->instructions[i].raw_bytes.size();
+        other_address += other_block->instructions[i].raw_bytes.size();
+      }
+    }
+  }
+
+  auto file = [](const Sample& sample) {
+    BinDiffFile file;
+    file.metadata = {sample.hash, sample.hash, sample.hash};
+    file.num_functions = sample.functions.size();
+    file.num_basic_blocks = sample.num_basic_blocks;
+    file.num_edges = sample.num_basic_blocks - file.num_functions;
+    file.num_instructions = sample.num_instructions;
+    return file;
+  };
+  const int64_t total_instructions =
+      primary.num_instructions + secondary.num_instructions;
+  DiffSimilarity similarity;
+  similarity.similarity =
+      total_instructions > 0
+          ? 2.0 * total_matched_instructions / total_instructions
+          : 0.0;
+  similarity.confidence = 1.0;
+  return writer->Finish(file(primary), file(secondary), similarity);
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<std::string>> WriteSyntheticChain(
+    const SyntheticOptions& options, absl::string_view directory) {
+  if (options.num_samples < 2 || options.num_functions < 1 ||
+      options.min_basic_blocks < 1 || options.min_instructions < 1) {
+    return absl::InvalidArgumentError(
+        "Need at least two samples and one function, basic block and "
+        "instruction");
+  }
+  auto write_binexport = [directory](const Sample& sample) {
+    return BinExportBuilder().Write(
+        sample, JoinPath(directory, absl::StrCat(sample.hash, ".BinExport")));
+  };
+  // Only two samples are kept in memory at a time.
+  SampleGenerator generator(options);
+  std::vector<std::string> diffs;
+  Sample previous = generator.NewSample();
+  NA_RETURN_IF_ERROR(write_binexport(previous));
+  for (int i = 1; i < options.num_samples; ++i) {
+    Sample sample = generator.DeriveSample(previous);
+    NA_RETURN_IF_ERROR(write_binexport(sample));
+    diffs.push_back(JoinPath(
+        directory, absl::StrCat(previous.hash, "_vs_", sample.hash,
+                                ".BinDiff")));
+    NA_RETURN_IF_ERROR(WriteBinDiff(previous, sample, diffs.back()));
+    previous = std::move(sample);
+  }
+  return diffs;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,75 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Generates synthetic chains of .BinExport files and the .BinDiff files that
+// connect them, for benchmarking and stress testing at sizes beyond those of
+// the test data. The first sample consists of random x86-32 functions. Every
+// following sample is derived from its predecessor: some functions are
+// replaced, some basic blocks of the remaining functions are rewritten and
+// some instructions are mutated. The diffs match exactly what was kept.
+
+#ifndef VXSIG_SYNTHETIC_H_
+#define VXSIG_SYNTHETIC_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "vxsig/types.h"
+
+namespace security::vxsig {
+
+struct SyntheticOptions {
+  // Number of samples in the chain, which has one diff less.
+  int num_samples = 3;
+
+  // Size of each sample. Sizes are drawn uniformly from the ranges.
+  int num_functions = 1000;
+  int min_basic_blocks = 1;
+  int max_basic_blocks = 12;
+  int min_instructions = 1;
+  int max_instructions = 10;
+
+  // Fraction of the functions of a sample that are kept in the next one. The
+  // others are replaced by new functions.
+  double shared_function_ratio = 0.9;
+
+  // Fraction of the basic blocks of a kept function that are kept. The others
+  // are replaced by new basic blocks.
+  double shared_block_ratio = 0.9;
+
+  // Probability that an instruction of a kept basic block is replaced by a
+  // different one of the same size. Mutated instructions are not matched.
+  double mutation_rate = 0.05;
+
+  // Address of the first function of each sample.
+  MemoryAddress base_address = 0x401000;
+
+  // Seeds the random number generator, the output only depends on the
+  // options.
+  uint64_t seed = 42;
+};
+
+// Writes the samples "<hash>.BinExport" and the diffs
+// "<hash1>_vs_<hash2>.BinDiff" to the directory, which must exist, and
+// returns the paths of the diffs in chain order. The hashes are random
+// SHA256-like hex strings.
+absl::StatusOr<std::vector<std::string>> WriteSyntheticChain(
+    const SyntheticOptions& options, absl::string_view directory);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_SYNTHETIC_H_
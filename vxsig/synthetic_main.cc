@@ -0,0 +1,106 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A program that writes a synthetic chain of .BinExport and .BinDiff files for
+// scale testing. Pass the printed diffs to the signature generator, e.g.:
+//   vxsig_synthetic --num_functions=100000 /tmp/synthetic
+//   vxsig /tmp/synthetic/*.BinDiff
+// The shell sorts the diffs by name, which is not the chain order. Use
+// --order_diffs or the order that this program prints.
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/base/internal/raw_logging.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "vxsig/synthetic.h"
+
+ABSL_FLAG(int32_t, num_samples, security::vxsig::SyntheticOptions().num_samples,
+          "Number of samples in the chain");
+ABSL_FLAG(int32_t, num_functions,
+          security::vxsig::SyntheticOptions().num_functions,
+          "Number of functions per sample");
+ABSL_FLAG(int32_t, min_basic_blocks,
+          security::vxsig::SyntheticOptions().min_basic_blocks,
+          "Minimum number of basic blocks per function");
+ABSL_FLAG(int32_t, max_basic_blocks,
+          security::vxsig::SyntheticOptions().max_basic_blocks,
+          "Maximum number of basic blocks per function");
+ABSL_FLAG(int32_t, min_instructions,
+          security::vxsig::SyntheticOptions().min_instructions,
+          "Minimum number of instructions per basic block");
+ABSL_FLAG(int32_t, max_instructions,
+          security::vxsig::SyntheticOptions().max_instructions,
+          "Maximum number of instructions per basic block");
+ABSL_FLAG(double, shared_function_ratio,
+          security::vxsig::SyntheticOptions().shared_function_ratio,
+          "Fraction of functions kept from one sample to the next");
+ABSL_FLAG(double, shared_block_ratio,
+          security::vxsig::SyntheticOptions().shared_block_ratio,
+          "Fraction of basic blocks kept in each kept function");
+ABSL_FLAG(double, mutation_rate,
+          security::vxsig::SyntheticOptions().mutation_rate,
+          "Probability that an instruction of a kept basic block changes");
+ABSL_FLAG(uint64_t, seed, security::vxsig::SyntheticOptions().seed,
+          "Seed for the random number generator");
+
+namespace security::vxsig {
+namespace {
+
+void SyntheticMain(int argc, char* argv[]) {
+  ABSL_RAW_CHECK(argc == 2, "Need output directory");
+
+  SyntheticOptions options;
+  options.num_samples = absl::GetFlag(FLAGS_num_samples);
+  options.num_functions = absl::GetFlag(FLAGS_num_functions);
+  options.min_basic_blocks = absl::GetFlag(FLAGS_min_basic_blocks);
+  options.max_basic_blocks = absl::GetFlag(FLAGS_max_basic_blocks);
+  options.min_instructions = absl::GetFlag(FLAGS_min_instructions);
+  options.max_instructions = absl::GetFlag(FLAGS_max_instructions);
+  options.shared_function_ratio = absl::GetFlag(FLAGS_shared_function_ratio);
+  options.shared_block_ratio = absl::GetFlag(FLAGS_shared_block_ratio);
+  options.mutation_rate = absl::GetFlag(FLAGS_mutation_rate);
+  options.seed = absl::GetFlag(FLAGS_seed);
+
+  const std::string directory = argv[1];
+  ABSL_RAW_CHECK(CreateDirectories(directory).ok(),
+                 "Failed to create output directory");
+  auto diffs = WriteSyntheticChain(options, directory);
+  ABSL_RAW_CHECK(diffs.ok(), absl::StrCat("Failed to write chain: ",
+                                          diffs.status().message())
+                                 .c_str());
+  for (const auto& diff : *diffs) {
+    absl::PrintF("%s\n", diff);
+  }
+}
+
+}  // namespace
+}  // namespace security::vxsig
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(absl::StrCat(
+      "Write a synthetic chain of BinExport and BinDiff files.\n"
+      "usage:\n",
+      argv[0], " [OPTION] DIRECTORY"));
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  security::vxsig::SyntheticMain(args.size(), &args[0]);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/synthetic.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/binexport_reader.h"
+#include "vxsig/corpus.h"
+#include "vxsig/diff_result_reader.h"
+#include "vxsig/siggen.h"
+#include "vxsig/test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::Gt;
+using testing::IsEmpty;
+using testing::Lt;
+using testing::Not;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+class SyntheticTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    auto directory = CreateTestTempDirectory();
+    ASSERT_THAT(directory, IsOk());
+    directory_ = *std::move(directory);
+    options_.num_functions = 50;
+  }
+
+  std::string directory_;
+  SyntheticOptions options_;
+};
+
+TEST_F(SyntheticTest, WritesChainForTheReaders) {
+  auto diffs = WriteSyntheticChain(options_, directory_);
+  ASSERT_THAT(diffs, IsOk());
+  ASSERT_THAT(*diffs, SizeIs(2));
+
+  std::vector<std::string> samples;
+  for (const auto& diff : *diffs) {
+    std::pair<FileMetaData, FileMetaData> metadata;
+    DiffSimilarity similarity;
+    ASSERT_THAT(ReadBinDiffMetaData(diff, &metadata, &similarity), IsOk());
+    EXPECT_THAT(metadata.first.filename, SizeIs(64));
+    if (!samples.empty()) {
+      EXPECT_THAT(metadata.first.filename, Eq(samples.back()));
+    } else {
+      samples.push_back(metadata.first.filename);
+    }
+    samples.push_back(metadata.second.filename);
+    EXPECT_THAT(similarity.similarity, Gt(0.5));
+    EXPECT_THAT(similarity.similarity, Lt(1.0));
+
+    int function_matches = 0;
+    int basic_block_matches = 0;
+    ASSERT_THAT(
+        ParseBinDiff(
+            diff,
+            [&](const MemoryAddressPair&) { ++function_matches; },
+            [&](const MemoryAddressPair&) { ++basic_block_matches; },
+            /*instruction_match_receiver=*/nullptr, &metadata),
+        IsOk());
+    EXPECT_THAT(function_matches, Gt(0));
+    EXPECT_THAT(function_matches, Lt(options_.num_functions));
+    EXPECT_THAT(basic_block_matches, Gt(function_matches));
+  }
+
+  for (const auto& sample : samples) {
+    int functions = 0;
+    int immediates = 0;
+    ASSERT_THAT(
+        ParseBinExport(
+            JoinPath(directory_, absl::StrCat(sample, ".BinExport")),
+            [&](const std::string& sha256, MemoryAddress,
+                BinExport2::CallGraph::Vertex::Type, double) {
+              EXPECT_THAT(sha256, Eq(sample));
+              ++functions;
+            },
+            [&](MemoryAddress, MemoryAddress, const std::string&,
+                const std::string&, const Immediates& instruction_immediates) {
+              immediates += instruction_immediates.size();
+            }),
+        IsOk());
+    EXPECT_THAT(functions, Eq(options_.num_functions));
+    EXPECT_THAT(immediates, Gt(0));
+  }
+}
+
+TEST_F(SyntheticTest, GeneratesSignature) {
+  auto diffs = WriteSyntheticChain(options_, directory_);
+  ASSERT_THAT(diffs, IsOk());
+
+  AvSignatureGenerator siggen;
+  siggen.set_verbose(false).set_num_threads(1);
+  siggen.AddDiffResults(*diffs);
+  Signature signature;
+  signature.mutable_definition()->set_detection_name("synthetic_test");
+  ASSERT_THAT(siggen.Generate(&signature), IsOk());
+  EXPECT_THAT(signature.raw_signature().piece(), Not(IsEmpty()));
+}
+
+TEST_F(SyntheticTest, DependsOnlyOnOptions) {
+  options_.num_samples = 2;
+  auto first = WriteSyntheticChain(options_, directory_);
+  ASSERT_THAT(first, IsOk());
+  const std::string other_directory = JoinPath(directory_, "other");
+  ASSERT_THAT(CreateDirectories(other_directory), IsOk());
+  auto second = WriteSyntheticChain(options_, other_directory);
+  ASSERT_THAT(second, IsOk());
+  ASSERT_THAT(*second, SizeIs(1));
+  EXPECT_THAT(Basename((*second)[0]), Eq(Basename((*first)[0])));
+  EXPECT_THAT(ReadFileContents((*second)[0]),
+              Eq(ReadFileContents((*first)[0])));
+}
+
+TEST_F(SyntheticTest, RejectsEmptyChain) {
+  options_.num_samples = 1;
+  EXPECT_THAT(WriteSyntheticChain(options_, directory_).ok(), Eq(false));
+}
+
+}  // namespace
+}  // namespace security::vxsig
@@ -0,0 +1,39 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/test_util.h"
+
+#include <cstdlib>
+
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+
+namespace security::vxsig {
+
+std::string TestDataPath(absl::string_view filename) {
+  return JoinPath(getenv("TEST_SRCDIR"), "com_google_vxsig/vxsig/testdata",
+                  filename);
+}
+
+absl::StatusOr<std::string> CreateTestTempDirectory() {
+  std::string directory = JoinPath(
+      getenv("TEST_TMPDIR"),
+      testing::UnitTest::GetInstance()->current_test_info()->name());
+  NA_RETURN_IF_ERROR(RemoveAll(directory));
+  NA_RETURN_IF_ERROR(CreateDirectories(directory));
+  return directory;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,37 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Helpers shared by tests that read the test data or write files.
+
+#ifndef VXSIG_TEST_UTIL_H_
+#define VXSIG_TEST_UTIL_H_
+
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace security::vxsig {
+
+// Returns the path of a file in vxsig/testdata.
+std::string TestDataPath(absl::string_view filename);
+
+// Creates an empty directory below $TEST_TMPDIR that is named after the
+// current test, removing anything left there by an earlier run. Returns its
+// path.
+absl::StatusOr<std::string> CreateTestTempDirectory();
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_TEST_UTIL_H_
@@ -0,0 +1,227 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/trace.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/clock.h"
+
+namespace security::vxsig {
+namespace internal {
+std::atomic<Tracer*> global_tracer{nullptr};
+}  // namespace internal
+
+namespace {
+
+// Minimum time between two samples of the same counter in the Chrome trace.
+// Counters may be updated very often, e.g. once per LCS row.
+constexpr int64_t kCounterSampleIntervalNs = 1000 * 1000;
+
+std::string JsonString(absl::string_view value) {
+  std::string result = "\"";
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        result += "\\\"";
+        break;
+      case '\\':
+        result += "\\\\";
+        break;
+      case '\n':
+        result += "\\n";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          absl::StrAppendFormat(&result, "\\u%04x", c);
+        } else {
+          result += c;
+        }
+    }
+  }
+  result += "\"";
+  return result;
+}
+
+absl::Status WriteFile(absl::string_view filename, absl::string_view data) {
+  std::ofstream output(std::string(filename),
+                       std::ios::binary | std::ios::trunc);
+  output.write(data.data(), data.size());
+  if (!output) {
+    return absl::UnknownError(absl::StrCat("Failed to write ", filename));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+void SetGlobalTracer(Tracer* tracer) {
+  internal::global_tracer.store(tracer, std::memory_order_release);
+}
+
+int GetTraceThreadId() {
+  static std::atomic<int> next_id{1};
+  thread_local const int id = next_id++;
+  return id;
+}
+
+int64_t GetPeakRssBytes() {
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return static_cast<int64_t>(usage.ru_maxrss) * 1024;  // Linux uses KiB
+}
+
+TraceSpan::TraceSpan(absl::string_view name) : tracer_(GetGlobalTracer()) {
+  if (tracer_ != nullptr) {
+    event_.name = std::string(name);
+    event_.start_ns = absl::GetCurrentTimeNanos();
+    event_.thread_id = GetTraceThreadId();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (tracer_ != nullptr) {
+    event_.duration_ns = absl::GetCurrentTimeNanos() - event_.start_ns;
+    tracer_->AddEvent(std::move(event_));
+  }
+}
+
+Tracer::Tracer() : start_ns_(absl::GetCurrentTimeNanos()) {}
+
+void Tracer::AddEvent(TraceEvent event) {
+  absl::MutexLock lock(&mutex_);
+  events_.push_back(std::move(event));
+}
+
+void Tracer::AddCount(absl::string_view counter, int64_t delta) {
+  const int64_t now = absl::GetCurrentTimeNanos();
+  absl::MutexLock lock(&mutex_);
+  auto it = counters_.find(counter);
+  if (it == counters_.end()) {
+    it = counters_.emplace(std::string(counter), Counter()).first;
+  }
+  auto& entry = it->second;
+  entry.value += delta;
+  if (entry.samples.empty() ||
+      now - entry.samples.back().time_ns >= kCounterSampleIntervalNs) {
+    entry.samples.push_back({now, entry.value});
+  } else {
+    entry.samples.back().value = entry.value;
+  }
+}
+
+TraceSummary Tracer::Summarize() const {
+  TraceSummary summary;
+  summary.wall_ns = absl::GetCurrentTimeNanos() - start_ns_;
+  summary.peak_rss_bytes = GetPeakRssBytes();
+  absl::MutexLock lock(&mutex_);
+  for (const auto& event : events_) {
+    auto& phase = summary.phases[event.name];
+    ++phase.count;
+    phase.total_ns += event.duration_ns;
+    phase.max_ns = std::max(phase.max_ns, event.duration_ns);
+  }
+  for (const auto& [name, counter] : counters_) {
+    summary.counters[name] = counter.value;
+  }
+  return summary;
+}
+
+std::string Tracer::ToChromeTraceJson() const {
+  const int pid = getpid();
+  auto micros = [this](int64_t ns) {
+    return absl::StrFormat("%.3f", (ns - start_ns_) / 1000.0);
+  };
+  std::string json = "{\"traceEvents\":[\n";
+  bool first = true;
+  auto append_event = [&json, &first](const std::string& event) {
+    absl::StrAppend(&json, first ? "" : ",\n", event);
+    first = false;
+  };
+
+  absl::MutexLock lock(&mutex_);
+  for (const auto& event : events_) {
+    std::string args;
+    for (const auto& [key, value] : event.int_args) {
+      absl::StrAppend(&args, args.empty() ? "" : ",", JsonString(key), ":",
+                      value);
+    }
+    for (const auto& [key, value] : event.string_args) {
+      absl::StrAppend(&args, args.empty() ? "" : ",", JsonString(key), ":",
+                      JsonString(value));
+    }
+    append_event(absl::StrCat(
+        "{\"name\":", JsonString(event.name),
+        ",\"cat\":\"vxsig\",\"ph\":\"X\",\"ts\":", micros(event.start_ns),
+        ",\"dur\":", absl::StrFormat("%.3f", event.duration_ns / 1000.0),
+        ",\"pid\":", pid, ",\"tid\":", event.thread_id, ",\"args\":{", args,
+        "}}"));
+  }
+  for (const auto& [name, counter] : counters_) {
+    for (const auto& sample : counter.samples) {
+      append_event(absl::StrCat("{\"name\":", JsonString(name),
+                                ",\"cat\":\"vxsig\",\"ph\":\"C\",\"ts\":",
+                                micros(sample.time_ns), ",\"pid\":", pid,
+                                ",\"args\":{\"value\":", sample.value, "}}"));
+    }
+  }
+  append_event(absl::StrCat(
+      "{\"name\":\"peak_rss_bytes\",\"cat\":\"vxsig\",\"ph\":\"C\",\"ts\":",
+      micros(absl::GetCurrentTimeNanos()), ",\"pid\":", pid,
+      ",\"args\":{\"value\":", GetPeakRssBytes(), "}}"));
+  absl::StrAppend(&json, "\n]}\n");
+  return json;
+}
+
+std::string Tracer::SummaryToJson() const {
+  const TraceSummary summary = Summarize();
+  std::string json = absl::StrCat("{\n  \"wall_us\": ", summary.wall_ns / 1000,
+                                  ",\n  \"peak_rss_bytes\": ",
+                                  summary.peak_rss_bytes, ",\n  \"phases\": {");
+  bool first = true;
+  for (const auto& [name, phase] : summary.phases) {
+    absl::StrAppend(&json, first ? "\n" : ",\n", "    ", JsonString(name),
+                    ": {\"count\": ", phase.count,
+                    ", \"total_us\": ", phase.total_ns / 1000,
+                    ", \"max_us\": ", phase.max_ns / 1000, "}");
+    first = false;
+  }
+  absl::StrAppend(&json, "\n  },\n  \"counters\": {");
+  first = true;
+  for (const auto& [name, value] : summary.counters) {
+    absl::StrAppend(&json, first ? "\n" : ",\n", "    ", JsonString(name),
+                    ": ", value);
+    first = false;
+  }
+  absl::StrAppend(&json, "\n  }\n}\n");
+  return json;
+}
+
+absl::Status Tracer::WriteChromeTrace(absl::string_view filename) const {
+  return WriteFile(filename, ToChromeTraceJson());
+}
+
+absl::Status Tracer::WriteSummary(absl::string_view filename) const {
+  return WriteFile(filename, SummaryToJson());
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,167 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lightweight instrumentation for the phases of signature generation. Spans
+// and counters are recorded into the process-wide tracer, if one is
+// installed. Without a tracer, each span or counter costs a single atomic
+// load.
+// Use like this:
+//   Tracer tracer;
+//   SetGlobalTracer(&tracer);
+//   {
+//     TraceSpan span("Phase");
+//     span.Arg("size", size);
+//     TraceCount("items", num_items);
+//   }
+//   SetGlobalTracer(nullptr);
+//   tracer.WriteChromeTrace("trace.json");
+
+#ifndef VXSIG_TRACE_H_
+#define VXSIG_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace security::vxsig {
+
+struct TraceEvent {
+  std::string name;
+  int64_t start_ns;
+  int64_t duration_ns;
+  int thread_id;
+  std::vector<std::pair<std::string, int64_t>> int_args;
+  std::vector<std::pair<std::string, std::string>> string_args;
+};
+
+// Aggregated statistics of a trace.
+struct TraceSummary {
+  struct Phase {
+    int64_t count = 0;
+    int64_t total_ns = 0;
+    int64_t max_ns = 0;
+  };
+  int64_t wall_ns = 0;
+  int64_t peak_rss_bytes = 0;
+  std::map<std::string, Phase> phases;
+  std::map<std::string, int64_t> counters;
+};
+
+// Collects trace events and counters. This class is thread-safe.
+class Tracer {
+ public:
+  Tracer();
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  void AddEvent(TraceEvent event);
+  void AddCount(absl::string_view counter, int64_t delta);
+
+  TraceSummary Summarize() const;
+
+  // Returns the trace in the Chrome trace-event format, to be loaded in
+  // chrome://tracing or Perfetto. Counters are written as counter events.
+  std::string ToChromeTraceJson() const;
+
+  // Returns the summary as a JSON object.
+  std::string SummaryToJson() const;
+
+  absl::Status WriteChromeTrace(absl::string_view filename) const;
+  absl::Status WriteSummary(absl::string_view filename) const;
+
+ private:
+  struct CounterSample {
+    int64_t time_ns;
+    int64_t value;
+  };
+  struct Counter {
+    int64_t value = 0;
+    std::vector<CounterSample> samples;
+  };
+
+  const int64_t start_ns_;
+  mutable absl::Mutex mutex_;
+  std::vector<TraceEvent> events_ ABSL_GUARDED_BY(mutex_);
+  std::map<std::string, Counter, std::less<>> counters_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+namespace internal {
+extern std::atomic<Tracer*> global_tracer;
+}  // namespace internal
+
+// Installs the process-wide tracer. Passing nullptr disables tracing. The
+// tracer must outlive all spans that were started while it was installed.
+void SetGlobalTracer(Tracer* tracer);
+
+inline Tracer* GetGlobalTracer() {
+  return internal::global_tracer.load(std::memory_order_acquire);
+}
+
+// Returns a small, stable id for the calling thread.
+int GetTraceThreadId();
+
+// Returns the peak resident set size of the process in bytes.
+int64_t GetPeakRssBytes();
+
+// Records the time between construction and destruction as a trace event on
+// the current thread.
+class TraceSpan {
+ public:
+  explicit TraceSpan(absl::string_view name);
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  ~TraceSpan();
+
+  TraceSpan& Arg(absl::string_view key, int64_t value) {
+    if (tracer_ != nullptr) {
+      event_.int_args.emplace_back(std::string(key), value);
+    }
+    return *this;
+  }
+
+  TraceSpan& Arg(absl::string_view key, absl::string_view value) {
+    if (tracer_ != nullptr) {
+      event_.string_args.emplace_back(std::string(key), std::string(value));
+    }
+    return *this;
+  }
+
+ private:
+  Tracer* tracer_;
+  TraceEvent event_;
+};
+
+// Adds delta to the named counter.
+inline void TraceCount(absl::string_view counter, int64_t delta) {
+  if (Tracer* tracer = GetGlobalTracer()) {
+    tracer->AddCount(counter, delta);
+  }
+}
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_TRACE_H_
@@ -0,0 +1,90 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/trace.h"
+
+#include <iterator>
+#include <string>
+#include <thread>  // NOLINT
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "vxsig/common_subsequence.h"
+
+using testing::Eq;
+using testing::Gt;
+using testing::HasSubstr;
+using testing::IsEmpty;
+using testing::Not;
+
+namespace security::vxsig {
+namespace {
+
+class TraceTest : public testing::Test {
+ protected:
+  void SetUp() override { SetGlobalTracer(&tracer_); }
+  void TearDown() override { SetGlobalTracer(nullptr); }
+
+  Tracer tracer_;
+};
+
+TEST_F(TraceTest, RecordsSpansAndCounters) {
+  {
+    TraceSpan span("Outer");
+    span.Arg("size", 42).Arg("file", "a\"b");
+    TraceCount("items", 3);
+    std::thread([]() {
+      TraceSpan span("Inner");
+      TraceCount("items", 4);
+    }).join();
+  }
+  const TraceSummary summary = tracer_.Summarize();
+  ASSERT_THAT(summary.phases.count("Outer"), Eq(1));
+  EXPECT_THAT(summary.phases.at("Outer").count, Eq(1));
+  EXPECT_THAT(summary.phases.at("Inner").count, Eq(1));
+  EXPECT_THAT(summary.counters.at("items"), Eq(7));
+  EXPECT_THAT(summary.peak_rss_bytes, Gt(0));
+
+  const std::string trace = tracer_.ToChromeTraceJson();
+  EXPECT_THAT(trace, HasSubstr("\"name\":\"Outer\""));
+  EXPECT_THAT(trace, HasSubstr("\"size\":42"));
+  EXPECT_THAT(trace, HasSubstr(R"("file":"a\"b")"));
+  EXPECT_THAT(trace, HasSubstr("\"ph\":\"C\""));
+  EXPECT_THAT(tracer_.SummaryToJson(), HasSubstr("\"items\": 7"));
+}
+
+TEST_F(TraceTest, InstrumentsCommonSubsequence) {
+  const std::vector<std::string> sequences = {"abcde", "axcye", "abxde"};
+  std::string result;
+  CommonSubsequence(sequences, std::back_inserter(result));
+  const TraceSummary summary = tracer_.Summarize();
+  EXPECT_THAT(summary.phases.count("CommonSubsequence"), Eq(1));
+  EXPECT_THAT(summary.counters.at("lcs_cells"), Gt(0));
+}
+
+TEST(TraceDisabledTest, RecordsNothingWithoutTracer) {
+  Tracer tracer;
+  {
+    TraceSpan span("Span");
+    TraceCount("items", 1);
+  }
+  const TraceSummary summary = tracer.Summarize();
+  EXPECT_THAT(summary.phases, IsEmpty());
+  EXPECT_THAT(summary.counters, IsEmpty());
+  EXPECT_THAT(tracer.ToChromeTraceJson(), Not(HasSubstr("Span")));
+}
+
+}  // namespace
+}  // namespace security::vxsig
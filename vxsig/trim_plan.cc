@@ -0,0 +1,267 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/trim_plan.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+
+#include "absl/hash/internal/city.h"
+#include "absl/strings/str_cat.h"
+#include "base/logging.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+
+namespace security::vxsig {
+namespace {
+
+absl::Status SolveKnapsack(const int64_t max_byte_len,
+                           const RawSignature& raw_signature,
+                           std::vector<int>* piece_indices) {
+  if (!piece_indices) {
+    return absl::InvalidArgumentError("Piece indices must be non-nullptr");
+  }
+  // The code below is disabled for now, as piece weights need a function
+  // corpus.
+  // When enabling, include "ortools/linear_solver/linear_solver.h".
+#if 0
+  MPSolver solver("SolverSiggen", MPSolver::SCIP_MIXED_INTEGER_PROGRAMMING);
+  solver.SetSolverSpecificParametersAsString(
+      absl::StrCat("limits/memory = ", 8ULL << 30 /* 8 GiB */,
+                   "\nlimits/time = ", 1800 /* 30min */, "\n"));
+  solver.MutableObjective()->SetMaximization();
+  MPConstraint* contraint = solver.MakeRowConstraint(0.0, max_byte_len);
+
+  // Gather maximum weight and size values to scale later.
+  double max_weight = 0;
+  double max_size = 0;
+  for (const auto& piece : raw_signature.piece()) {
+    max_weight = std::max(static_cast<double>(piece.weight()), max_weight);
+    max_size = std::max(static_cast<double>(piece.bytes().size()), max_size);
+  }
+
+  std::vector<MPVariable*> vars(piece_indices->size());
+  const double log_max_weight = log(max_weight);
+  for (int i = 0; i < vars.size(); ++i) {
+    const auto& piece = raw_signature.piece((*piece_indices)[i]);
+    auto& var = vars[i];
+    var = solver.MakeBoolVar(/*name=*/"");
+    double weight = piece.weight();
+    if (weight > 0) {
+      // Log scale the weight and map into a (0, 100] range. The "+ 1" ensures
+      // that we never end up with zero weights. The log scale is useful since
+      // we're ultimately dealing with function frequencies.
+      const double scaled_log_weight =
+          (1 + log(weight)) / (1 + log_max_weight) * 100;
+      // Scale the piece length into (0, 100] range. Since the pieces are not
+      // allowed to be empty, we cannot end up with a zero size.
+      const double scaled_size = piece.bytes().size() / max_size * 100;
+      // Set the weight used for solving the implicit Knapsack problem. By
+      // scaling down the per-piece weight and multiplying with the scaled
+      // per-piece length, we prefer including longer pieces in the final
+      // signature.
+      weight = scaled_log_weight * scaled_size;
+    }
+    solver.MutableObjective()->SetCoefficient(var, weight);
+    contraint->SetCoefficient(var, piece.bytes().size());
+  }
+  const auto solver_result = solver.Solve();
+  if (solver_result != MPSolver::OPTIMAL) {
+    return absl::InternalError(
+        absl::StrCat("Solver failed with code: ", solver_result));
+  }
+  RawSignature result;
+  for (int i = 0; i < vars.size(); ++i) {
+    if (vars[i]->solution_value() == 0.0) {
+      (*piece_indices)[i] = -1;
+    }
+  }
+  piece_indices->erase(
+      std::remove_if(piece_indices->begin(), piece_indices->end(),
+                     [](int i) { return i < 0; }),
+      piece_indices->end());
+#endif
+  return absl::OkStatus();
+}
+
+// Returns the piece indices in the order of a random permutation that only
+// depends on the variant.
+void ShufflePieces(int variant, std::vector<int>* piece_indices) {
+  // Mix the signature variant into the PRNG's seed.
+  std::string seed =
+      absl::StrCat(variant ^ 0x1599C98B /* Random number to mask 0 */,
+                   "369ea79bcded92881284" /* Random bytes */);
+  std::mt19937 random(
+      absl::hash_internal::CityHash64(seed.c_str(), seed.size()));
+  std::shuffle(piece_indices->begin(), piece_indices->end(), random);
+}
+
+// Orders the pieces by decreasing weight, then by decreasing length.
+void SortByWeight(const RawSignature& raw_sig,
+                  std::vector<int>* piece_indices) {
+  std::sort(
+      piece_indices->begin(), piece_indices->end(), [&raw_sig](int a, int b) {
+        // Prefer higher weight.
+        int compare = raw_sig.piece(a).weight() - raw_sig.piece(b).weight();
+        if (compare == 0) {
+          // Prefer longer pieces.
+          compare =
+              raw_sig.piece(a).bytes().size() - raw_sig.piece(b).bytes().size();
+        }
+        return compare > 0;
+      });
+}
+
+}  // namespace
+
+const TrimPlan::Ordering& TrimPlan::GetOrdering(const OrderingKey& key) const {
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    auto it = orderings_.find(key);
+    if (it != orderings_.end()) {
+      return *it->second;
+    }
+  }
+
+  // Compute the ordering without holding the lock, concurrent callers for
+  // the same key compute the same result.
+  const auto& [kind, min_piece_len, exclude_unweighted, variant] = key;
+  auto ordering = std::make_unique<Ordering>();
+  auto& indices = ordering->indices;
+  indices.reserve(raw_sig_.piece_size());
+  for (int i = 0; i < raw_sig_.piece_size(); ++i) {
+    const auto& piece = raw_sig_.piece(i);
+    if (exclude_unweighted && piece.weight() == 0) {
+      continue;
+    }
+    if (piece.bytes().size() >= min_piece_len) {
+      indices.push_back(i);
+    }
+  }
+  switch (kind) {
+    case kPieceOrder:
+      break;
+    case kShuffled:
+      ShufflePieces(variant, &indices);
+      break;
+    case kByWeight:
+      SortByWeight(raw_sig_, &indices);
+      break;
+  }
+  ordering->prefix_lengths.reserve(indices.size() + 1);
+  ordering->prefix_lengths.push_back(0);
+  for (int i : indices) {
+    ordering->prefix_lengths.push_back(ordering->prefix_lengths.back() +
+                                       raw_sig_.piece(i).bytes().size());
+  }
+
+  absl::MutexLock lock(&mutex_);
+  return *orderings_.try_emplace(key, std::move(ordering)).first->second;
+}
+
+absl::Status TrimPlan::GetSubsetIndices(const SignatureDefinition& definition,
+                                        int engine_min_piece_len,
+                                        std::vector<int>* indices) const {
+  CHECK(indices);
+  auto& piece_indices = *indices;
+  piece_indices.clear();
+
+  const int min_piece_len =
+      std::max(engine_min_piece_len, definition.min_piece_length());
+  const auto algorithm = definition.trim_algorithm();
+  const bool exclude_unweighted =
+      algorithm == SignatureDefinition::TRIM_WEIGHTED ||
+      algorithm == SignatureDefinition::TRIM_WEIGHTED_GREEDY;
+  const int64_t max_length = definition.trim_length();
+  if (max_length < 0 && algorithm != SignatureDefinition::TRIM_NONE) {
+    return absl::InvalidArgumentError("Unbounded signature trimming requested");
+  }
+
+  // Returns the number of leading pieces of an ordering that fit into the
+  // trim length.
+  auto num_fitting = [max_length](const Ordering& ordering) {
+    const auto& prefix = ordering.prefix_lengths;
+    return std::upper_bound(prefix.begin(), prefix.end(), max_length) -
+           prefix.begin() - 1;
+  };
+  switch (algorithm) {
+    case SignatureDefinition::TRIM_NONE:
+    case SignatureDefinition::TRIM_WEIGHTED: {
+      const Ordering& ordering = GetOrdering(
+          {kPieceOrder, min_piece_len, exclude_unweighted, /*variant=*/0});
+      piece_indices = ordering.indices;
+      if (algorithm == SignatureDefinition::TRIM_WEIGHTED) {
+        NA_RETURN_IF_ERROR(
+            SolveKnapsack(max_length, raw_sig_, &piece_indices));
+      }
+      break;
+    }
+    case SignatureDefinition::TRIM_LAST: {
+      const Ordering& ordering = GetOrdering(
+          {kPieceOrder, min_piece_len, exclude_unweighted, /*variant=*/0});
+      piece_indices.assign(ordering.indices.begin(),
+                           ordering.indices.begin() + num_fitting(ordering));
+      break;
+    }
+    case SignatureDefinition::TRIM_FIRST: {
+      // Keep the longest suffix that fits.
+      const Ordering& ordering = GetOrdering(
+          {kPieceOrder, min_piece_len, exclude_unweighted, /*variant=*/0});
+      const auto& prefix = ordering.prefix_lengths;
+      const int first =
+          std::lower_bound(prefix.begin(), prefix.end(),
+                           prefix.back() - max_length) -
+          prefix.begin();
+      piece_indices.assign(ordering.indices.begin() + first,
+                           ordering.indices.end());
+      break;
+    }
+    case SignatureDefinition::TRIM_RANDOM: {
+      const Ordering& ordering =
+          GetOrdering({kShuffled, min_piece_len, exclude_unweighted,
+                       definition.variant()});
+      piece_indices.assign(ordering.indices.begin(),
+                           ordering.indices.begin() + num_fitting(ordering));
+      break;
+    }
+    case SignatureDefinition::TRIM_WEIGHTED_GREEDY: {
+      const Ordering& ordering = GetOrdering(
+          {kByWeight, min_piece_len, exclude_unweighted, /*variant=*/0});
+      int64_t current_length = 0;
+      for (int i : ordering.indices) {
+        const int64_t new_length =
+            current_length + raw_sig_.piece(i).bytes().size();
+        if (new_length > max_length) {
+          // Don't give up yet, shorter pieces may follow.
+          continue;
+        }
+        piece_indices.push_back(i);
+        current_length = new_length;
+      }
+      break;
+    }
+    default:
+      return absl::InvalidArgumentError("Unknown signature trimming algorithm");
+  }
+
+  if (piece_indices.empty()) {
+    return absl::InvalidArgumentError("No byte piece to create signature");
+  }
+
+  std::sort(piece_indices.begin(), piece_indices.end());
+  return absl::OkStatus();
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,82 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Precomputed trimming state for a raw signature. Signature generation
+// formats the same raw signature with many definitions: all variants, trim
+// lengths and minimum piece lengths of a variant search, and the minimum
+// piece lengths of the different engines. A TrimPlan computes the pieces that
+// qualify for a minimum length, their order for the trim algorithm and the
+// prefix sums of their lengths once, so that each further subset only costs a
+// binary search and copying the selected piece indices.
+
+#ifndef VXSIG_TRIM_PLAN_H_
+#define VXSIG_TRIM_PLAN_H_
+
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+class TrimPlan {
+ public:
+  // Does not take ownership, the raw signature must outlive the plan and must
+  // not be modified while it is in use.
+  explicit TrimPlan(const RawSignature& raw_sig) : raw_sig_(raw_sig) {}
+
+  TrimPlan(const TrimPlan&) = delete;
+  TrimPlan& operator=(const TrimPlan&) = delete;
+
+  // Returns the sorted indices of the pieces that the definition selects, see
+  // GetRelevantSignatureSubsetIndices(). May be called concurrently.
+  absl::Status GetSubsetIndices(const SignatureDefinition& definition,
+                                int engine_min_piece_len,
+                                std::vector<int>* indices) const;
+
+  const RawSignature& raw_signature() const { return raw_sig_; }
+
+ private:
+  // The qualifying pieces in the order in which a trim algorithm considers
+  // them, together with the prefix sums of their lengths.
+  struct Ordering {
+    std::vector<int> indices;
+    std::vector<int64_t> prefix_lengths;  // One more than indices.
+  };
+
+  enum OrderKind { kPieceOrder, kShuffled, kByWeight };
+
+  // Identifies an ordering by its kind, the minimum piece length, whether
+  // pieces without weight are excluded, and the variant for shuffles.
+  using OrderingKey = std::tuple<OrderKind, int, bool, int>;
+
+  // Returns the ordering for the key, computing it on first use. The returned
+  // reference stays valid for the lifetime of the plan.
+  const Ordering& GetOrdering(const OrderingKey& key) const;
+
+  const RawSignature& raw_sig_;
+  mutable absl::Mutex mutex_;
+  mutable absl::flat_hash_map<OrderingKey, std::unique_ptr<const Ordering>>
+      orderings_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_TRIM_PLAN_H_
@@ -0,0 +1,123 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/trim_plan.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/signature_formatter.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsFalse;
+
+namespace security::vxsig {
+namespace {
+
+class TrimPlanTest : public testing::Test {
+ protected:
+  TrimPlanTest()
+      : raw_signature_(MakeRawSignature(
+            {"00", "1111", "22", "333333", "44", "5555", "66", "77"})) {
+    for (int i = 0; i < raw_signature_->piece_size(); ++i) {
+      raw_signature_->mutable_piece(i)->set_weight(i % 3);
+    }
+    definition_.set_min_piece_length(0);
+  }
+
+  std::unique_ptr<RawSignature> raw_signature_;
+  SignatureDefinition definition_;
+};
+
+TEST_F(TrimPlanTest, TrimsLastAndFirst) {
+  const TrimPlan plan(*raw_signature_);
+  std::vector<int> indices;
+  definition_.set_trim_algorithm(SignatureDefinition::TRIM_LAST);
+  definition_.set_trim_length(7);
+  ASSERT_THAT(plan.GetSubsetIndices(definition_, /*engine_min_piece_len=*/0,
+                                    &indices),
+              IsOk());
+  EXPECT_THAT(indices, ElementsAre(0, 1));
+
+  definition_.set_trim_algorithm(SignatureDefinition::TRIM_FIRST);
+  ASSERT_THAT(plan.GetSubsetIndices(definition_, /*engine_min_piece_len=*/0,
+                                    &indices),
+              IsOk());
+  EXPECT_THAT(indices, ElementsAre(6, 7));
+
+  // Only the pieces with at least four bytes qualify.
+  definition_.set_trim_length(10);
+  ASSERT_THAT(plan.GetSubsetIndices(definition_, /*engine_min_piece_len=*/4,
+                                    &indices),
+              IsOk());
+  EXPECT_THAT(indices, ElementsAre(3, 5));
+}
+
+TEST_F(TrimPlanTest, RejectsInvalidDefinitions) {
+  const TrimPlan plan(*raw_signature_);
+  std::vector<int> indices;
+  definition_.set_trim_algorithm(SignatureDefinition::TRIM_LAST);
+  definition_.set_trim_length(-1);
+  EXPECT_THAT(plan.GetSubsetIndices(definition_, /*engine_min_piece_len=*/0,
+                                    &indices)
+                  .ok(),
+              IsFalse());
+  definition_.set_trim_length(100);
+  definition_.set_min_piece_length(7);
+  EXPECT_THAT(plan.GetSubsetIndices(definition_, /*engine_min_piece_len=*/0,
+                                    &indices)
+                  .ok(),
+              IsFalse());
+}
+
+TEST_F(TrimPlanTest, ReusedPlanMatchesSingleUse) {
+  const TrimPlan plan(*raw_signature_);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (auto algorithm :
+         {SignatureDefinition::TRIM_NONE, SignatureDefinition::TRIM_LAST,
+          SignatureDefinition::TRIM_FIRST, SignatureDefinition::TRIM_RANDOM,
+          SignatureDefinition::TRIM_WEIGHTED_GREEDY}) {
+      for (int trim_length = 0; trim_length < 30; ++trim_length) {
+        for (int min_piece_length : {0, 3, 4, 7}) {
+          for (int variant : {0, 1, 4242}) {
+            definition_.set_trim_algorithm(algorithm);
+            definition_.set_trim_length(trim_length);
+            definition_.set_min_piece_length(min_piece_length);
+            definition_.set_variant(variant);
+            std::vector<int> reused;
+            std::vector<int> single_use;
+            const absl::Status status = plan.GetSubsetIndices(
+                definition_, /*engine_min_piece_len=*/1, &reused);
+            EXPECT_THAT(GetRelevantSignatureSubsetIndices(
+                            definition_, *raw_signature_,
+                            /*engine_min_piece_len=*/1, &single_use),
+                        Eq(status));
+            EXPECT_THAT(reused, Eq(single_use));
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace security::vxsig
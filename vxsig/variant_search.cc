@@ -0,0 +1,197 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/variant_search.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "vxsig/scan_cost.h"
+#include "vxsig/trim_plan.h"
+
+namespace security::vxsig {
+namespace {
+
+// Per-piece data shared by all candidates.
+struct PieceStats {
+  int quality = 0;
+  int64_t atom_hits = 0;  // Total over the scan corpus
+  std::vector<int> goodware_files;
+};
+
+int64_t CountAtomHits(const Atom& atom, const Corpus& corpus) {
+  const CompiledPiece compiled{atom.bytes,
+                               std::string(atom.bytes.size(), '\xff')};
+  int64_t hits = 0;
+  for (const auto& file : corpus.files()) {
+    for (size_t pos = FindPiece(compiled, file.data);
+         pos != absl::string_view::npos;
+         pos = FindPiece(compiled, file.data, pos + 1)) {
+      ++hits;
+    }
+  }
+  return hits;
+}
+
+std::vector<int> ValuesOrDefault(const std::vector<int>& values,
+                                 int default_value) {
+  return values.empty() ? std::vector<int>{default_value} : values;
+}
+
+void EvaluateCandidate(const SignatureDefinition& base_definition,
+                       const TrimPlan& plan,
+                       const std::vector<PieceStats>& pieces,
+                       const VariantSearchOptions& options,
+                       VariantCandidate* candidate) {
+  SignatureDefinition definition = base_definition;
+  definition.set_variant(candidate->variant);
+  definition.set_trim_length(candidate->trim_length);
+  definition.set_min_piece_length(candidate->min_piece_length);
+  std::vector<int> indices;
+  if (!plan.GetSubsetIndices(definition, options.engine_min_piece_len,
+                             &indices)
+           .ok()) {
+    return;
+  }
+  const RawSignature& raw = plan.raw_signature();
+  candidate->valid = true;
+  candidate->num_pieces = indices.size();
+  candidate->min_atom_quality = kMaxAtomQuality;
+  int64_t quality_sum = 0;
+  int64_t atom_hits = 0;
+  std::vector<int> goodware_hits;
+  for (int i = 0; i < indices.size(); ++i) {
+    const auto& stats = pieces[indices[i]];
+    candidate->num_bytes += raw.piece(indices[i]).bytes().size();
+    candidate->min_atom_quality =
+        std::min(candidate->min_atom_quality, stats.quality);
+    quality_sum += stats.quality;
+    atom_hits += stats.atom_hits;
+    if (i == 0) {
+      goodware_hits = stats.goodware_files;
+    } else if (!goodware_hits.empty()) {
+      std::vector<int> intersection;
+      std::set_intersection(goodware_hits.begin(), goodware_hits.end(),
+                            stats.goodware_files.begin(),
+                            stats.goodware_files.end(),
+                            std::back_inserter(intersection));
+      goodware_hits.swap(intersection);
+    }
+  }
+  candidate->mean_atom_quality =
+      static_cast<double>(quality_sum) / candidate->num_pieces;
+  if (options.scan_corpus != nullptr &&
+      options.scan_corpus->total_bytes() > 0) {
+    candidate->verifications_per_mb =
+        atom_hits / (options.scan_corpus->total_bytes() / (1024.0 * 1024.0));
+  }
+  candidate->goodware_hits = goodware_hits.size();
+  const double scan_cost = std::log2(1 + candidate->verifications_per_mb);
+  candidate->score =
+      candidate->min_atom_quality + candidate->mean_atom_quality / 4 -
+      options.scan_cost_weight * scan_cost -
+      options.goodware_hit_penalty * candidate->goodware_hits;
+}
+
+}  // namespace
+
+absl::StatusOr<VariantSearchResult> SearchVariants(
+    const Signature& signature, const VariantSearchOptions& options) {
+  const auto& definition = signature.definition();
+  const auto& raw = signature.raw_signature();
+
+  const std::vector<int> variants =
+      definition.trim_algorithm() == SignatureDefinition::TRIM_RANDOM
+          ? ValuesOrDefault(options.variants, definition.variant())
+          : std::vector<int>{definition.variant()};
+  const std::vector<int> trim_lengths =
+      ValuesOrDefault(options.trim_lengths, definition.trim_length());
+  const std::vector<int> min_piece_lengths =
+      ValuesOrDefault(options.min_piece_lengths, definition.min_piece_length());
+
+  // Only pieces that are at least as long as the smallest minimum piece length
+  // can be part of any candidate.
+  const int min_len =
+      std::max(options.engine_min_piece_len,
+               *std::min_element(min_piece_lengths.begin(),
+                                 min_piece_lengths.end()));
+  const std::shared_ptr<Executor> executor =
+      GetOrMakeExecutor(options.executor, options.num_threads);
+  std::vector<PieceStats> pieces(raw.piece_size());
+  executor->ParallelFor(raw.piece_size(), [&](int64_t i) {
+    const auto& piece = raw.piece(i);
+    if (piece.bytes().size() < min_len) {
+      return;
+    }
+    auto& stats = pieces[i];
+    const Atom atom = ExtractBestAtom(CompilePiece(piece));
+    stats.quality = atom.quality;
+    if (options.scan_corpus != nullptr) {
+      stats.atom_hits = CountAtomHits(atom, *options.scan_corpus);
+    }
+    if (options.goodware != nullptr) {
+      stats.goodware_files = options.goodware->FindFilesWithPiece(piece);
+    }
+  });
+
+  VariantSearchResult result;
+  for (int variant : variants) {
+    for (int trim_length : trim_lengths) {
+      for (int min_piece_length : min_piece_lengths) {
+        VariantCandidate candidate;
+        candidate.variant = variant;
+        candidate.trim_length = trim_length;
+        candidate.min_piece_length = min_piece_length;
+        result.candidates.push_back(candidate);
+      }
+    }
+  }
+  // The candidates share the trimming state of the raw signature.
+  const TrimPlan plan(raw);
+  executor->ParallelFor(result.candidates.size(), [&](int64_t i) {
+    EvaluateCandidate(definition, plan, pieces, options, &result.candidates[i]);
+  });
+
+  for (int i = 0; i < result.candidates.size(); ++i) {
+    const auto& candidate = result.candidates[i];
+    if (candidate.valid &&
+        (result.best_candidate < 0 ||
+         candidate.score > result.candidates[result.best_candidate].score)) {
+      result.best_candidate = i;
+    }
+  }
+  if (result.best_candidate < 0) {
+    return absl::FailedPreconditionError(
+        "No signature definition in the search space yields a signature");
+  }
+
+  const auto& best = result.candidates[result.best_candidate];
+  result.best = signature;
+  // The formatted signatures belong to the old definition.
+  result.best.clear_clam_av_signature();
+  result.best.clear_yara_signature();
+  auto* best_definition = result.best.mutable_definition();
+  best_definition->set_variant(best.variant);
+  best_definition->set_trim_length(best.trim_length);
+  best_definition->set_min_piece_length(best.min_piece_length);
+  return result;
+}
+
+}  // namespace security::vxsig
@@ -0,0 +1,103 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Searches for the signature definition (variant, trim length and minimum
+// piece length) that yields the best trimmed signature for a given raw
+// signature. All candidates share the same raw signature, so the expensive
+// per-piece work (atom selection, scanning and goodware lookups) is only done
+// once for each piece.
+
+#ifndef VXSIG_VARIANT_SEARCH_H_
+#define VXSIG_VARIANT_SEARCH_H_
+
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "vxsig/corpus.h"
+#include "vxsig/executor.h"
+#include "vxsig/goodware.h"
+#include "vxsig/vxsig.pb.h"
+
+namespace security::vxsig {
+
+struct VariantSearchOptions {
+  // The search space. Empty lists use the value from the signature
+  // definition. Variants are only searched when using TRIM_RANDOM.
+  std::vector<int> variants;
+  std::vector<int> trim_lengths;
+  std::vector<int> min_piece_lengths;
+
+  // Minimum piece length of the target engine.
+  int engine_min_piece_len = 2;
+
+  // Optional corpus that is scanned to estimate the number of piece
+  // verifications per MB (see scan_cost.h). Not owned.
+  const Corpus* scan_corpus = nullptr;
+
+  // Optional goodware corpus. Not owned.
+  const GoodwareCorpus* goodware = nullptr;
+
+  // Weights of the score components. A candidate's score is:
+  //   min_atom_quality + mean_atom_quality / 4
+  //     - scan_cost_weight * log2(1 + verifications_per_mb)
+  //     - goodware_hit_penalty * goodware_hits
+  double scan_cost_weight = 10.0;
+  double goodware_hit_penalty = 1000.0;
+
+  // Number of threads to use if no executor is set, zero selects a default.
+  int num_threads = 0;
+
+  // Optional executor for evaluating pieces and candidates. Not owned.
+  Executor* executor = nullptr;
+};
+
+// A single point in the search space together with its evaluation.
+struct VariantCandidate {
+  int variant = 0;
+  int trim_length = 0;
+  int min_piece_length = 0;
+
+  // False if the definition does not yield a signature, for example because
+  // all pieces are too short. The fields below are only set for valid
+  // candidates.
+  bool valid = false;
+  int num_pieces = 0;
+  int num_bytes = 0;
+  int min_atom_quality = 0;
+  double mean_atom_quality = 0;
+  double verifications_per_mb = 0;
+  int goodware_hits = 0;
+  double score = 0;
+};
+
+struct VariantSearchResult {
+  // Copy of the input signature with the best definition. The raw signature
+  // is left as is, trimming happens when formatting. Formatted signatures are
+  // cleared.
+  Signature best;
+
+  // All evaluated candidates, in search space order.
+  std::vector<VariantCandidate> candidates;
+  int best_candidate = -1;
+};
+
+// Evaluates all combinations of the search space in parallel and returns the
+// highest scoring one. Ties are broken in favor of the earlier candidate.
+// Returns an error if no candidate yields a signature.
+absl::StatusOr<VariantSearchResult> SearchVariants(
+    const Signature& signature, const VariantSearchOptions& options);
+
+}  // namespace security::vxsig
+
+#endif  // VXSIG_VARIANT_SEARCH_H_
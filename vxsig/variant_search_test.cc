@@ -0,0 +1,110 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "vxsig/variant_search.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/scan_cost.h"
+#include "vxsig/signature_test_util.h"
+#include "vxsig/vxsig.pb.h"
+
+using not_absl::IsOk;
+using testing::Eq;
+using testing::Gt;
+using testing::IsFalse;
+using testing::SizeIs;
+
+namespace security::vxsig {
+namespace {
+
+class VariantSearchTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    auto* definition = signature_.mutable_definition();
+    definition->set_trim_algorithm(SignatureDefinition::TRIM_LAST);
+    definition->set_trim_length(8);
+    definition->set_min_piece_length(4);
+    AddSignaturePieces({std::string(4, '\0'), "\x8b\xec\x83\xe4",
+                        "\x55\x8b\xec\x56\x57\x8b\x7d", "ab"},
+                       signature_.mutable_raw_signature());
+  }
+
+  Signature signature_;
+};
+
+TEST_F(VariantSearchTest, PrefersHighAtomQuality) {
+  VariantSearchOptions options;
+  options.trim_lengths = {4, 8};
+  options.min_piece_lengths = {2, 5};
+  options.num_threads = 2;
+  auto result = SearchVariants(signature_, options);
+  ASSERT_THAT(result, IsOk());
+  ASSERT_THAT(result->candidates, SizeIs(4));
+
+  // Trim length 4 with minimum piece length 2 only keeps the zero bytes.
+  EXPECT_THAT(result->candidates[0].num_pieces, Eq(1));
+  EXPECT_THAT(result->candidates[0].min_atom_quality,
+              Eq(kMaxAtomQuality - 88 + 48 - 40));
+  // Trim length 4 with minimum piece length 5 is empty.
+  EXPECT_THAT(result->candidates[1].valid, IsFalse());
+
+  const auto& best = result->best.definition();
+  EXPECT_THAT(best.trim_length(), Eq(8));
+  EXPECT_THAT(best.min_piece_length(), Eq(5));
+  // The raw signature is unchanged.
+  EXPECT_THAT(result->best.raw_signature().piece_size(), Eq(4));
+}
+
+TEST_F(VariantSearchTest, PenalizesScanCostAndGoodware) {
+  Corpus corpus;
+  corpus.AddFile("zeroes", std::string(1 << 12, '\0'));
+  Corpus goodware_corpus;
+  goodware_corpus.AddFile("benign", "\x55\x8b\xec\x56\x57\x8b\x7d");
+  auto goodware = GoodwareCorpus::FromCorpus(std::move(goodware_corpus));
+
+  VariantSearchOptions options;
+  options.min_piece_lengths = {4, 5};
+  options.scan_corpus = &corpus;
+  options.goodware = goodware.get();
+  auto result = SearchVariants(signature_, options);
+  ASSERT_THAT(result, IsOk());
+  ASSERT_THAT(result->candidates, SizeIs(2));
+
+  // The zero bytes are expensive to scan for.
+  const auto& first = result->candidates[0];
+  EXPECT_THAT(first.num_pieces, Eq(2));
+  EXPECT_THAT(first.verifications_per_mb, Gt(1000));
+  EXPECT_THAT(first.goodware_hits, Eq(0));
+
+  // Without goodware, the second candidate would score better.
+  const auto& second = result->candidates[1];
+  EXPECT_THAT(second.num_pieces, Eq(1));
+  EXPECT_THAT(second.verifications_per_mb, Eq(0));
+  EXPECT_THAT(second.goodware_hits, Eq(1));
+  EXPECT_THAT(second.min_atom_quality, Gt(first.min_atom_quality));
+  EXPECT_THAT(result->best_candidate, Eq(0));
+}
+
+TEST_F(VariantSearchTest, NoValidCandidate) {
+  VariantSearchOptions options;
+  options.min_piece_lengths = {100};
+  EXPECT_FALSE(SearchVariants(signature_, options).ok());
+}
+
+}  // namespace
+}  // namespace security::vxsig
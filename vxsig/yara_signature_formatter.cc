@@ -16,11 +16,10 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <string>
 #include <vector>
 
-#include "absl/flags/flag.h"
 #include "absl/strings/ascii.h"
-#include "absl/strings/escaping.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
@@ -30,13 +29,9 @@
 #include "absl/strings/substitute.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
 #include "vxsig/signature_formatter.h"
+#include "vxsig/trim_plan.h"
 #include "vxsig/vxsig.pb.h"
 
-ABSL_FLAG(bool, siggen_yara_debug_masking, false,
-            "Include unmasked hex bytes in signature output");
-ABSL_FLAG(bool, siggen_yara_debug_weights, false,
-            "Include signature piece weights in output");
-
 namespace security::vxsig {
 namespace {
 
@@ -50,25 +45,29 @@ enum {
 };
 
 static constexpr char kYaraHexWildcard[] = "[-]";
+// Spaces of the same width, to align pieces that follow no wildcard.
+static constexpr char kYaraNoWildcard[] = "   ";
 
 std::string MakeValidIdentifier(absl::string_view identifier) {
   return absl::StrReplaceAll(identifier.substr(0, kYaraMaxIdentLen),
                              {{"-", "_"}});
 }
 
-}  // namespace
-
-absl::Status YaraSignatureFormatter::DoFormat(Signature* signature) const {
-  std::string* signature_data =
-      signature->mutable_yara_signature()->mutable_data();
-  // Avoid too many reallocations.
-  signature_data->clear();
-  signature_data->reserve(2 * signature->ByteSizeLong());
-
-  auto signature_definition = signature->definition();
+// Appends the rule for a signature to the output. The pieces are written
+// directly from the raw signature of the plan, without copying them. Leaves
+// the output unchanged on error.
+absl::Status AppendYaraRule(const FormatterOptions& options,
+                            const SignatureDefinition& signature_definition,
+                            const TrimPlan& plan,
+                            std::string* signature_data) {
+  const RawSignature& raw_signature = plan.raw_signature();
+  // Select the pieces first, so that a failure does not leave a partial rule.
+  std::vector<int> piece_indices;
+  NA_RETURN_IF_ERROR(plan.GetSubsetIndices(signature_definition,
+                                           kYaraMinTokens, &piece_indices));
 
   // Rule name and tags
-  std::string name = signature_definition.detection_name();
+  absl::string_view name = signature_definition.detection_name();
   if (name.empty()) {
     name = signature_definition.unique_signature_id();
   }
@@ -87,36 +86,33 @@ absl::Status YaraSignatureFormatter::DoFormat(Signature* signature) const {
     // Metadata dictionary
     absl::StrAppend(signature_data, "  meta:\n");
     for (const auto& meta : signature_definition.meta()) {
-      std::string value;
       switch (meta.value_case()) {
         case SignatureDefinition::Meta::kStringValue:
-          value = absl::StrCat("\"", MakeValidIdentifier(meta.string_value()),
-                               "\"");
+          absl::StrAppend(signature_data, "    ", meta.key(), " = \"",
+                          MakeValidIdentifier(meta.string_value()), "\"\n");
           break;
         case SignatureDefinition::Meta::kIntValue:
-          value = std::to_string(meta.int_value());
+          absl::StrAppend(signature_data, "    ", meta.key(), " = ",
+                          meta.int_value(), "\n");
           break;
         case SignatureDefinition::Meta::kBoolValue:
-          value = meta.bool_value() ? "true" : "false";
+          absl::StrAppend(signature_data, "    ", meta.key(), " = ",
+                          meta.bool_value() ? "true" : "false", "\n");
           break;
         case SignatureDefinition::Meta::VALUE_NOT_SET:
-          continue;
+          break;
       }
-      absl::StrAppend(signature_data, "    ", meta.key(), " = ", value, "\n");
     }
   }
 
   // The actual regex signature.
   absl::StrAppend(signature_data, "  strings:\n    $ = {\n");
 
-  RawSignature subset_regex;
-  NA_RETURN_IF_ERROR(
-      GetRelevantSignatureSubset(*signature, kYaraMinTokens, &subset_regex));
-
   int num_hex_string_tokens = 0;
   int max_copy_bytes = 0;
   bool needs_wildcard = false;
-  for (const auto& piece : subset_regex.piece()) {
+  for (const int i : piece_indices) {
+    const auto& piece = raw_signature.piece(i);
     if (num_hex_string_tokens > kYaraMaxHexStringTokens) {
       break;
     }
@@ -128,29 +124,23 @@ absl::Status YaraSignatureFormatter::DoFormat(Signature* signature) const {
       break;
     }
 
-    absl::StrAppend(signature_data, "      ");
+    absl::StrAppend(signature_data, "      ",
+                    needs_wildcard ? kYaraHexWildcard : kYaraNoWildcard);
     if (needs_wildcard) {
-      absl::StrAppend(signature_data, kYaraHexWildcard);
       ++num_hex_string_tokens;  // Current wildcard
-    } else {
-      absl::StrAppend(signature_data,
-                      std::string(strlen(kYaraHexWildcard), ' '));
     }
 
-    const auto piece_bytes(piece.bytes().substr(0, max_copy_bytes));
-    int start_mask = signature_data->size();
-    absl::StrAppend(signature_data, absl::BytesToHexString(piece_bytes), "\n");
-    for (const auto& masked_nibble : piece.masked_nibble()) {
-      if (masked_nibble / 2 < max_copy_bytes) {
-        (*signature_data)[start_mask + masked_nibble] = '?';
-      }
-    }
-    if (absl::GetFlag(FLAGS_siggen_yara_debug_masking)) {
+    const absl::string_view piece_bytes =
+        absl::string_view(piece.bytes()).substr(0, max_copy_bytes);
+    AppendPieceHex(piece, max_copy_bytes, signature_data);
+    signature_data->push_back('\n');
+    if (options.yara_debug_masking) {
       // Align with masked hex bytes.
-      absl::StrAppend(signature_data, "      // ",
-                      absl::BytesToHexString(piece_bytes), "\n");
+      absl::StrAppend(signature_data, "      // ");
+      AppendHex(piece_bytes, signature_data);
+      signature_data->push_back('\n');
     }
-    if (absl::GetFlag(FLAGS_siggen_yara_debug_weights)) {
+    if (options.yara_debug_weights) {
       absl::StrAppend(signature_data, "         // Weight: ", piece.weight(),
                       "\n");
     }
@@ -167,19 +157,33 @@ absl::Status YaraSignatureFormatter::DoFormat(Signature* signature) const {
   return absl::OkStatus();
 }
 
+}  // namespace
+
+absl::Status YaraSignatureFormatter::DoFormat(Signature* signature,
+                                              const TrimPlan& plan) const {
+  std::string* signature_data =
+      signature->mutable_yara_signature()->mutable_data();
+  // Avoid too many reallocations.
+  signature_data->clear();
+  signature_data->reserve(2 * signature->ByteSizeLong());
+  return AppendYaraRule(options(), signature->definition(), plan,
+                        signature_data);
+}
+
 absl::Status YaraSignatureFormatter::DoFormatDatabase(
     const Signatures& signatures, std::string* database) const {
   database->clear();
-  Signature format_signature;
   for (const auto& signature : signatures.signature()) {
-    const auto* signature_data = &signature.yara_signature().data();
-    Signature format_signature;
-    if (signature_data->empty()) {
-      format_signature = signature;
-      NA_RETURN_IF_ERROR(Format(&format_signature));
-      signature_data = &format_signature.yara_signature().data();
+    const std::string& signature_data = signature.yara_signature().data();
+    if (!signature_data.empty()) {
+      absl::StrAppend(database, signature_data);
+      continue;
     }
-    absl::StrAppend(database, *signature_data);
+    // Format directly into the database instead of formatting a copy of the
+    // signature.
+    const TrimPlan plan(signature.raw_signature());
+    NA_RETURN_IF_ERROR(
+        AppendYaraRule(options(), signature.definition(), plan, database));
   }
   return absl::OkStatus();
 }
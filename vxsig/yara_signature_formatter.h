@@ -23,11 +23,20 @@ namespace security::vxsig {
 // This class inherits from SignatureFormatter to implement the Yara 2.0
 // signature format. See https://yara.readthedocs.io/en/v3.4.0/ for details.
 class YaraSignatureFormatter : public SignatureFormatter {
+ public:
+  explicit YaraSignatureFormatter(const FormatterOptions& options)
+      : SignatureFormatter(options) {}
+
  private:
-  absl::Status DoFormat(Signature* signature) const override;
+  absl::Status DoFormat(Signature* signature,
+                        const TrimPlan& plan) const override;
 
   absl::Status DoFormatDatabase(const Signatures& signatures,
                                 std::string* database) const override;
+
+  const std::string& GetOutput(const Signature& signature) const override {
+    return signature.yara_signature().data();
+  }
 };
 
 }  // namespace security::vxsig
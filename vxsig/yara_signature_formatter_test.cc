@@ -17,20 +17,26 @@
 
 #include <fstream>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
 #include "base/logging.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/status_matchers.h"
+#include "vxsig/executor.h"
 #include "vxsig/signature_formatter.h"
 #include "vxsig/yara_signature_test_util.h"
 
 using not_absl::IsOk;
 using testing::Eq;
+using testing::HasSubstr;
 using testing::IsTrue;
+using testing::Not;
 
 namespace security::vxsig {
 
@@ -84,6 +90,43 @@ TEST_F(YaraSignatureFormatterTest, TestStripSingleByte) {
                  "of them}"));
 }
 
+TEST_F(YaraSignatureFormatterTest, TestDebugOptions) {
+  definition_->set_detection_name("test");
+  definition_->set_min_piece_length(2);
+  AddSignaturePieces({"12", "34"}, &signature_);
+  EXPECT_THAT(formatter_->Format(&signature_), IsOk());
+  EXPECT_THAT(signature_.yara_signature().data(), Not(HasSubstr("Weight")));
+
+  FormatterOptions options;
+  options.yara_debug_weights = true;
+  formatter_ = SignatureFormatter::Create(SignatureType::YARA, options);
+  EXPECT_THAT(formatter_->options().yara_debug_weights, IsTrue());
+  EXPECT_THAT(formatter_->Format(&signature_), IsOk());
+  EXPECT_THAT(signature_.yara_signature().data(), HasSubstr("// Weight: 0"));
+}
+
+TEST_F(YaraSignatureFormatterTest, TestConcurrentFormatting) {
+  constexpr int kNumSignatures = 64;
+  std::vector<Signature> signatures(kNumSignatures);
+  std::vector<std::string> expected(kNumSignatures);
+  for (int i = 0; i < kNumSignatures; ++i) {
+    auto& signature = signatures[i];
+    signature.mutable_definition()->set_detection_name(absl::StrCat("s", i));
+    signature.mutable_definition()->set_min_piece_length(2);
+    AddSignaturePieces({absl::StrCat("piece", i), "1234"}, &signature);
+    ASSERT_THAT(formatter_->Format(&signature), IsOk());
+    expected[i] = signature.yara_signature().data();
+    signature.clear_yara_signature();
+  }
+  WorkStealingExecutor executor(/*num_threads=*/8);
+  executor.ParallelFor(kNumSignatures, [&](int64_t i) {
+    EXPECT_THAT(formatter_->Format(&signatures[i]), IsOk());
+  });
+  for (int i = 0; i < kNumSignatures; ++i) {
+    EXPECT_THAT(signatures[i].yara_signature().data(), Eq(expected[i]));
+  }
+}
+
 TEST_F(YaraSignatureFormatterTest, TestDatabaseSingleSignature) {
   Signatures signatures;
   auto* signature = signatures.add_signature();
@@ -119,6 +162,23 @@ TEST_F(YaraSignatureFormatterTest, TestDatabaseMultipleSignatures) {
          "rule two {\nstrings:$ = {3536[-]3738}condition:all of them}"));
 }
 
+TEST_F(YaraSignatureFormatterTest, TestDatabaseKeepsCompleteRules) {
+  Signatures signatures;
+  {
+    auto* signature = signatures.add_signature();
+    signature->mutable_definition()->set_detection_name("one");
+    signature->mutable_definition()->set_min_piece_length(2);
+    AddSignaturePieces({"12", "34"}, signature);
+  }
+  // Has no pieces, so formatting fails.
+  signatures.add_signature()->mutable_definition()->set_detection_name("two");
+  std::string database;
+  EXPECT_FALSE(formatter_->FormatDatabase(signatures, &database).ok());
+  EXPECT_THAT(
+      MakeComparableYaraSignature(database),
+      Eq("rule one {\nstrings:$ = {3132[-]3334}condition:all of them}"));
+}
+
 TEST_F(YaraSignatureFormatterTest, TestMaxHexStringTokensOnePiece) {
   Signatures signatures;
   {